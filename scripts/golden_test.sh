@@ -0,0 +1,309 @@
+#
+# golden_test
+#
+# Run this to regression test the output of mwax_beamdb2fil before/after any change to the write path.
+#
+# It generates a fixed synthetic observation with mwax_beamdb2fil_loadgen, replays it through
+# mwax_beamdb2fil (--replay, so no ringbuffer or shared memory is needed) and compares every file
+# produced against the committed golden digests in golden/digests.txt:
+#  * fil files: every header field, the data size and a digest of the data
+#  * stats (and any other, e.g. the .crc32c checksum sidecars) files: a digest of the contents
+# and checks every fil file against its checksum sidecar with mwax_filverify. It then replays the same observations
+# once per row of VARIANTS below (a set of options, and the fil header fields which the options may change), and
+# checks every fil file is otherwise the same as the golden one, plus whatever that variant's hooks check: that every
+# beam extracted (with mwax_filextract) from a multi-beam container (--container) matches its fil file, that a missing
+# sub observation is written as a filled gap, that --wideband stitches the coarse channels, that a --pipeline writes
+# the same stats, and that each level of a --quicklook pyramid (read with mwax_qlview) is the 2x2 mean of the one
+# below (and is shed by --degrade). To test a new option, add a row (and hooks if it needs them). Last it checks a
+# truncated observation stops with an error, --wideband of an observation joined part way or without beam seconds, and
+# that a QUIT in one file stops the replay of another which is waiting for data (a fifo).
+#
+# golden/digests.txt must be written by a build against the real psrdada and cfitsio libraries.
+#
+# Tolerance modes (the digest of lossy/quantised products can be made tolerant of tiny float
+# differences, e.g. from a different summation order):
+#   --fil-mode=exact|roundN     fil data digest is of the exact bytes, or each sample rounded to N significant digits
+#   --stats-mode=exact|roundN   stats digest is of the exact text, or each number rounded to N significant digits
+#
+# Usage: golden_test.sh [--update] [--fil-mode=MODE] [--stats-mode=MODE]
+#   --update  rewrite golden/digests.txt from this build (only do this when the output is meant to change!)
+#
+# Set BIN to the directory containing the executables if it is not ../bin relative to this script.
+#
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+BIN=${BIN:-$SCRIPT_DIR/../bin}
+GOLDEN=$SCRIPT_DIR/golden/digests.txt
+UPDATE=0
+FIL_MODE=exact
+STATS_MODE=round6
+
+for arg in "$@"
+do
+      case $arg in
+            --update) UPDATE=1 ;;
+            --fil-mode=*) FIL_MODE=${arg#*=} ;;
+            --stats-mode=*) STATS_MODE=${arg#*=} ;;
+            *) echo "Error- unknown argument $arg"; exit -1 ;;
+      esac
+done
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+cd $WORK
+mkdir out stats metafits
+
+START=$(date +%s.%N)
+
+# 2 beams x 64 channels x 1000 timesteps/sec. One 8 sec observation, then one which starts as
+# 16 sec and is extended to 24 sec at its second sub-observation (exercises the nsamples update)
+$BIN/mwax_beamdb2fil_loadgen -o golden.dada -m metafits -b 2 -c 64 -t 20 -D 8,16/24 -O 1300000000 2> loadgen.log || { cat loadgen.log; echo "FAILED: loadgen"; exit 1; }
+
+$BIN/mwax_beamdb2fil --replay --destination-path=out --stats-path=stats --metafits-path=metafits golden.dada 2> beamdb2fil.log || { tail -20 beamdb2fil.log; echo "FAILED: mwax_beamdb2fil --replay"; exit 1; }
+
+# Every block written must match the CRC32C recorded in its sidecar as it was written
+$BIN/mwax_filverify out/*.fil > verify.log 2>&1 || { cat verify.log; echo "FAILED: mwax_filverify"; exit 1; }
+
+# The inputs of the variants below: the same observations with a sub observation missing (the second of the second
+# observation), and with a second coarse channel (110)
+HDR_SIZE=$(head -c 4096 golden.dada | tr -d '\0' | awk '$1 == "HDR_SIZE" { print $2 }')
+TRANSFER_SIZE=$(head -c 4096 golden.dada | tr -d '\0' | awk '$1 == "TRANSFER_SIZE" { print $2 }')
+TRANSFER_BYTES=$((HDR_SIZE + TRANSFER_SIZE))
+{ head -c $((TRANSFER_BYTES * 2)) golden.dada; tail -c +$((TRANSFER_BYTES * 3 + 1)) golden.dada; } > gap.dada
+$BIN/mwax_beamdb2fil_loadgen -o golden110.dada -m metafits -b 2 -c 64 -t 20 -D 8,16/24 -O 1300000000 -C 110 2> loadgen.log || { cat loadgen.log; echo "FAILED: loadgen (coarse channel 110)"; exit 1; }
+
+# The same observations written with other options. Each variant is replayed into a directory of its name, every fil
+# file in it must match its checksum sidecar, and the fil file each out/*.fil becomes (the sed expression, - for the
+# same name) must have the same header and data but for the fields listed. A variant can add to that with
+#   before_NAME   run before it is replayed (into its empty directory)
+#   after_NAME    run once it has been replayed
+#   check_NAME F W  run for each out/*.fil F and the fil file W it became
+#   finally_NAME  run once every fil file has been compared
+#
+# name              dada files                   options                                          fields which may differ                                  fil file name
+VARIANTS="
+container         ; golden.dada                ; --container                                      ; rawdatafile|nbeams|ibeam|header_bytes                    ; s|^|extracted/|
+gap               ; gap.dada                   ;                                                  ; rawdatafile|header_bytes|data_fnv1a64                    ; -
+wideband          ; golden.dada golden110.dada ; --wideband                                       ; rawdatafile|header_bytes|nchans|data_bytes|data_fnv1a64  ; s/_ch109_/_ch109-110_/
+pipeline          ; golden.dada                ; --pipeline=stats,write,stats_files --stats-path=pipeline/stats ; rawdatafile|header_bytes               ; -
+quicklook         ; golden.dada                ; --quicklook=10                                   ; rawdatafile|header_bytes                                 ; -
+quicklook_degrade ; golden.dada                ; --quicklook --degrade=0,0                        ; rawdatafile|header_bytes                                 ; -
+"
+
+# Multi-beam containers must extract (with mwax_filextract) to the same beams; only the fields which say where the beam
+# came from may differ
+after_container() {
+      mkdir container/extracted
+
+      for c in container/*.mfil
+      do
+            $BIN/mwax_filextract -o container/extracted $c >> extract.log 2>&1 || { cat extract.log; echo "FAILED: mwax_filextract $c"; exit 1; }
+      done
+}
+
+# A sub observation missing must still be written: the fil files keep their headers (and the other sub observations)
+# with the gap filled with zeros, and the gap is recorded in the gaps sidecar
+finally_gap() {
+      [ "$(cat gap/*.gaps | grep -v '^#')" = "8 1 16 $TRANSFER_SIZE" ] || { cat gap/*.gaps; echo "FAILED: the gap was not recorded"; exit 1; }
+}
+
+# Stitched into wideband fil files (--wideband) each has the same header as the one coarse channel file but twice the
+# channels
+check_wideband() {
+      [ "$($BIN/mwax_fildump $2 | awk '$1 == "nchans" { print $2 }')" = "128" ] || { echo "FAILED: $2 does not have 128 channels"; exit 1; }
+}
+
+# Through a pipeline given with --pipeline, without the checksum stage (so the write checksums each block instead), the
+# stats are the same too
+before_pipeline() {
+      mkdir pipeline/stats
+}
+
+finally_pipeline() {
+      diff -r stats pipeline/stats > pipeline.diff || { cat pipeline.diff; echo "FAILED: the stats differ with --pipeline"; exit 1; }
+}
+
+# Returns the rows of level 0 of a quick-look file
+quicklook_rows() {
+      $BIN/mwax_qlview --info $1 | awk '$2 == "level" && $3 == "0:" { print $4 }'
+}
+
+# With --quicklook each beam has a quick-look pyramid: a row every 0.1 sec, and each level the mean of each 2x2 (rows x
+# channels) of the level below (an odd last row on its own)
+check_quicklook() {
+      q=quicklook/$(basename $1 .fil).qlk
+      seconds=$(( $($BIN/mwax_fildump $1 | awk '$1 == "data_bytes" { print $2 }') / (64 * 4 * 1000) ))
+      [ "$(quicklook_rows $q)" = "$((seconds * 10))" ] || { $BIN/mwax_qlview --info $q; echo "FAILED: $q does not have $((seconds * 10)) rows"; exit 1; }
+
+      for level in 0 1 2 3 4 5
+      do
+            awk 'FNR == 1 { f++ } /^#/ { next }
+                 f == 1 { n++; for (i = 2; i <= NF; i++) v[n, i - 1] = $i; nc = NF - 1; next }
+                 { r++; r0 = 2 * r - 1; r1 = (2 * r <= n) ? 2 * r : r0
+                   for (c = 1; c < NF; c++) { c0 = (nc > 1) ? 2 * c - 1 : 1; c1 = (nc > 1) ? 2 * c : 1
+                                              m = (v[r0, c0] + v[r0, c1] + v[r1, c0] + v[r1, c1]) / 4
+                                              if ((m - $(c + 1)) ^ 2 > (1e-5 * m) ^ 2) bad++ } }
+                 END { exit (bad > 0 || r == 0) }' <($BIN/mwax_qlview --level=$level $q) <($BIN/mwax_qlview --level=$((level + 1)) $q) ||
+                  { echo "FAILED: level $((level + 1)) of $q is not the 2x2 mean of level $level"; exit 1; }
+      done
+}
+
+# With --degrade=0,0 (always under pressure) the quick-look pyramid is shed as an extra product once the level gets
+# there, part way through the first observation (which keeps only the rows before it) and all of the second (which has
+# no quick-look files)
+check_quicklook_degrade() {
+      q=quicklook_degrade/$(basename $1 .fil).qlk
+      seconds=$(( $($BIN/mwax_fildump $1 | awk '$1 == "data_bytes" { print $2 }') / (64 * 4 * 1000) ))
+
+      case $1 in
+            */1300000000_*)
+                  rows=$(quicklook_rows $q)
+                  [ -n "$rows" ] && [ "$rows" -gt 0 ] && [ "$rows" -lt "$((seconds * 10))" ] || { $BIN/mwax_qlview --info $q; echo "FAILED: $q was not shed part way through"; exit 1; }
+                  ;;
+            *)
+                  [ ! -e $q ] && [ ! -e $q.partial ] || { echo "FAILED: $q was written with extra products shed"; exit 1; }
+                  ;;
+      esac
+}
+
+finally_quicklook_degrade() {
+      grep -q "level 1 -> 2" quicklook_degrade.log || { tail -20 quicklook_degrade.log; echo "FAILED: --degrade=0,0 did not shed extra products"; exit 1; }
+}
+
+while IFS=';' read -r name files options fields rename
+do
+      name=$(echo $name)
+      [ -n "$name" ] || continue
+      fields=$(echo $fields)
+      rename=$(echo $rename)
+
+      mkdir $name
+      [ "$(type -t before_$name)" = "function" ] && before_$name
+      $BIN/mwax_beamdb2fil --replay $options --destination-path=$name --metafits-path=metafits $files 2> $name.log < /dev/null ||
+            { tail -20 $name.log; echo "FAILED: mwax_beamdb2fil --replay $options $files"; exit 1; }
+      [ "$(type -t after_$name)" = "function" ] && after_$name
+
+      if ls $name/*.fil > /dev/null 2>&1
+      then
+            $BIN/mwax_filverify $name/*.fil > verify.log 2>&1 || { cat verify.log; echo "FAILED: mwax_filverify of the $name files"; exit 1; }
+      fi
+
+      for f in out/*.fil
+      do
+            w=$name/$(basename $f)
+            [ "$rename" = "-" ] || w=$name/$(basename $f | sed "$rename")
+            diff <($BIN/mwax_fildump $f | grep -v -E "^($fields) ") <($BIN/mwax_fildump $w | grep -v -E "^($fields) ") > $name.diff ||
+                  { cat $name.diff; echo "FAILED: $w differs from $f"; exit 1; }
+            [ "$(type -t check_$name)" = "function" ] && check_$name $f $w
+      done
+
+      [ "$(type -t finally_$name)" = "function" ] && finally_$name
+      rm -rf $name
+done <<< "$VARIANTS"
+
+rm -rf gap.dada
+
+# A truncated file (its last beam second cut short) must stop the replay with an error, not be read past its end
+mkdir truncated
+head -c $(($(stat -c %s golden.dada) - 100000)) golden.dada > truncated.dada
+$BIN/mwax_beamdb2fil --replay --destination-path=truncated --metafits-path=metafits truncated.dada 2> truncated.log
+TRUNCATED_STATUS=$?
+[ $TRUNCATED_STATUS -eq 1 ] && grep -q "is truncated" truncated.log || { tail -20 truncated.log; echo "FAILED: mwax_beamdb2fil --replay of a truncated file exited with $TRUNCATED_STATUS"; exit 1; }
+
+rm -rf truncated truncated.dada
+
+# A ring which joins the second observation part way through, while the other is still on the first, must not end
+# the second observation's band early: it has both coarse channels, whichever ring gets there first
+mkdir wideband_join
+tail -c +$((TRANSFER_BYTES * 2 + 1)) golden.dada > join.dada
+$BIN/mwax_beamdb2fil --replay --wideband --destination-path=wideband_join --metafits-path=metafits join.dada golden110.dada 2> wideband_join.log || { tail -20 wideband_join.log; echo "FAILED: mwax_beamdb2fil --replay --wideband of an observation joined part way through"; exit 1; }
+$BIN/mwax_filverify wideband_join/*.fil > verify.log 2>&1 || { cat verify.log; echo "FAILED: mwax_filverify of the joined wideband files"; exit 1; }
+
+for beam in 01 02
+do
+      w=$(ls wideband_join/1300000008_*_ch109-110_$beam.fil 2> /dev/null)
+      [ -n "$w" ] || { ls wideband_join; grep wideband wideband_join.log; echo "FAILED: beam $beam of 1300000008 was not written with both coarse channels"; exit 1; }
+done
+
+# An observation of which no beam second arrives (a file with only the header) must not leave a wideband fil file
+# (or a .partial) without samples behind
+mkdir wideband_empty
+head -c $HDR_SIZE golden110.dada > empty.dada
+$BIN/mwax_beamdb2fil --replay --wideband --destination-path=wideband_empty --metafits-path=metafits empty.dada 2> wideband_empty.log || { tail -20 wideband_empty.log; echo "FAILED: mwax_beamdb2fil --replay --wideband of an observation without beam seconds"; exit 1; }
+[ -z "$(ls wideband_empty)" ] || { ls wideband_empty; echo "FAILED: wideband files were left for an observation without beam seconds"; exit 1; }
+
+rm -rf wideband_join wideband_empty join.dada empty.dada golden110.dada
+
+# A QUIT in one file must stop the others, even one waiting for data which is not coming (a fifo nothing is written
+# to, as a ring with no observation waits for its next header)
+mkdir quit
+$BIN/mwax_beamdb2fil_loadgen -o quit.dada -m metafits -b 1 -c 64 -t 20 -D 8 -O 1300000100 -q 2> loadgen.log || { cat loadgen.log; echo "FAILED: loadgen (quit)"; exit 1; }
+mkfifo idle.fifo
+exec 3<> idle.fifo
+timeout 30 $BIN/mwax_beamdb2fil --replay --destination-path=quit --metafits-path=metafits quit.dada idle.fifo 2> quit.log
+QUIT_STATUS=$?
+exec 3>&-
+[ $QUIT_STATUS -eq 0 ] || { tail -20 quit.log; echo "FAILED: mwax_beamdb2fil --replay with a QUIT and an idle fifo exited with $QUIT_STATUS (124 = still waiting)"; exit 1; }
+$BIN/mwax_filverify quit/1300000100_*.fil > verify.log 2>&1 || { cat verify.log; echo "FAILED: mwax_filverify of the observation before the QUIT"; exit 1; }
+
+rm -rf quit quit.dada idle.fifo
+
+# Returns the round digits for a mode (roundN -> N, exact -> 0)
+round_digits() {
+      case $1 in
+            round*) echo ${1#round} ;;
+            *) echo 0 ;;
+      esac
+}
+
+FIL_ROUND=$(round_digits $FIL_MODE)
+STATS_ROUND=$(round_digits $STATS_MODE)
+
+# Build the manifest of everything produced
+{
+      echo "modes fil=$FIL_MODE stats=$STATS_MODE"
+
+      for f in $(find out stats -type f | sort)
+      do
+            case $f in
+                  *.fil)
+                        $BIN/mwax_fildump --round=$FIL_ROUND $f | sed "s|^|$f |"
+                        ;;
+                  stats/*.txt)
+                        if [ "$STATS_ROUND" -gt 0 ]
+                        then
+                              echo "$f round$STATS_ROUND $(awk -v d=$STATS_ROUND '{for(i=1;i<=NF;i++) $i=sprintf("%." d "g",$i); print}' $f | sha256sum | cut -d' ' -f1)"
+                        else
+                              echo "$f sha256 $(sha256sum $f | cut -d' ' -f1)"
+                        fi
+                        ;;
+                  *)
+                        echo "$f sha256 $(sha256sum $f | cut -d' ' -f1)"
+                        ;;
+            esac
+      done
+} > manifest.txt
+
+END=$(date +%s.%N)
+
+if [ $UPDATE -eq 1 ]
+then
+      cp manifest.txt $GOLDEN
+      echo "Updated $GOLDEN ($(wc -l < $GOLDEN) lines)"
+      exit 0
+fi
+
+if [ ! -f $GOLDEN ]
+then
+      echo "FAILED: $GOLDEN does not exist (run with --update on a known good build)"
+      exit 1
+fi
+
+if diff -u $GOLDEN manifest.txt > manifest.diff
+then
+      echo "PASSED: $(grep -c . manifest.txt) golden fields/digests match ($(awk "BEGIN {printf \"%.1f\", $END - $START}") sec)"
+      exit 0
+else
+      cat manifest.diff
+      echo "FAILED: output differs from $GOLDEN (see diff above)"
+      exit 1
+fi
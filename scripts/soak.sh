@@ -0,0 +1,50 @@
+#
+# soak
+#
+# Run this to soak test mwax_beamdb2fil against the synthetic beamformer load generator.
+#
+# Usage: soak.sh BEAMS [REALTIME_FACTOR] [DURATIONS]
+#
+# e.g. soak.sh 4 1.0 8,8,8,16/32,64
+#
+# This will:
+#  * create ring 5678 and fill it with BEAMS beams of 1280 channels x 1000 timesteps/sec at
+#    REALTIME_FACTOR x real time, for back to back observations of DURATIONS seconds
+#  * run mwax_beamdb2fil reading from the ring
+#  * report (and log to fill_BEAMS.csv) the ring fill level, and whether mwax_beamdb2fil kept up
+#
+# Increase BEAMS until the result is FELL BEHIND to find the max sustainable beams per host.
+#
+if [ -z "$1" ]
+then
+      echo "Error- must pass number of beams"
+      exit -1
+fi
+
+BEAMS=$1
+RATE=${2:-1.0}
+DURATIONS=${3:-8,8,16,16/32,64}
+KEY=5678
+
+mkdir -p soak_out soak_stats soak_metafits
+
+# clean up any old ring
+dada_db -d -k $KEY 2> /dev/null
+
+echo Starting load generator for $BEAMS beams at ${RATE}x real time...
+../bin/mwax_beamdb2fil_loadgen -k $KEY -m soak_metafits -b $BEAMS -r $RATE -D $DURATIONS -l fill_$BEAMS.csv -w 3 -q &
+LOADGEN_PID=$!
+
+# give the ring time to be created
+sleep 1
+
+echo Starting beamdb2fil...
+../bin/mwax_beamdb2fil -k $KEY --destination-path=./soak_out --stats-path=./soak_stats --metafits-path=./soak_metafits --health-ip=127.0.0.1 --health-port=7123 &
+BEAMDB2FIL_PID=$!
+
+wait $LOADGEN_PID
+RESULT=$?
+wait $BEAMDB2FIL_PID
+
+echo Fill level log: fill_$BEAMS.csv
+exit $RESULT
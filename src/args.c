@@ -8,9 +8,13 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "args.h"
+#include "asynclog.h"
 #include "global.h"
+#include "quicklook.h"
 #include "version.h"
+#include "wideband.h"
 
 /**
  * 
@@ -22,14 +26,44 @@
  */
 int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
 {
-    globalArgs->input_db_key = 0;
+    globalArgs->input_db_key_count = 0;
     globalArgs->metafits_path = NULL;
     globalArgs->destination_path = NULL;
     globalArgs->health_ip = NULL;
     globalArgs->health_port = 0;
     globalArgs->stats_path = NULL;
+    globalArgs->prometheus_path = NULL;
+    globalArgs->perf_counters = 0;
+    globalArgs->trace_path = NULL;
+    globalArgs->log_rate_limit = ASYNCLOG_DEFAULT_RATE_LIMIT;
+    globalArgs->hugepages = 0;
+    globalArgs->no_checksums = 0;
+    globalArgs->segment_seconds = 0;
+    globalArgs->segment_mb = 0;
+    globalArgs->notify_socket = NULL;
+    globalArgs->manifest_path = NULL;
+    globalArgs->normalise_seconds = 0;
+    globalArgs->subbands = 1;
+    globalArgs->container = 0;
+    globalArgs->wideband = 0;
+    globalArgs->wideband_timeout_ms = WIDEBAND_DEFAULT_TIMEOUT_MS;
+    globalArgs->quicklook_rows = 0;
+    globalArgs->metafits_cache_dir = NULL;
+    globalArgs->reader_cpus = NULL;
+    globalArgs->worker_cpus = NULL;
+    globalArgs->writer_cpus = NULL;
+    globalArgs->kernels = NULL;
+    globalArgs->pipeline = NULL;
+    globalArgs->degrade = 0;
+    globalArgs->degrade_high_fill = DEGRADE_DEFAULT_HIGH_FILL;
+    globalArgs->degrade_low_fill = DEGRADE_DEFAULT_LOW_FILL;
+    globalArgs->beam_priorities = NULL;
+    globalArgs->beam_priority_count = 0;
+    globalArgs->replay = 0;
+    globalArgs->replay_file_count = 0;
+    globalArgs->replay_files = NULL;
 
-    static const char *optString = "k:m:d:i:p:?";
+    static const char *optString = "k:m:d:i:p:P:CT:L:HNS:Z:U:M:n::b:cw::Q::A:G::B:R:W:O:K:X:r?";
 
     static const struct option longOpts[] =
         {
@@ -39,6 +73,30 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
             {"health-ip", required_argument, NULL, 'i'},
             {"health-port", required_argument, NULL, 'p'},
             {"stats-path", optional_argument, NULL, 's'},
+            {"prometheus-file", required_argument, NULL, 'P'},
+            {"perf-counters", no_argument, NULL, 'C'},
+            {"trace-path", required_argument, NULL, 'T'},
+            {"log-rate-limit", required_argument, NULL, 'L'},
+            {"hugepages", no_argument, NULL, 'H'},
+            {"no-checksums", no_argument, NULL, 'N'},
+            {"segment-seconds", required_argument, NULL, 'S'},
+            {"segment-mb", required_argument, NULL, 'Z'},
+            {"notify-socket", required_argument, NULL, 'U'},
+            {"manifest", required_argument, NULL, 'M'},
+            {"normalise", optional_argument, NULL, 'n'},
+            {"subbands", required_argument, NULL, 'b'},
+            {"container", no_argument, NULL, 'c'},
+            {"wideband", optional_argument, NULL, 'w'},
+            {"quicklook", optional_argument, NULL, 'Q'},
+            {"metafits-cache", required_argument, NULL, 'A'},
+            {"degrade", optional_argument, NULL, 'G'},
+            {"beam-priorities", required_argument, NULL, 'B'},
+            {"reader-cpus", required_argument, NULL, 'R'},
+            {"worker-cpus", required_argument, NULL, 'W'},
+            {"writer-cpus", required_argument, NULL, 'O'},
+            {"kernels", required_argument, NULL, 'K'},
+            {"pipeline", required_argument, NULL, 'X'},
+            {"replay", no_argument, NULL, 'r'},
             {"help", no_argument, NULL, '?'},
             {NULL, no_argument, NULL, 0}};
 
@@ -51,7 +109,12 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
         switch (opt)
         {
         case 'k':
-            globalArgs->input_db_key = strtol(optarg, NULL, 16);
+            if (parse_keys(optarg, globalArgs) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Error: (-k | --key) expects one or more (at most %d) comma separated hexadecimal keys e.g. --key=dada,eada\n", ARGS_MAX_KEYS);
+                print_usage();
+                exit(1);
+            }
             break;
 
         case 'd':
@@ -74,6 +137,135 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
             globalArgs->stats_path = optarg;
             break;
 
+        case 'P':
+            globalArgs->prometheus_path = optarg;
+            break;
+
+        case 'C':
+            globalArgs->perf_counters = 1;
+            break;
+
+        case 'T':
+            globalArgs->trace_path = optarg;
+            break;
+
+        case 'L':
+            globalArgs->log_rate_limit = atoi(optarg);
+            break;
+
+        case 'H':
+            globalArgs->hugepages = 1;
+            break;
+
+        case 'N':
+            globalArgs->no_checksums = 1;
+            break;
+
+        case 'S':
+            globalArgs->segment_seconds = atoi(optarg);
+            break;
+
+        case 'Z':
+            globalArgs->segment_mb = atoi(optarg);
+            break;
+
+        case 'U':
+            globalArgs->notify_socket = optarg;
+            break;
+
+        case 'M':
+            globalArgs->manifest_path = optarg;
+            break;
+
+        case 'n':
+            globalArgs->normalise_seconds = BANDPASS_DEFAULT_TIME_CONSTANT;
+
+            if (optarg && (sscanf(optarg, "%lf", &globalArgs->normalise_seconds) != 1 || !(globalArgs->normalise_seconds >= 1)))
+            {
+                fprintf(stderr, "Error: (-n | --normalise) expects a time constant of at least 1 second e.g. --normalise=10\n");
+                print_usage();
+                exit(1);
+            }
+            break;
+
+        case 'b':
+            globalArgs->subbands = atoi(optarg);
+            break;
+
+        case 'c':
+            globalArgs->container = 1;
+            break;
+
+        case 'w':
+            globalArgs->wideband = 1;
+
+            if (optarg && (sscanf(optarg, "%d", &globalArgs->wideband_timeout_ms) != 1 || globalArgs->wideband_timeout_ms < 1))
+            {
+                fprintf(stderr, "Error: (-w | --wideband) expects a timeout of at least 1 ms e.g. --wideband=2000\n");
+                print_usage();
+                exit(1);
+            }
+            break;
+
+        case 'Q':
+            globalArgs->quicklook_rows = QUICKLOOK_DEFAULT_ROWS;
+
+            if (optarg && (sscanf(optarg, "%d", &globalArgs->quicklook_rows) != 1 || globalArgs->quicklook_rows < 1))
+            {
+                fprintf(stderr, "Error: (-Q | --quicklook) expects at least 1 row per second e.g. --quicklook=10\n");
+                print_usage();
+                exit(1);
+            }
+            break;
+
+        case 'A':
+            globalArgs->metafits_cache_dir = optarg;
+            break;
+
+        case 'G':
+            globalArgs->degrade = 1;
+
+            if (optarg && sscanf(optarg, "%lf,%lf", &globalArgs->degrade_high_fill, &globalArgs->degrade_low_fill) != 2)
+            {
+                fprintf(stderr, "Error: (-G | --degrade) expects HIGH,LOW ring fill fractions e.g. --degrade=0.5,0.2\n");
+                print_usage();
+                exit(1);
+            }
+            break;
+
+        case 'B':
+            if (parse_beam_priorities(optarg, globalArgs) != EXIT_SUCCESS)
+            {
+                fprintf(stderr, "Error: (-B | --beam-priorities) expects a comma separated list of integers e.g. --beam-priorities=2,1,1\n");
+                print_usage();
+                exit(1);
+            }
+            break;
+
+        case 'R':
+            globalArgs->reader_cpus = optarg;
+            break;
+
+        case 'W':
+            globalArgs->worker_cpus = optarg;
+            break;
+
+        case 'O':
+            globalArgs->writer_cpus = optarg;
+            break;
+
+        case 'K':
+            globalArgs->kernels = optarg;
+            break;
+
+        case 'X':
+            globalArgs->pipeline = optarg;
+            break;
+
+        case 'r':
+            globalArgs->replay = 1;
+            break;
+
         case '?':
             print_usage();
             return EXIT_FAILURE;
@@ -86,8 +278,22 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
         opt = getopt_long(argc, argv, optString, longOpts, &longIndex);
     }
 
+    // In replay mode the remaining (non option) arguments are the dada files to process
+    if (globalArgs->replay)
+    {
+        globalArgs->replay_file_count = argc - optind;
+        globalArgs->replay_files = &argv[optind];
+
+        if (globalArgs->replay_file_count < 1)
+        {
+            fprintf(stderr, "Error: at least one dada file must be provided with (-r | --replay).\n");
+            print_usage();
+            exit(1);
+        }
+    }
+
     // Check that mandatory parameters are passed
-    if (!globalArgs->input_db_key)
+    if (globalArgs->input_db_key_count == 0 && !globalArgs->replay)
     {
         fprintf(stderr, "Error: input shared memory key (-k | --key) is mandatory.\n");
         print_usage();
@@ -108,20 +314,144 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
         exit(1);
     }
 
-    if (!globalArgs->health_ip)
+    if (!globalArgs->health_ip && !globalArgs->replay)
     {
         fprintf(stderr, "Error: health ip (-i | --health-ip) is mandatory.\n");
         print_usage();
         exit(1);
     }
 
-    if (!globalArgs->health_port)
+    if (!globalArgs->health_port && !globalArgs->replay)
     {
         fprintf(stderr, "Error: health port (-p | --health-port) is mandatory.\n");
         print_usage();
         exit(1);
     }
 
+    if (globalArgs->segment_seconds < 0 || globalArgs->segment_mb < 0)
+    {
+        fprintf(stderr, "Error: (-S | --segment-seconds) and (-Z | --segment-mb) must be positive (or 0 for one file per observation).\n");
+        print_usage();
+        exit(1);
+    }
+
+    if (globalArgs->subbands < 1)
+    {
+        fprintf(stderr, "Error: (-b | --subbands) must be at least 1 (1 for the whole band in one file).\n");
+        print_usage();
+        exit(1);
+    }
+
+    if (globalArgs->container && (globalArgs->subbands > 1 || globalArgs->segment_seconds > 0 || globalArgs->segment_mb > 0 || globalArgs->normalise_seconds > 0))
+    {
+        fprintf(stderr, "Error: (-c | --container) can not be used with --subbands, --segment-seconds, --segment-mb or --normalise.\n");
+        print_usage();
+        exit(1);
+    }
+
+    if (globalArgs->wideband && (globalArgs->container || globalArgs->subbands > 1 || globalArgs->segment_seconds > 0 || globalArgs->segment_mb > 0 || globalArgs->normalise_seconds > 0))
+    {
+        fprintf(stderr, "Error: (-w | --wideband) can not be used with --container, --subbands, --segment-seconds, --segment-mb or --normalise.\n");
+        print_usage();
+        exit(1);
+    }
+
+    // 0,0 is always under pressure (nothing is ever less than 0 full), e.g. to test shedding when replaying files
+    if (globalArgs->degrade && !(globalArgs->degrade_low_fill >= 0 && (globalArgs->degrade_low_fill < globalArgs->degrade_high_fill || globalArgs->degrade_high_fill == 0) &&
+                                 globalArgs->degrade_high_fill <= 1))
+    {
+        fprintf(stderr, "Error: (-G | --degrade) fill fractions must satisfy 0 <= LOW < HIGH <= 1 (or be 0,0).\n");
+        print_usage();
+        exit(1);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * 
+ *  @brief Parses a comma separated list of hexadecimal shared memory keys (one reader is started for each ringbuffer).
+ *  @param[in] list The list e.g. "dada,eada".
+ *  @param[in] globalArgs Pointer to the structure where we put the parsed keys.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the list is not valid.
+ */
+int parse_keys(const char *list, globalArgs_s *globalArgs)
+{
+    int count = 0;
+    const char *item = list;
+
+    while (count < ARGS_MAX_KEYS)
+    {
+        char *end;
+        long key = strtol(item, &end, 16);
+
+        if (end == item || (*end != ',' && *end != '\0') || key <= 0)
+            return EXIT_FAILURE;
+
+        // The same ringbuffer can only have one reader
+        for (int k = 0; k < count; k++)
+        {
+            if (globalArgs->input_db_keys[k] == (key_t)key)
+                return EXIT_FAILURE;
+        }
+
+        globalArgs->input_db_keys[count++] = (key_t)key;
+
+        if (*end == '\0')
+        {
+            globalArgs->input_db_key_count = count;
+            return EXIT_SUCCESS;
+        }
+
+        item = end + 1;
+    }
+
+    return EXIT_FAILURE;
+}
+
+/**
+ * 
+ *  @brief Parses a comma separated list of beam priorities (one per beam, in beam order).
+ *  @param[in] list The list e.g. "2,1,1".
+ *  @param[in] globalArgs Pointer to the structure where we put the parsed priorities.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the list is not valid.
+ */
+int parse_beam_priorities(const char *list, globalArgs_s *globalArgs)
+{
+    int count = 1;
+
+    for (const char *c = list; *c; c++)
+    {
+        if (*c == ',')
+            count++;
+    }
+
+    int *priorities = malloc(count * sizeof(int));
+
+    if (priorities == NULL)
+        return EXIT_FAILURE;
+
+    const char *item = list;
+
+    for (int i = 0; i < count; i++)
+    {
+        char *end;
+        long priority = strtol(item, &end, 10);
+
+        if (end == item || (*end != ',' && *end != '\0') || priority < 0 || priority > 1000)
+        {
+            free(priorities);
+            return EXIT_FAILURE;
+        }
+
+        priorities[i] = (int)priority;
+        item = end + 1;
+    }
+
+    free(globalArgs->beam_priorities);
+    globalArgs->beam_priorities = priorities;
+    globalArgs->beam_priority_count = count;
+
     return EXIT_SUCCESS;
 }
 
@@ -132,16 +462,43 @@ int process_args(int argc, char *argv[], globalArgs_s *globalArgs)
 void print_usage()
 {
     print_version();
-    printf("\nUsage: mwax_beamdb2fil [OPTION]...\n\n");
+    printf("\nUsage: mwax_beamdb2fil [OPTION]...\n");
+    printf("   or: mwax_beamdb2fil --replay [OPTION]... FILE...\n\n");
     printf("This code will open the dada ringbuffer containing beam \n");
     printf("data from the MWAX beamformer.\n");
-    printf("It will then write out a filterbank (fil) file to the destination dir.\n\n");
-    printf("  -k --key=KEY                Hexadecimal shared memory key\n");
+    printf("It will then write out a filterbank (fil) file to the destination dir.\n");
+    printf("In replay mode the dada FILEs are read from disk instead (each on its own\n");
+    printf("thread) and no ringbuffer, health ip or health port is required.\n\n");
+    printf("  -k --key=KEY[,KEY...]       Hexadecimal shared memory key (or keys, one reader per ringbuffer)\n");
     printf("  -d --destination-path=PATH  Destination path for gpubox files\n");
     printf("  -m --metafits-path=PATH     Metafits directory path\n");
     printf("  -i --health-ip=IP           Health UDP destination ip address\n");
     printf("  -p --health-port=PORT       Health UDP destination port\n");
     printf("  -s --stats-path=PATH        (Optional) Statistics directory path\n");
+    printf("  -P --prometheus-file=PATH   (Optional) Also write metrics every second to this node_exporter textfile (.prom)\n");
+    printf("  -C --perf-counters          (Optional) Profile each stage with hardware counters, reported at the end of each observation\n");
+    printf("  -T --trace-path=PATH        (Optional) Write a Chrome trace (JSON) of each observation, or of the last spans on SIGUSR2, to PATH\n");
+    printf("  -L --log-rate-limit=N       (Optional) Max lines per second of each per block log message, 0 for no limit (default %d)\n", ASYNCLOG_DEFAULT_RATE_LIMIT);
+    printf("  -H --hugepages              (Optional) Back the staging buffers with hugepages (MAP_HUGETLB, needs vm.nr_hugepages)\n");
+    printf("  -N --no-checksums           (Optional) Do not write the CRC32C sidecar (.crc32c) of each fil file\n");
+    printf("  -S --segment-seconds=N      (Optional) Start a new fil file (segment) for each beam every N seconds\n");
+    printf("  -Z --segment-mb=N           (Optional) Start a new fil file (segment) before the data of a beam's file exceeds N MiB\n");
+    printf("  -U --notify-socket=PATH     (Optional) Send a record of each finished fil file to this UNIX datagram socket\n");
+    printf("  -M --manifest=PATH          (Optional) Append a record of each finished fil file to this file\n");
+    printf("  -n --normalise[=SECONDS]    (Optional) Write each beam normalised by its running per channel mean and rms over SECONDS (default %.0f)\n", BANDPASS_DEFAULT_TIME_CONSTANT);
+    printf("  -b --subbands=N             (Optional) Write each beam as N fil files of consecutive channels (N must divide the channels)\n");
+    printf("  -c --container              (Optional) Write all beams of each observation into one multi-beam container (.mfil) instead of a fil file per beam\n");
+    printf("  -w --wideband[=MS]          (Optional) Stitch the coarse channels of the rings (or replayed files) into a wideband fil file per beam, waiting MS for late ones (default %d)\n", WIDEBAND_DEFAULT_TIMEOUT_MS);
+    printf("  -Q --quicklook[=ROWS]       (Optional) Also write a quick-look pyramid (%s) of each beam, ROWS rows per second at full resolution (default %d)\n", QUICKLOOK_EXTENSION, QUICKLOOK_DEFAULT_ROWS);
+    printf("  -A --metafits-cache=DIR     (Optional) Also cache what is read from each metafits in DIR, so a restart does not need to read it again\n");
+    printf("  -G --degrade[=HIGH,LOW]     (Optional) Shed stats, then extra products, then low priority beams, while the ring is at least HIGH full (default 0.5,0.2)\n");
+    printf("  -B --beam-priorities=LIST   (Optional) Comma separated priority of each beam for --degrade; lowest is shed first (default 1)\n");
+    printf("  -R --reader-cpus=LIST       (Optional) Bind the reader (or replay) threads to these cpus e.g. 0-3,8\n");
+    printf("  -W --worker-cpus=LIST       (Optional) Bind the background (health, log) threads to these cpus\n");
+    printf("  -O --writer-cpus=LIST       (Optional) Bind threads which only write or close files to these cpus\n");
+    printf("  -K --kernels=ISA[,K=ISA]    (Optional) Use scalar, sse4.2, avx2 or avx512 kernels (or KERNEL=ISA for one) instead of the newest this cpu supports\n");
+    printf("  -X --pipeline=STAGE[,...]   (Optional) The stages of each beam, in order (of stats, normalise, quicklook, subbands, checksum, write, stats_files)\n");
+    printf("  -r --replay                 (Optional) Replay the dada FILEs given instead of reading a ringbuffer\n");
     printf("  -? --help                   This help text\n");
 }
 
@@ -9,17 +9,62 @@
 
 #include <sys/ipc.h> // for key_t
 
+#define ARGS_MAX_KEYS 24 // Ringbuffers (--key) one process can read, one reader thread each
+
 // Command line Args
 typedef struct
 {
-    key_t input_db_key;
+    key_t input_db_keys[ARGS_MAX_KEYS];
+    int input_db_key_count;
     char *destination_path;
     char *metafits_path;
     char *health_ip;
     char *stats_path;
     int health_port;
+    char *prometheus_path;
+    int perf_counters;
+    char *trace_path;
+    int log_rate_limit;
+    int hugepages;
+    int no_checksums;
+    int segment_seconds;
+    int segment_mb;
+    char *notify_socket;
+    char *manifest_path;
+    double normalise_seconds;
+    int subbands;
+    int container;
+    int wideband;            // stitch the coarse channels of the rings into wideband fil files (see wideband.c)
+    int wideband_timeout_ms; // how long a beam second waits for late coarse channels
+    int quicklook_rows;      // level 0 rows per second of each beam's quick-look pyramid (see quicklook.c), 0 for none
+    char *metafits_cache_dir;
+
+    // cpu lists (hwloc list syntax e.g. "0-3,8") for each thread role, NULL to leave unbound
+    char *reader_cpus;
+    char *worker_cpus;
+    char *writer_cpus;
+
+    // Instruction set of the per sample kernels (see kernels.c), NULL for the newest the cpu supports
+    char *kernels;
+
+    // The stages of each beam's pipeline, in order (see pipeline.c), NULL for those the options ask for
+    char *pipeline;
+
+    // Shed optional work when we fall behind the ringbuffer
+    int degrade;
+    double degrade_high_fill;
+    double degrade_low_fill;
+    int *beam_priorities;
+    int beam_priority_count;
+
+    // Replay mode- read dada files from disk instead of a ringbuffer
+    int replay;
+    int replay_file_count;
+    char **replay_files;
 } globalArgs_s;
 
 void print_version();
 void print_usage();
-int process_args(int argc, char *argv[], globalArgs_s *globalArgs);
\ No newline at end of file
+int process_args(int argc, char *argv[], globalArgs_s *globalArgs);
+int parse_beam_priorities(const char *list, globalArgs_s *globalArgs);
+int parse_keys(const char *list, globalArgs_s *globalArgs);
\ No newline at end of file
@@ -0,0 +1,371 @@
+/**
+ * @file asynclog.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that moves hot path logging off the reader thread
+ *
+ * multilog() formats the message and writes it to stderr under a mutex, which costs microseconds on the reader thread
+ * for every beam second. Instead the hot path calls asynclog_write(), which only stores the message id and its raw
+ * arguments in a lock-free multi producer / single consumer ring (a bounded queue where each slot carries a sequence
+ * number). A formatter thread drains the ring, applies a per message rate limit (lines per second, with a count of
+ * what was suppressed) and passes the lines to multilog(). If the ring is full the message is dropped and counted,
+ * so the hot path never waits. Errors are still logged synchronously with multilog() (after asynclog_flush()).
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asynclog.h"
+#include "latency.h"
+#include "placement.h"
+#include "trace.h"
+
+typedef struct asynclog_ring_s
+{
+    asynclog_record_s *records;
+    uint64_t size; // power of 2
+    uint64_t head; // next position to claim (producers)
+    uint64_t tail; // next position to consume (formatter thread only)
+    uint64_t dropped;
+} asynclog_ring_s;
+
+typedef struct asynclog_message_s
+{
+    const char *name;
+    int priority;
+    const char *format; // every argument is a long (%ld / %lu)
+} asynclog_message_s;
+
+static const asynclog_message_s asynclog_messages[ASYNCLOG_MESSAGE_COUNT] = {
+    {"io processing block", LOG_DEBUG, "dada_dbfil_io(): Processing block %ld.\n"},
+    {"io writing block", LOG_INFO, "dada_dbfil_io(): Writing %lu of %lu bytes into new fil block for beam %ld; Marker = %ld.\n"},
+    {"io stats written", LOG_INFO, "dada_dbfil_io(): wrote out spectrum and time statistics for beam %ld (marker %ld).\n"},
+    {"io_block processing block", LOG_INFO, "dada_dbfil_io_block(): Processing block id %lu\n"},
+    {"io first block", LOG_INFO, "dada_dbfil_io(): First beam second of obs %ld (second %ld) written %ld us after the observation was opened.\n"},
+    {"io past end", LOG_WARNING, "dada_dbfil_io(): Not writing beam %ld second %ld, which is past the end of the observation (%ld sec).\n"}};
+
+static asynclog_ring_s g_asynclog_ring;
+static int g_asynclog_running = 0; // 0 until asynclog_init() (messages are then logged synchronously)
+static int g_asynclog_stop = 0;
+static int g_asynclog_rate_limit = 0;
+static multilog_t *g_asynclog_log = NULL;
+static pthread_t g_asynclog_thread;
+
+/**
+ *
+ *  @brief Claims a slot in the ring and stores a record in it. Lock free; drops the record if the ring is full.
+ *  @param[in] ring Pointer to the ring.
+ *  @param[in] log Pointer to the logger the message is for.
+ *  @param[in] message The message id.
+ *  @param[in] args The arguments of the message.
+ *  @returns 1 if the record was stored, 0 if the ring was full.
+ */
+static int asynclog_ring_push(asynclog_ring_s *ring, multilog_t *log, int message, const int64_t *args)
+{
+    uint64_t position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    asynclog_record_s *record;
+
+    for (;;)
+    {
+        record = &ring->records[position & (ring->size - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) - position);
+
+        if (diff == 0)
+        {
+            // The slot is free for this position- claim it (another producer may beat us to it)
+            if (__atomic_compare_exchange_n(&ring->head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The formatter has not consumed this slot yet: full
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        {
+            position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->log = log;
+    record->message = message;
+    memcpy(record->args, args, sizeof(record->args));
+
+    __atomic_store_n(&record->seq, position + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/**
+ *
+ *  @brief Takes the oldest record from the ring. Only called by one thread.
+ *  @param[in] ring Pointer to the ring.
+ *  @param[out] out The record.
+ *  @returns 1 if a record was taken, 0 if the ring is empty.
+ */
+static int asynclog_ring_pop(asynclog_ring_s *ring, asynclog_record_s *out)
+{
+    asynclog_record_s *record = &ring->records[ring->tail & (ring->size - 1)];
+
+    if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != ring->tail + 1)
+        return 0;
+
+    *out = *record;
+
+    // Hand the slot back to the producers for the next lap
+    __atomic_store_n(&record->seq, ring->tail + ring->size, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/**
+ *
+ *  @brief Allocates a ring and marks every slot free.
+ *  @param[in] ring Pointer to the ring.
+ *  @param[in] nrecords Number of records (a power of 2).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be allocated.
+ */
+static int asynclog_ring_init(asynclog_ring_s *ring, uint64_t nrecords)
+{
+    memset(ring, 0, sizeof(asynclog_ring_s));
+
+    if (posix_memalign((void **)&ring->records, 64, nrecords * sizeof(asynclog_record_s)) != 0)
+        return EXIT_FAILURE;
+
+    ring->size = nrecords;
+
+    for (uint64_t i = 0; i < nrecords; i++)
+        ring->records[i].seq = i;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Formats and logs one message.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] message The message id.
+ *  @param[in] args The arguments of the message.
+ */
+static void asynclog_format(multilog_t *log, int message, const int64_t *args)
+{
+    const asynclog_message_s *m = &asynclog_messages[message];
+
+    multilog(log, m->priority, m->format, args[0], args[1], args[2], args[3]);
+}
+
+/**
+ *
+ *  @brief The formatter thread. Drains the ring, rate limiting each message to g_asynclog_rate_limit lines per second.
+ *  @param[in] args Not used.
+ *  @returns NULL.
+ */
+static void *asynclog_thread_fn(void *args)
+{
+    (void)args;
+
+    trace_set_thread_name("log");
+    placement_bind_thread(g_asynclog_log, placement_worker, "log");
+
+    uint64_t window_start_ns = latency_now_ns();
+    uint64_t window_count[ASYNCLOG_MESSAGE_COUNT] = {0};
+    uint64_t suppressed[ASYNCLOG_MESSAGE_COUNT] = {0};
+    uint64_t reported_dropped = 0;
+    asynclog_record_s record;
+
+    for (;;)
+    {
+        int stopping = __atomic_load_n(&g_asynclog_stop, __ATOMIC_ACQUIRE);
+        int drained = 0;
+
+        while (asynclog_ring_pop(&g_asynclog_ring, &record))
+        {
+            drained++;
+
+            if (record.message < 0 || record.message >= ASYNCLOG_MESSAGE_COUNT)
+                continue;
+
+            if (g_asynclog_rate_limit > 0 && window_count[record.message] >= (uint64_t)g_asynclog_rate_limit)
+            {
+                suppressed[record.message]++;
+                continue;
+            }
+
+            window_count[record.message]++;
+            asynclog_format(record.log, record.message, record.args);
+        }
+
+        uint64_t now_ns = latency_now_ns();
+
+        // New rate limit window (1 sec); report what was suppressed or dropped in the last one
+        if (now_ns - window_start_ns >= 1000000000 || stopping)
+        {
+            for (int m = 0; m < ASYNCLOG_MESSAGE_COUNT; m++)
+            {
+                if (suppressed[m] > 0)
+                    multilog(g_asynclog_log, LOG_WARNING, "asynclog: suppressed %lu \"%s\" messages (limit is %d per second).\n", suppressed[m], asynclog_messages[m].name, g_asynclog_rate_limit);
+
+                window_count[m] = 0;
+                suppressed[m] = 0;
+            }
+
+            uint64_t dropped = __atomic_load_n(&g_asynclog_ring.dropped, __ATOMIC_RELAXED);
+
+            if (dropped != reported_dropped)
+            {
+                multilog(g_asynclog_log, LOG_WARNING, "asynclog: ring was full, dropped %lu messages.\n", dropped - reported_dropped);
+                reported_dropped = dropped;
+            }
+
+            window_start_ns = now_ns;
+        }
+
+        // The ring was drained after we saw the stop flag, so nothing written before asynclog_shutdown() is lost
+        if (stopping)
+            break;
+
+        if (drained == 0)
+        {
+            struct timespec idle = {0, ASYNCLOG_IDLE_SLEEP_MS * 1000000L};
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ *
+ *  @brief Allocates the ring and starts the formatter thread. Call once from main() before any logging threads start.
+ *  @param[in] log Pointer to the logger (for messages from asynclog itself).
+ *  @param[in] nrecords Number of records the ring holds (rounded up to a power of 2).
+ *  @param[in] rate_limit Max lines per message per second, or 0 for no limit.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be started (messages are then logged synchronously).
+ */
+int asynclog_init(multilog_t *log, int nrecords, int rate_limit)
+{
+    uint64_t size = 1;
+
+    while (size < (uint64_t)nrecords)
+        size <<= 1;
+
+    if (asynclog_ring_init(&g_asynclog_ring, size) != EXIT_SUCCESS)
+    {
+        multilog(log, LOG_ERR, "asynclog_init(): Could not allocate a ring of %lu log records. Logging synchronously.\n", size);
+        return EXIT_FAILURE;
+    }
+
+    g_asynclog_log = log;
+    g_asynclog_rate_limit = rate_limit;
+    g_asynclog_stop = 0;
+
+    if (pthread_create(&g_asynclog_thread, NULL, asynclog_thread_fn, NULL) != 0)
+    {
+        multilog(log, LOG_ERR, "asynclog_init(): Could not create the log formatter thread. Logging synchronously.\n");
+        free(g_asynclog_ring.records);
+        g_asynclog_ring.records = NULL;
+        return EXIT_FAILURE;
+    }
+
+    __atomic_store_n(&g_asynclog_running, 1, __ATOMIC_RELEASE);
+
+    if (rate_limit > 0)
+        multilog(log, LOG_INFO, "asynclog_init(): Hot path messages are logged from a background thread (ring of %lu, at most %d lines per message per second).\n", size, rate_limit);
+    else
+        multilog(log, LOG_INFO, "asynclog_init(): Hot path messages are logged from a background thread (ring of %lu, no rate limit).\n", size);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Logs a hot path message. Only the id and arguments are stored; the formatter thread formats it later.
+ *         Before asynclog_init() (or after asynclog_shutdown()) the message is logged synchronously instead.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] message The message id.
+ *  @param[in] arg0 First argument (0 if the message has fewer arguments).
+ *  @param[in] arg1 Second argument.
+ *  @param[in] arg2 Third argument.
+ *  @param[in] arg3 Fourth argument.
+ */
+void asynclog_write(multilog_t *log, asynclog_message_enum message, int64_t arg0, int64_t arg1, int64_t arg2, int64_t arg3)
+{
+    int64_t args[ASYNCLOG_MAX_ARGS] = {arg0, arg1, arg2, arg3};
+
+    if (!__atomic_load_n(&g_asynclog_running, __ATOMIC_ACQUIRE))
+    {
+        asynclog_format(log, message, args);
+        return;
+    }
+
+    asynclog_ring_push(&g_asynclog_ring, log, message, args);
+}
+
+/**
+ *
+ *  @brief Waits until every message written so far has been logged (so a synchronous message logged next comes after
+ *         them). Not for the hot path.
+ */
+void asynclog_flush()
+{
+    if (!__atomic_load_n(&g_asynclog_running, __ATOMIC_ACQUIRE))
+        return;
+
+    uint64_t head = __atomic_load_n(&g_asynclog_ring.head, __ATOMIC_ACQUIRE);
+
+    // A claimed slot is always completed, so the tail reaches the head we saw
+    while (__atomic_load_n(&g_asynclog_ring.tail, __ATOMIC_ACQUIRE) < head)
+    {
+        struct timespec wait = {0, 100000};
+        nanosleep(&wait, NULL);
+    }
+}
+
+/**
+ *
+ *  @brief Logs everything left in the ring and stops the formatter thread. Call before multilog_close().
+ */
+void asynclog_shutdown()
+{
+    if (!__atomic_load_n(&g_asynclog_running, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&g_asynclog_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(g_asynclog_thread, NULL);
+
+    // Anything written from here on is logged synchronously
+    __atomic_store_n(&g_asynclog_running, 0, __ATOMIC_RELEASE);
+
+    free(g_asynclog_ring.records);
+    g_asynclog_ring.records = NULL;
+}
+
+/**
+ *
+ *  @brief Measures what asynclog_write() costs the hot path, using a scratch ring (nothing is logged).
+ *  @returns The mean cost of storing one message, in nanoseconds.
+ */
+double asynclog_measure_overhead_ns()
+{
+    const int iterations = 4096;
+    asynclog_ring_s scratch;
+
+    if (asynclog_ring_init(&scratch, iterations) != EXIT_SUCCESS)
+        return 0;
+
+    int64_t args[ASYNCLOG_MAX_ARGS] = {1, 2, 3, 4};
+    uint64_t start = latency_now_ns();
+
+    for (int i = 0; i < iterations; i++)
+        asynclog_ring_push(&scratch, NULL, msg_io_writing_block, args);
+
+    double overhead = (double)(latency_now_ns() - start) / iterations;
+    free(scratch.records);
+
+    return overhead;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file asynclog.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that moves hot path logging off the reader thread
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "multilog.h"
+
+#define ASYNCLOG_DEFAULT_RECORDS 4096    // Size of the ring (must be a power of 2). When full new messages are dropped
+#define ASYNCLOG_DEFAULT_RATE_LIMIT 100  // Default max lines per message per second (0 = unlimited)
+#define ASYNCLOG_MAX_ARGS 4
+#define ASYNCLOG_IDLE_SLEEP_MS 5         // How long the formatter sleeps when the ring is empty
+
+// The hot path messages. Each has a fixed format (see asynclog.c) whose arguments are all %ld / %lu
+typedef enum asynclog_message_enum
+{
+    msg_io_processing_block = 0, // dada_dbfil_io(): Processing block...
+    msg_io_writing_block,        // dada_dbfil_io(): Writing ... into new fil block...
+    msg_io_stats_written,        // dada_dbfil_io(): wrote out spectrum and time statistics...
+    msg_io_block,                // dada_dbfil_io_block(): Processing block id...
+    msg_io_first_block,          // dada_dbfil_io(): First beam second of the observation written...
+    msg_io_past_end,             // dada_dbfil_io(): Beam second past the end of the observation not written...
+    ASYNCLOG_MESSAGE_COUNT
+} asynclog_message_enum;
+
+// One message. Only the ids and raw arguments are stored; the formatter thread does the formatting
+typedef struct asynclog_record_s
+{
+    uint64_t seq; // ring position + 1 once the record is complete, position + ring size once it has been consumed
+    multilog_t *log;
+    int32_t message;
+    int32_t reserved;
+    int64_t args[ASYNCLOG_MAX_ARGS];
+} __attribute__((aligned(64))) asynclog_record_s;
+
+int asynclog_init(multilog_t *log, int nrecords, int rate_limit);
+void asynclog_write(multilog_t *log, asynclog_message_enum message, int64_t arg0, int64_t arg1, int64_t arg2, int64_t arg3);
+void asynclog_flush();
+void asynclog_shutdown();
+double asynclog_measure_overhead_ns();
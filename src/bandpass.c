@@ -0,0 +1,201 @@
+/**
+ * @file bandpass.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that normalises each beam by its running per channel bandpass
+ *
+ * With --normalise each beam keeps a running robust mean and rms of every channel (and pol), and every sample is
+ * written as (x - mean) / rms, so downstream search code gets zero mean, unit rms data across the band. The running
+ * values are exponentially weighted over the last --normalise seconds: each beam second moves them by 1/TAU of the way
+ * to the values measured in that second. To stop RFI dragging them around, samples are clipped to within
+ * BANDPASS_CLIP_SIGMA rms of the running mean before they are measured, and the rms comes from the mean absolute
+ * deviation (scaled to an rms for gaussian noise) rather than the variance. The first beam second of an observation
+ * starts the values off.
+ *
+ * Each beam second updates the running values and is then normalised by them. The mean and rms it was normalised by
+ * are written to a NAME.scales sidecar next to the fil file, so the original powers can be recovered: x = y * rms + mean.
+ *
+ * The loops over every sample (measuring and applying) are kernels (see kernels.c), built for each instruction set
+ * and chosen at startup. The rest run over contiguous channels with no branches, so the compiler vectorises them (-O3).
+ */
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bandpass.h"
+#include "kernels.h"
+
+/**
+ *
+ *  @brief Allocates the running bandpass of a beam. Call at the start of each observation.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] bandpass Pointer to the bandpass (zeroed, or freed with bandpass_free()).
+ *  @param[in] nvalues Values in one time step (channels * pols).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be allocated.
+ */
+int bandpass_init(multilog_t *log, bandpass_s *bandpass, int nvalues)
+{
+    bandpass_free(bandpass);
+
+    bandpass->nvalues = nvalues;
+    bandpass->seconds = 0;
+    bandpass->offset = calloc(nvalues, sizeof(float));
+    bandpass->scale = calloc(nvalues, sizeof(float));
+    bandpass->inv_scale = calloc(nvalues, sizeof(float));
+    bandpass->clip = calloc(nvalues, sizeof(float));
+    bandpass->sum = calloc(nvalues, sizeof(float));
+    bandpass->abs_dev = calloc(nvalues, sizeof(float));
+
+    if (bandpass->offset == NULL || bandpass->scale == NULL || bandpass->inv_scale == NULL || bandpass->clip == NULL ||
+        bandpass->sum == NULL || bandpass->abs_dev == NULL)
+    {
+        multilog(log, LOG_ERR, "bandpass_init(): Could not allocate the bandpass of %d values.\n", nvalues);
+        bandpass_free(bandpass);
+        return EXIT_FAILURE;
+    }
+
+    for (int v = 0; v < nvalues; v++)
+        bandpass->clip[v] = FLT_MAX;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Measures the (clipped) mean deviation and mean absolute deviation of each value from the running mean over
+ *         one beam second, into sum and abs_dev.
+ *  @param[in,out] bandpass Pointer to the bandpass.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ */
+static void bandpass_measure(bandpass_s *bandpass, const float *in, long ntimesteps)
+{
+    const int nvalues = bandpass->nvalues;
+    const float *__restrict offset = bandpass->offset;
+    const float *__restrict clip = bandpass->clip;
+    float *__restrict sum = bandpass->sum;
+    float *__restrict abs_dev = bandpass->abs_dev;
+
+    memset(sum, 0, nvalues * sizeof(float));
+    memset(abs_dev, 0, nvalues * sizeof(float));
+
+    kernel_bandpass_measure(in, ntimesteps, nvalues, offset, clip, sum, abs_dev);
+
+    const float inv_ntimesteps = 1.0f / (float)ntimesteps;
+
+    for (int v = 0; v < nvalues; v++)
+    {
+        sum[v] *= inv_ntimesteps;
+        abs_dev[v] *= inv_ntimesteps;
+    }
+}
+
+/**
+ *
+ *  @brief Moves the running mean and rms of each value towards those of a beam second.
+ *  @param[in,out] bandpass Pointer to the bandpass.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] weight Weight of this beam second (1 / time constant in seconds).
+ */
+void bandpass_update(bandpass_s *bandpass, const float *in, long ntimesteps, float weight)
+{
+    if (ntimesteps <= 0)
+        return;
+
+    // The first beam second starts us off: take its plain mean, then clip about that to get a robust mean and rms
+    if (bandpass->seconds == 0)
+    {
+        bandpass_measure(bandpass, in, ntimesteps);
+
+        for (int v = 0; v < bandpass->nvalues; v++)
+            bandpass->offset[v] += bandpass->sum[v];
+
+        bandpass_measure(bandpass, in, ntimesteps);
+
+        for (int v = 0; v < bandpass->nvalues; v++)
+            bandpass->clip[v] = BANDPASS_CLIP_SIGMA * BANDPASS_MAD_TO_RMS * bandpass->abs_dev[v];
+
+        weight = 1.0f;
+    }
+
+    bandpass_measure(bandpass, in, ntimesteps);
+
+    const int nvalues = bandpass->nvalues;
+    float *__restrict offset = bandpass->offset;
+    float *__restrict scale = bandpass->scale;
+    float *__restrict inv_scale = bandpass->inv_scale;
+    float *__restrict clip = bandpass->clip;
+    const float *__restrict sum = bandpass->sum;
+    const float *__restrict abs_dev = bandpass->abs_dev;
+
+    for (int v = 0; v < nvalues; v++)
+    {
+        offset[v] += weight * sum[v];
+        scale[v] = (1.0f - weight) * scale[v] + weight * BANDPASS_MAD_TO_RMS * abs_dev[v];
+        inv_scale[v] = scale[v] > 0.0f ? 1.0f / scale[v] : 0.0f;
+        clip[v] = scale[v] > 0.0f ? BANDPASS_CLIP_SIGMA * scale[v] : FLT_MAX;
+    }
+
+    bandpass->seconds++;
+}
+
+/**
+ *
+ *  @brief Normalises a beam second: out = (in - mean) / rms for each value. Values with no rms (e.g. flagged channels)
+ *         are written as 0.
+ *  @param[in] bandpass Pointer to the bandpass.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[out] out Where to write the normalised beam second (same layout, must not overlap in).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ */
+void bandpass_apply(const bandpass_s *bandpass, const float *in, float *out, long ntimesteps)
+{
+    kernel_bandpass_apply(in, out, ntimesteps, bandpass->nvalues, bandpass->offset, bandpass->inv_scale);
+}
+
+/**
+ *
+ *  @brief Writes the mean and rms applied to a beam second to the scales sidecar: one line of the second (from the
+ *         start of the observation), then a "mean rms" pair for each channel and pol of the file.
+ *  @param[in] scales_file The scales sidecar.
+ *  @param[in] bandpass Pointer to the bandpass.
+ *  @param[in] second The beam second.
+ *  @param[in] first_value The first value (channel * pols) in the file (not 0 if the file is a sub-band).
+ *  @param[in] nvalues Values (channels * pols) in the file.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be written.
+ */
+int bandpass_write_scales(FILE *scales_file, const bandpass_s *bandpass, int second, int first_value, int nvalues)
+{
+    if (fprintf(scales_file, "%d", second) < 0)
+        return EXIT_FAILURE;
+
+    for (int v = first_value; v < first_value + nvalues; v++)
+    {
+        if (fprintf(scales_file, " %.7g %.7g", bandpass->offset[v], bandpass->scale[v]) < 0)
+            return EXIT_FAILURE;
+    }
+
+    if (fputc('\n', scales_file) == EOF)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Frees the running bandpass of a beam (it can be freed more than once).
+ *  @param[in,out] bandpass Pointer to the bandpass.
+ */
+void bandpass_free(bandpass_s *bandpass)
+{
+    free(bandpass->offset);
+    free(bandpass->scale);
+    free(bandpass->inv_scale);
+    free(bandpass->clip);
+    free(bandpass->sum);
+    free(bandpass->abs_dev);
+
+    memset(bandpass, 0, sizeof(bandpass_s));
+}
@@ -0,0 +1,35 @@
+/**
+ * @file bandpass.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that normalises each beam by its running per channel bandpass
+ *
+ */
+#pragma once
+
+#include <stdio.h>
+#include "multilog.h"
+
+#define BANDPASS_SCALES_EXTENSION ".scales"  // Appended to the fil file name
+#define BANDPASS_DEFAULT_TIME_CONSTANT 10.0  // Seconds; each beam second has weight 1/this in the running statistics
+#define BANDPASS_CLIP_SIGMA 3.0f             // Samples further than this many rms from the mean are clipped (RFI)
+#define BANDPASS_MAD_TO_RMS 1.2533141f       // sqrt(pi/2): mean absolute deviation to rms, for gaussian noise
+
+// The running bandpass of one beam: a robust mean and rms for each channel and pol
+typedef struct bandpass_s
+{
+    int nvalues;      // channels * pols (the values in one time step)
+    int seconds;      // beam seconds seen this observation
+    float *offset;    // running mean, subtracted
+    float *scale;     // running rms (0 if the channel has no signal)
+    float *inv_scale; // 1 / scale, multiplied (0 if scale is 0)
+    float *clip;      // BANDPASS_CLIP_SIGMA * scale (or FLT_MAX until we have a scale)
+    float *sum;       // accumulators for the beam second being processed
+    float *abs_dev;
+} bandpass_s;
+
+int bandpass_init(multilog_t *log, bandpass_s *bandpass, int nvalues);
+void bandpass_update(bandpass_s *bandpass, const float *in, long ntimesteps, float weight);
+void bandpass_apply(const bandpass_s *bandpass, const float *in, float *out, long ntimesteps);
+int bandpass_write_scales(FILE *scales_file, const bandpass_s *bandpass, int second, int first_value, int nvalues);
+void bandpass_free(bandpass_s *bandpass);
@@ -0,0 +1,212 @@
+/**
+ * @file bufferpool.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code for the pool of preallocated staging buffers used by the hot path
+ *
+ * Per block temporaries (e.g. the stats accumulators) used to be calloc'd and freed for every beam second. Instead
+ * each reader reserves one region at the start of an observation, sized from the observation (at least
+ * expected_transfer_size per buffer), and splits it into equal buffers recycled through a free list. The region is
+ * hugepage backed if we can (MAP_HUGETLB with --hugepages, otherwise transparent hugepages are requested), mlocked
+ * and touched up front, so the hot path never faults or calls the allocator. If the pool is ever empty (or a buffer
+ * is too small) we fall back to the heap and count it, so "no heap allocations in steady state" can be checked in
+ * the metrics (staging_heap_allocs).
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bufferpool.h"
+#include "metrics.h"
+
+/**
+ *
+ *  @brief Maps a region, as hugepages if asked and possible, mlocks it and touches every page.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] pool Pointer to the pool (region, region_bytes, hugetlb and locked are set).
+ *  @param[in] bytes Minimum size of the region.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if no memory could be mapped.
+ */
+static int buffer_pool_map(multilog_t *log, buffer_pool_s *pool, size_t bytes)
+{
+    // Round up to whole hugepages, so either kind of hugepage can back all of it
+    pool->region_bytes = (bytes + BUFFER_POOL_HUGEPAGE_BYTES - 1) / BUFFER_POOL_HUGEPAGE_BYTES * BUFFER_POOL_HUGEPAGE_BYTES;
+    pool->region = MAP_FAILED;
+    pool->hugetlb = 0;
+    pool->locked = 0;
+
+    if (pool->use_hugepages)
+    {
+        pool->region = mmap(NULL, pool->region_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (pool->region == MAP_FAILED)
+            multilog(log, LOG_WARNING, "buffer_pool_reserve(): Could not map %lu bytes of hugepages (%s); see /proc/sys/vm/nr_hugepages. Using transparent hugepages.\n", pool->region_bytes, strerror(errno));
+        else
+            pool->hugetlb = 1;
+    }
+
+    if (pool->region == MAP_FAILED)
+    {
+        pool->region = mmap(NULL, pool->region_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (pool->region == MAP_FAILED)
+        {
+            multilog(log, LOG_ERR, "buffer_pool_reserve(): Could not map %lu bytes for staging buffers. Error: %s\n", pool->region_bytes, strerror(errno));
+            pool->region = NULL;
+            return EXIT_FAILURE;
+        }
+
+        madvise(pool->region, pool->region_bytes, MADV_HUGEPAGE);
+    }
+
+    // Keep it resident; not fatal (RLIMIT_MEMLOCK may be too low)
+    if (mlock(pool->region, pool->region_bytes) == 0)
+        pool->locked = 1;
+    else
+        multilog(log, LOG_WARNING, "buffer_pool_reserve(): Could not mlock %lu bytes of staging buffers (%s); check ulimit -l.\n", pool->region_bytes, strerror(errno));
+
+    // Fault every page in now (on the NUMA node the reader's memory is bound to), not in the hot path
+    memset(pool->region, 0, pool->region_bytes);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Unmaps the region and frees the free list.
+ *  @param[in] pool Pointer to the pool.
+ */
+static void buffer_pool_unmap(buffer_pool_s *pool)
+{
+    if (pool->region != NULL)
+    {
+        if (pool->locked)
+            munlock(pool->region, pool->region_bytes);
+
+        munmap(pool->region, pool->region_bytes);
+    }
+
+    free(pool->free_list);
+
+    pool->region = NULL;
+    pool->region_bytes = 0;
+    pool->buffer_bytes = 0;
+    pool->nbuffers = 0;
+    pool->free_list = NULL;
+    pool->nfree = 0;
+}
+
+/**
+ *
+ *  @brief Makes sure the pool has nbuffers buffers of at least buffer_bytes each, all free. Called at the start of each
+ *         observation; the region is only remapped if it is too small, so observations of the same shape reuse it.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] pool Pointer to the pool.
+ *  @param[in] buffer_bytes Minimum size of each buffer.
+ *  @param[in] nbuffers Number of buffers.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the region could not be allocated.
+ */
+int buffer_pool_reserve(multilog_t *log, buffer_pool_s *pool, size_t buffer_bytes, int nbuffers)
+{
+    size_t aligned_bytes = (buffer_bytes + BUFFER_POOL_ALIGNMENT - 1) / BUFFER_POOL_ALIGNMENT * BUFFER_POOL_ALIGNMENT;
+
+    if (pool->region == NULL || pool->buffer_bytes < aligned_bytes || pool->nbuffers < nbuffers)
+    {
+        buffer_pool_unmap(pool);
+
+        pool->free_list = malloc(nbuffers * sizeof(void *));
+
+        if (pool->free_list == NULL || buffer_pool_map(log, pool, aligned_bytes * nbuffers) != EXIT_SUCCESS)
+        {
+            buffer_pool_unmap(pool);
+            return EXIT_FAILURE;
+        }
+
+        pool->buffer_bytes = aligned_bytes;
+        pool->nbuffers = nbuffers;
+
+        metrics_add_staging_pool_map(pool->region_bytes);
+
+        multilog(log, LOG_INFO, "buffer_pool_reserve(): %d staging buffers of %lu bytes (%lu bytes, %s%s).\n", nbuffers, aligned_bytes, pool->region_bytes,
+                 pool->hugetlb ? "hugepages" : "transparent hugepages requested", pool->locked ? ", mlocked" : "");
+    }
+
+    // Every buffer is free at the start of an observation
+    pool->nfree = 0;
+
+    for (int b = pool->nbuffers - 1; b >= 0; b--)
+        pool->free_list[pool->nfree++] = pool->region + (size_t)b * pool->buffer_bytes;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Takes a zeroed buffer of at least bytes from the pool. If the pool is empty or its buffers are too small
+ *         the buffer comes from the heap instead, and is counted (staging_heap_allocs).
+ *  @param[in] pool Pointer to the pool.
+ *  @param[in] bytes Bytes needed (zeroed).
+ *  @returns The buffer, or NULL if the heap fallback failed.
+ */
+void *buffer_pool_get(buffer_pool_s *pool, size_t bytes)
+{
+    if (pool->nfree > 0 && bytes <= pool->buffer_bytes)
+    {
+        void *buffer = pool->free_list[--pool->nfree];
+        memset(buffer, 0, bytes);
+        return buffer;
+    }
+
+    metrics_add_staging_heap_alloc();
+
+    return calloc(1, bytes);
+}
+
+/**
+ *
+ *  @brief Takes a buffer of at least bytes from the pool, like buffer_pool_get(), but does not zero it (for buffers
+ *         which are about to be overwritten in full).
+ *  @param[in] pool Pointer to the pool.
+ *  @param[in] bytes Bytes needed.
+ *  @returns The buffer, or NULL if the heap fallback failed.
+ */
+void *buffer_pool_get_uninitialised(buffer_pool_s *pool, size_t bytes)
+{
+    if (pool->nfree > 0 && bytes <= pool->buffer_bytes)
+        return pool->free_list[--pool->nfree];
+
+    metrics_add_staging_heap_alloc();
+
+    return malloc(bytes);
+}
+
+/**
+ *
+ *  @brief Returns a buffer from buffer_pool_get() (or buffer_pool_get_uninitialised()) to the pool (or frees it, if it came from the heap).
+ *  @param[in] pool Pointer to the pool.
+ *  @param[in] buffer The buffer (NULL is ignored).
+ */
+void buffer_pool_put(buffer_pool_s *pool, void *buffer)
+{
+    if (buffer == NULL)
+        return;
+
+    char *address = (char *)buffer;
+
+    if (pool->region != NULL && address >= pool->region && address < pool->region + pool->region_bytes && pool->nfree < pool->nbuffers)
+        pool->free_list[pool->nfree++] = buffer;
+    else
+        free(buffer);
+}
+
+/**
+ *
+ *  @brief Frees the pool.
+ *  @param[in] pool Pointer to the pool.
+ */
+void buffer_pool_destroy(buffer_pool_s *pool)
+{
+    buffer_pool_unmap(pool);
+}
@@ -0,0 +1,38 @@
+/**
+ * @file bufferpool.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the pool of preallocated staging buffers used by the hot path
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "multilog.h"
+
+#define BUFFER_POOL_DEFAULT_BUFFERS 4          // Buffers in the pool (the hot path needs up to 4 per beam second)
+#define BUFFER_POOL_ALIGNMENT 64               // Each buffer starts on a cache line
+#define BUFFER_POOL_HUGEPAGE_BYTES (2 * 1024 * 1024)
+
+// One region of equal sized buffers, recycled through a free list. Owned by one reader thread (no locking)
+typedef struct buffer_pool_s
+{
+    int use_hugepages; // try MAP_HUGETLB first (--hugepages)
+
+    char *region;
+    size_t region_bytes;
+    size_t buffer_bytes;
+    int nbuffers;
+    int hugetlb; // region is MAP_HUGETLB (otherwise THP is requested with madvise)
+    int locked;  // region is mlocked
+
+    void **free_list;
+    int nfree;
+} buffer_pool_s;
+
+int buffer_pool_reserve(multilog_t *log, buffer_pool_s *pool, size_t buffer_bytes, int nbuffers);
+void *buffer_pool_get(buffer_pool_s *pool, size_t bytes);
+void *buffer_pool_get_uninitialised(buffer_pool_s *pool, size_t bytes);
+void buffer_pool_put(buffer_pool_s *pool, void *buffer);
+void buffer_pool_destroy(buffer_pool_s *pool);
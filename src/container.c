@@ -0,0 +1,303 @@
+/**
+ * @file container.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that writes every beam of an observation into one multi-beam container file
+ *
+ * With --container each observation is one file instead of one fil file per beam, so a process with dozens of beams
+ * has one file (and one stream of writes) open rather than dozens. Beam seconds are appended as they come off the
+ * ring, so the data is written sequentially, and the writes are gathered in a CONTAINER_WRITE_BUFFER_BYTES buffer so
+ * the filesystem sees a few large writes rather than one per beam second. Where each beam second went is kept in an
+ * index table, which is written after the data when the container is closed (and its offset patched into the header).
+ * The container also holds the fil header of each beam, so mwax_filextract can turn any beam back into a normal fil
+ * file by reading its header and then its beam seconds (found through the index) without scanning the data.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "crc32c.h"
+#include "metrics.h"
+#include "util.h"
+
+/**
+ *
+ *  @brief Adds a beam second to the index (growing it if the observation turned out longer than expected).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] container Pointer to the container.
+ *  @param[in] entry The entry.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the index could not be grown.
+ */
+static int container_add_index_entry(multilog_t *log, container_s *container, const container_index_entry_s *entry)
+{
+    if (container->header.index_entries == container->index_capacity)
+    {
+        uint64_t capacity = container->index_capacity * 2;
+        container_index_entry_s *index = realloc(container->index, capacity * sizeof(container_index_entry_s));
+
+        if (index == NULL)
+        {
+            multilog(log, LOG_ERR, "container_add_index_entry(): Could not grow the index to %lu entries.\n", capacity);
+            return EXIT_FAILURE;
+        }
+
+        container->index = index;
+        container->index_capacity = capacity;
+    }
+
+    container->index[container->header.index_entries++] = *entry;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Creates a container and reserves room for its header and beam table (the beam headers come next, from
+ *         container_write_beam_header()). If this fails, no container is left open or on disk.
+ *  @param[in] log Pointer to the logger.
+ *  @param[out] container Pointer to the container.
+ *  @param[in] filename What to create.
+ *  @param[in] obs_id The observation.
+ *  @param[in] nbeams Beams in the observation.
+ *  @param[in] checksums 1 to store the CRC32C of each beam second in the index.
+ *  @param[in] first_second The first beam second (0 unless the observation was joined in progress).
+ *  @param[in] expected_seconds Beam seconds expected (the index starts this big).
+ *  @param[in] expected_bytes Bytes of beam seconds expected (this much is preallocated).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int container_open(multilog_t *log, container_s *container, char *filename, long obs_id, int nbeams, int checksums, int first_second,
+                   uint64_t expected_seconds, uint64_t expected_bytes)
+{
+    memset(container, 0, sizeof(container_s));
+
+    memcpy(container->header.magic, CONTAINER_MAGIC, sizeof(container->header.magic));
+    container->header.version = CONTAINER_VERSION;
+    container->header.nbeams = nbeams;
+    container->header.obs_id = obs_id;
+    container->header.flags = checksums ? CONTAINER_FLAG_CHECKSUMS : 0;
+    container->header.first_second = (uint32_t)first_second;
+
+    container->index_capacity = expected_seconds > 0 ? expected_seconds : (uint64_t)nbeams;
+    container->beams = calloc(nbeams, sizeof(container_beam_s));
+    container->index = malloc(container->index_capacity * sizeof(container_index_entry_s));
+    container->write_buffer = malloc(CONTAINER_WRITE_BUFFER_BYTES);
+
+    if (container->beams == NULL || container->index == NULL || container->write_buffer == NULL)
+    {
+        multilog(log, LOG_ERR, "container_open(): Could not allocate the index of %lu beam seconds.\n", container->index_capacity);
+        container_close(log, container, filename);
+        return EXIT_FAILURE;
+    }
+
+    container->file = fopen(filename, "wb");
+
+    if (container->file == NULL)
+    {
+        multilog(log, LOG_ERR, "container_open(): Error creating %s. Error: %s\n", filename, strerror(errno));
+        metrics_add_file_opened(0);
+        container_close(log, container, filename);
+        return EXIT_FAILURE;
+    }
+
+    metrics_add_file_opened(1);
+
+    setvbuf(container->file, container->write_buffer, _IOFBF, CONTAINER_WRITE_BUFFER_BYTES);
+    posix_fadvise(fileno(container->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Reserve the space of the beam seconds up front (container_close() cuts it back to what was written)
+    int preallocate_error = preallocate_file(fileno(container->file), (off_t)expected_bytes);
+
+    if (preallocate_error != 0)
+        multilog(log, LOG_DEBUG, "container_open(): Could not preallocate %lu bytes for %s. Error: %s\n", expected_bytes, filename, strerror(preallocate_error));
+
+    // The header and beam table are written again (complete) when the container is closed
+    if (fwrite(&container->header, sizeof(container_header_s), 1, container->file) != 1 ||
+        fwrite(container->beams, sizeof(container_beam_s), nbeams, container->file) != (size_t)nbeams)
+    {
+        multilog(log, LOG_ERR, "container_open(): Error writing the header of %s. Error: %s\n", filename, strerror(errno));
+        container_close(log, container, filename);
+        unlink(filename);
+        return EXIT_FAILURE;
+    }
+
+    multilog(log, LOG_INFO, "container_open(): Writing %d beams to %s.\n", nbeams, filename);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Writes the fil header of a beam. Call for every beam after container_open(), before any data, and again
+ *         (with only nsamples changed) before container_close() to rewrite it in place.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] container Pointer to the container.
+ *  @param[in] beam The beam index.
+ *  @param[in] filheader Its fil header.
+ *  @param[in] npol Pols.
+ *  @param[in] bytes_per_second Bytes in a beam second.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int container_write_beam_header(multilog_t *log, container_s *container, int beam, const cFilFileHeader *filheader, int npol, uint64_t bytes_per_second)
+{
+    container_beam_s *container_beam = &container->beams[beam];
+
+    cFilFile filfile;
+    filfile.m_szFileName = NULL;
+    filfile.m_File = container->file;
+
+    off_t end = ftello(container->file);
+    off_t start = end;
+
+    // Rewriting? It goes back where it was
+    if (container_beam->header_bytes > 0)
+    {
+        start = (off_t)container_beam->header_offset;
+
+        if (fseeko(container->file, start, SEEK_SET) != 0)
+        {
+            multilog(log, LOG_ERR, "container_write_beam_header(): Error seeking to the header of beam %d. Error: %s\n", beam + 1, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    CFilFile_WriteHeader(&filfile, filheader);
+
+    off_t header_end = ftello(container->file);
+
+    if (container_beam->header_bytes > 0)
+    {
+        if (header_end - start != (off_t)container_beam->header_bytes)
+        {
+            multilog(log, LOG_ERR, "container_write_beam_header(): Header of beam %d changed length (%ld to %ld bytes).\n", beam + 1, (long)container_beam->header_bytes, (long)(header_end - start));
+            return EXIT_FAILURE;
+        }
+
+        if (fseeko(container->file, end, SEEK_SET) != 0)
+        {
+            multilog(log, LOG_ERR, "container_write_beam_header(): Error seeking back to the end. Error: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    container_beam->header_offset = (uint64_t)start;
+    container_beam->header_bytes = (uint32_t)(header_end - start);
+    container_beam->nchan = (uint32_t)filheader->nchans;
+    container_beam->npol = (uint32_t)npol;
+    container_beam->ntimesteps = (uint32_t)(bytes_per_second / ((uint64_t)filheader->nchans * npol * (filheader->nbits / 8)));
+    container_beam->bytes_per_second = bytes_per_second;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Appends a beam second of a beam and indexes it.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] container Pointer to the container.
+ *  @param[in] beam The beam index.
+ *  @param[in] second The beam second (from the start of the observation).
+ *  @param[in] data The beam second.
+ *  @param[in] bytes Its length.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int container_write_block(multilog_t *log, container_s *container, int beam, int second, const void *data, uint64_t bytes)
+{
+    container_index_entry_s entry;
+    entry.beam = (uint32_t)beam;
+    entry.second = (uint32_t)second;
+    entry.offset = (uint64_t)ftello(container->file);
+    entry.bytes = bytes;
+    entry.crc32c = (container->header.flags & CONTAINER_FLAG_CHECKSUMS) ? crc32c(0, data, bytes) : 0;
+    entry.flags = 0;
+
+    if (fwrite(data, 1, bytes, container->file) != bytes)
+    {
+        multilog(log, LOG_ERR, "container_write_block(): Error writing beam %d second %d. Error: %s\n", beam + 1, second, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return container_add_index_entry(log, container, &entry);
+}
+
+/**
+ *
+ *  @brief Indexes a beam second which was shed to keep up, or which never arrived. Nothing is stored; it reads back as zeros.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] container Pointer to the container.
+ *  @param[in] beam The beam index.
+ *  @param[in] second The beam second (from the start of the observation).
+ *  @param[in] bytes Its length.
+ *  @param[in] flags Why it was not stored: CONTAINER_BLOCK_SHED or CONTAINER_BLOCK_GAP.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int container_skip_block(multilog_t *log, container_s *container, int beam, int second, uint64_t bytes, uint32_t flags)
+{
+    container_index_entry_s entry;
+    entry.beam = (uint32_t)beam;
+    entry.second = (uint32_t)second;
+    entry.offset = 0;
+    entry.bytes = bytes;
+    entry.crc32c = 0;
+    entry.flags = flags;
+
+    return container_add_index_entry(log, container, &entry);
+}
+
+/**
+ *
+ *  @brief Writes the index after the data, patches the header and beam table, and closes the container. Also frees
+ *         what container_open() allocated if it failed part way. Does nothing if no container is open.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] container Pointer to the container.
+ *  @param[in] filename Its name (for errors).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int container_close(multilog_t *log, container_s *container, char *filename)
+{
+    int result = EXIT_SUCCESS;
+
+    if (container->file != NULL)
+    {
+        off_t index_offset = ftello(container->file);
+
+        container->header.index_offset = (uint64_t)index_offset;
+
+        off_t end = index_offset + (off_t)(container->header.index_entries * sizeof(container_index_entry_s));
+
+        // The container ends with the index (it may have been preallocated longer)
+        if (fwrite(container->index, sizeof(container_index_entry_s), container->header.index_entries, container->file) != container->header.index_entries ||
+            fseeko(container->file, 0, SEEK_SET) != 0 ||
+            fwrite(&container->header, sizeof(container_header_s), 1, container->file) != 1 ||
+            fwrite(container->beams, sizeof(container_beam_s), container->header.nbeams, container->file) != container->header.nbeams ||
+            fflush(container->file) != 0 || ftruncate(fileno(container->file), end) != 0)
+        {
+            multilog(log, LOG_ERR, "container_close(): Error writing the index of %s. Error: %s\n", filename, strerror(errno));
+            result = EXIT_FAILURE;
+        }
+
+        if (fclose(container->file) != 0)
+        {
+            multilog(log, LOG_ERR, "container_close(): Error closing %s. Error: %s\n", filename, strerror(errno));
+            result = EXIT_FAILURE;
+        }
+        else
+        {
+            metrics_add_file_closed();
+            multilog(log, LOG_INFO, "container_close(): Closed %s (%lu beam seconds indexed).\n", filename, container->header.index_entries);
+        }
+    }
+
+    free(container->write_buffer);
+    free(container->beams);
+    free(container->index);
+
+    container->file = NULL;
+    container->write_buffer = NULL;
+    container->beams = NULL;
+    container->index = NULL;
+
+    return result;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file container.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that writes every beam of an observation into one multi-beam container file
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "filfile.h"
+#include "multilog.h"
+
+#define CONTAINER_EXTENSION ".mfil"                     // oooooooooo_YYYYMMDDhhmmss_chCCC.mfil
+#define CONTAINER_MAGIC "MWAXMFIL"                      // First 8 bytes of a container
+#define CONTAINER_VERSION 1
+#define CONTAINER_WRITE_BUFFER_BYTES (16 * 1024 * 1024) // Writes are gathered into sequential writes of this size
+#define CONTAINER_FLAG_CHECKSUMS 0x1                    // container_header_s.flags: index entries have a CRC32C
+#define CONTAINER_BLOCK_SHED 0x1                        // container_index_entry_s.flags: beam second was shed (zeros, not stored)
+#define CONTAINER_BLOCK_GAP 0x2                         // container_index_entry_s.flags: beam second never arrived (zeros, not stored)
+
+// The layout of a container (all little endian):
+//   container_header_s
+//   container_beam_s * nbeams
+//   the fil header of each beam (as it would be at the start of that beam's fil file, with nbeams/ibeam set)
+//   beam seconds, one after another as they arrive (any beam order)
+//   container_index_entry_s * index_entries (at index_offset)
+
+typedef struct container_header_s
+{
+    char magic[8];          // CONTAINER_MAGIC
+    uint32_t version;       // CONTAINER_VERSION
+    uint32_t nbeams;        // beams in the container
+    uint64_t index_offset;  // where the index starts (0 if the container was not closed)
+    uint64_t index_entries; // beam seconds in the index
+    int64_t obs_id;
+    uint32_t flags;         // CONTAINER_FLAG_*
+    uint32_t first_second;  // beam second the container starts at (not 0 if the observation was joined in progress)
+    uint32_t reserved[4];
+} container_header_s; // 64 bytes
+
+typedef struct container_beam_s
+{
+    uint64_t header_offset;    // where the fil header of this beam is
+    uint32_t header_bytes;     // its length
+    uint32_t nchan;            // channels
+    uint32_t npol;             // pols
+    uint32_t ntimesteps;       // time steps per beam second
+    uint64_t bytes_per_second; // bytes in a beam second
+} container_beam_s; // 32 bytes
+
+typedef struct container_index_entry_s
+{
+    uint32_t beam;   // beam index (0 based)
+    uint32_t second; // beam second from the start of the observation
+    uint64_t offset; // where its data is (0 if shed or a gap)
+    uint64_t bytes;  // its length
+    uint32_t crc32c; // CRC32C of its data (0 if shed, a gap, or CONTAINER_FLAG_CHECKSUMS is not set)
+    uint32_t flags;  // CONTAINER_BLOCK_*
+} container_index_entry_s; // 32 bytes
+
+// A container being written. Owned by one reader thread (no locking)
+typedef struct container_s
+{
+    FILE *file; // NULL if no container is open
+    char *write_buffer;
+    container_header_s header;
+    container_beam_s *beams;
+    container_index_entry_s *index;
+    uint64_t index_capacity;
+} container_s;
+
+int container_open(multilog_t *log, container_s *container, char *filename, long obs_id, int nbeams, int checksums, int first_second,
+                   uint64_t expected_seconds, uint64_t expected_bytes);
+int container_write_beam_header(multilog_t *log, container_s *container, int beam, const cFilFileHeader *filheader, int npol, uint64_t bytes_per_second);
+int container_write_block(multilog_t *log, container_s *container, int beam, int second, const void *data, uint64_t bytes);
+int container_skip_block(multilog_t *log, container_s *container, int beam, int second, uint64_t bytes, uint32_t flags);
+int container_close(multilog_t *log, container_s *container, char *filename);
@@ -0,0 +1,267 @@
+/**
+ * @file crc32c.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code for the CRC32C (Castagnoli) checksum of the fil data
+ *
+ * On x86 cpus with SSE4.2 the crc32 instruction is used. It has a latency of 3 cycles but a throughput of 1 per
+ * cycle, so large buffers are split into 3 interleaved streams whose CRCs are combined at the end (shifting a CRC
+ * past n zero bytes is a multiplication by x^(8n) mod P, as in zlib's crc32_combine), which runs at ~8 bytes/cycle.
+ * Other cpus use a slice-by-8 table. The implementation is chosen once, at the first call.
+ */
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78         // Castagnoli polynomial, reflected
+#define CRC32C_STREAM_BYTES (8 * 1024) // Bytes per stream per step of the 3 way hardware loop
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *data, size_t len);
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_stream_shift; // x^(8 * CRC32C_STREAM_BYTES) mod P
+static crc32c_fn crc32c_update = NULL;
+static const char *crc32c_name = "none";
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ *
+ *  @brief Multiplies two polynomials modulo P (reflected bit order).
+ *  @param[in] a First polynomial.
+ *  @param[in] b Second polynomial.
+ *  @returns a * b mod P.
+ */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+/**
+ *
+ *  @brief Returns x^(8 * bytes) mod P, which shifts a CRC past that many zero bytes.
+ *  @param[in] bytes Number of bytes.
+ *  @returns x^(8 * bytes) mod P.
+ */
+static uint32_t crc32c_x8nmodp(uint64_t bytes)
+{
+    uint32_t p = (uint32_t)1 << 31; // x^0
+    uint32_t x2n = (uint32_t)1 << 30; // x^1
+
+    // x^(2^k) for k = 0, 1, 2 ... by repeated squaring, multiplied in for each set bit of 8 * bytes
+    for (uint64_t n = bytes * 8; n; n >>= 1)
+    {
+        if (n & 1)
+            p = crc32c_multmodp(x2n, p);
+
+        x2n = crc32c_multmodp(x2n, x2n);
+    }
+
+    return p;
+}
+
+/**
+ *
+ *  @brief Software CRC32C (slice-by-8) of the raw register (no pre/post inversion).
+ *  @param[in] crc The register so far.
+ *  @param[in] data Bytes to add.
+ *  @param[in] len Number of bytes.
+ *  @returns The updated register.
+ */
+static uint32_t crc32c_update_sw(uint32_t crc, const unsigned char *data, size_t len)
+{
+    while (len > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8)
+    {
+        uint64_t word = *(const uint64_t *)data ^ crc;
+
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+
+        data += 8;
+        len -= 8;
+    }
+
+    while (len > 0)
+    {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+/**
+ *
+ *  @brief SSE4.2 CRC32C of the raw register (no pre/post inversion), 3 streams at a time for large buffers.
+ *  @param[in] crc The register so far.
+ *  @param[in] data Bytes to add.
+ *  @param[in] len Number of bytes.
+ *  @returns The updated register.
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_update_hw(uint32_t crc, const unsigned char *data, size_t len)
+{
+    uint64_t crc0 = crc;
+
+    while (len > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+        len--;
+    }
+
+    while (len >= 3 * CRC32C_STREAM_BYTES)
+    {
+        const uint64_t *s0 = (const uint64_t *)data;
+        const uint64_t *s1 = (const uint64_t *)(data + CRC32C_STREAM_BYTES);
+        const uint64_t *s2 = (const uint64_t *)(data + 2 * CRC32C_STREAM_BYTES);
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+
+        for (size_t i = 0; i < CRC32C_STREAM_BYTES / 8; i++)
+        {
+            crc0 = _mm_crc32_u64(crc0, s0[i]);
+            crc1 = _mm_crc32_u64(crc1, s1[i]);
+            crc2 = _mm_crc32_u64(crc2, s2[i]);
+        }
+
+        // crc(A || B) = crc(A) shifted past B, xor crc of B from 0
+        crc0 = crc32c_multmodp(crc32c_stream_shift, (uint32_t)crc0) ^ (uint32_t)crc1;
+        crc0 = crc32c_multmodp(crc32c_stream_shift, (uint32_t)crc0) ^ (uint32_t)crc2;
+
+        data += 3 * CRC32C_STREAM_BYTES;
+        len -= 3 * CRC32C_STREAM_BYTES;
+    }
+
+    while (len >= 8)
+    {
+        crc0 = _mm_crc32_u64(crc0, *(const uint64_t *)data);
+        data += 8;
+        len -= 8;
+    }
+
+    while (len > 0)
+    {
+        crc0 = _mm_crc32_u8((uint32_t)crc0, *data++);
+        len--;
+    }
+
+    return (uint32_t)crc0;
+}
+#endif
+
+/**
+ *
+ *  @brief Builds the tables and picks the implementation for this cpu (called once).
+ */
+static void crc32c_init()
+{
+    for (int n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+        crc32c_table[0][n] = crc;
+    }
+
+    for (int n = 0; n < 256; n++)
+    {
+        for (int t = 1; t < 8; t++)
+            crc32c_table[t][n] = crc32c_table[0][crc32c_table[t - 1][n] & 0xff] ^ (crc32c_table[t - 1][n] >> 8);
+    }
+
+    crc32c_stream_shift = crc32c_x8nmodp(CRC32C_STREAM_BYTES);
+
+    crc32c_update = crc32c_update_sw;
+    crc32c_name = "software (slice-by-8)";
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_update = crc32c_update_hw;
+        crc32c_name = "sse4.2 (3 way)";
+    }
+#endif
+}
+
+/**
+ *
+ *  @brief Adds bytes to a CRC32C. Start with crc = 0; crc32c(crc32c(0, a), b) is the CRC of a followed by b.
+ *  @param[in] crc The CRC so far (0 to start).
+ *  @param[in] data Bytes to add.
+ *  @param[in] len Number of bytes.
+ *  @returns The updated CRC.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return ~crc32c_update(~crc, (const unsigned char *)data, len);
+}
+
+/**
+ *
+ *  @brief Returns the name of the implementation in use (for the log).
+ *  @returns The name.
+ */
+const char *crc32c_implementation()
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+    return crc32c_name;
+}
+
+/**
+ *
+ *  @brief Returns the CRC32C of A followed by B, from the CRC of each (so per block CRCs can be combined into the CRC of
+ *         the whole file without another pass over the data).
+ *  @param[in] crc1 CRC of A.
+ *  @param[in] crc2 CRC of B.
+ *  @param[in] len2 Length of B in bytes.
+ *  @returns The CRC of A followed by B.
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    return crc32c_multmodp(crc32c_x8nmodp(len2), crc1) ^ crc2;
+}
+
+/**
+ *
+ *  @brief Adds len zero bytes to a CRC32C, without needing the zeros (e.g. for a hole in a file).
+ *  @param[in] crc The CRC so far.
+ *  @param[in] len Number of zero bytes.
+ *  @returns The updated CRC.
+ */
+uint32_t crc32c_zeros(uint32_t crc, uint64_t len)
+{
+    return ~crc32c_multmodp(crc32c_x8nmodp(len), ~crc);
+}
@@ -0,0 +1,18 @@
+/**
+ * @file crc32c.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the CRC32C (Castagnoli) checksum of the fil data
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC32C_SIDECAR_EXTENSION ".crc32c" // Appended to the fil file name
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint32_t crc32c_zeros(uint32_t crc, uint64_t len);
+const char *crc32c_implementation();
@@ -13,10 +13,86 @@
 #include "global.h"
 #include "dada_dbfil.h"
 #include "ascii_header.h"
+#include "asynclog.h"
 #include "filwriter.h"
+#include "kernels.h"
+#include "metafitscache.h"
 #include "metafitsreader.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "quicklook.h"
+#include "segment.h"
+#include "trace.h"
+#include "wideband.h"
 #include "../mwax_common/mwax_global_defs.h" // From mwax-common
 
+/**
+ * 
+ *  @brief Creates the context of one reader (a ringbuffer, or a dada file being replayed). The callbacks keep the state
+ *         of the observation in it, so each reader needs its own.
+ *  @param[in] template_ctx Pointer to a context with the options, paths and hostname populated. They are copied.
+ *  @returns The new context, or NULL if it could not be allocated.
+ */
+dada_db_s *create_reader_context(const dada_db_s *template_ctx)
+{
+  dada_db_s *ctx = calloc(1, sizeof(dada_db_s));
+
+  if (ctx == NULL)
+    return NULL;
+
+  ctx->log = template_ctx->log;
+  ctx->destination_dir = template_ctx->destination_dir;
+  ctx->stats_dir = template_ctx->stats_dir;
+  ctx->metafits_path = template_ctx->metafits_path;
+  memcpy(ctx->hostname, template_ctx->hostname, sizeof(ctx->hostname));
+  ctx->perf.requested = template_ctx->perf.requested;
+  ctx->degrade = template_ctx->degrade;
+  ctx->pool.use_hugepages = template_ctx->pool.use_hugepages;
+  ctx->checksums = template_ctx->checksums;
+  ctx->segment_seconds = template_ctx->segment_seconds;
+  ctx->segment_bytes = template_ctx->segment_bytes;
+  ctx->normalise_seconds = template_ctx->normalise_seconds;
+  ctx->subbands = template_ctx->subbands;
+  memcpy(ctx->pipeline_stages, template_ctx->pipeline_stages, sizeof(ctx->pipeline_stages));
+  ctx->pipeline_nstages = template_ctx->pipeline_nstages;
+  ctx->container_mode = template_ctx->container_mode;
+  ctx->wideband_mode = template_ctx->wideband_mode;
+  ctx->quicklook_rows = template_ctx->quicklook_rows;
+
+  return ctx;
+}
+
+/**
+ * 
+ *  @brief Frees a context created by create_reader_context() and everything its observations allocated.
+ *  @param[in] ctx Pointer to the context.
+ */
+void destroy_reader_context(dada_db_s *ctx)
+{
+  // The closer thread counts each segment it finishes in the context, so it must be done with ours first
+  segment_closer_drain(&ctx->segments_closing);
+
+  perf_counters_close(&ctx->perf);
+  buffer_pool_destroy(&ctx->pool);
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+  {
+    free(ctx->beams[beam].channels);
+    bandpass_free(&ctx->beams[beam].bandpass);
+    free(ctx->beams[beam].outputs);
+  }
+
+  free(ctx->beams);
+
+  if (ctx->metafits_info != NULL)
+  {
+    free(ctx->metafits_info->filename);
+    free(ctx->metafits_info);
+  }
+
+  free(ctx);
+}
+
 /**
  * 
  *  @brief This is called at the begininning of each new 8 second sub-observation.
@@ -34,6 +110,8 @@ int dada_dbfil_open(dada_client_t *client)
   multilog_t *log = (multilog_t *)client->log;
   multilog(log, LOG_INFO, "dada_dbfil_open(): extracting params from dada header\n");
 
+  uint64_t open_start_ns = latency_now_ns();
+
   // These need to be set for psrdada
   client->transfer_bytes = 0;
   client->optimal_bytes = 0;
@@ -117,17 +195,31 @@ int dada_dbfil_open(dada_client_t *client)
 
       for (int beam = 0; beam < ctx->nbeams_total; beam++)
       {
-        if (&(ctx->beams[beam].out_filfile_ptr) != NULL)
+        for (int subband = 0; subband < ctx->beams[beam].noutputs; subband++)
         {
-          multilog(log, LOG_INFO, "dada_dbfil_open(): Closing %s...\n", ctx->beams[beam].fil_filename);
+          multilog(log, LOG_INFO, "dada_dbfil_open(): Closing %s...\n", ctx->beams[beam].outputs[subband].fil_filename);
 
-          if (close_fil(client, &(ctx->beams[beam].out_filfile_ptr), beam))
+          if (close_fil(client, beam, subband))
           {
             multilog(log, LOG_ERR, "dada_dbfil_open(): Error closing fils file.\n");
             return -1;
           }
         }
       }
+
+      if (close_container(client))
+      {
+        multilog(log, LOG_ERR, "dada_dbfil_open(): Error closing container.\n");
+        return -1;
+      }
+
+      if (ctx->wideband_mode)
+        wideband_close(log, ctx);
+
+      if (ctx->quicklook_rows > 0)
+        quicklook_close(log, ctx);
+
+      close_gaps_file(ctx);
     }
 
     // Check- has the obs id changed?
@@ -138,6 +230,8 @@ int dada_dbfil_open(dada_client_t *client)
       {
         return -1;
       }
+
+      ctx->obs_start_ns = open_start_ns;
     }
   }
   else
@@ -193,11 +287,16 @@ int dada_dbfil_open(dada_client_t *client)
       multilog(log, LOG_ERR, "dada_dbfits_open(): %s is less than the previous observation (%d < %d).\n", HEADER_OBS_OFFSET, ctx->obs_offset, new_obs_offset_sec);
       return -1;
     }
-    else if (new_obs_offset_sec - ctx->obs_offset != ctx->secs_per_subobs)
+    else if (new_obs_offset_sec - ctx->obs_offset < ctx->secs_per_subobs)
     {
       multilog(log, LOG_ERR, "dada_dbfits_open(): %s did not increase by %d seconds (Old = %d; new = %d; difference = %d).\n", HEADER_OBS_OFFSET, ctx->secs_per_subobs, ctx->obs_offset, new_obs_offset_sec, new_obs_offset_sec - ctx->obs_offset);
       return -1;
     }
+    else if (new_obs_offset_sec - ctx->obs_offset > ctx->secs_per_subobs)
+    {
+      // Sub observations went missing upstream. The gap is filled below, so we carry on with this one
+      multilog(log, LOG_WARNING, "dada_dbfits_open(): %s jumped by more than %d seconds (Old = %d; new = %d; difference = %d). Filling the gap.\n", HEADER_OBS_OFFSET, ctx->secs_per_subobs, ctx->obs_offset, new_obs_offset_sec, new_obs_offset_sec - ctx->obs_offset);
+    }
     else
     {
       multilog(log, LOG_INFO, "dada_dbfits_open(): %s incremented from %d sec to %d sec.\n", HEADER_OBS_OFFSET, ctx->obs_offset, new_obs_offset_sec);
@@ -205,13 +304,328 @@ int dada_dbfil_open(dada_client_t *client)
 
     /* update new offset */
     ctx->obs_offset = new_obs_offset_sec;
+
+    // Fill whatever never arrived before this sub observation (sub observations lost upstream, or a short transfer)
+    // with zeros, so this one is written where it belongs
+    if (ctx->obs_marker_number < ctx->obs_offset)
+    {
+      if (fill_gap(client, ctx->obs_offset < ctx->exposure_sec ? ctx->obs_offset : ctx->exposure_sec) != EXIT_SUCCESS)
+        return -1;
+    }
   }
 
+  metrics_set_observation(ctx->obs_id, ctx->subobs_id, ctx->obs_id != 0 ? ctx->nbeams_total : 0);
+
+  trace_span("dada_dbfil_open", "obs", open_start_ns, "subobs_id", ctx->subobs_id);
+
   multilog(log, LOG_INFO, "dada_dbfil_open(): completed\n");
 
   return EXIT_SUCCESS;
 }
 
+/**
+ * 
+ *  @brief Formats the time in our file names: the UTC_START of the observation (YYYY-MM-DD-hh:mm:ss in the header) as
+ *         YYYYMMDDhhmmss, moved on to where the file starts (where we joined it, if we joined it in progress).
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] start_sec Second (from the start of the observation) the file starts at.
+ *  @param[out] text Where to write it.
+ *  @param[in] text_size Size of text.
+ */
+static void format_file_start_time(dada_db_s *ctx, int start_sec, char *text, size_t text_size)
+{
+  struct tm start_tm;
+  memset(&start_tm, 0, sizeof(start_tm));
+  sscanf(ctx->utc_start, "%d-%d-%d-%d:%d:%d", &start_tm.tm_year, &start_tm.tm_mon, &start_tm.tm_mday, &start_tm.tm_hour, &start_tm.tm_min, &start_tm.tm_sec);
+
+  start_tm.tm_year -= 1900;
+  start_tm.tm_mon -= 1;
+  start_tm.tm_sec += start_sec;
+
+  time_t start_time = timegm(&start_tm);
+  gmtime_r(&start_time, &start_tm);
+
+  strftime(text, text_size, "%Y%m%d%H%M%S", &start_tm);
+}
+
+/**
+ * 
+ *  @brief Works out the name of a beam's (current) fil file: oooooooooo_YYYYMMDDhhmmss_chCCC_BB.fil, with _sbNN (the
+ *         sub-band) appended if the beam is split into sub-bands, then _sNNN (the segment) if we are writing segments
+ *         e.g. oooooooooo_YYYYMMDDhhmmss_chCCC_BB_sb03_s002.fil (the time is always the start of the observation, or
+ *         where we joined it).
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam The beam index.
+ *  @param[in] subband The sub-band (0 if the beam is not split into sub-bands).
+ */
+void make_fil_filename(dada_db_s *ctx, int beam, int subband)
+{
+  /* Work out the name of the file using the UTC START          */
+  char start_text[32];
+  format_file_start_time(ctx, ctx->join_offset_sec, start_text, sizeof(start_text));
+
+  char subband_text[16] = "";
+  char segment_text[16] = "";
+
+  if (ctx->beams[beam].noutputs > 1)
+    snprintf(subband_text, sizeof(subband_text), "_sb%02d", subband);
+
+  if (ctx->beams[beam].segment_secs > 0)
+    snprintf(segment_text, sizeof(segment_text), "_s%03d", ctx->beams[beam].segment_index);
+
+  /* Make a new filename- oooooooooo_YYYYMMDDhhmmss_chCCC_FFF.fil */
+  snprintf(ctx->beams[beam].outputs[subband].fil_filename, PATH_MAX, "%s/%ld_%s_ch%02d_%02d%s%s.fil", ctx->destination_dir,
+           ctx->obs_id, start_text, ctx->coarse_channel, beam + 1, subband_text, segment_text);
+}
+
+/**
+ * 
+ *  @brief Works out the name of the multi-beam container (--container) of the observation: oooooooooo_YYYYMMDDhhmmss_chCCC.mfil
+ *  @param[in] ctx Pointer to our context.
+ */
+void make_container_filename(dada_db_s *ctx)
+{
+  char start_text[32];
+  format_file_start_time(ctx, ctx->join_offset_sec, start_text, sizeof(start_text));
+
+  snprintf(ctx->container_filename, PATH_MAX, "%s/%ld_%s_ch%02d%s", ctx->destination_dir,
+           ctx->obs_id, start_text, ctx->coarse_channel, CONTAINER_EXTENSION);
+}
+
+/**
+ * 
+ *  @brief Works out the name of a beam's quick-look file (--quicklook): oooooooooo_YYYYMMDDhhmmss_chCCC_BB.qlk
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam The beam index.
+ *  @param[out] filename Where to write the name (PATH_MAX).
+ */
+void make_quicklook_filename(dada_db_s *ctx, int beam, char *filename)
+{
+  char start_text[32];
+  format_file_start_time(ctx, ctx->join_offset_sec, start_text, sizeof(start_text));
+
+  snprintf(filename, PATH_MAX, "%s/%ld_%s_ch%02d_%02d%s", ctx->destination_dir,
+           ctx->obs_id, start_text, ctx->coarse_channel, beam + 1, QUICKLOOK_EXTENSION);
+}
+
+/**
+ * 
+ *  @brief Works out the name of a beam's wideband fil file (--wideband): oooooooooo_YYYYMMDDhhmmss_chLLL-HHH_BB.fil,
+ *         where LLL-HHH are the lowest and highest coarse channels in it.
+ *  @param[in] ctx Pointer to the context of one ring of the band.
+ *  @param[in] beam The beam index.
+ *  @param[in] first_coarse_channel The lowest coarse channel of the band.
+ *  @param[in] last_coarse_channel The highest coarse channel of the band.
+ *  @param[in] start_sec Second (from the start of the observation) the file starts at.
+ *  @param[out] filename Where to write the name (PATH_MAX).
+ */
+void make_wideband_filename(dada_db_s *ctx, int beam, int first_coarse_channel, int last_coarse_channel, int start_sec, char *filename)
+{
+  char start_text[32];
+  format_file_start_time(ctx, start_sec, start_text, sizeof(start_text));
+
+  snprintf(filename, PATH_MAX, "%s/%ld_%s_ch%02d-%02d_%02d.fil", ctx->destination_dir,
+           ctx->obs_id, start_text, first_coarse_channel, last_coarse_channel, beam + 1);
+}
+
+/**
+ * 
+ *  @brief Rolls a beam over to its next segment: creates the next fil file of each sub-band (with tstart moved on to the
+ *         start of the segment) and hands the finished ones to the closer thread. Called between two beam seconds.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] beam The beam index.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+int next_fil_segment(dada_client_t *client, int beam)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  uint64_t segment_start_ns = latency_now_ns();
+
+  int finished_segment = ctx->beams[beam].segment_index;
+
+  ctx->beams[beam].segment_index++;
+  ctx->beams[beam].segment_start_sec += ctx->beams[beam].segment_secs;
+  ctx->beams[beam].segment_written_secs = 0;
+
+  int result = EXIT_SUCCESS;
+
+  for (int subband = 0; subband < ctx->beams[beam].noutputs; subband++)
+  {
+    fil_output_s *output = &ctx->beams[beam].outputs[subband];
+
+    // Take what the closer needs before the output moves on to the next file
+    segment_close_s finished;
+    memcpy(finished.fil_filename, output->fil_filename, sizeof(finished.fil_filename));
+    memcpy(finished.fil_partial_filename, output->fil_partial_filename, sizeof(finished.fil_partial_filename));
+    finished.fil_file = output->out_filfile_ptr.m_File;
+    memcpy(finished.checksum_filename, output->checksum_filename, sizeof(finished.checksum_filename));
+    finished.checksum_file = output->checksum_file;
+    finished.data_crc = output->data_crc;
+    memcpy(finished.scales_filename, output->scales_filename, sizeof(finished.scales_filename));
+    finished.scales_file = output->scales_file;
+    finished.obs_id = ctx->obs_id;
+    finished.nsamples = output->header_nsamples; // a segment we roll over from is always full
+    finished.beam = beam;
+    finished.segment = finished_segment;
+    finished.subband = ctx->beams[beam].noutputs > 1 ? subband : -1;
+    finished.closing = &ctx->segments_closing;
+
+    output->out_filfile_ptr.m_File = NULL;
+    output->checksum_file = NULL;
+    output->scales_file = NULL;
+
+    make_fil_filename(ctx, beam, subband);
+
+    if (create_fil(client, beam, subband, ctx->metafits_info) != EXIT_SUCCESS)
+      result = EXIT_FAILURE;
+
+    // Close the finished segment whether or not the next one could be created
+    segment_close_async(log, &finished);
+  }
+
+  if (result != EXIT_SUCCESS)
+  {
+    multilog(log, LOG_ERR, "next_fil_segment(): Error creating segment %d for beam %d.\n", ctx->beams[beam].segment_index, beam + 1);
+    return -1;
+  }
+
+  trace_span("next_segment", "file", segment_start_ns, "beam", beam + 1);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * 
+ *  @brief Fills a gap in the observation (beam seconds which never arrived, e.g. sub observations lost upstream) with
+ *         zeros, so every sample after it keeps its time and we carry on writing instead of giving up on the
+ *         observation (and everything behind it in the ringbuffer). In fil files the gap is skipped over, so it reads
+ *         back as zeros (as shed beam seconds do); in a container it is indexed with CONTAINER_BLOCK_GAP. Either way it
+ *         is recorded in the gaps sidecar of the observation, oooooooooo_YYYYMMDDhhmmss_chCCC.gaps.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] end_second The beam second (from the start of the observation) to fill up to.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+int fill_gap(dada_client_t *client, int end_second)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  uint64_t gap_start_ns = latency_now_ns();
+
+  int first_second = ctx->obs_marker_number;
+  int first_beam = ctx->block_number % ctx->nbeams_total;
+  uint64_t fill_bytes = 0;
+  int result = EXIT_SUCCESS;
+
+  // One beam second at a time, in the order they would have arrived (so segments roll over where they would have)
+  while (ctx->obs_marker_number < end_second && result == EXIT_SUCCESS)
+  {
+    int beam = ctx->block_number % ctx->nbeams_total;
+    uint64_t beam_bytes = ctx->beams[beam].ntimesteps * ctx->beams[beam].nchan * ctx->npol * sizeof(float);
+    uint64_t subband_bytes = beam_bytes / (ctx->beams[beam].noutputs > 1 ? ctx->beams[beam].noutputs : 1);
+
+    if (ctx->beams[beam].segment_secs > 0 && ctx->beams[beam].segment_written_secs >= ctx->beams[beam].segment_secs)
+      result = next_fil_segment(client, beam);
+
+    if (result == EXIT_SUCCESS && ctx->wideband_mode)
+      result = wideband_deposit(log, ctx, beam, ctx->obs_marker_number, NULL);
+
+    if (result == EXIT_SUCCESS && ctx->container_mode)
+      result = container_skip_block(log, &ctx->container, beam, ctx->obs_marker_number, beam_bytes, CONTAINER_BLOCK_GAP);
+
+    for (int subband = 0; subband < ctx->beams[beam].noutputs && result == EXIT_SUCCESS; subband++)
+    {
+      fil_output_s *output = &ctx->beams[beam].outputs[subband];
+
+      result = skip_fil_block(client, &output->out_filfile_ptr, subband_bytes);
+      output->data_crc = crc32c_zeros(output->data_crc, subband_bytes);
+    }
+
+    ctx->beams[beam].segment_written_secs++;
+    fill_bytes += beam_bytes;
+
+    if (beam == ctx->nbeams_total - 1)
+      ctx->obs_marker_number += 1;
+
+    ctx->block_number += 1;
+  }
+
+  ctx->gaps++;
+  ctx->gap_fill_bytes += fill_bytes;
+  metrics_add_gap(fill_bytes);
+  metrics_set_marker(ctx->obs_marker_number);
+
+  if (result != EXIT_SUCCESS)
+  {
+    multilog(log, LOG_ERR, "fill_gap(): Error filling the gap from second %d (beam %d) to second %d of %ld.\n", first_second, first_beam + 1, end_second, ctx->obs_id);
+    return -1;
+  }
+
+  multilog(log, LOG_WARNING, "fill_gap(): Filled the gap from second %d (beam %d) to second %d of %ld with %lu bytes of zeros.\n",
+           first_second, first_beam + 1, end_second, ctx->obs_id, fill_bytes);
+
+  // And record it in the gaps sidecar (created with the first gap)
+  if (ctx->gaps_file == NULL)
+  {
+    char start_text[32];
+    format_file_start_time(ctx, ctx->join_offset_sec, start_text, sizeof(start_text));
+
+    snprintf(ctx->gaps_filename, PATH_MAX, "%s/%ld_%s_ch%02d%s", ctx->destination_dir, ctx->obs_id, start_text, ctx->coarse_channel, GAPS_SIDECAR_EXTENSION);
+
+    char gaps_partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(gaps_partial_filename, sizeof(gaps_partial_filename), "%s%s", ctx->gaps_filename, FIL_PARTIAL_EXTENSION);
+
+    ctx->gaps_file = fopen(gaps_partial_filename, "w");
+
+    if (ctx->gaps_file == NULL)
+      multilog(log, LOG_ERR, "fill_gap(): Error creating gaps file: %s. Error: %s\n", ctx->gaps_filename, strerror(errno));
+    else
+      fprintf(ctx->gaps_file, "# beam seconds of obs %ld which never arrived and are zeros in its files (seconds are from the start of the observation)\n"
+                              "# first_second first_beam end_second bytes\n",
+              ctx->obs_id);
+  }
+
+  if (ctx->gaps_file != NULL)
+  {
+    fprintf(ctx->gaps_file, "%d %d %d %lu\n", first_second, first_beam + 1, end_second, fill_bytes);
+    fflush(ctx->gaps_file);
+  }
+
+  trace_span("fill_gap", "io", gap_start_ns, "seconds", end_second - first_second);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * 
+ *  @brief Closes the gaps sidecar of the observation (if it had any gaps) and gives it its final name.
+ *  @param[in] ctx Pointer to our context.
+ */
+void close_gaps_file(dada_db_s *ctx)
+{
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  if (ctx->gaps > 0)
+    multilog(log, LOG_WARNING, "close_gaps_file(): %ld had %lu gaps filled with %lu bytes of zeros.\n", ctx->obs_id, ctx->gaps, ctx->gap_fill_bytes);
+
+  if (ctx->gaps_file == NULL)
+    return;
+
+  char gaps_partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)];
+  snprintf(gaps_partial_filename, sizeof(gaps_partial_filename), "%s%s", ctx->gaps_filename, FIL_PARTIAL_EXTENSION);
+
+  if (fclose(ctx->gaps_file) != 0)
+    multilog(log, LOG_ERR, "close_gaps_file(): Error closing gaps file %s. Error: %s\n", gaps_partial_filename, strerror(errno));
+  else if (rename(gaps_partial_filename, ctx->gaps_filename) != 0)
+    multilog(log, LOG_ERR, "close_gaps_file(): Error renaming %s to %s. Error: %s\n", gaps_partial_filename, ctx->gaps_filename, strerror(errno));
+
+  ctx->gaps_file = NULL;
+}
+
 /**
  * 
  *  @brief This code peforms steps necessary to setup for a new observation
@@ -228,17 +642,6 @@ int process_new_observation(dada_client_t *client, long new_obs_id, long new_sub
   assert(ctx->log != 0);
   multilog_t *log = (multilog_t *)ctx->log;
 
-  // But the new_obs_id != new_subobs_id, then it means we are not at the start of an observation and we should skip it
-  if (new_obs_id != new_subobs_id)
-  {
-    multilog(log, LOG_WARNING, "dada_dbfil_open(): Detected an in progress observation (obs_id: %lu / sub_obs_id: %lu). Skipping this observation.\n", new_obs_id, new_subobs_id);
-    // Set obs and subobs to 0 so the io and close methods know we have nothing to do
-    ctx->obs_id = 0;
-    ctx->subobs_id = 0;
-
-    return EXIT_SUCCESS;
-  }
-
   // initialise our structure
   ctx->block_open = 0;
   ctx->bytes_read = 0;
@@ -246,6 +649,18 @@ int process_new_observation(dada_client_t *client, long new_obs_id, long new_sub
   ctx->curr_block = 0;
   ctx->block_number = 0;
   ctx->duration_changed = 0;
+  ctx->gaps = 0;
+  ctx->gap_fill_bytes = 0;
+  ctx->gaps_file = NULL;
+
+  for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    latency_reset(&ctx->latency[stage]);
+
+  // The counters only count the thread which opens them, so open them here on the reader thread
+  if (ctx->perf.requested && !ctx->perf.attempted)
+    perf_counters_open(log, &ctx->perf);
+
+  perf_counters_reset(&ctx->perf);
 
   // Set the obsid & sub obsid
   ctx->obs_id = new_obs_id;
@@ -259,36 +674,77 @@ int process_new_observation(dada_client_t *client, long new_obs_id, long new_sub
     return -1;
   }
 
-  // Open and Read metafits file
-  snprintf(ctx->metafits_filename, PATH_MAX, "%s/%ld_metafits.fits", ctx->metafits_path, ctx->obs_id);
-
-  multilog(log, LOG_INFO, "dada_dbfil_open(): Reading metafits file: %s\n", ctx->metafits_filename);
+  // If new_obs_id != new_subobs_id we are not at the start of the observation (e.g. we were restarted part way through
+  // it), so we join it where it is: the files start at OBS_OFFSET (their tstart, name and nsamples say so), and the
+  // marker counts seconds from the start of the observation as usual, so we still stop at the end of it
+  ctx->join_offset_sec = 0;
+  ctx->obs_marker_number = 0;
 
-  if (open_fits(client, &ctx->in_metafits_ptr, ctx->metafits_filename) != EXIT_SUCCESS)
+  if (new_obs_id != new_subobs_id)
   {
-    // Error!
-    exit(EXIT_FAILURE);
+    if (ctx->obs_offset <= 0 || ctx->obs_offset >= ctx->exposure_sec)
+    {
+      multilog(log, LOG_WARNING, "dada_dbfil_open(): Detected an in progress observation (obs_id: %lu / sub_obs_id: %lu) with %s %d of %d sec. Skipping this observation.\n",
+               new_obs_id, new_subobs_id, HEADER_OBS_OFFSET, ctx->obs_offset, ctx->exposure_sec);
+      // Set obs and subobs to 0 so the io and close methods know we have nothing to do
+      ctx->obs_id = 0;
+      ctx->subobs_id = 0;
+
+      return EXIT_SUCCESS;
+    }
+
+    multilog(log, LOG_WARNING, "dada_dbfil_open(): Detected an in progress observation (obs_id: %lu / sub_obs_id: %lu). Joining it at %s %d sec (%d of %d sec missed).\n",
+             new_obs_id, new_subobs_id, HEADER_OBS_OFFSET, ctx->obs_offset, ctx->obs_offset, ctx->exposure_sec);
+
+    ctx->join_offset_sec = ctx->obs_offset;
+    ctx->obs_marker_number = ctx->obs_offset;
   }
 
-  // Read data from metafits
-  if (ctx->metafits_info != 0)
-    free(ctx->metafits_info);
+  if (ctx->degrade.enabled)
+    degrade_new_observation(&ctx->degrade, ctx->nbeams_total);
 
-  ctx->metafits_info = malloc(sizeof(metafits_s));
+  // Open and Read metafits file (unless we have read it before, see metafitscache.c)
+  snprintf(ctx->metafits_filename, PATH_MAX, "%s/%ld_metafits.fits", ctx->metafits_path, ctx->obs_id);
 
-  if (read_metafits(client, ctx->in_metafits_ptr, ctx->metafits_info) != EXIT_SUCCESS)
+  uint64_t metafits_start_ns = latency_now_ns();
+
+  if (ctx->metafits_info != 0)
   {
-    // Error!
-    return EXIT_FAILURE;
+    free(ctx->metafits_info->filename);
+    free(ctx->metafits_info);
   }
 
-  // Close metafits
-  if (close_fits(client, &ctx->in_metafits_ptr) != EXIT_SUCCESS)
+  ctx->metafits_info = calloc(1, sizeof(metafits_s));
+
+  if (metafits_cache_get(log, ctx->obs_id, ctx->metafits_filename, ctx->metafits_info) != EXIT_SUCCESS)
   {
-    // Error!
-    return EXIT_FAILURE;
+    multilog(log, LOG_INFO, "dada_dbfil_open(): Reading metafits file: %s\n", ctx->metafits_filename);
+
+    if (open_fits(client, &ctx->in_metafits_ptr, ctx->metafits_filename) != EXIT_SUCCESS)
+    {
+      // Error!
+      exit(EXIT_FAILURE);
+    }
+
+    // Read data from metafits
+    if (read_metafits(client, ctx->in_metafits_ptr, ctx->metafits_info) != EXIT_SUCCESS)
+    {
+      // Error!
+      return EXIT_FAILURE;
+    }
+
+    // Close metafits
+    if (close_fits(client, &ctx->in_metafits_ptr) != EXIT_SUCCESS)
+    {
+      // Error!
+      return EXIT_FAILURE;
+    }
+
+    metafits_cache_put(log, ctx->obs_id, ctx->metafits_filename, ctx->metafits_info);
   }
 
+  trace_span("metafits", "obs", metafits_start_ns, "obs_id", ctx->obs_id);
+
   //
   // Check transfer size read in from header matches what we expect from the other params
   //
@@ -309,28 +765,216 @@ int process_new_observation(dada_client_t *client, long new_obs_id, long new_sub
     return -1;
   } */
 
+  // Reserve the per block temporaries up front, so the hot path does not allocate. A buffer holds a whole block
+  // (for conversions) or any beam's stats accumulators
+  size_t staging_bytes = ctx->expected_transfer_size;
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+  {
+    if (ctx->beams[beam].nchan * sizeof(double) > staging_bytes)
+      staging_bytes = ctx->beams[beam].nchan * sizeof(double);
+
+    if (ctx->beams[beam].ntimesteps * sizeof(double) > staging_bytes)
+      staging_bytes = ctx->beams[beam].ntimesteps * sizeof(double);
+  }
+
+  if (buffer_pool_reserve(log, &ctx->pool, staging_bytes, BUFFER_POOL_DEFAULT_BUFFERS) != EXIT_SUCCESS)
+  {
+    multilog(log, LOG_ERR, "dada_dbfil_open(): Error reserving staging buffers.\n");
+    return -1;
+  }
+
   /* Create fil files for each beam output                      */
   for (int beam = 0; beam < ctx->nbeams_total; beam++)
   {
-    /* Work out the name of the file using the UTC START          */
-    /* Convert the UTC_START from the header format: YYYY-MM-DD-hh:mm:ss into YYYYMMDDhhmmss  */
-    int year, month, day, hour, minute, second;
-    sscanf(ctx->utc_start, "%d-%d-%d-%d:%d:%d", &year, &month, &day, &hour, &minute, &second);
+    // Split into sub-bands? Each is written to its own fil file
+    if (ctx->beams[beam].nchan % ctx->subbands != 0)
+    {
+      multilog(log, LOG_ERR, "dada_dbfil_open(): Beam %d has %ld channels, which can not be split into %d sub-bands.\n", beam + 1, ctx->beams[beam].nchan, ctx->subbands);
+      return -1;
+    }
+
+    // With --container (or --wideband) the beams have no fil files of their own: they all go into the container
+    // (created below), or to the assembler (see wideband.c)
+    ctx->beams[beam].noutputs = (ctx->container_mode || ctx->wideband_mode) ? 0 : ctx->subbands;
+    ctx->beams[beam].nsubband_chan = ctx->beams[beam].nchan / ctx->subbands;
+    ctx->beams[beam].outputs = calloc(ctx->beams[beam].noutputs, sizeof(fil_output_s));
+
+    if (ctx->subbands > 1)
+      multilog(log, LOG_INFO, "dada_dbfil_open(): Beam %d will be written as %d sub-bands of %ld channels.\n", beam + 1, ctx->subbands, ctx->beams[beam].nsubband_chan);
+
+    multilog(log, LOG_INFO, "dada_dbfil_open(): Beam %d kernels take the %s shape path.\n", beam + 1, kernels_shape_name(ctx->beams[beam].nchan, ctx->npol));
+
+    // Split into segments? (see segment.c) The size limit is per file
+    uint64_t beam_bytes_per_sec = (uint64_t)ctx->beams[beam].ntimesteps * ctx->beams[beam].nsubband_chan * ctx->npol * (ctx->nbit / 8);
+
+    ctx->beams[beam].segment_secs = segment_seconds_for_beam(ctx->segment_seconds, ctx->segment_bytes, beam_bytes_per_sec);
+    ctx->beams[beam].segment_index = 0;
+    ctx->beams[beam].segment_start_sec = ctx->join_offset_sec;
+    ctx->beams[beam].segment_written_secs = 0;
+
+    if (ctx->beams[beam].segment_secs > 0)
+      multilog(log, LOG_INFO, "dada_dbfil_open(): Beam %d will be written in segments of %d sec (%lu bytes).\n", beam + 1, ctx->beams[beam].segment_secs, beam_bytes_per_sec * ctx->beams[beam].segment_secs);
+
+    // Start the running bandpass afresh for each observation (see bandpass.c)
+    if (ctx->normalise_seconds > 0 && bandpass_init(log, &ctx->beams[beam].bandpass, ctx->beams[beam].nchan * ctx->npol) != EXIT_SUCCESS)
+    {
+      multilog(log, LOG_ERR, "dada_dbfil_open(): Error allocating the bandpass of beam %d.\n", beam + 1);
+      return -1;
+    }
+
+    pipeline_build(log, ctx, beam);
+
+    uint64_t create_start_ns = latency_now_ns();
+
+    for (int subband = 0; subband < ctx->beams[beam].noutputs; subband++)
+    {
+      make_fil_filename(ctx, beam, subband);
+
+      if (create_fil(client, beam, subband, ctx->metafits_info))
+      {
+        multilog(log, LOG_ERR, "dada_dbfil_open(): Error creating new fil file for beam %d.\n", beam + 1);
+        return -1;
+      }
+    }
+
+    trace_span("create_fil", "file", create_start_ns, "beam", beam + 1);
+  }
+
+  if (ctx->container_mode)
+  {
+    uint64_t create_start_ns = latency_now_ns();
 
-    /* Make a new filename- oooooooooo_YYYYMMDDhhmmss_chCCC_FFF.fil */
-    snprintf(ctx->beams[beam].fil_filename, PATH_MAX, "%s/%ld_%04d%02d%02d%02d%02d%02d_ch%02d_%02d.fil", ctx->destination_dir,
-             ctx->obs_id, year, month, day, hour, minute, second, ctx->coarse_channel, beam + 1);
+    make_container_filename(ctx);
 
-    if (create_fil(client, beam, &(ctx->beams[beam].out_filfile_ptr), ctx->metafits_info))
+    if (create_container(client, ctx->metafits_info))
     {
-      multilog(log, LOG_ERR, "dada_dbfil_open(): Error creating new fil file for beam %d.\n", beam + 1);
+      multilog(log, LOG_ERR, "dada_dbfil_open(): Error creating new container.\n");
       return -1;
     }
+
+    trace_span("create_container", "file", create_start_ns, "beams", ctx->nbeams_total);
+  }
+
+  // Join the other rings in the wideband files of this observation (the first ring here starts it)
+  if (ctx->wideband_mode && wideband_open(log, ctx) != EXIT_SUCCESS)
+  {
+    multilog(log, LOG_ERR, "dada_dbfil_open(): Error setting up the wideband files.\n");
+    return -1;
+  }
+
+  // And the quick-look pyramid of each beam, built in the background (see quicklook.c)
+  if (ctx->quicklook_rows > 0 && quicklook_open(log, ctx) != EXIT_SUCCESS)
+  {
+    multilog(log, LOG_ERR, "dada_dbfil_open(): Error creating the quick-look files.\n");
+    return -1;
   }
 
   return EXIT_SUCCESS;
 }
 
+/**
+ * 
+ *  @brief Records how long a stage took, for the beam, the observation and the process metrics (for a stage whose time
+ *         is summed over several spans, such as a pipeline stage's tiles, so it has no span of its own in the trace).
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam The beam index.
+ *  @param[in] stage The stage.
+ *  @param[in] duration_ns How long it took.
+ */
+void record_stage_duration(dada_db_s *ctx, int beam, latency_stage_enum stage, uint64_t duration_ns)
+{
+  latency_record(&ctx->latency[stage], duration_ns);
+  latency_record(&ctx->beams[beam].latency[stage], duration_ns);
+  metrics_record_stage(beam, stage, duration_ns);
+}
+
+/**
+ * 
+ *  @brief Records the time since stage_start_ns against a stage, for the beam, the observation, the process metrics
+ *         and the trace.
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam The beam index.
+ *  @param[in] stage The stage which just finished.
+ *  @param[in] stage_start_ns Timestamp (latency_now_ns()) of the start of the stage.
+ *  @returns The current timestamp, so it can be used as the start of the next stage.
+ */
+uint64_t record_stage_latency(dada_db_s *ctx, int beam, latency_stage_enum stage, uint64_t stage_start_ns)
+{
+  uint64_t now_ns = latency_now_ns();
+
+  record_stage_duration(ctx, beam, stage, now_ns - stage_start_ns);
+  perf_counters_stage_end(&ctx->perf, stage);
+  trace_span(latency_stage_names[stage], "io", stage_start_ns, "beam", beam + 1);
+
+  return now_ns;
+}
+
+/**
+ * 
+ *  @brief Logs the per stage (and per beam) latency histograms of the observation in progress.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] reason Why we are logging (e.g. end of observation).
+ */
+void log_latency_summary(dada_client_t *client, const char *reason)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  multilog(log, LOG_INFO, "Latency summary for obs %lu (%s):\n", ctx->obs_id, reason);
+
+  char label[64];
+
+  for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+  {
+    latency_log_histogram(log, latency_stage_names[stage], &ctx->latency[stage]);
+  }
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+  {
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+      snprintf(label, sizeof(label), "beam %02d %s", beam + 1, latency_stage_names[stage]);
+      latency_log_histogram(log, label, &ctx->beams[beam].latency[stage]);
+    }
+  }
+}
+
+/**
+ * 
+ *  @brief Logs what was shed to keep up during the observation, including any beam seconds which are zeros in the fil files.
+ *  @param[in] client A pointer to the dada_client_t object.
+ */
+void log_degrade_summary(dada_client_t *client)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  degrade_log_summary(log, &ctx->degrade);
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+  {
+    if (ctx->beams[beam].blocks_shed > 0)
+      multilog(log, LOG_WARNING, "Degrade: beam %d (priority %d) had %lu beam seconds shed (written as zeros) in %s\n", beam + 1,
+               degrade_beam_priority(&ctx->degrade, beam), ctx->beams[beam].blocks_shed,
+               ctx->beams[beam].noutputs > 0 ? ctx->beams[beam].outputs[0].fil_filename : ctx->container_filename);
+  }
+}
+
+/**
+ * 
+ *  @brief Dumps everything in the trace ring (when asked to with SIGUSR2) to sigusr2_<unix time>_trace.json.
+ *  @param[in] log Pointer to the logger.
+ */
+void dump_trace_on_request(multilog_t *log)
+{
+  char trace_label[64];
+  snprintf(trace_label, sizeof(trace_label), "sigusr2_%ld", (long)time(NULL));
+  trace_dump(log, trace_label, 0);
+}
+
 /**
  * 
  *  @brief This is the function psrdada calls when we have new data to read.
@@ -351,10 +995,12 @@ int64_t dada_dbfil_io(dada_client_t *client, void *buffer, uint64_t bytes)
   {
     multilog_t *log = (multilog_t *)ctx->log;
 
+    uint64_t io_start_ns = latency_now_ns();
+
     uint64_t written = 0;
     uint64_t wrote = 0;
 
-    multilog(log, LOG_DEBUG, "dada_dbfil_io(): Processing block %d.\n", ctx->block_number);
+    asynclog_write(log, msg_io_processing_block, ctx->block_number, 0, 0, 0);
 
     // Determine which beam this is. For example with 3 beams:
     // Block 0 == 1st beam timestep 1
@@ -365,7 +1011,22 @@ int64_t dada_dbfil_io(dada_client_t *client, void *buffer, uint64_t bytes)
     // Block 5 == 3rd beam timestep 2
     int beam = ctx->block_number % ctx->nbeams_total;
 
-    multilog(log, LOG_INFO, "dada_dbfil_io(): Writing %d of %d bytes into new fil block for beam %d; Marker = %d.\n", ctx->expected_transfer_size, bytes, beam, ctx->obs_marker_number);
+    // Beam seconds past the end of the observation (EXPOSURE_SECS was cut to less than we are being sent) are not
+    // written, as the files are only as long as the observation. dada_dbfil_close() then ends the observation
+    if (ctx->obs_marker_number >= ctx->exposure_sec)
+    {
+      asynclog_write(log, msg_io_past_end, beam + 1, ctx->obs_marker_number, ctx->exposure_sec, 0);
+      metrics_add_dropped(bytes);
+
+      if (beam == ctx->nbeams_total - 1)
+        ctx->obs_marker_number += 1;
+
+      ctx->block_number += 1;
+
+      return bytes;
+    }
+
+    asynclog_write(log, msg_io_writing_block, ctx->expected_transfer_size, bytes, beam, ctx->obs_marker_number);
 
     // Read ring buffer block and write data out
     float *in_buffer = (float *)buffer;
@@ -375,101 +1036,80 @@ int64_t dada_dbfil_io(dada_client_t *client, void *buffer, uint64_t bytes)
 
     long out_buffer_bytes = out_buffer_elements * sizeof(float);
 
-    int input_index = 0;
+    // Every stage reads the whole beam second, so a short block (e.g. a truncated file being replayed) cannot be used
+    if (bytes < (uint64_t)out_buffer_bytes)
+    {
+      asynclog_flush();
+      multilog(log, LOG_ERR, "dada_dbfil_io(): Block of %lu bytes is shorter than a beam second (beam %d, %ld bytes).\n", bytes, beam + 1, out_buffer_bytes);
+      metrics_add_dropped(bytes);
+      return -1;
+    }
 
-    ctx->beams[beam].power_freq = calloc(ctx->beams[beam].nchan, sizeof(double));
-    ctx->beams[beam].power_time = calloc(ctx->beams[beam].ntimesteps, sizeof(double));
+    perf_counters_io_begin(&ctx->perf, out_buffer_bytes);
 
-    // For this beam loop through all of the timesteps
-    for (long t = 0; t < ctx->beams[beam].ntimesteps; t++)
-    {
-      // Iterate through all of the channels in the timestep
-      for (long ch = 0; ch < ctx->beams[beam].nchan; ch++)
-      {
-        // Each channel can have polarisations
-        for (int pol = 0; pol < ctx->npol; pol++)
-        {
-          // Update stats but only if we asked for it
-          if (ctx->stats_dir != NULL)
-          {
-            ctx->beams[beam].power_freq[ch] += (double)in_buffer[input_index];
-            ctx->beams[beam].power_time[t] += (double)in_buffer[input_index];
-          }
+    // Decide if we need to shed work to keep up with the ringbuffer (see degrade.c)
+    degrade_update(log, &ctx->degrade, (ipcbuf_t *)client->data_block, ctx->nbeams_total, ctx->obs_marker_number);
 
-          /* uncomment this for debug! 
-              if (t<=0 && ctx->block_number==0)
-                printf("t=%d; ch=%d; pol=%d; in_index=%d; out_index=%d value=%f;\n", t, ch, pol, input_index, output_index, in_buffer[input_index]);
-              */
+    int shed_beam = degrade_should_shed_beam(&ctx->degrade, beam);
 
-          // increment the input_data index
-          input_index = input_index + 1;
-        }
-      }
-    }
+    // Through the stages of this beam's pipeline (see pipeline.c), e.g. stats, normalise, checksum, write, stats files
+    pipeline_block_s block = {.client = client,
+                              .ctx = ctx,
+                              .log = log,
+                              .beam = beam,
+                              .second = ctx->obs_marker_number,
+                              .ntimesteps = ctx->beams[beam].ntimesteps,
+                              .nvalues = ctx->beams[beam].nchan * ctx->npol,
+                              .bytes = out_buffer_bytes,
+                              .data = in_buffer,
+                              .shed = shed_beam,
+                              .stage_start_ns = io_start_ns};
 
-    // Create the fil block for this beam
-    //printf("\n\nnbit: %d ntimesteps: %lu nchan: %lu npol: %d out_buffer_bytes: %lu\n\n", ctx->nbit/8, ctx->beams[beam].ntimesteps, ctx->beams[beam].nchan, ctx->npol, out_buffer_bytes);
-    if (create_fil_block(client, &(ctx->beams[beam].out_filfile_ptr), ctx->nbit / 8, ctx->beams[beam].ntimesteps,
-                         ctx->beams[beam].nchan, ctx->npol, (float *)buffer, out_buffer_bytes))
+    if (pipeline_run(&ctx->beams[beam].pipeline, &block) != EXIT_SUCCESS)
     {
       // Error!
+      asynclog_flush();
       multilog(log, LOG_ERR, "dada_dbfil_io(): Error Writing into new fil block (beam %d).\n", beam + 1);
+      metrics_add_dropped(bytes);
       return -1;
     }
-    else
-    {
-      wrote = out_buffer_bytes;
-      written += wrote;
-
-      // If this beam is the last beam then increment the marker number
-      if (beam == ctx->nbeams_total - 1)
-        ctx->obs_marker_number += 1;
-
-      ctx->block_number += 1;
-      ctx->bytes_written += written;
 
-      if (ctx->stats_dir != NULL)
-      {
-        /* Make a new filename for the freq stats */
-        char output_spectrum_filename[PATH_MAX];
-        snprintf(output_spectrum_filename, PATH_MAX, "%s/%ld_ch%02d_%02d_%03d_spec.txt",
-                 ctx->stats_dir, ctx->obs_id, ctx->coarse_channel, beam + 1, ctx->obs_marker_number);
+    wrote = out_buffer_bytes;
+    written += wrote;
 
-        FILE *out_fs = fopen(output_spectrum_filename, "w");
-        for (int ch = 0; ch < ctx->beams[beam].nchan; ch++)
-        {
-          ctx->beams[beam].power_freq[ch] = ctx->beams[beam].power_freq[ch] / (double)ctx->beams[beam].ntimesteps;
+    // If this beam is the last beam then increment the marker number
+    if (beam == ctx->nbeams_total - 1)
+      ctx->obs_marker_number += 1;
 
-          fprintf(out_fs, "%d %f\n", ch, ctx->beams[beam].power_freq[ch]);
-        }
-        fclose(out_fs);
+    // How quickly we got going (this matters most after a restart part way through an observation)
+    if (ctx->block_number == 0)
+      asynclog_write(log, msg_io_first_block, ctx->obs_id, ctx->join_offset_sec, (latency_now_ns() - ctx->obs_start_ns) / 1000, 0);
 
-        /* Make a new filename for the time stats */
-        char output_time_filename[PATH_MAX];
-        snprintf(output_time_filename, PATH_MAX, "%s/%ld_ch%02d_%02d_%03d_time.txt",
-                 ctx->stats_dir, ctx->obs_id, ctx->coarse_channel, beam + 1, ctx->obs_marker_number);
+    ctx->block_number += 1;
+    ctx->bytes_written += written;
 
-        FILE *out_ft = fopen(output_time_filename, "w");
-        for (long t = 0; t < ctx->beams[beam].ntimesteps; t++)
-        {
-          ctx->beams[beam].power_time[t] = ctx->beams[beam].power_time[t] / (double)ctx->beams[beam].nchan;
+    if (!shed_beam)
+      metrics_add_beam_bytes(beam, written);
+    metrics_set_marker(ctx->obs_marker_number);
 
-          fprintf(out_ft, "%ld %f\n", t, ctx->beams[beam].power_time[t]);
-        }
-        fclose(out_ft);
+    degrade_record_io_cost(&ctx->degrade, record_stage_latency(ctx, beam, stage_io, io_start_ns) - io_start_ns);
 
-        multilog(log, LOG_INFO, "dada_dbfil_io(): wrote out spectrum (%s) and time (%s) statistics.", output_spectrum_filename, output_time_filename);
-      }
-    }
+    // Were we asked (SIGUSR1) to dump the latency of the observation so far?
+    if (latency_dump_requested())
+      log_latency_summary(client, "SIGUSR1");
 
-    // Cleanup
-    free(ctx->beams[beam].power_freq);
-    free(ctx->beams[beam].power_time);
+    // Or (SIGUSR2) to dump the trace
+    if (trace_dump_requested())
+      dump_trace_on_request(log);
 
     return bytes;
   }
   else
+  {
+    // Not processing an observation (e.g. we skipped one which was in progress), so this block is not written out
+    metrics_add_dropped(bytes);
     return bytes;
+  }
 }
 
 /**
@@ -488,7 +1128,7 @@ int64_t dada_dbfil_io_block(dada_client_t *client, void *buffer, uint64_t bytes,
 
   multilog_t *log = (multilog_t *)ctx->log;
 
-  multilog(log, LOG_INFO, "dada_dbfil_io_block(): Processing block id %llu\n", block_id);
+  asynclog_write(log, msg_io_block, block_id, 0, 0, 0);
 
   return dada_dbfil_io(client, buffer, bytes);
 }
@@ -506,6 +1146,9 @@ int dada_dbfil_close(dada_client_t *client, uint64_t bytes_written)
   dada_db_s *ctx = (dada_db_s *)client->context;
 
   multilog_t *log = (multilog_t *)client->log;
+
+  // Let the io messages of this sub observation out first
+  asynclog_flush();
   multilog(log, LOG_INFO, "dada_dbfil_close(bytes_written=%lu): Started.\n", bytes_written);
 
   int do_close_file = 0;
@@ -527,9 +1170,10 @@ int dada_dbfil_close(dada_client_t *client, uint64_t bytes_written)
     }
     else
     {
-      // We hit the end of the ring buffer, but we shouldn't have. Put out a warning
-      multilog(log, LOG_ERR, "dada_dbfil_close(): We hit the end of the ring buffer, but we shouldn't have! EXPOSURE_SEC=%d but this block OBS_OFFSET=%d and ends at %d sec.\n", ctx->exposure_sec, ctx->obs_offset, ctx->obs_marker_number);
-      exit(-1);
+      // We hit the end of the ring buffer, but we shouldn't have. What was past the end of the observation was not
+      // written (see dada_dbfil_io()), so end the observation here rather than lose what is still in the ringbuffer
+      multilog(log, LOG_ERR, "dada_dbfil_close(): We hit the end of the ring buffer, but we shouldn't have! EXPOSURE_SEC=%d but this block OBS_OFFSET=%d and ends at %d sec. Ending the observation.\n", ctx->exposure_sec, ctx->obs_offset, ctx->obs_marker_number);
+      do_close_file = 1;
     }
   }
   else if (is_mwax_mode_quit(ctx->mode) == 1)
@@ -539,26 +1183,73 @@ int dada_dbfil_close(dada_client_t *client, uint64_t bytes_written)
 
   if (do_close_file == 1)
   {
+    if (ctx->obs_id != 0)
+    {
+      log_latency_summary(client, "end of observation");
+      perf_counters_log_summary(log, &ctx->perf);
+      log_degrade_summary(client);
+    }
+
     // Observation ends NOW! It got cut short, or we naturally are at the end of the observation
     // Close existing fil files (if we have any)
     for (int beam = 0; beam < ctx->nbeams_total; beam++)
     {
-      if (&(ctx->beams[beam].out_filfile_ptr) != NULL)
+      for (int subband = 0; subband < ctx->beams[beam].noutputs; subband++)
       {
-        multilog(log, LOG_INFO, "dada_dbfil_close(): Closing %s...\n", ctx->beams[beam].fil_filename);
+        multilog(log, LOG_INFO, "dada_dbfil_close(): Closing %s...\n", ctx->beams[beam].outputs[subband].fil_filename);
+
+        uint64_t close_start_ns = latency_now_ns();
+
+        close_fil(client, beam, subband);
 
-        close_fil(client, &(ctx->beams[beam].out_filfile_ptr), beam);
+        trace_span("close_fil", "file", close_start_ns, "beam", beam + 1);
 
         /* File is closed- reset the pointer to null */
-        ctx->beams[beam].out_filfile_ptr.m_File = NULL;
+        ctx->beams[beam].outputs[subband].out_filfile_ptr.m_File = NULL;
       }
     }
 
+    if (ctx->container.file != NULL)
+    {
+      multilog(log, LOG_INFO, "dada_dbfil_close(): Closing %s...\n", ctx->container_filename);
+
+      uint64_t close_start_ns = latency_now_ns();
+
+      close_container(client);
+
+      trace_span("close_container", "file", close_start_ns, "beams", ctx->nbeams_total);
+    }
+
+    if (ctx->wideband_mode)
+      wideband_close(log, ctx);
+
+    if (ctx->quicklook_rows > 0)
+      quicklook_close(log, ctx);
+
+    close_gaps_file(ctx);
+
+    // And the earlier segments of this ring still being closed in the background
+    segment_closer_drain(&ctx->segments_closing);
+
+    // Write out the timeline of this observation
+    if (ctx->obs_id != 0 && trace_enabled())
+    {
+      char trace_label[64];
+      snprintf(trace_label, sizeof(trace_label), "%ld_ch%02d", ctx->obs_id, ctx->coarse_channel);
+      trace_dump(log, trace_label, ctx->obs_start_ns);
+    }
+
     // Now reset the obs_id/sub_obs_id variables
     multilog(log, LOG_INFO, "dada_dbfil_close(): resetting global obs_id to 0.\n");
     ctx->obs_id = 0;
     ctx->subobs_id = 0;
     ctx->obs_marker_number = 0;
+
+    for (int beam = 0; beam < ctx->nbeams_total; beam++)
+      bandpass_free(&ctx->beams[beam].bandpass);
+
+    metrics_set_observation(0, 0, 0);
+    metrics_set_marker(0);
   }
 
   multilog(log, LOG_INFO, "dada_dbfil_close(): completed\n");
@@ -581,6 +1272,18 @@ int read_dada_header(dada_client_t *client)
   assert(ctx->log != 0);
   multilog_t *log = (multilog_t *)ctx->log;
 
+  // The previous observation's beams are about to go, with their channels, fil outputs and bandpass (the bandpass is normally
+  // freed at the end of the observation, but not if it was cut short by a new one)
+  if (ctx->beams != 0)
+  {
+    for (int beam = 0; beam < ctx->nbeams_total; beam++)
+    {
+      free(ctx->beams[beam].channels);
+      bandpass_free(&ctx->beams[beam].bandpass);
+      free(ctx->beams[beam].outputs);
+    }
+  }
+
   strncpy(ctx->utc_start, "", UTC_START_LEN);
   ctx->nbit = 0;
   ctx->npol = 0;
@@ -701,8 +1404,8 @@ int read_dada_header(dada_client_t *client)
   if (ctx->beams != 0)
     free(ctx->beams);
 
-  // Allocate beams
-  ctx->beams = malloc(ctx->nbeams_total * sizeof(beam_s));
+  // Allocate beams (zeroed, as the fil file and channel pointers are checked before use)
+  ctx->beams = calloc(ctx->nbeams_total, sizeof(beam_s));
 
   ctx->expected_transfer_size = 0;
 
@@ -759,9 +1462,6 @@ int read_dada_header(dada_client_t *client)
   // allocate space for the fine channel frequencies for each beam
   for (int beam = 0; beam < ctx->nbeams_incoherent; beam++)
   {
-    if (ctx->beams[beam].channels != 0)
-      free(ctx->beams[beam].channels);
-
     ctx->beams[beam].channels = calloc(ctx->beams[beam].nchan, sizeof(double));
 
     int fine_chan_width_hz = ctx->bandwidth_hz / ctx->beams[beam].nchan;
@@ -8,11 +8,26 @@
 #pragma once
 
 #include "dada_client.h"
+#include "global.h"
 
 // function prototypes
+dada_db_s *create_reader_context(const dada_db_s *template_ctx);
+void destroy_reader_context(dada_db_s *ctx);
 int dada_dbfil_open(dada_client_t *client);
 int dada_dbfil_close(dada_client_t *client, uint64_t bytes_written);
 int64_t dada_dbfil_io(dada_client_t *client, void *buffer, uint64_t bytes);
 int64_t dada_dbfil_io_block(dada_client_t *client, void *buffer, uint64_t bytes, uint64_t block_id);
 int read_dada_header(dada_client_t *client);
-int process_new_observation(dada_client_t *client, long new_obs_id, long new_subobs_id);
\ No newline at end of file
+int process_new_observation(dada_client_t *client, long new_obs_id, long new_subobs_id);
+void make_fil_filename(dada_db_s *ctx, int beam, int subband);
+void make_container_filename(dada_db_s *ctx);
+void make_quicklook_filename(dada_db_s *ctx, int beam, char *filename);
+void make_wideband_filename(dada_db_s *ctx, int beam, int first_coarse_channel, int last_coarse_channel, int start_sec, char *filename);
+int next_fil_segment(dada_client_t *client, int beam);
+int fill_gap(dada_client_t *client, int end_second);
+void close_gaps_file(dada_db_s *ctx);
+void record_stage_duration(dada_db_s *ctx, int beam, latency_stage_enum stage, uint64_t duration_ns);
+uint64_t record_stage_latency(dada_db_s *ctx, int beam, latency_stage_enum stage, uint64_t stage_start_ns);
+void log_latency_summary(dada_client_t *client, const char *reason);
+void dump_trace_on_request(multilog_t *log);
+void log_degrade_summary(dada_client_t *client);
\ No newline at end of file
@@ -0,0 +1,248 @@
+/**
+ * @file degrade.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that sheds optional work when we fall behind the ringbuffer
+ *
+ * Before each beam second dada_dbfil_io() calls degrade_update(), which looks at how full the ringbuffer is and
+ * at the recent cost of a beam second against its real time budget (1 sec / nbeams). If we stay under pressure
+ * for DEGRADE_ESCALATE_SECONDS the next level of work is shed (stats, then extra products such as the quick-look
+ * pyramid, then low priority beams). Once the backlog has stayed clear for DEGRADE_RESTORE_SECONDS one level is
+ * restored. Every change is logged and counted. A shed beam second is not written; the fil file position is moved
+ * past it, so it reads back as zeros and every later sample stays at its correct time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "degrade.h"
+#include "metrics.h"
+
+static const char *degrade_level_names[] = {"everything written", "stats shed", "stats and extra products shed"};
+
+/**
+ *
+ *  @brief Initialises the scheduler.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] high_fill Ring fill (fraction) at or above which we are under pressure.
+ *  @param[in] low_fill Ring fill (fraction) at or below which the backlog has cleared.
+ *  @param[in] beam_priorities Priority of each beam (index 0 = beam 1), lowest is shed first. NULL for none.
+ *  @param[in] beam_priority_count Number of priorities.
+ */
+void degrade_init(degrade_s *degrade, double high_fill, double low_fill, int *beam_priorities, int beam_priority_count)
+{
+    degrade->enabled = 1;
+    degrade->high_fill = high_fill;
+    degrade->low_fill = low_fill;
+    degrade->beam_priorities = beam_priorities;
+    degrade->beam_priority_count = beam_priority_count;
+    degrade->level = degrade_none;
+    degrade->max_level = degrade_shed_extras;
+}
+
+/**
+ *
+ *  @brief Returns the priority of a beam.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] beam Beam index.
+ *  @returns The priority of the beam.
+ */
+int degrade_beam_priority(degrade_s *degrade, int beam)
+{
+    if (degrade->beam_priorities != NULL && beam < degrade->beam_priority_count)
+        return degrade->beam_priorities[beam];
+
+    return DEGRADE_DEFAULT_BEAM_PRIORITY;
+}
+
+/**
+ *
+ *  @brief Works out the highest level for this observation's beams and resets the counts. The level itself is kept,
+ *         since if the disks were slow at the end of the last observation they will be at the start of this one.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] nbeams Number of beams in the observation.
+ */
+void degrade_new_observation(degrade_s *degrade, int nbeams)
+{
+    int min_priority = DEGRADE_DEFAULT_BEAM_PRIORITY;
+    int max_priority = DEGRADE_DEFAULT_BEAM_PRIORITY;
+
+    for (int beam = 0; beam < nbeams; beam++)
+    {
+        int priority = degrade_beam_priority(degrade, beam);
+
+        if (beam == 0 || priority < min_priority)
+            min_priority = priority;
+
+        if (beam == 0 || priority > max_priority)
+            max_priority = priority;
+    }
+
+    // Level 3+k sheds priority <= k; the highest priority beams are never shed, and we skip the levels which would
+    // not shed anything (below the lowest priority)
+    degrade->first_beam_level = degrade_shed_beams + min_priority;
+    degrade->max_level = (min_priority < max_priority) ? degrade_shed_extras + max_priority : degrade_shed_extras;
+
+    if (degrade->level > degrade->max_level || (degrade->level >= degrade_shed_beams && degrade->level < degrade->first_beam_level))
+        degrade->level = (degrade->level > degrade->max_level) ? degrade->max_level : degrade_shed_extras;
+
+    degrade->level_changes = 0;
+    degrade->stats_skipped = 0;
+    degrade->extras_skipped = 0;
+    degrade->max_level_reached = degrade->level;
+    degrade->pressure_calls = 0;
+    degrade->clear_calls = 0;
+
+    metrics_set_degrade_level(degrade->level);
+}
+
+/**
+ *
+ *  @brief Records the cost of the last beam second (exponentially weighted, 1/8 weight to the newest).
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] io_ns Nanoseconds the last beam second took.
+ */
+void degrade_record_io_cost(degrade_s *degrade, uint64_t io_ns)
+{
+    if (degrade->io_cost_ewma_ns == 0)
+        degrade->io_cost_ewma_ns = io_ns;
+    else
+        degrade->io_cost_ewma_ns = (degrade->io_cost_ewma_ns * 7 + io_ns) / 8;
+}
+
+/**
+ *
+ *  @brief Logs and counts a change of level.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] new_level The level we are changing to.
+ *  @param[in] cost_ratio io cost as a fraction of the real time budget.
+ *  @param[in] obs_marker Seconds into the observation.
+ */
+static void degrade_change_level(multilog_t *log, degrade_s *degrade, int new_level, double cost_ratio, int obs_marker)
+{
+    char description[64];
+
+    if (new_level < degrade_shed_beams)
+        snprintf(description, sizeof(description), "%s", degrade_level_names[new_level]);
+    else
+        snprintf(description, sizeof(description), "stats, extras and beams with priority <= %d shed", new_level - degrade_shed_beams);
+
+    multilog(log, new_level > degrade->level ? LOG_WARNING : LOG_INFO, "Degrade: ring %.0f%% full, io cost %.0f%% of budget at marker %d: level %d -> %d (%s).\n",
+             degrade->last_fill * 100.0, cost_ratio * 100.0, obs_marker, degrade->level, new_level, description);
+
+    degrade->level = new_level;
+    degrade->level_changes++;
+    degrade->pressure_calls = 0;
+    degrade->clear_calls = 0;
+
+    if (new_level > degrade->max_level_reached)
+        degrade->max_level_reached = new_level;
+
+    metrics_set_degrade_level(new_level);
+    metrics_add_degrade_change();
+}
+
+/**
+ *
+ *  @brief Called before each beam second. Decides if we need to shed (or can restore) a level.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] data_block The ringbuffer we are reading (NULL when replaying files).
+ *  @param[in] nbeams Number of beams (a second of data is nbeams io calls).
+ *  @param[in] obs_marker Seconds into the observation (for the log).
+ */
+void degrade_update(multilog_t *log, degrade_s *degrade, ipcbuf_t *data_block, int nbeams, int obs_marker)
+{
+    if (!degrade->enabled || nbeams < 1)
+        return;
+
+    // How full is the ring?
+    double fill = 0;
+
+    if (data_block != NULL)
+    {
+        uint64_t nbufs = ipcbuf_get_nbufs(data_block);
+
+        if (nbufs > 0)
+            fill = (double)ipcbuf_get_nfull_iread(data_block, 0) / nbufs;
+    }
+
+    degrade->last_fill = fill;
+
+    // How expensive is a beam second compared to its real time budget?
+    double cost_ratio = degrade->io_cost_ewma_ns / (1e9 / nbeams);
+
+    int pressure = (fill >= degrade->high_fill || cost_ratio >= DEGRADE_HIGH_COST);
+    int clear = (!pressure && fill <= degrade->low_fill && cost_ratio < DEGRADE_LOW_COST);
+
+    degrade->pressure_calls = pressure ? degrade->pressure_calls + 1 : 0;
+    degrade->clear_calls = clear ? degrade->clear_calls + 1 : 0;
+
+    if (degrade->pressure_calls >= DEGRADE_ESCALATE_SECONDS * nbeams && degrade->level < degrade->max_level)
+    {
+        int new_level = degrade->level + 1;
+
+        if (new_level == degrade_shed_beams)
+            new_level = degrade->first_beam_level;
+
+        degrade_change_level(log, degrade, new_level, cost_ratio, obs_marker);
+    }
+    else if (degrade->clear_calls >= DEGRADE_RESTORE_SECONDS * nbeams && degrade->level > degrade_none)
+    {
+        int new_level = degrade->level - 1;
+
+        if (new_level < degrade->first_beam_level && new_level >= degrade_shed_beams)
+            new_level = degrade_shed_extras;
+
+        degrade_change_level(log, degrade, new_level, cost_ratio, obs_marker);
+    }
+}
+
+/**
+ *
+ *  @brief Returns whether stats should be skipped.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @returns 1 to skip stats, 0 otherwise.
+ */
+int degrade_should_shed_stats(degrade_s *degrade)
+{
+    return degrade->level >= degrade_shed_stats;
+}
+
+/**
+ *
+ *  @brief Returns whether extra products should be skipped.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @returns 1 to skip extra products, 0 otherwise.
+ */
+int degrade_should_shed_extras(degrade_s *degrade)
+{
+    return degrade->level >= degrade_shed_extras;
+}
+
+/**
+ *
+ *  @brief Returns whether a beam second of this beam should be skipped.
+ *  @param[in] degrade Pointer to the scheduler.
+ *  @param[in] beam Beam index.
+ *  @returns 1 to skip this beam, 0 otherwise.
+ */
+int degrade_should_shed_beam(degrade_s *degrade, int beam)
+{
+    return degrade->level >= degrade_shed_beams && degrade_beam_priority(degrade, beam) <= degrade->level - degrade_shed_beams;
+}
+
+/**
+ *
+ *  @brief Logs what was shed during the observation.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] degrade Pointer to the scheduler.
+ */
+void degrade_log_summary(multilog_t *log, degrade_s *degrade)
+{
+    if (!degrade->enabled)
+        return;
+
+    multilog(log, degrade->max_level_reached > degrade_none ? LOG_WARNING : LOG_INFO, "Degrade: %lu level changes this observation, highest level %d, %lu beam seconds of stats and %lu of extra products skipped, now at level %d.\n",
+             degrade->level_changes, degrade->max_level_reached, degrade->stats_skipped, degrade->extras_skipped, degrade->level);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file degrade.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that sheds optional work when we fall behind the ringbuffer
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "dada_client.h"
+#include "multilog.h"
+
+// Levels are cumulative: each one sheds everything the levels below it shed
+typedef enum degrade_level_enum
+{
+    degrade_none = 0,        // Everything is written
+    degrade_shed_stats = 1,  // No stats (spectrum/time files)
+    degrade_shed_extras = 2, // No extra products (the quick-look pyramid)
+    degrade_shed_beams = 3   // Level 3+k also sheds beams with priority <= k (never the highest priority beams)
+} degrade_level_enum;
+
+#define DEGRADE_DEFAULT_HIGH_FILL 0.5   // Ring fill (fraction) at or above which we are under pressure
+#define DEGRADE_DEFAULT_LOW_FILL 0.2    // Ring fill (fraction) at or below which the backlog has cleared
+#define DEGRADE_HIGH_COST 0.9           // io cost (fraction of the real time budget of a beam second) which is pressure
+#define DEGRADE_LOW_COST 0.7            // io cost below which the backlog can clear
+#define DEGRADE_ESCALATE_SECONDS 2      // Seconds of pressure before shedding the next level
+#define DEGRADE_RESTORE_SECONDS 10      // Seconds of clear before restoring a level
+#define DEGRADE_DEFAULT_BEAM_PRIORITY 1 // Beams with no priority given
+
+typedef struct degrade_s
+{
+    int enabled;
+    double high_fill;
+    double low_fill;
+    int *beam_priorities; // per beam (index 0 = beam 1), NULL if none given
+    int beam_priority_count;
+
+    int level;
+    int max_level;       // highest level which sheds something for this observation
+    int first_beam_level; // lowest level which sheds a beam for this observation (if max_level >= degrade_shed_beams)
+    uint64_t io_cost_ewma_ns;
+    double last_fill;
+    int pressure_calls; // consecutive io calls under pressure
+    int clear_calls;    // consecutive io calls with the backlog clear
+
+    // Counts for this observation (the process totals are in g_metrics)
+    uint64_t level_changes;
+    uint64_t stats_skipped;
+    uint64_t extras_skipped;
+    int max_level_reached;
+} degrade_s;
+
+void degrade_init(degrade_s *degrade, double high_fill, double low_fill, int *beam_priorities, int beam_priority_count);
+void degrade_new_observation(degrade_s *degrade, int nbeams);
+void degrade_update(multilog_t *log, degrade_s *degrade, ipcbuf_t *data_block, int nbeams, int obs_marker);
+void degrade_record_io_cost(degrade_s *degrade, uint64_t io_ns);
+int degrade_beam_priority(degrade_s *degrade, int beam);
+int degrade_should_shed_stats(degrade_s *degrade);
+int degrade_should_shed_extras(degrade_s *degrade);
+int degrade_should_shed_beam(degrade_s *degrade, int beam);
+void degrade_log_summary(multilog_t *log, degrade_s *degrade);
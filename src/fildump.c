@@ -0,0 +1,175 @@
+/**
+ * @file fildump.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief Dumps the header of a fil file field by field, plus a digest of its data
+ *
+ * The output is one "key value" pair per line and is used by scripts/golden_test.sh
+ * to compare output products against committed golden digests.
+ */
+#include <getopt.h>
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filfile.h"
+#include "version.h"
+
+#define FILDUMP_READ_SIZE (4 * 1024 * 1024) // Bytes of data read at a time
+#define FNV1A64_OFFSET 0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+
+/**
+ *
+ *  @brief Adds bytes to a running FNV-1a 64 bit hash.
+ *  @param[in] hash The hash so far.
+ *  @param[in] data Bytes to add.
+ *  @param[in] len Number of bytes to add.
+ *  @returns The updated hash.
+ */
+uint64_t fnv1a64(uint64_t hash, const unsigned char *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= data[i];
+    hash *= FNV1A64_PRIME;
+  }
+
+  return hash;
+}
+
+/**
+ *
+ *  @brief Provides the user with the summary of usage/help.
+ */
+void fildump_print_usage()
+{
+  printf("mwax_fildump v%d.%d.%d\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  printf("\nUsage: mwax_fildump [OPTION]... FILE\n\n");
+  printf("Prints the header fields of a fil file and a digest of its data.\n\n");
+  printf("  -r --round=N   Digest 32 bit data rounded to N significant digits (tolerant of\n");
+  printf("                 float reordering) instead of the exact bytes\n");
+  printf("  -? --help      This help text\n");
+}
+
+/**
+ *
+ *  @brief This is main for mwax_fildump.
+ *  @param[in] argc Count of arguments passed in from command line.
+ *  @param[in] argv Array of arguments passed in from command line.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the file could not be read.
+ */
+int main(int argc, char *argv[])
+{
+  int round_digits = 0;
+
+  static const struct option longOpts[] =
+      {
+          {"round", required_argument, NULL, 'r'},
+          {"help", no_argument, NULL, '?'},
+          {NULL, no_argument, NULL, 0}};
+
+  int opt = 0;
+
+  while ((opt = getopt_long(argc, argv, "r:?", longOpts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'r':
+      round_digits = atoi(optarg);
+      break;
+    default:
+      fildump_print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    fildump_print_usage();
+    return EXIT_FAILURE;
+  }
+
+  FILE *file = fopen(argv[optind], "rb");
+
+  if (file == NULL)
+  {
+    fprintf(stderr, "Error: could not open %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  cFilFileHeader header;
+  long header_bytes = 0;
+
+  if (CFilFile_ReadHeader(file, &header, &header_bytes) != EXIT_SUCCESS)
+  {
+    fprintf(stderr, "Error: %s does not have a valid fil header\n", argv[optind]);
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  printf("telescope_id %d\n", header.telescope_id);
+  printf("machine_id %d\n", header.machine_id);
+  printf("data_type %d\n", header.data_type);
+  printf("rawdatafile %s\n", header.rawdatafile);
+  printf("source_name %s\n", header.source_name);
+  printf("barycentric %d\n", header.barycentric);
+  printf("pulsarcentric %d\n", header.pulsarcentric);
+  printf("az_start %.17g\n", header.az_start);
+  printf("za_start %.17g\n", header.za_start);
+  printf("src_raj %.17g\n", header.src_raj);
+  printf("src_dej %.17g\n", header.src_dej);
+  printf("tstart %.17g\n", header.tstart);
+  printf("tsamp %.17g\n", header.tsamp);
+  printf("nbits %d\n", header.nbits);
+  printf("nsamples %d\n", header.nsamples);
+  printf("fch1 %.17g\n", header.fch1);
+  printf("foff %.17g\n", header.foff);
+  printf("nchans %ld\n", header.nchans);
+  printf("nifs %d\n", header.nifs);
+  printf("nbeams %d\n", header.nbeams);
+  printf("ibeam %d\n", header.ibeam);
+  printf("header_bytes %ld\n", header_bytes);
+
+  // Digest the data
+  unsigned char *buffer = malloc(FILDUMP_READ_SIZE);
+  uint64_t hash = FNV1A64_OFFSET;
+  uint64_t data_bytes = 0;
+  size_t bytes_read = 0;
+
+  while ((bytes_read = fread(buffer, 1, FILDUMP_READ_SIZE, file)) > 0)
+  {
+    if (round_digits > 0 && header.nbits == 32)
+    {
+      // Hash the rounded text of each sample so small float differences are tolerated
+      float *samples = (float *)buffer;
+      char text[64];
+
+      for (size_t s = 0; s < bytes_read / sizeof(float); s++)
+      {
+        int len = snprintf(text, sizeof(text), "%.*g", round_digits, samples[s]);
+        hash = fnv1a64(hash, (unsigned char *)text, len + 1);
+      }
+    }
+    else
+    {
+      hash = fnv1a64(hash, buffer, bytes_read);
+    }
+
+    data_bytes += bytes_read;
+  }
+
+  printf("data_bytes %lu\n", data_bytes);
+
+  if (round_digits > 0 && header.nbits == 32)
+    printf("data_fnv1a64_round%d %016lx\n", round_digits, hash);
+  else
+    printf("data_fnv1a64 %016lx\n", hash);
+
+  free(buffer);
+  fclose(file);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,349 @@
+/**
+ * @file filextract.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief Extracts beams from the multi-beam containers (.mfil) written by mwax_beamdb2fil --container
+ *
+ * Each selected beam of FILE is written as a normal fil file: its fil header (stored in the container), then its beam
+ * seconds in time order, found through the index at the end of the container. Only the header, beam table, index and
+ * the beam's own blocks are read, so extracting one beam does not read the others. Beam seconds which were shed (or
+ * are missing) are written as zeros, and every block is checked against its CRC32C if the container has them.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "crc32c.h"
+#include "version.h"
+
+/**
+ *
+ *  @brief Provides the user with the summary of usage/help.
+ */
+void filextract_print_usage()
+{
+  printf("mwax_filextract v%d.%d.%d\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  printf("\nUsage: mwax_filextract [OPTION]... FILE\n\n");
+  printf("Writes beams of the multi-beam container FILE (%s) as fil files NAME_BB.fil.\n\n", CONTAINER_EXTENSION);
+  printf("  -b --beam=N          Extract beam N (1 based, can be given more than once; default: all beams)\n");
+  printf("  -o --output-dir=DIR  Write the fil files to DIR (default: the directory of FILE)\n");
+  printf("  -l --list            Only list the beams in FILE\n");
+  printf("  -? --help            This help text\n");
+}
+
+/**
+ *
+ *  @brief Orders index entries by beam second (for qsort).
+ *  @param[in] a An index entry.
+ *  @param[in] b Another index entry.
+ *  @returns <0, 0 or >0 as a is before, at or after b.
+ */
+int compare_seconds(const void *a, const void *b)
+{
+  const container_index_entry_s *entry_a = (const container_index_entry_s *)a;
+  const container_index_entry_s *entry_b = (const container_index_entry_s *)b;
+
+  return (entry_a->second > entry_b->second) - (entry_a->second < entry_b->second);
+}
+
+/**
+ *
+ *  @brief Writes one beam of the container as a fil file.
+ *  @param[in] fd The container.
+ *  @param[in] header Its header.
+ *  @param[in] beam_info The beam.
+ *  @param[in] beam The beam index.
+ *  @param[in] index The index of the container.
+ *  @param[in] out_filename Where to write the fil file.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error (or a block failed its CRC32C).
+ */
+int extract_beam(int fd, const container_header_s *header, const container_beam_s *beam_info, int beam, const container_index_entry_s *index, const char *out_filename)
+{
+  container_index_entry_s *entries = malloc((header->index_entries + 1) * sizeof(container_index_entry_s));
+  unsigned char *buffer = malloc(beam_info->header_bytes > beam_info->bytes_per_second ? beam_info->header_bytes : beam_info->bytes_per_second);
+  FILE *out = fopen(out_filename, "wb");
+
+  if (entries == NULL || buffer == NULL || out == NULL)
+  {
+    fprintf(stderr, "Error: could not create %s (%s)\n", out_filename, strerror(errno));
+    free(entries);
+    free(buffer);
+    if (out != NULL)
+      fclose(out);
+    return EXIT_FAILURE;
+  }
+
+  // This beam's blocks, in time order
+  uint64_t nentries = 0;
+
+  for (uint64_t i = 0; i < header->index_entries; i++)
+  {
+    if (index[i].beam == (uint32_t)beam)
+      entries[nentries++] = index[i];
+  }
+
+  qsort(entries, nentries, sizeof(container_index_entry_s), compare_seconds);
+
+  int result = EXIT_SUCCESS;
+  uint64_t bad_blocks = 0;
+  uint64_t zero_blocks = 0;
+
+  // The fil header, as it was written
+  if (pread(fd, buffer, beam_info->header_bytes, beam_info->header_offset) != (ssize_t)beam_info->header_bytes ||
+      fwrite(buffer, 1, beam_info->header_bytes, out) != beam_info->header_bytes)
+  {
+    fprintf(stderr, "Error: could not copy the header of beam %d to %s (%s)\n", beam + 1, out_filename, strerror(errno));
+    result = EXIT_FAILURE;
+  }
+
+  // Then each beam second (from the first in the container). Any which are missing (shed, or gaps) are zeros, so the
+  // time of every sample is kept
+  uint32_t next_second = header->first_second;
+
+  for (uint64_t e = 0; e < nentries && result == EXIT_SUCCESS; e++)
+  {
+    container_index_entry_s *entry = &entries[e];
+
+    if (entry->bytes != beam_info->bytes_per_second || entry->second < next_second)
+    {
+      fprintf(stderr, "Error: beam %d second %u in the index is not valid\n", beam + 1, entry->second);
+      result = EXIT_FAILURE;
+      break;
+    }
+
+    memset(buffer, 0, beam_info->bytes_per_second);
+
+    for (; next_second < entry->second && result == EXIT_SUCCESS; next_second++)
+    {
+      if (fwrite(buffer, 1, beam_info->bytes_per_second, out) != beam_info->bytes_per_second)
+        result = EXIT_FAILURE;
+
+      zero_blocks++;
+    }
+
+    if (entry->flags & (CONTAINER_BLOCK_SHED | CONTAINER_BLOCK_GAP))
+    {
+      zero_blocks++;
+    }
+    else if (pread(fd, buffer, entry->bytes, entry->offset) != (ssize_t)entry->bytes)
+    {
+      fprintf(stderr, "Error: beam %d second %u (offset %" PRIu64 ") is past the end of the container\n", beam + 1, entry->second, entry->offset);
+      result = EXIT_FAILURE;
+      break;
+    }
+    else if ((header->flags & CONTAINER_FLAG_CHECKSUMS) && crc32c(0, buffer, entry->bytes) != entry->crc32c)
+    {
+      fprintf(stderr, "Error: beam %d second %u (offset %" PRIu64 ") does not match its crc32c %08x\n", beam + 1, entry->second, entry->offset, entry->crc32c);
+      bad_blocks++;
+    }
+
+    if (result == EXIT_SUCCESS && fwrite(buffer, 1, entry->bytes, out) != entry->bytes)
+      result = EXIT_FAILURE;
+
+    next_second = entry->second + 1;
+  }
+
+  if (fclose(out) != 0)
+    result = EXIT_FAILURE;
+
+  if (result != EXIT_SUCCESS)
+    fprintf(stderr, "Error: could not write %s (%s)\n", out_filename, strerror(errno));
+  else if (bad_blocks > 0)
+    result = EXIT_FAILURE;
+
+  printf("%s %s beam %d %u seconds (%lu zero) %s\n", result == EXIT_SUCCESS ? "OK" : "FAILED", out_filename, beam + 1,
+         next_second - header->first_second, zero_blocks, bad_blocks > 0 ? "CRC32C MISMATCH" : "");
+
+  free(entries);
+  free(buffer);
+
+  return result;
+}
+
+/**
+ *
+ *  @brief This is main for mwax_filextract.
+ *  @param[in] argc Count of arguments passed in from command line.
+ *  @param[in] argv Array of arguments passed in from command line.
+ *  @returns EXIT_SUCCESS if every selected beam was extracted and matched its checksums, otherwise EXIT_FAILURE.
+ */
+int main(int argc, char *argv[])
+{
+  const char *output_dir = NULL;
+  int list_only = 0;
+  int *beams = calloc(argc, sizeof(int));
+  int beam_count = 0;
+
+  static const struct option longOpts[] =
+      {
+          {"beam", required_argument, NULL, 'b'},
+          {"output-dir", required_argument, NULL, 'o'},
+          {"list", no_argument, NULL, 'l'},
+          {"help", no_argument, NULL, '?'},
+          {NULL, no_argument, NULL, 0}};
+
+  int opt = 0;
+
+  while ((opt = getopt_long(argc, argv, "b:o:l?", longOpts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      beams[beam_count++] = atoi(optarg);
+      break;
+
+    case 'o':
+      output_dir = optarg;
+      break;
+
+    case 'l':
+      list_only = 1;
+      break;
+
+    default:
+      filextract_print_usage();
+      free(beams);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    filextract_print_usage();
+    free(beams);
+    return EXIT_FAILURE;
+  }
+
+  const char *filename = argv[optind];
+  int fd = open(filename, O_RDONLY);
+
+  if (fd == -1)
+  {
+    fprintf(stderr, "Error: could not open %s (%s)\n", filename, strerror(errno));
+    free(beams);
+    return EXIT_FAILURE;
+  }
+
+  container_header_s header;
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CONTAINER_VERSION || header.nbeams == 0)
+  {
+    fprintf(stderr, "Error: %s is not a version %d multi-beam container\n", filename, CONTAINER_VERSION);
+    close(fd);
+    free(beams);
+    return EXIT_FAILURE;
+  }
+
+  if (header.index_offset == 0)
+  {
+    fprintf(stderr, "Error: %s has no index (it was not closed)\n", filename);
+    close(fd);
+    free(beams);
+    return EXIT_FAILURE;
+  }
+
+  container_beam_s *beam_table = calloc(header.nbeams, sizeof(container_beam_s));
+  container_index_entry_s *index = malloc((header.index_entries + 1) * sizeof(container_index_entry_s));
+  ssize_t beam_table_bytes = header.nbeams * sizeof(container_beam_s);
+  ssize_t index_bytes = header.index_entries * sizeof(container_index_entry_s);
+
+  if (beam_table == NULL || index == NULL || pread(fd, beam_table, beam_table_bytes, sizeof(header)) != beam_table_bytes ||
+      pread(fd, index, index_bytes, header.index_offset) != index_bytes)
+  {
+    fprintf(stderr, "Error: could not read the beam table and index of %s\n", filename);
+    close(fd);
+    free(beam_table);
+    free(index);
+    free(beams);
+    return EXIT_FAILURE;
+  }
+
+  printf("%s: obs %" PRId64 ", %u beams, %" PRIu64 " beam seconds from second %u%s\n", filename, header.obs_id, header.nbeams,
+         header.index_entries, header.first_second, (header.flags & CONTAINER_FLAG_CHECKSUMS) ? ", crc32c" : "");
+
+  if (list_only)
+  {
+    for (uint32_t b = 0; b < header.nbeams; b++)
+    {
+      uint64_t seconds = 0;
+      uint64_t shed = 0;
+      uint64_t gaps = 0;
+
+      for (uint64_t i = 0; i < header.index_entries; i++)
+      {
+        if (index[i].beam == b)
+        {
+          seconds++;
+          shed += (index[i].flags & CONTAINER_BLOCK_SHED) ? 1 : 0;
+          gaps += (index[i].flags & CONTAINER_BLOCK_GAP) ? 1 : 0;
+        }
+      }
+
+      printf("beam %02u: %u channels, %u pols, %u time steps per sec, %" PRIu64 " seconds (%" PRIu64 " shed, %" PRIu64 " gaps)\n", b + 1,
+             beam_table[b].nchan, beam_table[b].npol, beam_table[b].ntimesteps, seconds, shed, gaps);
+    }
+
+    close(fd);
+    free(beam_table);
+    free(index);
+    free(beams);
+    return EXIT_SUCCESS;
+  }
+
+  // Output names: the container name without the extension, then _BB.fil (as the fil file of that beam would be named)
+  char base[PATH_MAX];
+  char filename_copy[PATH_MAX];
+  snprintf(filename_copy, sizeof(filename_copy), "%s", filename);
+
+  if (output_dir != NULL)
+    snprintf(base, sizeof(base), "%s/%s", output_dir, basename(filename_copy));
+  else
+    snprintf(base, sizeof(base), "%s", filename);
+
+  size_t base_len = strlen(base);
+  size_t extension_len = strlen(CONTAINER_EXTENSION);
+
+  if (base_len > extension_len && strcmp(&base[base_len - extension_len], CONTAINER_EXTENSION) == 0)
+    base[base_len - extension_len] = '\0';
+
+  if (beam_count == 0)
+  {
+    for (uint32_t b = 0; b < header.nbeams; b++)
+      beams[beam_count++] = b + 1;
+  }
+
+  int failed = 0;
+
+  for (int i = 0; i < beam_count; i++)
+  {
+    if (beams[i] < 1 || beams[i] > (int)header.nbeams)
+    {
+      fprintf(stderr, "Error: %s has no beam %d (it has beams 1 to %u)\n", filename, beams[i], header.nbeams);
+      failed = 1;
+      continue;
+    }
+
+    char out_filename[PATH_MAX + 16];
+    snprintf(out_filename, sizeof(out_filename), "%s_%02d.fil", base, beams[i]);
+
+    if (extract_beam(fd, &header, &beam_table[beams[i] - 1], beams[i] - 1, index, out_filename) != EXIT_SUCCESS)
+      failed = 1;
+  }
+
+  close(fd);
+  free(beam_table);
+  free(index);
+  free(beams);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
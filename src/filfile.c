@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "filfile.h"
+#include "filfiletypes.h"
 
 //
 // CFilFile
@@ -143,6 +144,119 @@ int CFilFile_WriteData(cFilFile *filfile_ptr, float *data_float, int n_floats)
     return ret;
 }
 
+// READING :
+int CFilFile_ReadString(FILE *file, char *value, int max_len)
+{
+    int len = 0;
+
+    if (fread(&len, sizeof(int), 1, file) != 1 || len <= 0 || len >= max_len)
+    {
+        return -1;
+    }
+
+    if (fread(value, 1, len, file) != (size_t)len)
+    {
+        return -1;
+    }
+
+    value[len] = '\0';
+
+    return len;
+}
+
+// Reads a header written by CFilFile_WriteHeader. Returns EXIT_SUCCESS and the size of the header in bytes
+// (i.e. the offset of the first data byte) or EXIT_FAILURE if the header is not valid.
+int CFilFile_ReadHeader(FILE *file, cFilFileHeader *filHeader, long *header_bytes)
+{
+    char keyword[PATH_MAX];
+
+    memset(filHeader, 0, sizeof(cFilFileHeader));
+    CFilFileHeader_Constructor(filHeader);
+
+    if (CFilFile_ReadString(file, keyword, PATH_MAX) < 0 || strcmp(keyword, "HEADER_START") != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    while (CFilFile_ReadString(file, keyword, PATH_MAX) >= 0)
+    {
+        if (strcmp(keyword, "HEADER_END") == 0)
+        {
+            *header_bytes = ftell(file);
+            return EXIT_SUCCESS;
+        }
+
+        // Find the keyword in our table
+        int key = 0;
+        while (key < FIL_HEADER_KEYWORD_COUNT && strcmp(keyword, gFilFileKeywordTypes[key].keyword) != 0)
+        {
+            key++;
+        }
+
+        if (key == FIL_HEADER_KEYWORD_COUNT)
+        {
+            printf("ERROR : unknown keyword %s in fil header\n", keyword);
+            return EXIT_FAILURE;
+        }
+
+        int iValue = 0;
+        double dValue = 0;
+        char szValue[PATH_MAX] = "";
+        size_t ret = 1;
+
+        switch (gFilFileKeywordTypes[key].type)
+        {
+        case eFilHdrInt:
+            ret = fread(&iValue, sizeof(iValue), 1, file);
+            break;
+        case eFilHdrDouble:
+            ret = fread(&dValue, sizeof(dValue), 1, file);
+            break;
+        case eFilHdrStr:
+            ret = (CFilFile_ReadString(file, szValue, PATH_MAX) >= 0);
+            break;
+        default:
+            break;
+        }
+
+        if (ret != 1)
+        {
+            printf("ERROR : could not read value of keyword %s in fil header\n", keyword);
+            return EXIT_FAILURE;
+        }
+
+        switch ((eFilHeaderKey)(key + 1))
+        {
+        case enum_telescope_id: filHeader->telescope_id = iValue; break;
+        case enum_machine_id: filHeader->machine_id = iValue; break;
+        case enum_data_type: filHeader->data_type = iValue; break;
+        case enum_rawdatafile: memcpy(filHeader->rawdatafile, szValue, PATH_MAX); break;
+        case enum_source_name: memcpy(filHeader->source_name, szValue, PATH_MAX); break;
+        case enum_barycentric: filHeader->barycentric = iValue; break;
+        case enum_pulsarcentric: filHeader->pulsarcentric = iValue; break;
+        case enum_az_start: filHeader->az_start = dValue; break;
+        case enum_za_start: filHeader->za_start = dValue; break;
+        case enum_src_raj: filHeader->src_raj = dValue; break;
+        case enum_src_dej: filHeader->src_dej = dValue; break;
+        case enum_tstart: filHeader->tstart = dValue; break;
+        case enum_tsamp: filHeader->tsamp = dValue; break;
+        case enum_nbits: filHeader->nbits = iValue; break;
+        case enum_nsamples: filHeader->nsamples = iValue; break;
+        case enum_fch1: filHeader->fch1 = dValue; break;
+        case enum_foff: filHeader->foff = dValue; break;
+        case enum_nchans: filHeader->nchans = iValue; break;
+        case enum_nifs: filHeader->nifs = iValue; break;
+        case enum_refdm: filHeader->refdm = dValue; break;
+        case enum_period: filHeader->period = dValue; break;
+        case enum_nbeams: filHeader->nbeams = iValue; break;
+        case enum_ibeam: filHeader->ibeam = iValue; break;
+        default: break;
+        }
+    }
+
+    return EXIT_FAILURE;
+}
+
 //
 // CFilFileHeader
 //
@@ -54,6 +54,10 @@ int CFilFile_WriteKeyword_string(cFilFile *filfile_ptr, const char *keyname, con
 // DATA :
 int CFilFile_WriteData(cFilFile *filfile_ptr, float *data_float, int n_channels);
 
+// READING :
+int CFilFile_ReadString(FILE *file, char *value, int max_len);
+int CFilFile_ReadHeader(FILE *file, cFilFileHeader *filHeader, long *header_bytes);
+
 //
 // CFilFileHeader
 //
@@ -46,3 +46,7 @@ typedef struct eFilKeyword
    const char* keyword;
    enum eFilHeaderType type;
 } eFilKeyword;
+
+// Table of keywords/types, indexed by eFilHeaderKey - 1 (see filfiletypes.c)
+#define FIL_HEADER_KEYWORD_COUNT 25
+extern eFilKeyword gFilFileKeywordTypes[];
@@ -0,0 +1,285 @@
+/**
+ * @file filverify.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief Verifies fil files against their CRC32C sidecars (written by mwax_beamdb2fil as each block was written)
+ *
+ * Each FILE is checked against FILE.crc32c, whose lines are "offset length crc32c" for every beam second. Files are
+ * verified in parallel (one thread per file, up to --jobs at a time). A block which does not match was corrupted
+ * after mwax_beamdb2fil wrote it (on disk or in transfer).
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "version.h"
+
+typedef struct filverify_file_s
+{
+  const char *filename;
+  int result; // EXIT_SUCCESS if every block matched
+  uint64_t blocks;
+  uint64_t bytes;
+  uint64_t bad_blocks;
+  char message[2 * PATH_MAX + 256]; // first problem found
+} filverify_file_s;
+
+typedef struct filverify_job_s
+{
+  filverify_file_s *files;
+  int file_count;
+  int next_file; // taken with an atomic increment by each thread
+} filverify_job_s;
+
+/**
+ *
+ *  @brief Provides the user with the summary of usage/help.
+ */
+void filverify_print_usage()
+{
+  printf("mwax_filverify v%d.%d.%d\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  printf("\nUsage: mwax_filverify [OPTION]... FILE...\n\n");
+  printf("Checks each block of each fil FILE against the CRC32C in FILE%s.\n\n", CRC32C_SIDECAR_EXTENSION);
+  printf("  -j --jobs=N    Verify up to N files at once (default: number of cpus)\n");
+  printf("  -? --help      This help text\n");
+}
+
+/**
+ *
+ *  @brief Verifies one fil file against its sidecar.
+ *  @param[in] file The file (the result fields are filled in).
+ */
+void verify_file(filverify_file_s *file)
+{
+  char sidecar_filename[PATH_MAX + sizeof(CRC32C_SIDECAR_EXTENSION)];
+  snprintf(sidecar_filename, sizeof(sidecar_filename), "%s%s", file->filename, CRC32C_SIDECAR_EXTENSION);
+
+  file->result = EXIT_FAILURE;
+
+  FILE *sidecar = fopen(sidecar_filename, "r");
+
+  if (sidecar == NULL)
+  {
+    snprintf(file->message, sizeof(file->message), "could not open %s (%s)", sidecar_filename, strerror(errno));
+    return;
+  }
+
+  int fd = open(file->filename, O_RDONLY);
+
+  if (fd == -1)
+  {
+    snprintf(file->message, sizeof(file->message), "could not open (%s)", strerror(errno));
+    fclose(sidecar);
+    return;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  unsigned char *buffer = NULL;
+  uint64_t buffer_bytes = 0;
+  char line[256];
+  int line_number = 0;
+  int failed = 0;
+
+  while (!failed && fgets(line, sizeof(line), sidecar) != NULL)
+  {
+    line_number++;
+
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    uint64_t offset, length;
+    uint32_t expected;
+
+    if (sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNx32, &offset, &length, &expected) != 3)
+    {
+      snprintf(file->message, sizeof(file->message), "line %d of %s is not valid", line_number, sidecar_filename);
+      failed = 1;
+      break;
+    }
+
+    // Every block written has data, so an empty one means the sidecar is damaged
+    if (length == 0)
+    {
+      snprintf(file->message, sizeof(file->message), "line %d of %s has a block of 0 bytes", line_number, sidecar_filename);
+      failed = 1;
+      break;
+    }
+
+    if (length > buffer_bytes)
+    {
+      free(buffer);
+      buffer = malloc(length);
+      buffer_bytes = length;
+
+      if (buffer == NULL)
+      {
+        snprintf(file->message, sizeof(file->message), "could not allocate %" PRIu64 " bytes", length);
+        failed = 1;
+        break;
+      }
+    }
+
+    ssize_t got = pread(fd, buffer, length, offset);
+
+    if (got != (ssize_t)length)
+    {
+      snprintf(file->message, sizeof(file->message), "block at offset %" PRIu64 " (%" PRIu64 " bytes) is past the end of the file", offset, length);
+      failed = 1;
+      break;
+    }
+
+    uint32_t actual = crc32c(0, buffer, length);
+
+    if (actual != expected)
+    {
+      if (file->bad_blocks == 0)
+        snprintf(file->message, sizeof(file->message), "block at offset %" PRIu64 " (%" PRIu64 " bytes) has crc32c %08x, expected %08x", offset, length, actual, expected);
+
+      file->bad_blocks++;
+    }
+
+    file->blocks++;
+    file->bytes += length;
+  }
+
+  if (!failed && file->blocks == 0)
+  {
+    snprintf(file->message, sizeof(file->message), "%s has no blocks", sidecar_filename);
+    failed = 1;
+  }
+
+  if (!failed && file->bad_blocks == 0)
+    file->result = EXIT_SUCCESS;
+
+  free(buffer);
+  close(fd);
+  fclose(sidecar);
+}
+
+/**
+ *
+ *  @brief A verify thread: takes the next file until there are none left.
+ *  @param[in] args Pointer to the filverify_job_s.
+ *  @returns NULL.
+ */
+void *verify_thread_fn(void *args)
+{
+  filverify_job_s *job = (filverify_job_s *)args;
+
+  for (;;)
+  {
+    int f = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED);
+
+    if (f >= job->file_count)
+      break;
+
+    verify_file(&job->files[f]);
+  }
+
+  return NULL;
+}
+
+/**
+ *
+ *  @brief This is main for mwax_filverify.
+ *  @param[in] argc Count of arguments passed in from command line.
+ *  @param[in] argv Array of arguments passed in from command line.
+ *  @returns EXIT_SUCCESS if every block of every file matches, otherwise EXIT_FAILURE.
+ */
+int main(int argc, char *argv[])
+{
+  int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  static const struct option longOpts[] =
+      {
+          {"jobs", required_argument, NULL, 'j'},
+          {"help", no_argument, NULL, '?'},
+          {NULL, no_argument, NULL, 0}};
+
+  int opt = 0;
+
+  while ((opt = getopt_long(argc, argv, "j:?", longOpts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+
+    default:
+      filverify_print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc)
+  {
+    filverify_print_usage();
+    return EXIT_FAILURE;
+  }
+
+  filverify_job_s job;
+  job.file_count = argc - optind;
+  job.files = calloc(job.file_count, sizeof(filverify_file_s));
+  job.next_file = 0;
+
+  for (int f = 0; f < job.file_count; f++)
+    job.files[f].filename = argv[optind + f];
+
+  if (jobs < 1)
+    jobs = 1;
+
+  if (jobs > job.file_count)
+    jobs = job.file_count;
+
+  pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+
+  for (int t = 0; t < jobs; t++)
+    pthread_create(&threads[t], NULL, verify_thread_fn, &job);
+
+  for (int t = 0; t < jobs; t++)
+    pthread_join(threads[t], NULL);
+
+  // Report in the order given
+  int failed = 0;
+  uint64_t total_bytes = 0;
+
+  for (int f = 0; f < job.file_count; f++)
+  {
+    filverify_file_s *file = &job.files[f];
+
+    if (file->result == EXIT_SUCCESS)
+    {
+      printf("OK %s %lu blocks %lu bytes\n", file->filename, file->blocks, file->bytes);
+    }
+    else
+    {
+      printf("FAILED %s: %s", file->filename, file->message);
+
+      if (file->bad_blocks > 0)
+        printf(" (%lu of %lu blocks bad)", file->bad_blocks, file->blocks);
+
+      printf("\n");
+      failed++;
+    }
+
+    total_bytes += file->bytes;
+  }
+
+  fprintf(stderr, "%d of %d files verified (%.1f MB, crc32c %s)\n", job.file_count - failed, job.file_count, total_bytes / 1048576.0, crc32c_implementation());
+
+  free(threads);
+  free(job.files);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -10,46 +10,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "global.h"
+#include "crc32c.h"
 #include "filfile.h"
 #include "filwriter.h"
+#include "metrics.h"
 #include "multilog.h"
+#include "notify.h"
 #include "util.h"
 
 /**
  *
- *  @brief Creates a blank new fil file called 'filename' and populates it with data from the psrdada header.
- *  @param[in] client A pointer to the dada_client_t object.
- *  @param[out] fptr pointer to the pointer of the fil file created.
- *  @param[in] filename Full path and name of the fil file to create.
- *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ *  @brief Returns how many seconds of the observation the beam's current fil file should hold: the whole observation
+ *         (from where we joined it, if we joined it in progress), or if we are writing segments, the segment (the last
+ *         segment may be shorter).
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam_index The beam index.
+ *  @returns The number of seconds.
  */
-int create_fil(dada_client_t *client, int beam_index, cFilFile *out_filfile_ptr, metafits_s *metafits)
+static int fil_file_seconds(dada_db_s *ctx, int beam_index)
 {
-  assert(client != 0);
-
-  assert(client->log != 0);
-  multilog_t *log = (multilog_t *)client->log;
-  dada_db_s *ctx = (dada_db_s *)client->context;
-
-  beam_s beam = ctx->beams[beam_index];
+  beam_s *beam = &ctx->beams[beam_index];
 
-  multilog(log, LOG_INFO, "create_fil(): Creating new fil file for beam %d: %s...\n", beam_index, beam.fil_filename);
-
-  // Create a new blank fil file
-  if (CFilFile_Open(out_filfile_ptr, beam.fil_filename) != EXIT_SUCCESS)
-  {
-    char error_text[30] = "";
-    multilog(log, LOG_ERR, "create_fil(): Error creating fil file: %s. Error: %s\n", beam.fil_filename, error_text);
-    return -1;
-  }
+  if (beam->segment_secs > 0 && ctx->exposure_sec - beam->segment_start_sec < beam->segment_secs)
+    return ctx->exposure_sec - beam->segment_start_sec;
+  else if (beam->segment_secs > 0)
+    return beam->segment_secs;
+  else
+    return ctx->exposure_sec - beam->segment_start_sec;
+}
 
-  // Write header
-  cFilFileHeader filheader;
+/**
+ *
+ *  @brief Populates the fil header of a beam (or one sub-band of it) from the psrdada header and the metafits.
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam_index The beam index/identifier.
+ *  @param[in] subband The sub-band (0 if the beam is not split into sub-bands).
+ *  @param[in] metafits The metafits info of the observation.
+ *  @param[in] rawdatafile The name of the file the header is for.
+ *  @param[out] filheader The header to populate.
+ */
+static void populate_fil_header(dada_db_s *ctx, int beam_index, int subband, metafits_s *metafits, const char *rawdatafile, cFilFileHeader *filheader)
+{
+  beam_s *beam = &ctx->beams[beam_index];
 
   // Init header struct
-  CFilFileHeader_Constructor(&filheader);
+  CFilFileHeader_Constructor(filheader);
 
   // Populate header
   int d, h, m;
@@ -68,29 +77,121 @@ int create_fil(dada_client_t *client, int beam_index, cFilFile *out_filfile_ptr,
   double dec = format_angle(d, m, s);
 
   // Other fields
-  filheader.telescope_id = 0; // FAKE
-  filheader.machine_id = 0;   // FAKE
-  filheader.data_type = 1;    // 1 - filterbank; 2 - timeseries
-  strncpy(filheader.rawdatafile, beam.fil_filename, 4096);
-  strncpy(filheader.source_name, metafits->filename, 4095);
-  filheader.barycentric = 0;
-  filheader.pulsarcentric = 0;
-  filheader.az_start = metafits->azimuth;                                               // Pointing azimuth (degrees)
-  filheader.za_start = 90 - metafits->altitude;                                         // Pointing zenith angle (degrees)
-  filheader.src_raj = ra;                                                               // RA (J2000) of source hhmmss.s
-  filheader.src_dej = dec;                                                              // DEC (J2000) of source ddmmss.s
-  filheader.tstart = metafits->mjd;                                                     // Timestamp MJD of first sample
-  filheader.tsamp = 1.0f / beam.ntimesteps;                                             // time interval between samples (seconds)
-  filheader.nbits = ctx->nbit;                                                          // bits per time sample
-  filheader.nsamples = beam.ntimesteps * ctx->exposure_sec;                             // number of time samples in the data file (rarely used)
-  filheader.fch1 = beam.channels[0];                                                    // Start freq (MHz) of first channel
-  filheader.foff = (double)ctx->bandwidth_hz / (double)1000000.0f / (double)beam.nchan; // fine channel bandwidth (MHz) - negative since we provide higest freq in fch1
-  filheader.nchans = beam.nchan;
-  filheader.nifs = ctx->npol; // Number of IF channels(polarisations I think)
-  filheader.refdm = 0;        // reference dispersion measure (cm^−3 pc)
-  filheader.period = 0;       // folding period (s)
-  filheader.nbeams = 1;       // Total beams in file
-  filheader.ibeam = 1;        // Beam number
+  filheader->telescope_id = 0; // FAKE
+  filheader->machine_id = 0;   // FAKE
+  filheader->data_type = 1;    // 1 - filterbank; 2 - timeseries
+  strncpy(filheader->rawdatafile, rawdatafile, 4096);
+  strncpy(filheader->source_name, metafits->filename, 4095);
+  filheader->barycentric = 0;
+  filheader->pulsarcentric = 0;
+  filheader->az_start = metafits->azimuth;                                                // Pointing azimuth (degrees)
+  filheader->za_start = 90 - metafits->altitude;                                          // Pointing zenith angle (degrees)
+  filheader->src_raj = ra;                                                                // RA (J2000) of source hhmmss.s
+  filheader->src_dej = dec;                                                               // DEC (J2000) of source ddmmss.s
+  filheader->tstart = metafits->mjd + beam->segment_start_sec / 86400.0;                  // Timestamp MJD of first sample (of this segment, or where we joined)
+  filheader->tsamp = 1.0f / beam->ntimesteps;                                             // time interval between samples (seconds)
+  filheader->nbits = ctx->nbit;                                                           // bits per time sample
+  filheader->nsamples = beam->ntimesteps * (beam->segment_secs > 0 ? beam->segment_secs : ctx->exposure_sec - beam->segment_start_sec); // number of time samples in the data file (rarely used)
+  filheader->fch1 = beam->channels[subband * beam->nsubband_chan];                        // Start freq (MHz) of first channel (of this sub-band)
+  filheader->foff = (double)ctx->bandwidth_hz / (double)1000000.0f / (double)beam->nchan; // fine channel bandwidth (MHz) - negative since we provide higest freq in fch1
+  filheader->nchans = beam->nsubband_chan;
+  filheader->nifs = ctx->npol; // Number of IF channels(polarisations I think)
+  filheader->refdm = 0;        // reference dispersion measure (cm^−3 pc)
+  filheader->period = 0;       // folding period (s)
+  filheader->nbeams = 1;       // Total beams in file
+  filheader->ibeam = 1;        // Beam number
+}
+
+/**
+ *
+ *  @brief Creates a fil file as NAME.partial, writes its header, reserves its whole length and starts its checksum
+ *         sidecar (unless --no-checksums). The scales sidecar, if any, is up to the caller.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in,out] output The output, with fil_filename set.
+ *  @param[in] filheader The header to write.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+static int open_fil_output(multilog_t *log, dada_db_s *ctx, fil_output_s *output, cFilFileHeader *filheader)
+{
+  cFilFile *out_filfile_ptr = &output->out_filfile_ptr;
+
+  // Create a new blank fil file. It is written as NAME.partial and only renamed to NAME once it is closed (see
+  // publish_fil_file()). NOTE: the filfile keeps a pointer to the name (it is reopened by close_fil()), so it must point
+  // at the output in the context, not at a copy of it
+  snprintf(output->fil_partial_filename, sizeof(output->fil_partial_filename), "%s%s", output->fil_filename, FIL_PARTIAL_EXTENSION);
+
+  if (CFilFile_Open(out_filfile_ptr, output->fil_partial_filename) != EXIT_SUCCESS)
+  {
+    char error_text[30] = "";
+    multilog(log, LOG_ERR, "create_fil(): Error creating fil file: %s. Error: %s\n", output->fil_filename, error_text);
+    metrics_add_file_opened(0);
+    return -1;
+  }
+
+  metrics_add_file_opened(1);
+
+  // Write the header
+  CFilFile_WriteHeader(out_filfile_ptr, filheader);
+  output->header_nsamples = filheader->nsamples;
+
+  // Reserve the whole file up front (finish_fil_file() cuts it back to what was written)
+  off_t expected_bytes = ftello(out_filfile_ptr->m_File) + (off_t)filheader->nsamples * filheader->nchans * ctx->npol * (ctx->nbit / 8);
+  int preallocate_error = preallocate_file(fileno(out_filfile_ptr->m_File), expected_bytes);
+
+  if (preallocate_error != 0)
+    multilog(log, LOG_DEBUG, "create_fil(): Could not preallocate %ld bytes for %s. Error: %s\n", (long)expected_bytes, output->fil_filename, strerror(preallocate_error));
+
+  // And start the checksum sidecar: one "offset length crc32c" line per beam second (see mwax_filverify). It is also
+  // renamed from NAME.partial when the fil file is closed
+  output->checksum_file = NULL;
+  output->data_crc = 0;
+
+  if (ctx->checksums)
+  {
+    snprintf(output->checksum_filename, sizeof(output->checksum_filename), "%s%s", output->fil_filename, CRC32C_SIDECAR_EXTENSION);
+
+    char checksum_partial_filename[sizeof(output->checksum_filename) + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(checksum_partial_filename, sizeof(checksum_partial_filename), "%s%s", output->checksum_filename, FIL_PARTIAL_EXTENSION);
+
+    output->checksum_file = fopen(checksum_partial_filename, "w");
+
+    if (output->checksum_file == NULL)
+      multilog(log, LOG_ERR, "create_fil(): Error creating checksum file: %s. Error: %s. Continuing without checksums for this file.\n", output->checksum_filename, strerror(errno));
+    else
+      fprintf(output->checksum_file, "# crc32c of each block of %s\n# offset length crc32c\n", output->fil_filename);
+  }
+
+  output->scales_file = NULL;
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Creates a blank new fil file (named by make_fil_filename()) and populates it with data from the psrdada header.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] beam_index The beam index/identifier.
+ *  @param[in] subband The sub-band (0 if the beam is not split into sub-bands).
+ *  @param[in] metafits The metafits info of the observation.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+int create_fil(dada_client_t *client, int beam_index, int subband, metafits_s *metafits)
+{
+  assert(client != 0);
+
+  assert(client->log != 0);
+  multilog_t *log = (multilog_t *)client->log;
+  dada_db_s *ctx = (dada_db_s *)client->context;
+
+  beam_s beam = ctx->beams[beam_index];
+  fil_output_s *output = &ctx->beams[beam_index].outputs[subband];
+
+  multilog(log, LOG_INFO, "create_fil(): Creating new fil file for beam %d: %s...\n", beam_index, output->fil_filename);
+
+  // Work out the header
+  cFilFileHeader filheader;
+  populate_fil_header(ctx, beam_index, subband, metafits, output->fil_filename, &filheader);
 
   multilog(log, LOG_INFO, "create_fil(): filheader.telescope_id : %d (0=FAKE)\n", filheader.telescope_id);
   multilog(log, LOG_INFO, "create_fil(): filheader.machine_id   : %d (0=FAKE)\n", filheader.machine_id);
@@ -106,7 +207,7 @@ int create_fil(dada_client_t *client, int beam_index, cFilFile *out_filfile_ptr,
   multilog(log, LOG_INFO, "create_fil(): filheader.tstart       : %f MJD of start\n", filheader.tstart);
   multilog(log, LOG_INFO, "create_fil(): filheader.tsamp        : %f sec per sample\n", filheader.tsamp);
   multilog(log, LOG_INFO, "create_fil(): filheader.nbits        : %d bits per sample\n", filheader.nbits);
-  multilog(log, LOG_INFO, "create_fil(): filheader.nsamples     : %ld total samples (timesteps per sec %ld * duration %d sec)\n", filheader.nsamples, beam.ntimesteps, ctx->exposure_sec);
+  multilog(log, LOG_INFO, "create_fil(): filheader.nsamples     : %ld total samples (timesteps per sec %ld * duration %d sec)\n", filheader.nsamples, beam.ntimesteps, beam.segment_secs > 0 ? beam.segment_secs : ctx->exposure_sec - beam.segment_start_sec);
   multilog(log, LOG_INFO, "create_fil(): filheader.fch1         : %f MHz (start of first) channel\n", filheader.fch1);
   multilog(log, LOG_INFO, "create_fil(): filheader.foff         : %f MHz width of channel\n", filheader.foff);
   multilog(log, LOG_INFO, "create_fil(): filheader.nchans       : %ld number of channels\n", filheader.nchans);
@@ -114,12 +215,69 @@ int create_fil(dada_client_t *client, int beam_index, cFilFile *out_filfile_ptr,
   multilog(log, LOG_INFO, "create_fil(): filheader.nbeams       : %d Number of beams\n", filheader.nbeams);
   multilog(log, LOG_INFO, "create_fil(): filheader.ibeam        : %d Beam number in this file\n", filheader.ibeam);
 
-  // Write the header
-  CFilFile_WriteHeader(out_filfile_ptr, &filheader);
+  if (open_fil_output(log, ctx, output, &filheader) != EXIT_SUCCESS)
+    return -1;
+
+  // And the scales sidecar: the mean and rms each beam second was normalised by (see bandpass.c). Without it the data
+  // cannot be turned back into powers, so we do not go on without it
+  if (ctx->normalise_seconds > 0)
+  {
+    snprintf(output->scales_filename, sizeof(output->scales_filename), "%s%s", output->fil_filename, BANDPASS_SCALES_EXTENSION);
+
+    char scales_partial_filename[sizeof(output->scales_filename) + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(scales_partial_filename, sizeof(scales_partial_filename), "%s%s", output->scales_filename, FIL_PARTIAL_EXTENSION);
+
+    output->scales_file = fopen(scales_partial_filename, "w");
+
+    if (output->scales_file == NULL)
+    {
+      multilog(log, LOG_ERR, "create_fil(): Error creating scales file: %s. Error: %s\n", output->scales_filename, strerror(errno));
+      return -1;
+    }
+
+    fprintf(output->scales_file, "# mean and rms each beam second of %s was normalised by (power = value * rms + mean)\n"
+                                 "# time constant %.1f sec, %d channels, %d pols\n"
+                                 "# second (from the start of the observation) then mean rms for each channel and pol\n",
+            output->fil_filename, ctx->normalise_seconds, (int)beam.nsubband_chan, ctx->npol);
+  }
 
   return (EXIT_SUCCESS);
 }
 
+/**
+ *
+ *  @brief Creates the wideband fil file of a beam (--wideband, see wideband.c): the header of the beam in one coarse
+ *         channel, widened to every coarse channel of the band. Named by make_wideband_filename().
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the context of one ring of the band (they only differ in their coarse channel).
+ *  @param[in] beam_index The beam index.
+ *  @param[in] metafits The metafits info of the observation.
+ *  @param[in] first_coarse_channel The lowest coarse channel of the band.
+ *  @param[in] ncoarse_channels How many coarse channels the band spans.
+ *  @param[in] start_sec Second (from the start of the observation) the file starts at.
+ *  @param[in,out] output The output, with fil_filename set.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+int create_wideband_fil(multilog_t *log, dada_db_s *ctx, int beam_index, metafits_s *metafits, int first_coarse_channel, int ncoarse_channels,
+                        int start_sec, fil_output_s *output)
+{
+  beam_s *beam = &ctx->beams[beam_index];
+
+  cFilFileHeader filheader;
+  populate_fil_header(ctx, beam_index, 0, metafits, output->fil_filename, &filheader);
+
+  // The band starts at the first fine channel of the lowest coarse channel (coarse channels are bandwidth_hz apart)
+  filheader.fch1 = beam->channels[0] + (double)(first_coarse_channel - ctx->coarse_channel) * ctx->bandwidth_hz / 1000000.0;
+  filheader.nchans = beam->nchan * ncoarse_channels;
+  filheader.tstart = metafits->mjd + start_sec / 86400.0;
+  filheader.nsamples = beam->ntimesteps * (ctx->exposure_sec - start_sec);
+
+  multilog(log, LOG_INFO, "create_wideband_fil(): Creating new wideband fil file for beam %d: %s (ch%02d-ch%02d, %ld channels from %f MHz, %d samples)...\n",
+           beam_index + 1, output->fil_filename, first_coarse_channel, first_coarse_channel + ncoarse_channels - 1, filheader.nchans, filheader.fch1, filheader.nsamples);
+
+  return open_fil_output(log, ctx, output, &filheader);
+}
+
 /**
  *
  *  @brief Updates a filterbank file header value for a specific keyword (int only supported right now).
@@ -135,8 +293,22 @@ int update_filfile_int(dada_client_t *client, cFilFile *filfile_ptr, char *keywo
   dada_db_s *ctx = (dada_db_s *)client->context;
 
   assert(ctx->log != 0);
-  multilog_t *log = (multilog_t *)ctx->log;
 
+  return update_fil_header_int((multilog_t *)ctx->log, filfile_ptr, keyword, new_value);
+}
+
+/**
+ *
+ *  @brief Updates a filterbank file header value for a specific keyword (int only supported right now). Only uses
+ *         what it is given (not the context), so it can be used off the reader thread.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] filfile_ptr pointer to FilFile which we are working on.
+ *  @param[in] keyword string with the keyword to search for.
+ *  @param[in] value new value for this keyword.
+ *  @returns EXIT_SUCCESS always but will log WARNINGS if there are problems.
+ */
+int update_fil_header_int(multilog_t *log, cFilFile *filfile_ptr, char *keyword, int new_value)
+{
   // Find the keyword for nsamples
   // 1. Start at top of file
   if (fseek(filfile_ptr->m_File, 0, SEEK_SET) == 0)
@@ -200,15 +372,123 @@ int update_filfile_int(dada_client_t *client, cFilFile *filfile_ptr, char *keywo
   return EXIT_SUCCESS;
 }
 
+/**
+ *
+ *  @brief Finishes a fil file: sets its length to what was written (or shed), closes it and closes its checksum and
+ *         scales sidecars. Only uses what it is given (not the context), so a segment can be finished on the closer thread.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] out_filfile_ptr Pointer to the filfile structure.
+ *  @param[in] checksum_file The checksum sidecar, or NULL if there is none.
+ *  @param[in] checksum_filename Name of the checksum sidecar (for errors).
+ *  @param[in] scales_file The scales sidecar, or NULL if there is none.
+ *  @param[in] scales_filename Name of the scales sidecar (for errors).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the fil file could not be closed.
+ */
+int finish_fil_file(multilog_t *log, cFilFile *out_filfile_ptr, FILE *checksum_file, const char *checksum_filename, FILE *scales_file, const char *scales_filename)
+{
+  // Only count files we actually had open (close can be called again for beams already closed)
+  int was_open = (out_filfile_ptr->m_File != NULL);
+
+  // The file should end at our position. If the last beam seconds were shed (skipped with skip_fil_block()) it ends
+  // before it, so extend it (sparse, reads as zeros); if it was preallocated and cut short, it ends after it
+  if (was_open && fflush(out_filfile_ptr->m_File) == 0)
+  {
+    off_t position = ftello(out_filfile_ptr->m_File);
+    struct stat file_stat;
+
+    if (position > 0 && fstat(fileno(out_filfile_ptr->m_File), &file_stat) == 0 && file_stat.st_size != position)
+    {
+      if (ftruncate(fileno(out_filfile_ptr->m_File), position) != 0)
+        multilog(log, LOG_ERR, "close_fil(): Error setting %s to %ld bytes. Error: %s\n", out_filfile_ptr->m_szFileName, (long)position, strerror(errno));
+    }
+  }
+
+  // Close the filterbank file and ensure it's written out
+  if (CFilFile_Close(out_filfile_ptr) != EXIT_SUCCESS)
+  {
+    char error_text[30] = "";
+    multilog(log, LOG_ERR, "close_fil(): Error closing fil file. Error: %s\n", error_text);
+    return EXIT_FAILURE;
+  }
+
+  // So a second close (or publish) of this file does nothing
+  out_filfile_ptr->m_File = NULL;
+
+  if (was_open)
+    metrics_add_file_closed();
+
+  if (checksum_file != NULL)
+  {
+    if (fclose(checksum_file) != 0)
+      multilog(log, LOG_ERR, "close_fil(): Error closing checksum file %s. Error: %s\n", checksum_filename, strerror(errno));
+  }
+
+  if (scales_file != NULL)
+  {
+    if (fclose(scales_file) != 0)
+      multilog(log, LOG_ERR, "close_fil(): Error closing scales file %s. Error: %s\n", scales_filename, strerror(errno));
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Publishes a finished (closed) fil file: renames its sidecars and then it from NAME.partial to NAME,
+ *         so a file with its final name is always complete, then tells downstream tools about it (see notify.c).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] partial_filename What the fil file is called while it is being written.
+ *  @param[in] filename The final name of the fil file.
+ *  @param[in] checksum_filename The final name of its checksum sidecar, or NULL if it has none.
+ *  @param[in] scales_filename The final name of its scales sidecar, or NULL if it has none.
+ *  @param[in,out] record The record to publish (path and bytes are filled in here).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the fil file could not be renamed.
+ */
+int publish_fil_file(multilog_t *log, const char *partial_filename, const char *filename, const char *checksum_filename, const char *scales_filename, notify_record_s *record)
+{
+  if (checksum_filename != NULL)
+  {
+    char checksum_partial_filename[PATH_MAX + sizeof(CRC32C_SIDECAR_EXTENSION) + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(checksum_partial_filename, sizeof(checksum_partial_filename), "%s%s", checksum_filename, FIL_PARTIAL_EXTENSION);
+
+    if (rename(checksum_partial_filename, checksum_filename) != 0)
+      multilog(log, LOG_ERR, "publish_fil_file(): Error renaming %s to %s. Error: %s\n", checksum_partial_filename, checksum_filename, strerror(errno));
+  }
+
+  if (scales_filename != NULL)
+  {
+    char scales_partial_filename[PATH_MAX + sizeof(BANDPASS_SCALES_EXTENSION) + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(scales_partial_filename, sizeof(scales_partial_filename), "%s%s", scales_filename, FIL_PARTIAL_EXTENSION);
+
+    if (rename(scales_partial_filename, scales_filename) != 0)
+      multilog(log, LOG_ERR, "publish_fil_file(): Error renaming %s to %s. Error: %s\n", scales_partial_filename, scales_filename, strerror(errno));
+  }
+
+  if (rename(partial_filename, filename) != 0)
+  {
+    multilog(log, LOG_ERR, "publish_fil_file(): Error renaming %s to %s. Error: %s\n", partial_filename, filename, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  struct stat file_stat;
+
+  record->path = filename;
+  record->bytes = (stat(filename, &file_stat) == 0) ? (uint64_t)file_stat.st_size : 0;
+
+  notify_file_closed(log, record);
+
+  return EXIT_SUCCESS;
+}
+
 /**
  *
  *  @brief Closes the fil file.
  *  @param[in] client A pointer to the dada_client_t object.
  *  @param[in] beam_index The beam index/identifier.
- *  @param[in,out] fptr Pointer to a pointer to the filfile structure.
+ *  @param[in] subband The sub-band (0 if the beam is not split into sub-bands).
  *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
  */
-int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index)
+int close_fil(dada_client_t *client, int beam_index, int subband)
 {
   assert(client != 0);
   dada_db_s *ctx = (dada_db_s *)client->context;
@@ -216,23 +496,32 @@ int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index)
   assert(ctx->log != 0);
   multilog_t *log = (multilog_t *)ctx->log;
 
+  fil_output_s *output = &ctx->beams[beam_index].outputs[subband];
+  cFilFile *out_filfile_ptr = &output->out_filfile_ptr;
+
   if (out_filfile_ptr != NULL)
   {
-    // Close the filterbank file and ensure it's written out
-    if (CFilFile_Close(out_filfile_ptr) != EXIT_SUCCESS)
-    {
-      char error_text[30] = "";
-      multilog(log, LOG_ERR, "close_fil(): Error closing fil file. Error: %s\n", error_text);
+    // Only publish files we actually had open (close can be called again for beams already closed)
+    int was_open = (out_filfile_ptr->m_File != NULL);
+    int has_checksum = (output->checksum_file != NULL);
+    int has_scales = (output->scales_file != NULL);
+
+    int finished = finish_fil_file(log, out_filfile_ptr, output->checksum_file, output->checksum_filename, output->scales_file, output->scales_filename);
+
+    output->checksum_file = NULL;
+    output->scales_file = NULL;
+
+    if (finished != EXIT_SUCCESS)
       return EXIT_FAILURE;
-    }
 
-    // Check if the duration changed mid observation
-    if (ctx->duration_changed == 1)
+    // Check if the duration changed mid observation, or this is the last segment of the observation (shorter than
+    // the others)
+    long nsamples = ctx->beams[beam_index].ntimesteps * fil_file_seconds(ctx, beam_index); // number of time samples in the data file (rarely used)
+
+    if (was_open && (ctx->duration_changed == 1 || nsamples != output->header_nsamples))
     {
       // Update the header (nsamples)
-      int nsamples = ctx->beams[beam_index].ntimesteps * ctx->exposure_sec; // number of time samples in the data file (rarely used)
-
-      multilog(log, LOG_INFO, "close_fil(): Beam: %d- Duration changed mid-observation, updating the header to update nsamples: %ld total samples (timesteps per sec %ld * duration %d sec)\n", beam_index, nsamples, ctx->beams[beam_index].ntimesteps, ctx->exposure_sec);
+      multilog(log, LOG_INFO, "close_fil(): Beam: %d- Duration changed mid-observation (or this is the last segment), updating the header to update nsamples: %ld total samples (timesteps per sec %ld * duration %d sec)\n", beam_index, nsamples, ctx->beams[beam_index].ntimesteps, fil_file_seconds(ctx, beam_index));
 
       // Update the nsamples value
       // Reopen the filterbank file for rw
@@ -250,6 +539,24 @@ int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index)
         multilog(log, LOG_ERR, "close_fil(): Error closing fil file (after updating the nsamples value). Error: %s\n", error_text);
         return EXIT_FAILURE;
       }
+
+      out_filfile_ptr->m_File = NULL;
+    }
+
+    if (was_open)
+    {
+      notify_record_s record;
+      record.obs_id = ctx->obs_id;
+      record.beam = beam_index + 1;
+      record.segment = ctx->beams[beam_index].segment_secs > 0 ? ctx->beams[beam_index].segment_index : -1;
+      record.subband = ctx->beams[beam_index].noutputs > 1 ? subband : -1;
+      record.nsamples = nsamples;
+      record.has_checksum = has_checksum;
+      record.data_crc32c = output->data_crc;
+
+      if (publish_fil_file(log, output->fil_partial_filename, output->fil_filename, has_checksum ? output->checksum_filename : NULL,
+                           has_scales ? output->scales_filename : NULL, &record) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
     }
   }
   else
@@ -262,6 +569,114 @@ int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index)
   return EXIT_SUCCESS;
 }
 
+/**
+ *
+ *  @brief Creates the multi-beam container of the observation (named by make_container_filename()) and writes the fil
+ *         header of every beam into it (see container.c).
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] metafits The metafits info of the observation.
+ *  @returns EXIT_SUCCESS on success, or -1 if there was an error.
+ */
+int create_container(dada_client_t *client, metafits_s *metafits)
+{
+  assert(client != 0);
+
+  assert(client->log != 0);
+  multilog_t *log = (multilog_t *)client->log;
+  dada_db_s *ctx = (dada_db_s *)client->context;
+
+  multilog(log, LOG_INFO, "create_container(): Creating new container for %d beams: %s...\n", ctx->nbeams_total, ctx->container_filename);
+
+  // Like a fil file, it is written as NAME.partial and only renamed to NAME once it is closed (see publish_fil_file())
+  snprintf(ctx->container_partial_filename, sizeof(ctx->container_partial_filename), "%s%s", ctx->container_filename, FIL_PARTIAL_EXTENSION);
+
+  // Beam seconds (and bytes) to expect, from where we joined the observation
+  int seconds = ctx->exposure_sec - ctx->join_offset_sec;
+  uint64_t expected_seconds = (uint64_t)ctx->nbeams_total * seconds;
+  uint64_t expected_bytes = 0;
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+    expected_bytes += (uint64_t)seconds * ctx->beams[beam].ntimesteps * ctx->beams[beam].nchan * ctx->npol * (ctx->nbit / 8);
+
+  if (container_open(log, &ctx->container, ctx->container_partial_filename, ctx->obs_id, ctx->nbeams_total, ctx->checksums,
+                     ctx->join_offset_sec, expected_seconds, expected_bytes) != EXIT_SUCCESS)
+    return -1;
+
+  for (int beam = 0; beam < ctx->nbeams_total; beam++)
+  {
+    cFilFileHeader filheader;
+    populate_fil_header(ctx, beam, 0, metafits, ctx->container_filename, &filheader);
+    filheader.nbeams = ctx->nbeams_total; // Total beams in file
+    filheader.ibeam = beam + 1;           // Beam number
+
+    uint64_t bytes_per_second = (uint64_t)ctx->beams[beam].ntimesteps * ctx->beams[beam].nchan * ctx->npol * (ctx->nbit / 8);
+
+    if (container_write_beam_header(log, &ctx->container, beam, &filheader, ctx->npol, bytes_per_second) != EXIT_SUCCESS)
+    {
+      // Without every beam's header the container is of no use, so it is not left open for close_container() to publish
+      container_close(log, &ctx->container, ctx->container_partial_filename);
+      unlink(ctx->container_partial_filename);
+      return -1;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Closes the multi-beam container of the observation (fixing nsamples in the beam headers if the duration
+ *         changed) and publishes it, unless that failed. Does nothing if there is no container open.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int close_container(dada_client_t *client)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+
+  assert(ctx->log != 0);
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  if (ctx->container.file == NULL)
+    return EXIT_SUCCESS;
+
+  int result = EXIT_SUCCESS;
+
+  if (ctx->duration_changed == 1)
+  {
+    multilog(log, LOG_INFO, "close_container(): Duration changed mid-observation, updating nsamples of each beam (duration %d sec)\n", ctx->exposure_sec);
+
+    for (int beam = 0; beam < ctx->nbeams_total && result == EXIT_SUCCESS; beam++)
+    {
+      cFilFileHeader filheader;
+      populate_fil_header(ctx, beam, 0, ctx->metafits_info, ctx->container_filename, &filheader);
+      filheader.nbeams = ctx->nbeams_total;
+      filheader.ibeam = beam + 1;
+
+      result = container_write_beam_header(log, &ctx->container, beam, &filheader, ctx->npol, ctx->container.beams[beam].bytes_per_second);
+    }
+  }
+
+  if (container_close(log, &ctx->container, ctx->container_partial_filename) != EXIT_SUCCESS || result != EXIT_SUCCESS)
+  {
+    // Its beam headers or index may be wrong, so it is not published (the data is still there if it is wanted)
+    multilog(log, LOG_ERR, "close_container(): %s is left as it is.\n", ctx->container_partial_filename);
+    return EXIT_FAILURE;
+  }
+
+  notify_record_s record;
+  record.obs_id = ctx->obs_id;
+  record.beam = 0;
+  record.segment = -1;
+  record.subband = -1;
+  record.nsamples = ctx->beams[0].ntimesteps * (ctx->exposure_sec - ctx->join_offset_sec);
+  record.has_checksum = 0; // the CRC32C of each beam second is in the index instead
+  record.data_crc32c = 0;
+
+  return publish_fil_file(log, ctx->container_partial_filename, ctx->container_filename, NULL, NULL, &record);
+}
+
 /**
  *
  *  @brief Creates a new block in an existing fil file.
@@ -273,17 +688,42 @@ int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index)
  *  @param[in] polarisations The number of pols in each beam.
  *  @param[in] buffer The pointer to the data to write into the block.
  *  @param[in] bytes The number of bytes in the buffer to write.
+ *  @param[in] checksum_file The checksum sidecar, or NULL if we are not writing checksums.
+ *  @param[in,out] data_crc The CRC32C of the data in the file so far (updated if we are writing checksums).
+ *  @param[in] block_crc The CRC32C of the buffer if it has already been computed (see the checksum stage in pipeline.c), or NULL.
  *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
  */
 int create_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, int bytes_per_sample, long timesteps,
-                     long fine_channels, int polarisations, float *buffer, uint64_t bytes)
+                     long fine_channels, int polarisations, float *buffer, uint64_t bytes, FILE *checksum_file, uint32_t *data_crc, const uint32_t *block_crc)
 {
   assert(client != 0);
   dada_db_s *ctx = (dada_db_s *)client->context;
 
   assert(ctx->log != 0);
-  multilog_t *log = (multilog_t *)ctx->log;
 
+  return write_fil_block((multilog_t *)ctx->log, out_filfile_ptr, bytes_per_sample, timesteps, fine_channels, polarisations, buffer, bytes, checksum_file, data_crc, block_crc);
+}
+
+/**
+ *
+ *  @brief Writes a block to the end of a fil file (and its CRC32C to the checksum sidecar). Only uses what it is given
+ *         (not the context), so it can be used off the reader thread.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] fptr Pointer to the fil file we will write to.
+ *  @param[in] bytes_per_sample The number of bytes per sample.
+ *  @param[in] timesteps The number of timesteps to write.
+ *  @param[in] fine_channels The number of fine channels.
+ *  @param[in] polarisations The number of pols in each beam.
+ *  @param[in] buffer The pointer to the data to write into the block.
+ *  @param[in] bytes The number of bytes in the buffer to write.
+ *  @param[in] checksum_file The checksum sidecar, or NULL if we are not writing checksums.
+ *  @param[in,out] data_crc The CRC32C of the data in the file so far (updated if we are writing checksums).
+ *  @param[in] block_crc The CRC32C of the buffer if it has already been computed (see the checksum stage in pipeline.c), or NULL.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int write_fil_block(multilog_t *log, cFilFile *out_filfile_ptr, int bytes_per_sample, long timesteps,
+                    long fine_channels, int polarisations, float *buffer, uint64_t bytes, FILE *checksum_file, uint32_t *data_crc, const uint32_t *block_crc)
+{
   // write stuff
   uint64_t buffer_elements = timesteps * fine_channels * polarisations;
   uint64_t in_check_bytes = buffer_elements * bytes_per_sample;
@@ -296,6 +736,16 @@ int create_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, int bytes
     return EXIT_FAILURE;
   }
 
+  // Checksum the block on its way to disk, so corruption after this point can be told apart from corruption before it
+  off_t offset = 0;
+  uint32_t crc = 0;
+
+  if (checksum_file != NULL)
+  {
+    offset = ftello(out_filfile_ptr->m_File);
+    crc = block_crc != NULL ? *block_crc : crc32c(0, buffer, bytes);
+  }
+
   int out_samples = CFilFile_WriteData(out_filfile_ptr, buffer, buffer_elements);
   uint64_t out_check_bytes = out_samples * bytes_per_sample;
 
@@ -307,5 +757,40 @@ int create_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, int bytes
     return EXIT_FAILURE;
   }
 
+  if (checksum_file != NULL && fprintf(checksum_file, "%ld %" PRIu64 " %08x\n", (long)offset, bytes, crc) < 0)
+  {
+    multilog(log, LOG_ERR, "create_fil_block(): Error writing checksum. Error: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  if (checksum_file != NULL)
+    *data_crc = crc32c_combine(*data_crc, crc, bytes);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Moves past a block in the fil file without writing it (used when a beam second is shed to keep up).
+ *         The hole reads back as zeros, and close_fil() makes sure the file is extended if it is at the end.
+ *  @param[in] client A pointer to the dada_client_t object.
+ *  @param[in] out_filfile_ptr pointer to FilFile which we are working on.
+ *  @param[in] bytes Number of bytes to skip.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int skip_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, uint64_t bytes)
+{
+  assert(client != 0);
+  dada_db_s *ctx = (dada_db_s *)client->context;
+
+  assert(ctx->log != 0);
+  multilog_t *log = (multilog_t *)ctx->log;
+
+  if (fseeko(out_filfile_ptr->m_File, (off_t)bytes, SEEK_CUR) != 0)
+  {
+    multilog(log, LOG_ERR, "skip_fil_block(): Error skipping %lu bytes in fil file. Error: %s\n", bytes, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
 }
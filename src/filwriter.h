@@ -9,8 +9,17 @@
 
 #include "dada_client.h"
 #include "global.h"
+#include "notify.h"
 
-int create_fil(dada_client_t *client, int beam_index, cFilFile *out_filfile_ptr, metafits_s *metafits);
+int create_fil(dada_client_t *client, int beam_index, int subband, metafits_s *metafits);
+int create_wideband_fil(multilog_t *log, dada_db_s *ctx, int beam_index, metafits_s *metafits, int first_coarse_channel, int ncoarse_channels, int start_sec, fil_output_s *output);
 int update_filfile_int(dada_client_t *client, cFilFile *filfile_ptr, char *keyword, int new_value);
-int close_fil(dada_client_t *client, cFilFile *out_filfile_ptr, int beam_index);
-int create_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, int bytes_per_sample, long timesteps, long fine_channels, int polarisations, float *buffer, uint64_t bytes);
\ No newline at end of file
+int update_fil_header_int(multilog_t *log, cFilFile *filfile_ptr, char *keyword, int new_value);
+int finish_fil_file(multilog_t *log, cFilFile *out_filfile_ptr, FILE *checksum_file, const char *checksum_filename, FILE *scales_file, const char *scales_filename);
+int publish_fil_file(multilog_t *log, const char *partial_filename, const char *filename, const char *checksum_filename, const char *scales_filename, notify_record_s *record);
+int close_fil(dada_client_t *client, int beam_index, int subband);
+int create_container(dada_client_t *client, metafits_s *metafits);
+int close_container(dada_client_t *client);
+int create_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, int bytes_per_sample, long timesteps, long fine_channels, int polarisations, float *buffer, uint64_t bytes, FILE *checksum_file, uint32_t *data_crc, const uint32_t *block_crc);
+int write_fil_block(multilog_t *log, cFilFile *out_filfile_ptr, int bytes_per_sample, long timesteps, long fine_channels, int polarisations, float *buffer, uint64_t bytes, FILE *checksum_file, uint32_t *data_crc, const uint32_t *block_crc);
+int skip_fil_block(dada_client_t *client, cFilFile *out_filfile_ptr, uint64_t bytes);
\ No newline at end of file
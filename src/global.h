@@ -11,13 +11,24 @@
 
 #include <stdint.h>
 #include <fitsio.h>
+#include "bandpass.h"
+#include "bufferpool.h"
+#include "container.h"
+#include "crc32c.h"
+#include "degrade.h"
 #include "filfile.h"
+#include "latency.h"
 #include "multilog.h"
+#include "perfcounters.h"
+#include "pipeline.h"
+#include "quicklook.h"
 
 #define MWAX_MODE_LEN 32    // Size of the MODE in PSRDADA header. E.g. "HW_LFILES", "VOLTAGE_START", "QUIT","NO_CAPTURE"
 #define UTC_START_LEN 20    // Size of UTC_START in the PSRDADA header (e.g. 2018-08-08-08:00:00)
 #define HOST_NAME_LEN 64    // Length of hostname
 #define IP_AS_STRING_LEN 15 // xxx.xxx.xxx.xxx
+#define FIL_PARTIAL_EXTENSION ".partial" // Appended to fil (and checksum) file names until they are closed
+#define GAPS_SIDECAR_EXTENSION ".gaps"   // oooooooooo_YYYYMMDDhhmmss_chCCC.gaps: the gaps filled with zeros in an observation
 
 typedef enum beam_type_enum
 {
@@ -26,12 +37,48 @@ typedef enum beam_type_enum
     coherent = 2
 } beam_type_enum;
 
-// Structure of a beam
-typedef struct beam_s
+// One fil file of a beam: the whole band, or one sub-band (--subbands)
+typedef struct fil_output_s
 {
-    // FIL info
     char fil_filename[PATH_MAX];
+    char fil_partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)]; // what it is called until it is closed
     cFilFile out_filfile_ptr;
+    long header_nsamples; // nsamples written in the header (close_fil() corrects it if it turned out different)
+
+    // CRC32C of each beam second written (NULL if --no-checksums)
+    char checksum_filename[PATH_MAX + sizeof(CRC32C_SIDECAR_EXTENSION)];
+    FILE *checksum_file;
+    uint32_t data_crc;  // CRC32C of all of the data in the fil file so far (combined from the per block CRCs)
+    uint32_t block_crc; // CRC32C of the beam second being written (set by the checksum stage, see pipeline.c)
+
+    // The mean and rms applied to each beam second of these channels (NULL unless --normalise, see bandpass.c)
+    char scales_filename[PATH_MAX + sizeof(BANDPASS_SCALES_EXTENSION)];
+    FILE *scales_file;
+} fil_output_s;
+
+// Structure of a beam
+typedef struct beam_s
+{
+    // FIL info: one file, or with --subbands one per sub-band (nsubband_chan channels each, in frequency order)
+    fil_output_s *outputs;
+    int noutputs;
+    long nsubband_chan;
+
+    // Segments (only if --segment-seconds or --segment-mb): the fil files are replaced every segment_secs beam seconds
+    int segment_secs;         // seconds per segment, 0 if the observation is one file
+    int segment_index;        // index of the current segment (in its file name)
+    int segment_start_sec;    // offset (seconds from the start of the observation) of the current segment
+    int segment_written_secs; // beam seconds written (or shed) into the current segment
+
+    // Running bandpass (only if --normalise, see bandpass.c)
+    bandpass_s bandpass;
+
+    // The stages each beam second goes through (see pipeline.c)
+    pipeline_s pipeline;
+
+    // Quick-look pyramid (only if --quicklook, see quicklook.c), and the level 0 rows of the beam second in progress
+    struct quicklook_beam_s *quicklook;
+    float *quicklook_rows;
 
     // Beam settings
     long time_integration;    // i.e. time-scrunch factor, e.g. 10 means sum 10 powers samples per output
@@ -43,6 +90,12 @@ typedef struct beam_s
     // Beam Statistics
     double *power_freq; // Stats by freq
     double *power_time; // Stats by time
+
+    // Per stage latency of this beam (this observation)
+    latency_histogram_s latency[LATENCY_STAGE_COUNT];
+
+    // Beam seconds not written to keep up (this observation, see degrade.c)
+    uint64_t blocks_shed;
 } beam_s;
 
 typedef struct metafits_s
@@ -72,6 +125,26 @@ typedef struct dada_db_s
     // Common
     char hostname[HOST_NAME_LEN + 1];
     char *destination_dir;
+    int checksums; // write a CRC32C sidecar per fil file (on unless --no-checksums)
+    int segment_seconds;    // start a new fil file every N seconds (--segment-seconds), 0 for one file per observation
+    uint64_t segment_bytes; // or when the next beam second would take the file past this size (--segment-mb), 0 for no limit
+    int segments_closing;   // segments handed to the closer thread it has not finished yet (see segment.c)
+    double normalise_seconds; // normalise each beam by its running bandpass over this many seconds (--normalise), 0 for raw powers
+    int subbands;             // write each beam as this many sub-band fil files (--subbands), 1 for the whole band
+    int quicklook_rows;       // level 0 rows per second of each beam's quick-look pyramid (--quicklook), 0 for none
+    int pipeline_stages[PIPELINE_STAGE_COUNT]; // the stages of each beam's pipeline, in order (--pipeline, or from the options)
+    int pipeline_nstages;
+
+    // Wideband output (only if --wideband, see wideband.c): the beams go to the assembler, which writes the channels of
+    // every ring into one fil file per beam. ring_index is this reader's ring (--key order, or replay file order)
+    int wideband_mode;
+    int ring_index;
+
+    // Multi-beam container (only if --container, see container.c): every beam of the observation in one file
+    int container_mode;
+    container_s container;
+    char container_filename[PATH_MAX];
+    char container_partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)]; // what it is called until it is closed
 
     // Stats
     char *stats_dir;
@@ -88,6 +161,7 @@ typedef struct dada_db_s
     char mode[MWAX_MODE_LEN];
     char utc_start[UTC_START_LEN];
     int obs_offset;
+    int join_offset_sec; // OBS_OFFSET of the first sub observation we saw: 0, or if we joined the observation in progress, where we joined it
     int coarse_channel;
     int nbit;
     int npol;
@@ -108,6 +182,27 @@ typedef struct dada_db_s
     int obs_marker_number;
     uint64_t expected_transfer_size;
     int duration_changed;
+
+    // Gaps in this observation (beam seconds which never arrived) filled with zeros, see fill_gap() in dada_dbfil.c
+    uint64_t gaps;
+    uint64_t gap_fill_bytes;
+    char gaps_filename[PATH_MAX];
+    FILE *gaps_file; // NULL until the first gap
+
+    // Per stage latency of all beams (this observation)
+    latency_histogram_s latency[LATENCY_STAGE_COUNT];
+
+    // Per stage hardware counters (only if --perf-counters)
+    perf_counters_s perf;
+
+    // Sheds optional work when we fall behind (only if --degrade)
+    degrade_s degrade;
+
+    // Per block temporaries (reserved at the start of each observation)
+    buffer_pool_s pool;
+
+    // latency_now_ns() when this observation started (the trace dumped at the end starts here)
+    uint64_t obs_start_ns;
 } dada_db_s;
 
 // Methods for the Quit mutex
@@ -6,13 +6,18 @@
  *
  */
 #include <arpa/inet.h>
+#include <stdio.h>
 #include <stdlib.h> 
 #include <string.h> 
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "health.h"
 #include "global.h"
+#include "placement.h"
+#include "prometheus.h"
+#include "trace.h"
 
 /**
  * 
@@ -51,6 +56,119 @@ int collect_buffer_stats(health_data_s *health_data, ipcbuf_t *header_block, ipc
     return EXIT_SUCCESS;
 }
 
+/**
+ * 
+ *  @brief Collects the pipeline counters (see metrics.h) and populates the versioned extension of the health packet.
+ *         These are for the whole process; collect_ring_stats() then fills in those of one ring.
+ *  @param[in] health_ext Pointer to the health_ext_s struct to be populated.
+ *  @param[in] blocks_behind Data blocks written to the ringbuffers but not yet read by us (all of them).
+ *  @param[in,out] last_beam_bytes The cumulative beam bytes at the last call, used to work out the rates. Updated.
+ *  @param[in,out] last_ns Timestamp of the last call (0 on the first call). Updated.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error. 
+ */
+int collect_pipeline_stats(health_ext_s *health_ext, uint64_t blocks_behind, uint64_t *last_beam_bytes, uint64_t *last_ns)
+{
+    memset(health_ext, 0, sizeof(health_ext_s));
+
+    health_ext->ext_magic = HEALTH_EXT_MAGIC;
+    health_ext->ext_version = HEALTH_EXT_VERSION;
+    health_ext->ext_length = sizeof(health_ext_s);
+
+    uint64_t now_ns = latency_now_ns();
+    health_ext->interval_ns = (*last_ns == 0) ? 0 : now_ns - *last_ns;
+    *last_ns = now_ns;
+
+    health_ext->obs_id = __atomic_load_n(&g_metrics.obs_id, __ATOMIC_RELAXED);
+    health_ext->subobs_id = __atomic_load_n(&g_metrics.subobs_id, __ATOMIC_RELAXED);
+    health_ext->obs_marker = __atomic_load_n(&g_metrics.obs_marker, __ATOMIC_RELAXED);
+    health_ext->nbeams = __atomic_load_n(&g_metrics.nbeams, __ATOMIC_RELAXED);
+
+    health_ext->blocks_behind = blocks_behind;
+    health_ext->blocks_processed = __atomic_load_n(&g_metrics.blocks_processed, __ATOMIC_RELAXED);
+    health_ext->blocks_dropped = __atomic_load_n(&g_metrics.blocks_dropped, __ATOMIC_RELAXED);
+    health_ext->bytes_dropped = __atomic_load_n(&g_metrics.bytes_dropped, __ATOMIC_RELAXED);
+
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        metrics_interval_s taken;
+        metrics_interval_take(&g_metrics.interval[stage], &taken);
+
+        health_ext->stages[stage].count = taken.count;
+        health_ext->stages[stage].mean_ns = (taken.count == 0) ? 0 : taken.sum_ns / taken.count;
+        health_ext->stages[stage].max_ns = taken.max_ns;
+        health_ext->stages[stage].total_ns = taken.sum_ns;
+    }
+
+    health_ext->degrade_level = __atomic_load_n(&g_metrics.degrade_level, __ATOMIC_RELAXED);
+    health_ext->degrade_changes = __atomic_load_n(&g_metrics.degrade_changes, __ATOMIC_RELAXED);
+    health_ext->blocks_shed = __atomic_load_n(&g_metrics.blocks_shed, __ATOMIC_RELAXED);
+    health_ext->stats_skipped = __atomic_load_n(&g_metrics.stats_skipped, __ATOMIC_RELAXED);
+    health_ext->staging_pool_maps = __atomic_load_n(&g_metrics.staging_pool_maps, __ATOMIC_RELAXED);
+    health_ext->staging_heap_allocs = __atomic_load_n(&g_metrics.staging_heap_allocs, __ATOMIC_RELAXED);
+    health_ext->notifications_sent = __atomic_load_n(&g_metrics.notifications_sent, __ATOMIC_RELAXED);
+    health_ext->notification_errors = __atomic_load_n(&g_metrics.notification_errors, __ATOMIC_RELAXED);
+    health_ext->gaps = __atomic_load_n(&g_metrics.gaps, __ATOMIC_RELAXED);
+    health_ext->gap_fill_bytes = __atomic_load_n(&g_metrics.gap_fill_bytes, __ATOMIC_RELAXED);
+
+    for (int beam = 0; beam < METRICS_MAX_BEAMS; beam++)
+    {
+        uint64_t beam_bytes = __atomic_load_n(&g_metrics.beam_bytes_written[beam], __ATOMIC_RELAXED);
+
+        if (health_ext->interval_ns > 0)
+            health_ext->beam_bytes_per_sec[beam] = (uint64_t)((beam_bytes - last_beam_bytes[beam]) * 1e9 / health_ext->interval_ns);
+
+        last_beam_bytes[beam] = beam_bytes;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * 
+ *  @brief Fills in the counters of one ring (see ring_metrics_s), the ring_ fields, in a health packet extension
+ *         populated by collect_pipeline_stats().
+ *  @param[in] health_ext Pointer to the health_ext_s struct to be completed.
+ *  @param[in] health_data Pointer to the already populated buffer stats of the ring (used for how far behind we are).
+ *  @param[in] ring Index of the ring.
+ *  @param[in] nrings Number of rings being read.
+ *  @param[in] key Shared memory key of the ring.
+ *  @param[in,out] last_beam_bytes The cumulative beam bytes of the ring at the last call, used to work out the rates. Updated.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error. 
+ */
+int collect_ring_stats(health_ext_s *health_ext, health_data_s *health_data, int ring, int nrings, key_t key, uint64_t *last_beam_bytes)
+{
+    ring_metrics_s *ring_metrics = &g_ring_metrics[ring];
+
+    health_ext->ring_key = (int32_t)key;
+    health_ext->ring_index = ring;
+    health_ext->nrings = nrings;
+
+    health_ext->ring_obs_id = __atomic_load_n(&ring_metrics->obs_id, __ATOMIC_RELAXED);
+    health_ext->ring_subobs_id = __atomic_load_n(&ring_metrics->subobs_id, __ATOMIC_RELAXED);
+    health_ext->ring_obs_marker = __atomic_load_n(&ring_metrics->obs_marker, __ATOMIC_RELAXED);
+    health_ext->ring_nbeams = __atomic_load_n(&ring_metrics->nbeams, __ATOMIC_RELAXED);
+
+    health_ext->ring_blocks_behind = health_data->data_bufs_written - health_data->data_bufs_read;
+    health_ext->ring_blocks_processed = __atomic_load_n(&ring_metrics->blocks_processed, __ATOMIC_RELAXED);
+    health_ext->ring_blocks_dropped = __atomic_load_n(&ring_metrics->blocks_dropped, __ATOMIC_RELAXED);
+    health_ext->ring_bytes_dropped = __atomic_load_n(&ring_metrics->bytes_dropped, __ATOMIC_RELAXED);
+    health_ext->ring_blocks_shed = __atomic_load_n(&ring_metrics->blocks_shed, __ATOMIC_RELAXED);
+    health_ext->ring_gaps = __atomic_load_n(&ring_metrics->gaps, __ATOMIC_RELAXED);
+    health_ext->ring_gap_fill_bytes = __atomic_load_n(&ring_metrics->gap_fill_bytes, __ATOMIC_RELAXED);
+
+    for (int beam = 0; beam < METRICS_MAX_BEAMS; beam++)
+    {
+        uint64_t beam_bytes = __atomic_load_n(&ring_metrics->beam_bytes_written[beam], __ATOMIC_RELAXED);
+
+        if (health_ext->interval_ns > 0)
+            health_ext->ring_beam_bytes_per_sec[beam] = (uint64_t)((beam_bytes - last_beam_bytes[beam]) * 1e9 / health_ext->interval_ns);
+
+        last_beam_bytes[beam] = beam_bytes;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 /**
  * 
  *  @brief This is the main health thread function to send health data for this process via UDP.
@@ -63,6 +181,9 @@ void* health_thread_fn(void *args)
 
     multilog(health_args->log, LOG_INFO, "Health: Thread started.\n");
 
+    trace_set_thread_name("health");
+    placement_bind_thread(health_args->log, placement_worker, "health");
+
     // Initialise UDP socket          
     int sock;
 
@@ -90,21 +211,64 @@ void* health_thread_fn(void *args)
 
     int quit = 0;
 
+    // Used to turn the cumulative counters into rates
+    uint64_t last_beam_bytes[METRICS_MAX_BEAMS] = {0};
+    uint64_t last_ring_beam_bytes[METRICS_MAX_RINGS][METRICS_MAX_BEAMS] = {{0}};
+    uint64_t last_ns = 0;
+
+    // The buffer stats of every ring, for Prometheus
+    health_data_s ring_data[METRICS_MAX_RINGS];
+
     while (!quit)
     {                
         // Check quit status
         quit = get_quit();    
 
-        // Gather stats from buffers
-        health_data_s data;
-        data.status = health_args->status;
-        collect_buffer_stats(&data, health_args->header_block, health_args->data_block);        
+        uint64_t wake_ns = latency_now_ns();
+
+        // Gather stats from the buffers and the pipeline, then send a record for each ring with its buffer stats and
+        // counters
+        uint64_t data_full_bufs = 0;
+        uint64_t blocks_behind = 0;
+
+        for (int ring = 0; ring < health_args->nrings; ring++)
+        {
+            ring_data[ring].status = health_args->status;
+            collect_buffer_stats(&ring_data[ring], health_args->header_blocks[ring], health_args->data_blocks[ring]);
+            blocks_behind += ring_data[ring].data_bufs_written - ring_data[ring].data_bufs_read;
+            data_full_bufs += ring_data[ring].data_full_bufs;
+        }
+
+        health_ext_s process_ext;
+        collect_pipeline_stats(&process_ext, blocks_behind, last_beam_bytes, &last_ns);
+
+        for (int ring = 0; ring < health_args->nrings; ring++)
+        {
+            health_packet_s packet;
+            packet.data = ring_data[ring];
+            packet.ext = process_ext;
+            collect_ring_stats(&packet.ext, &packet.data, ring, health_args->nrings, health_args->keys[ring], last_ring_beam_bytes[ring]);
+
+            //send the message        
+            if (sendto(sock, &packet, sizeof(health_packet_s), 0, (struct sockaddr *) &si_other, slen) == -1)
+            {
+                multilog(health_args->log, LOG_ERR, "Health: Could not open a socket to health IP: call to sendto() failed.\n");
+                exit(EXIT_FAILURE);        
+            }
+        }
+
+        // Publish for Prometheus too. Failures are logged but are not fatal
+        if (health_args->prometheus_path != NULL)
+            write_prometheus_textfile(health_args->log, health_args->prometheus_path, ring_data, health_args->keys, health_args->nrings);
+
+        trace_span("health", "health", wake_ns, "data_full_bufs", data_full_bufs);
 
-        //send the message        
-        if (sendto(sock, &data, sizeof(health_data_s), 0, (struct sockaddr *) &si_other, slen) == -1)
+        // Dump the trace if asked to (SIGUSR2). Done here too so it still happens between observations
+        if (trace_dump_requested())
         {
-            multilog(health_args->log, LOG_ERR, "Health: Could not open a socket to health IP: call to sendto() failed.\n");
-            exit(EXIT_FAILURE);        
+            char trace_label[64];
+            snprintf(trace_label, sizeof(trace_label), "sigusr2_%ld", (long)time(NULL));
+            trace_dump(health_args->log, trace_label, 0);
         }
 
         // Wait for 1 second
@@ -9,15 +9,19 @@
 
 #include "multilog.h"
 #include "dada_client.h"
+#include "metrics.h"
 
 typedef struct
 {    
     multilog_t* log;
-    ipcbuf_t* header_block;
-    ipcbuf_t* data_block;
+    int nrings;                                 // ringbuffers being read (one health record each is sent)
+    key_t keys[METRICS_MAX_RINGS];
+    ipcbuf_t* header_blocks[METRICS_MAX_RINGS];
+    ipcbuf_t* data_blocks[METRICS_MAX_RINGS];
     int status;
     char* health_udp_ip;
     int health_udp_port;
+    char* prometheus_path; // NULL if we are not writing a Prometheus textfile
 } health_thread_args_s;
 
 #pragma pack(push, 1)
@@ -48,8 +52,95 @@ typedef struct
     uint64_t data_clear_bufs;
     uint64_t data_available_bufs;
 } health_data_s;
+
+// The pipeline extension, sent straight after health_data_s in the same datagram. Receivers which only know
+// health_data_s can ignore the rest. A later version may append fields (and increase ext_length), but never moves them.
+#define HEALTH_EXT_MAGIC 0x4D574246 // "MWBF"
+#define HEALTH_EXT_VERSION 1
+
+// One stage (see latency_stage_enum) over the last health interval
+typedef struct
+{
+    uint64_t count;    // beam seconds which went through the stage
+    uint64_t mean_ns;
+    uint64_t max_ns;
+    uint64_t total_ns; // time spent in the stage
+} health_stage_s;
+
+typedef struct
+{
+    uint32_t ext_magic;
+    uint16_t ext_version;
+    uint16_t ext_length;       // bytes in the extension (including these fields)
+
+    uint64_t interval_ns;      // time the rates and stage figures cover
+
+    int64_t obs_id;            // 0 if not processing an observation. With several rings, the first ring's (see ring_obs_id)
+    int64_t subobs_id;
+    int32_t obs_marker;        // seconds of the observation written
+    int32_t nbeams;
+
+    uint64_t blocks_behind;    // data blocks written to the ringbuffer but not yet read by us
+    uint64_t blocks_processed; // beam seconds written (cumulative)
+    uint64_t blocks_dropped;   // blocks read but not written out (cumulative)
+    uint64_t bytes_dropped;
+
+    health_stage_s stages[LATENCY_STAGE_COUNT]; // io (processing), stats, fil_write, stats_write, tiles
+
+    uint64_t beam_bytes_per_sec[METRICS_MAX_BEAMS]; // only the first nbeams are used
+
+    // Degradation (see degrade.h)
+    int32_t degrade_level;    // see degrade_level_enum (0 = everything written)
+    int32_t reserved;
+    uint64_t degrade_changes; // cumulative
+    uint64_t blocks_shed;     // beam seconds not written to keep up (cumulative)
+    uint64_t stats_skipped;   // beam seconds with no stats to keep up (cumulative)
+
+    // Staging buffers
+    uint64_t staging_pool_maps;   // staging buffer regions mapped (cumulative, normally one per reader)
+    uint64_t staging_heap_allocs; // staging buffers which had to come from the heap (cumulative, should be 0)
+
+    // Finished file records (see notify.h)
+    uint64_t notifications_sent;  // finished files whose record was sent and/or appended (cumulative)
+    uint64_t notification_errors; // finished files whose record could not be (cumulative)
+
+    // Gaps in observations
+    uint64_t gaps;           // gaps in observations filled with zeros (cumulative)
+    uint64_t gap_fill_bytes; // bytes of zeros they were filled with (cumulative)
+
+    // One record is sent per ringbuffer (health_data_s is that ring's); everything above is for the whole process, but
+    // the observation (the first ring's)
+    int32_t ring_key;   // shared memory key of the ring
+    int32_t ring_index; // 0 based, in --key order
+    int32_t nrings;     // ringbuffers read by the process
+    int32_t reserved2;
+
+    // The same as the observation, block, shed, gap and beam rate fields above, but of this ring
+    int64_t ring_obs_id;            // 0 if the ring is not processing an observation
+    int64_t ring_subobs_id;
+    int32_t ring_obs_marker;
+    int32_t ring_nbeams;
+    uint64_t ring_blocks_behind;
+    uint64_t ring_blocks_processed;
+    uint64_t ring_blocks_dropped;
+    uint64_t ring_bytes_dropped;
+    uint64_t ring_blocks_shed;
+    uint64_t ring_gaps;
+    uint64_t ring_gap_fill_bytes;
+    uint64_t ring_beam_bytes_per_sec[METRICS_MAX_BEAMS]; // only the first ring_nbeams are used
+} health_ext_s;
+
+typedef struct
+{
+    health_data_s data;
+    health_ext_s ext;
+} health_packet_s;
 #pragma pack(pop)
 
 #define HEALTH_SLEEP_SECONDS 1  // How often does the health thread send data?
 
+int collect_buffer_stats(health_data_s *health_data, ipcbuf_t *header_block, ipcbuf_t *data_block);
+int collect_pipeline_stats(health_ext_s *health_ext, uint64_t blocks_behind, uint64_t *last_beam_bytes, uint64_t *last_ns);
+int collect_ring_stats(health_ext_s *health_ext, health_data_s *health_data, int ring, int nrings, key_t key, uint64_t *last_beam_bytes);
+
 void* health_thread_fn(void *args);
\ No newline at end of file
@@ -0,0 +1,421 @@
+/**
+ * @file kernels.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code for the per sample kernels, and the choice of which cpu's instructions they use
+ *
+ * The loops which touch every sample of a beam second (the stats, and with --normalise measuring and applying the
+ * bandpass) are built several times from the same C, once for each instruction set we run on: scalar (not vectorised,
+ * as a reference), SSE4.2, AVX2 and AVX-512. The binary is still built for the baseline cpu, and kernels_init() picks
+ * the newest variant the cpu supports (from cpuid) at startup, so the same binary uses AVX-512 where it has it and AVX2
+ * where it does not. --kernels=ISA (or KERNEL=ISA,...) overrides the choice, e.g. to benchmark one against another.
+ *
+ * Each variant also has fast paths for the shapes we normally see (one pol, 1280 or 2560 channels): the shape is a
+ * constant in them, so their loops have no remainder and the pol loop goes away. Other shapes use the generic loops.
+ *
+ * Every variant gives the same results as the others: they all add up the same sums in the same order, and FMA is not
+ * used, as it would round differently. That order is not the one the values come in, though: so that it vectorises,
+ * the sum of each timestep of the stats is reordered into KERNELS_TIME_LANES partial sums (of every 8th value) which are
+ * then added pairwise. The sums are of doubles, so this moves a timestep's sum by at most about nvalues * 1e-16 of the
+ * sum of its magnitudes (under 1e-12 for 2560 values), far below the 7 significant digits of the floats summed.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+typedef void (*kernel_stats_fn)(const float *in, long ntimesteps, long nchan, int npol, double *power_freq, double *power_time);
+typedef void (*kernel_measure_fn)(const float *in, long ntimesteps, int nvalues, const float *offset, const float *clip, float *sum, float *abs_dev);
+typedef void (*kernel_apply_fn)(const float *in, float *out, long ntimesteps, int nvalues, const float *offset, const float *inv_scale);
+
+#define KERNELS_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+_Static_assert(KERNELS_TIME_LANES == 8, "kernel_stats_body() adds up 8 partial sums");
+
+/**
+ *
+ *  @brief Accumulates the stats of a beam second: the sum of each channel (over time and pols) and of each timestep
+ *         (over channels and pols).
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nchan Channels.
+ *  @param[in] npol Pols.
+ *  @param[in,out] power_freq Sum of each channel (added to).
+ *  @param[in,out] power_time Sum of each timestep (added to).
+ */
+KERNELS_ALWAYS_INLINE void kernel_stats_body(const float *__restrict in, long ntimesteps, long nchan, int npol, double *__restrict power_freq,
+                                             double *__restrict power_time)
+{
+    const long nvalues = nchan * npol;
+
+    for (long t = 0; t < ntimesteps; t++)
+    {
+        const float *__restrict row = &in[t * nvalues];
+
+        if (npol == 1)
+        {
+            for (long ch = 0; ch < nchan; ch++)
+                power_freq[ch] += (double)row[ch];
+        }
+        else
+        {
+            for (long ch = 0; ch < nchan; ch++)
+            {
+                for (int pol = 0; pol < npol; pol++)
+                    power_freq[ch] += (double)row[ch * npol + pol];
+            }
+        }
+
+        // The sum of the timestep is kept in lanes (every 8th value), so it vectorises. This reorders the sum, but the
+        // same way in every variant
+        double lanes[KERNELS_TIME_LANES] = {0};
+        long v = 0;
+
+        for (; v + KERNELS_TIME_LANES <= nvalues; v += KERNELS_TIME_LANES)
+        {
+            for (int lane = 0; lane < KERNELS_TIME_LANES; lane++)
+                lanes[lane] += (double)row[v + lane];
+        }
+
+        for (int lane = 0; v < nvalues; v++, lane++)
+            lanes[lane] += (double)row[v];
+
+        power_time[t] += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+}
+
+/**
+ *
+ *  @brief Sums the deviation, and absolute deviation, of each value from the running mean over a beam second (clipped
+ *         to within clip of it). See bandpass.c.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nvalues Values in a time step (channels * pols).
+ *  @param[in] offset The running mean of each value.
+ *  @param[in] clip How far from the running mean each value is clipped.
+ *  @param[in,out] sum Sum of the deviations (added to).
+ *  @param[in,out] abs_dev Sum of the absolute deviations (added to).
+ */
+KERNELS_ALWAYS_INLINE void kernel_measure_body(const float *__restrict in, long ntimesteps, int nvalues, const float *__restrict offset,
+                                               const float *__restrict clip, float *__restrict sum, float *__restrict abs_dev)
+{
+    for (long t = 0; t < ntimesteps; t++)
+    {
+        const float *__restrict row = &in[t * nvalues];
+
+        for (int v = 0; v < nvalues; v++)
+        {
+            float dev = row[v] - offset[v];
+            dev = dev > clip[v] ? clip[v] : dev;
+            dev = dev < -clip[v] ? -clip[v] : dev;
+
+            sum[v] += dev;
+            abs_dev[v] += fabsf(dev);
+        }
+    }
+}
+
+/**
+ *
+ *  @brief Normalises a beam second: out = (in - mean) * (1 / rms) for each value. See bandpass.c.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[out] out Where to write the normalised beam second (must not overlap in).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nvalues Values in a time step (channels * pols).
+ *  @param[in] offset The running mean of each value.
+ *  @param[in] inv_scale 1 / the running rms of each value.
+ */
+KERNELS_ALWAYS_INLINE void kernel_apply_body(const float *__restrict in, float *__restrict out, long ntimesteps, int nvalues, const float *__restrict offset,
+                                             const float *__restrict inv_scale)
+{
+    for (long t = 0; t < ntimesteps; t++)
+    {
+        const float *__restrict in_row = &in[t * nvalues];
+        float *__restrict out_row = &out[t * nvalues];
+
+        for (int v = 0; v < nvalues; v++)
+            out_row[v] = (in_row[v] - offset[v]) * inv_scale[v];
+    }
+}
+
+// The shape fast paths: the same loops with the shape as a constant
+KERNELS_ALWAYS_INLINE void kernel_stats_shaped(const float *in, long ntimesteps, long nchan, int npol, double *power_freq, double *power_time)
+{
+    if (npol == 1 && nchan == 1280)
+        kernel_stats_body(in, ntimesteps, 1280, 1, power_freq, power_time);
+    else if (npol == 1 && nchan == 2560)
+        kernel_stats_body(in, ntimesteps, 2560, 1, power_freq, power_time);
+    else if (npol == 1)
+        kernel_stats_body(in, ntimesteps, nchan, 1, power_freq, power_time);
+    else
+        kernel_stats_body(in, ntimesteps, nchan, npol, power_freq, power_time);
+}
+
+KERNELS_ALWAYS_INLINE void kernel_measure_shaped(const float *in, long ntimesteps, int nvalues, const float *offset, const float *clip, float *sum, float *abs_dev)
+{
+    if (nvalues == 1280)
+        kernel_measure_body(in, ntimesteps, 1280, offset, clip, sum, abs_dev);
+    else if (nvalues == 2560)
+        kernel_measure_body(in, ntimesteps, 2560, offset, clip, sum, abs_dev);
+    else
+        kernel_measure_body(in, ntimesteps, nvalues, offset, clip, sum, abs_dev);
+}
+
+KERNELS_ALWAYS_INLINE void kernel_apply_shaped(const float *in, float *out, long ntimesteps, int nvalues, const float *offset, const float *inv_scale)
+{
+    if (nvalues == 1280)
+        kernel_apply_body(in, out, ntimesteps, 1280, offset, inv_scale);
+    else if (nvalues == 2560)
+        kernel_apply_body(in, out, ntimesteps, 2560, offset, inv_scale);
+    else
+        kernel_apply_body(in, out, ntimesteps, nvalues, offset, inv_scale);
+}
+
+// Builds each kernel for one instruction set (the bodies above are inlined into them, and compiled for it)
+#define KERNELS_VARIANT(isa, attributes)                                                                                                             \
+    attributes static void kernel_stats_##isa(const float *in, long ntimesteps, long nchan, int npol, double *power_freq, double *power_time)     \
+    {                                                                                                                                                \
+        kernel_stats_shaped(in, ntimesteps, nchan, npol, power_freq, power_time);                                                                    \
+    }                                                                                                                                                \
+    attributes static void kernel_measure_##isa(const float *in, long ntimesteps, int nvalues, const float *offset, const float *clip, float *sum, \
+                                                float *abs_dev)                                                                                      \
+    {                                                                                                                                                \
+        kernel_measure_shaped(in, ntimesteps, nvalues, offset, clip, sum, abs_dev);                                                                  \
+    }                                                                                                                                                \
+    attributes static void kernel_apply_##isa(const float *in, float *out, long ntimesteps, int nvalues, const float *offset, const float *inv_scale) \
+    {                                                                                                                                                \
+        kernel_apply_shaped(in, out, ntimesteps, nvalues, offset, inv_scale);                                                                        \
+    }
+
+KERNELS_VARIANT(scalar, __attribute__((optimize("no-tree-vectorize"))))
+
+#if defined(__x86_64__)
+KERNELS_VARIANT(sse42, __attribute__((target("sse4.2"))))
+KERNELS_VARIANT(avx2, __attribute__((target("avx2"))))
+KERNELS_VARIANT(avx512, __attribute__((target("avx512f"))))
+#else
+KERNELS_VARIANT(generic, )
+#endif
+
+typedef struct kernels_variant_s
+{
+    const char *name; // as given to --kernels, and logged
+    kernel_stats_fn stats;
+    kernel_measure_fn measure;
+    kernel_apply_fn apply;
+} kernels_variant_s;
+
+// Oldest first: the newest the cpu supports is the default
+static const kernels_variant_s kernels_variants[] = {
+    {"scalar", kernel_stats_scalar, kernel_measure_scalar, kernel_apply_scalar},
+#if defined(__x86_64__)
+    {"sse4.2", kernel_stats_sse42, kernel_measure_sse42, kernel_apply_sse42},
+    {"avx2", kernel_stats_avx2, kernel_measure_avx2, kernel_apply_avx2},
+    {"avx512", kernel_stats_avx512, kernel_measure_avx512, kernel_apply_avx512},
+#else
+    {"generic", kernel_stats_generic, kernel_measure_generic, kernel_apply_generic},
+#endif
+};
+
+#define KERNELS_VARIANT_COUNT (int)(sizeof(kernels_variants) / sizeof(kernels_variants[0]))
+
+// The kernels
+enum
+{
+    KERNEL_STATS,
+    KERNEL_BANDPASS_MEASURE,
+    KERNEL_BANDPASS_APPLY,
+    KERNEL_COUNT
+};
+
+static const char *kernel_names[KERNEL_COUNT] = {"stats", "bandpass_measure", "bandpass_apply"};
+
+// The variant of each kernel in use. Scalar until kernels_init() is called (e.g. by the tools)
+static int kernel_variant[KERNEL_COUNT] = {0};
+
+/**
+ *
+ *  @brief Accumulates the stats of a beam second: the sum of each channel (over time and pols) and of each timestep
+ *         (over channels and pols).
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nchan Channels.
+ *  @param[in] npol Pols.
+ *  @param[in,out] power_freq Sum of each channel (added to).
+ *  @param[in,out] power_time Sum of each timestep (added to).
+ */
+void kernel_stats(const float *in, long ntimesteps, long nchan, int npol, double *power_freq, double *power_time)
+{
+    kernels_variants[kernel_variant[KERNEL_STATS]].stats(in, ntimesteps, nchan, npol, power_freq, power_time);
+}
+
+/**
+ *
+ *  @brief Sums the deviation, and absolute deviation, of each value from the running mean over a beam second (clipped
+ *         to within clip of it).
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nvalues Values in a time step (channels * pols).
+ *  @param[in] offset The running mean of each value.
+ *  @param[in] clip How far from the running mean each value is clipped.
+ *  @param[in,out] sum Sum of the deviations (added to).
+ *  @param[in,out] abs_dev Sum of the absolute deviations (added to).
+ */
+void kernel_bandpass_measure(const float *in, long ntimesteps, int nvalues, const float *offset, const float *clip, float *sum, float *abs_dev)
+{
+    kernels_variants[kernel_variant[KERNEL_BANDPASS_MEASURE]].measure(in, ntimesteps, nvalues, offset, clip, sum, abs_dev);
+}
+
+/**
+ *
+ *  @brief Normalises a beam second: out = (in - mean) * (1 / rms) for each value.
+ *  @param[in] in The beam second ([time][channel][pol]).
+ *  @param[out] out Where to write the normalised beam second (must not overlap in).
+ *  @param[in] ntimesteps Time steps in the beam second.
+ *  @param[in] nvalues Values in a time step (channels * pols).
+ *  @param[in] offset The running mean of each value.
+ *  @param[in] inv_scale 1 / the running rms of each value.
+ */
+void kernel_bandpass_apply(const float *in, float *out, long ntimesteps, int nvalues, const float *offset, const float *inv_scale)
+{
+    kernels_variants[kernel_variant[KERNEL_BANDPASS_APPLY]].apply(in, out, ntimesteps, nvalues, offset, inv_scale);
+}
+
+/**
+ *
+ *  @brief Looks up a variant by name.
+ *  @param[in] name The name (e.g. avx2), which need not be terminated after len.
+ *  @param[in] len Length of the name.
+ *  @returns The index of the variant, or -1 if there is none of that name.
+ */
+static int kernels_find_variant(const char *name, size_t len)
+{
+    for (int variant = 0; variant < KERNELS_VARIANT_COUNT; variant++)
+    {
+        if (strlen(kernels_variants[variant].name) == len && strncmp(kernels_variants[variant].name, name, len) == 0)
+            return variant;
+    }
+
+    return -1;
+}
+
+/**
+ *
+ *  @brief Chooses the variant of each kernel: the newest the cpu supports, unless overridden. Call once from main()
+ *         before any reader starts.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] override NULL, or (--kernels) a comma separated list of ISA (every kernel) or KERNEL=ISA e.g.
+ *             "avx2" or "stats=scalar,bandpass_apply=avx512".
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the override is not valid or not supported by this cpu.
+ */
+int kernels_init(multilog_t *log, const char *override)
+{
+    int supported[KERNELS_VARIANT_COUNT];
+    int best = 0;
+
+    supported[0] = 1;
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+
+    supported[1] = __builtin_cpu_supports("sse4.2");
+    supported[2] = __builtin_cpu_supports("avx2");
+    supported[3] = __builtin_cpu_supports("avx512f");
+#else
+    supported[1] = 1;
+#endif
+
+    char cpu_text[64] = "";
+
+    for (int variant = 0; variant < KERNELS_VARIANT_COUNT; variant++)
+    {
+        if (supported[variant])
+        {
+            best = variant;
+            snprintf(cpu_text + strlen(cpu_text), sizeof(cpu_text) - strlen(cpu_text), "%s%s", variant ? " " : "", kernels_variants[variant].name);
+        }
+    }
+
+    for (int kernel = 0; kernel < KERNEL_COUNT; kernel++)
+        kernel_variant[kernel] = best;
+
+    // Overrides: ISA or KERNEL=ISA, comma separated
+    const char *item = override;
+
+    while (item != NULL && *item != '\0')
+    {
+        size_t item_len = strcspn(item, ",");
+        const char *equals = memchr(item, '=', item_len);
+        const char *isa = equals ? equals + 1 : item;
+        size_t isa_len = item_len - (isa - item);
+        int variant = kernels_find_variant(isa, isa_len);
+        int kernel = -1;
+
+        if (equals != NULL)
+        {
+            for (int k = 0; k < KERNEL_COUNT; k++)
+            {
+                if (strlen(kernel_names[k]) == (size_t)(equals - item) && strncmp(kernel_names[k], item, equals - item) == 0)
+                    kernel = k;
+            }
+
+            if (kernel < 0)
+            {
+                multilog(log, LOG_ERR, "kernels_init(): Unknown kernel in --kernels: %.*s (expected stats, bandpass_measure or bandpass_apply).\n", (int)(equals - item), item);
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (variant < 0)
+        {
+            multilog(log, LOG_ERR, "kernels_init(): Unknown instruction set in --kernels: %.*s (this cpu supports: %s).\n", (int)isa_len, isa, cpu_text);
+            return EXIT_FAILURE;
+        }
+
+        if (!supported[variant])
+        {
+            multilog(log, LOG_ERR, "kernels_init(): This cpu does not support %s (it supports: %s).\n", kernels_variants[variant].name, cpu_text);
+            return EXIT_FAILURE;
+        }
+
+        for (int k = 0; k < KERNEL_COUNT; k++)
+        {
+            if (kernel < 0 || k == kernel)
+                kernel_variant[k] = variant;
+        }
+
+        item += item_len;
+
+        if (*item == ',')
+            item++;
+    }
+
+    for (int kernel = 0; kernel < KERNEL_COUNT; kernel++)
+    {
+        multilog(log, LOG_INFO, "kernels_init(): %s: %s%s (this cpu supports: %s)\n", kernel_names[kernel], kernels_variants[kernel_variant[kernel]].name,
+                 kernel_variant[kernel] != best ? " (overridden)" : "", cpu_text);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Names the shape path the kernels take for a beam (for the log).
+ *  @param[in] nchan Channels.
+ *  @param[in] npol Pols.
+ *  @returns The name of the path.
+ */
+const char *kernels_shape_name(long nchan, int npol)
+{
+    if (npol == 1 && nchan == 1280)
+        return "1 pol x 1280 channels";
+    else if (npol == 1 && nchan == 2560)
+        return "1 pol x 2560 channels";
+    else if (npol == 1)
+        return "1 pol (generic channels)";
+    else
+        return "generic";
+}
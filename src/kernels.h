@@ -0,0 +1,19 @@
+/**
+ * @file kernels.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the per sample kernels, and the choice of which cpu's instructions they use
+ *
+ */
+#pragma once
+
+#include "multilog.h"
+
+#define KERNELS_TIME_LANES 8 // Partial sums per timestep of the stats (a reordered sum, but the same in every variant)
+
+void kernel_stats(const float *in, long ntimesteps, long nchan, int npol, double *power_freq, double *power_time);
+void kernel_bandpass_measure(const float *in, long ntimesteps, int nvalues, const float *offset, const float *clip, float *sum, float *abs_dev);
+void kernel_bandpass_apply(const float *in, float *out, long ntimesteps, int nvalues, const float *offset, const float *inv_scale);
+
+int kernels_init(multilog_t *log, const char *override);
+const char *kernels_shape_name(long nchan, int npol);
@@ -0,0 +1,176 @@
+/**
+ * @file latency.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that records per stage latency histograms of the hot path
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+
+const char *latency_stage_names[LATENCY_STAGE_COUNT] = {"io", "stats", "fil_write", "stats_write", "tiles"};
+
+static int g_latency_dump_requested = 0;
+
+/**
+ *
+ *  @brief Returns the bucket index for a value.
+ *  @param[in] value_ns Value in nanoseconds.
+ *  @returns Bucket index.
+ */
+static int latency_bucket(uint64_t value_ns)
+{
+    if (value_ns < LATENCY_SUB_BUCKETS)
+        return (int)value_ns;
+
+    int msb = 63 - __builtin_clzll(value_ns);
+    int shift = msb - LATENCY_SUB_BUCKET_BITS;
+    int bucket = (msb - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + (int)((value_ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
+
+    return bucket < LATENCY_HISTOGRAM_BUCKETS ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ *
+ *  @brief Returns the largest value (ns) which falls in a bucket.
+ *  @param[in] bucket Bucket index.
+ *  @returns Upper bound of the bucket in nanoseconds.
+ */
+uint64_t latency_bucket_upper_ns(int bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return (uint64_t)bucket;
+
+    int msb = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+    int shift = msb - LATENCY_SUB_BUCKET_BITS;
+    uint64_t sub_bucket = bucket % LATENCY_SUB_BUCKETS;
+
+    return ((LATENCY_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+/**
+ *
+ *  @brief Records one value into a histogram. Lock free.
+ *  @param[in] histogram Pointer to the histogram.
+ *  @param[in] value_ns Value in nanoseconds.
+ */
+void latency_record(latency_histogram_s *histogram, uint64_t value_ns)
+{
+    __atomic_fetch_add(&histogram->buckets[latency_bucket(value_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_ns, value_ns, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (value_ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, value_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ *
+ *  @brief Zeros a histogram.
+ *  @param[in] histogram Pointer to the histogram.
+ */
+void latency_reset(latency_histogram_s *histogram)
+{
+    memset(histogram, 0, sizeof(latency_histogram_s));
+}
+
+/**
+ *
+ *  @brief Returns the value (upper bound of the bucket, ns) at a percentile.
+ *  @param[in] histogram Pointer to the histogram.
+ *  @param[in] percentile Percentile (0-100).
+ *  @returns Value at the percentile in nanoseconds, or 0 if the histogram is empty.
+ */
+uint64_t latency_percentile(latency_histogram_s *histogram, double percentile)
+{
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+
+    if (count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(count * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for (int bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+
+        if (seen > target)
+        {
+            uint64_t upper = latency_bucket_upper_ns(bucket);
+            uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+            return upper < max ? upper : max;
+        }
+    }
+
+    return __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Logs a one line summary of a histogram (count, mean, p50, p90, p99, max in ms).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] label Label for the line.
+ *  @param[in] histogram Pointer to the histogram.
+ */
+void latency_log_histogram(multilog_t *log, const char *label, latency_histogram_s *histogram)
+{
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+
+    if (count == 0)
+        return;
+
+    multilog(log, LOG_INFO, "Latency %-20s n=%-6lu mean=%9.3f p50=%9.3f p90=%9.3f p99=%9.3f max=%9.3f ms\n", label, count,
+             __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED) / 1e6 / count, latency_percentile(histogram, 50) / 1e6,
+             latency_percentile(histogram, 90) / 1e6, latency_percentile(histogram, 99) / 1e6,
+             __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED) / 1e6);
+}
+
+/**
+ *
+ *  @brief Measures the cost of timing and recording one stage, so the overhead of the instrumentation is known.
+ *  @returns Mean nanoseconds per stage (one timestamp + one record).
+ */
+double latency_measure_overhead_ns()
+{
+    const int iterations = 100000;
+    latency_histogram_s *scratch = calloc(1, sizeof(latency_histogram_s));
+
+    uint64_t start = latency_now_ns();
+    uint64_t last = start;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        uint64_t now = latency_now_ns();
+        latency_record(scratch, now - last);
+        last = now;
+    }
+
+    double overhead = (double)(latency_now_ns() - start) / iterations;
+    free(scratch);
+
+    return overhead;
+}
+
+/**
+ *
+ *  @brief Flags that the histograms should be dumped. Safe to call from a signal handler.
+ */
+void latency_request_dump()
+{
+    __atomic_store_n(&g_latency_dump_requested, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Returns (and clears) whether a dump of the histograms was requested.
+ *  @returns 1 if a dump was requested, 0 otherwise.
+ */
+int latency_dump_requested()
+{
+    return __atomic_exchange_n(&g_latency_dump_requested, 0, __ATOMIC_RELAXED);
+}
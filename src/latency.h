@@ -0,0 +1,62 @@
+/**
+ * @file latency.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that records per stage latency histograms of the hot path
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include "multilog.h"
+
+// Histogram buckets are log-linear (HDR style): values < 16ns get their own bucket, then each power of 2
+// is split into 16 sub-buckets, so any value is within 6.25% of its bucket. 640 buckets covers > 1000 sec.
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS 640
+
+typedef enum latency_stage_enum
+{
+    stage_io = 0,      // All of dada_dbfil_io() for one beam second
+    stage_stats,       // Stats accumulation (the stats stage's tiles)
+    stage_fil_write,   // create_fil_block()
+    stage_stats_write, // fopen/write/fclose of the per second stats files
+    stage_tiles,       // The pipeline's passes over the samples (every stage's tiles, see pipeline.c)
+    LATENCY_STAGE_COUNT
+} latency_stage_enum;
+
+extern const char *latency_stage_names[LATENCY_STAGE_COUNT];
+
+// Updated with relaxed atomics, so the reader never takes a lock and any thread can read it
+typedef struct latency_histogram_s
+{
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} latency_histogram_s;
+
+/**
+ *
+ *  @brief Returns a monotonic timestamp in nanoseconds (clock_gettime is a vDSO call, ~20ns).
+ *  @returns Monotonic time in ns.
+ */
+static inline uint64_t latency_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void latency_record(latency_histogram_s *histogram, uint64_t value_ns);
+void latency_reset(latency_histogram_s *histogram);
+uint64_t latency_percentile(latency_histogram_s *histogram, double percentile);
+uint64_t latency_bucket_upper_ns(int bucket);
+void latency_log_histogram(multilog_t *log, const char *label, latency_histogram_s *histogram);
+double latency_measure_overhead_ns();
+
+// SIGUSR1 asks the reader to dump the histograms of the observation in progress
+void latency_request_dump();
+int latency_dump_requested();
@@ -0,0 +1,775 @@
+/**
+ * @file loadgen.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief Synthetic MWAX beamformer load generator, used to soak test mwax_beamdb2fil
+ *
+ * This creates a local psrdada ringbuffer (or writes a dada file) and fills it with
+ * realistic PSRDADA headers and synthetic beam data, one 8 second sub-observation per
+ * transfer, at a configurable multiple of real time. A metafits stub is written for each
+ * observation. While running, the fill level of the ring is sampled so we can tell whether
+ * mwax_beamdb2fil keeps up.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <linux/limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fitsio.h>
+#include "ascii_header.h"
+#include "dada_hdu.h"
+#include "ipcbuf.h"
+#include "multilog.h"
+#include "version.h"
+#include "../mwax_common/mwax_global_defs.h" // From mwax-common
+
+#define LOADGEN_HDR_SIZE 4096          // Size of each PSRDADA header
+#define LOADGEN_MAX_OBS 256            // Maximum number of observations in --durations
+#define LOADGEN_DATA_SECONDS 4         // Number of distinct seconds of synthetic data per beam (then we cycle)
+#define LOADGEN_GPS_EPOCH_UNIX 315964800 // Unix time of the GPS epoch (1980-01-06)
+#define LOADGEN_GPS_LEAP_SECONDS 18    // GPS - UTC
+#define LOADGEN_GPS_EPOCH_MJD 44244.0  // MJD of the GPS epoch
+
+// Command line Args
+typedef struct
+{
+  key_t ring_key;
+  char *output_file;
+  char *metafits_path;
+  char *fill_log;
+  char *mode;
+  int nbeams;
+  long nchan;
+  long time_integration;
+  int bandwidth_hz;
+  int coarse_channel;
+  int secs_per_subobs;
+  int nbufs;
+  double realtime_factor;
+  int start_delay;
+  int send_quit;
+  int keep_ring;
+  long first_obs_id;
+  int obs_count;
+  int initial_duration[LOADGEN_MAX_OBS]; // EXPOSURE_SECS in the first sub-observation
+  int final_duration[LOADGEN_MAX_OBS];   // EXPOSURE_SECS from the second sub-observation on
+} loadgenArgs_s;
+
+// Fill level statistics gathered by the monitor thread
+typedef struct
+{
+  multilog_t *log;
+  ipcbuf_t *data_block;
+  FILE *fill_log;
+  struct timespec start;
+  volatile long obs_id;
+  volatile int obs_offset;
+  volatile int done;
+
+  uint64_t nbufs;
+  uint64_t samples;
+  uint64_t max_full;
+  double sum_full;
+  uint64_t samples_over_90pct;
+  double max_lateness;
+  pthread_mutex_t mutex;
+} loadgen_monitor_s;
+
+volatile int g_loadgen_quit = 0;
+
+/**
+ *
+ *  @brief Stop generating at the next sub-observation boundary on SIGINT.
+ *  @param[in] signum Signal number to handle.
+ */
+void loadgen_sig_handler(int signum)
+{
+  (void)signum;
+  g_loadgen_quit = 1;
+}
+
+/**
+ *
+ *  @brief Returns seconds elapsed since start.
+ *  @param[in] start Time we started.
+ *  @returns seconds since start.
+ */
+double loadgen_elapsed(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ *
+ *  @brief Provides the user with the summary of usage/help.
+ */
+void loadgen_print_usage()
+{
+  printf("mwax_beamdb2fil_loadgen v%d.%d.%d\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  printf("\nUsage: mwax_beamdb2fil_loadgen [OPTION]...\n\n");
+  printf("This generates synthetic MWAX beamformer data into a new psrdada ringbuffer\n");
+  printf("(or a dada file) so mwax_beamdb2fil can be soak tested without a beamformer.\n\n");
+  printf("  -k --key=KEY                 Hexadecimal shared memory key of the ring to create\n");
+  printf("  -o --output-file=PATH        Write a dada file instead of a ringbuffer\n");
+  printf("  -m --metafits-path=PATH      Directory to write metafits stubs into\n");
+  printf("  -b --beams=N                 Number of incoherent beams (default 1)\n");
+  printf("  -c --channels=N              Fine channels per beam (default 1280)\n");
+  printf("  -t --time-integration=N      Time integration (tscrunch) per beam (default 1)\n");
+  printf("  -D --durations=LIST          Comma separated observation durations in sec, run back to back\n");
+  printf("                               (default 16). 'A/B' starts at A sec and changes EXPOSURE_SECS\n");
+  printf("                               to B sec at the second sub-observation\n");
+  printf("  -O --obs-id=ID               First observation id (default derived from the current time)\n");
+  printf("  -r --realtime-factor=F       Data rate as a multiple of real time, 0=unthrottled (default 1)\n");
+  printf("  -n --nbufs=N                 Number of data blocks in the ring (default 64)\n");
+  printf("  -l --fill-log=PATH           Write ring fill level samples (CSV) to PATH\n");
+  printf("  -w --start-delay=SEC         Seconds to wait for a reader after creating the ring (default 5)\n");
+  printf("  -M --mode=MODE               MODE to put in the header (default HW_LFILES)\n");
+  printf("  -C --coarse-channel=N        Coarse channel number (default 109)\n");
+  printf("  -q --quit                    Send a QUIT header once all observations are written\n");
+  printf("  -K --keep-ring               Do not destroy the ring on exit\n");
+  printf("  -? --help                    This help text\n");
+}
+
+/**
+ *
+ *  @brief Parses the --durations list.
+ *  @param[in] list The comma separated list.
+ *  @param[in,out] args Where the observation durations go.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int loadgen_parse_durations(char *list, loadgenArgs_s *args)
+{
+  args->obs_count = 0;
+
+  for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ","))
+  {
+    if (args->obs_count == LOADGEN_MAX_OBS)
+      return EXIT_FAILURE;
+
+    int initial = 0;
+    int final = 0;
+    int fields = sscanf(token, "%d/%d", &initial, &final);
+
+    if (fields < 1 || initial <= 0)
+      return EXIT_FAILURE;
+
+    args->initial_duration[args->obs_count] = initial;
+    args->final_duration[args->obs_count] = (fields == 2 && final > 0) ? final : initial;
+    args->obs_count++;
+  }
+
+  return args->obs_count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ *
+ *  @brief Parses and validates command line arguments.
+ *  @param[in] argc Count of arguments passed from main()
+ *  @param[in] argv[] Array of arguments passed from main()
+ *  @param[out] args Pointer to the structure where we put the parsed arguments.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int loadgen_process_args(int argc, char *argv[], loadgenArgs_s *args)
+{
+  memset(args, 0, sizeof(loadgenArgs_s));
+  args->metafits_path = ".";
+  args->mode = "HW_LFILES";
+  args->nbeams = 1;
+  args->nchan = 1280;
+  args->time_integration = 1;
+  args->bandwidth_hz = 1280000;
+  args->coarse_channel = 109;
+  args->secs_per_subobs = 8;
+  args->nbufs = 64;
+  args->realtime_factor = 1.0;
+  args->start_delay = 5;
+  args->obs_count = 1;
+  args->initial_duration[0] = 16;
+  args->final_duration[0] = 16;
+
+  static const char *optString = "k:o:m:b:c:t:D:O:r:n:l:w:M:C:qK?";
+
+  static const struct option longOpts[] =
+      {
+          {"key", required_argument, NULL, 'k'},
+          {"output-file", required_argument, NULL, 'o'},
+          {"metafits-path", required_argument, NULL, 'm'},
+          {"beams", required_argument, NULL, 'b'},
+          {"channels", required_argument, NULL, 'c'},
+          {"time-integration", required_argument, NULL, 't'},
+          {"durations", required_argument, NULL, 'D'},
+          {"obs-id", required_argument, NULL, 'O'},
+          {"realtime-factor", required_argument, NULL, 'r'},
+          {"nbufs", required_argument, NULL, 'n'},
+          {"fill-log", required_argument, NULL, 'l'},
+          {"start-delay", required_argument, NULL, 'w'},
+          {"mode", required_argument, NULL, 'M'},
+          {"coarse-channel", required_argument, NULL, 'C'},
+          {"quit", no_argument, NULL, 'q'},
+          {"keep-ring", no_argument, NULL, 'K'},
+          {"help", no_argument, NULL, '?'},
+          {NULL, no_argument, NULL, 0}};
+
+  int opt = 0;
+  int longIndex = 0;
+
+  while ((opt = getopt_long(argc, argv, optString, longOpts, &longIndex)) != -1)
+  {
+    switch (opt)
+    {
+    case 'k':
+      args->ring_key = strtol(optarg, NULL, 16);
+      break;
+    case 'o':
+      args->output_file = optarg;
+      break;
+    case 'm':
+      args->metafits_path = optarg;
+      break;
+    case 'b':
+      args->nbeams = atoi(optarg);
+      break;
+    case 'c':
+      args->nchan = atol(optarg);
+      break;
+    case 't':
+      args->time_integration = atol(optarg);
+      break;
+    case 'D':
+      if (loadgen_parse_durations(optarg, args) != EXIT_SUCCESS)
+      {
+        fprintf(stderr, "Error: --durations must be a comma separated list of (at most %d) durations.\n", LOADGEN_MAX_OBS);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'O':
+      args->first_obs_id = atol(optarg);
+      break;
+    case 'r':
+      args->realtime_factor = atof(optarg);
+      break;
+    case 'n':
+      args->nbufs = atoi(optarg);
+      break;
+    case 'l':
+      args->fill_log = optarg;
+      break;
+    case 'w':
+      args->start_delay = atoi(optarg);
+      break;
+    case 'M':
+      args->mode = optarg;
+      break;
+    case 'C':
+      args->coarse_channel = atoi(optarg);
+      break;
+    case 'q':
+      args->send_quit = 1;
+      break;
+    case 'K':
+      args->keep_ring = 1;
+      break;
+    case '?':
+    default:
+      loadgen_print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!args->ring_key && !args->output_file)
+  {
+    fprintf(stderr, "Error: one of (-k | --key) or (-o | --output-file) is mandatory.\n");
+    loadgen_print_usage();
+    return EXIT_FAILURE;
+  }
+
+  if (args->nbeams < 1 || args->nbeams > INCOHERENT_BEAMS_MAX)
+  {
+    fprintf(stderr, "Error: --beams must be between 1 and %d.\n", INCOHERENT_BEAMS_MAX);
+    return EXIT_FAILURE;
+  }
+
+  if (args->nchan < 1 || args->time_integration < 1 || args->bandwidth_hz % (args->nchan * args->time_integration) != 0)
+  {
+    fprintf(stderr, "Error: bandwidth (%d Hz) must be divisible by channels * time integration.\n", args->bandwidth_hz);
+    return EXIT_FAILURE;
+  }
+
+  for (int obs = 0; obs < args->obs_count; obs++)
+  {
+    if (args->initial_duration[obs] % args->secs_per_subobs != 0 || args->final_duration[obs] % args->secs_per_subobs != 0)
+    {
+      fprintf(stderr, "Error: observation durations must be multiples of %d sec.\n", args->secs_per_subobs);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Default the obs id to now (GPS time), on a sub-observation boundary
+  if (args->first_obs_id == 0)
+  {
+    args->first_obs_id = time(NULL) - LOADGEN_GPS_EPOCH_UNIX + LOADGEN_GPS_LEAP_SECONDS;
+    args->first_obs_id -= args->first_obs_id % args->secs_per_subobs;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Writes a metafits stub for an observation, with just the keys mwax_beamdb2fil reads.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] args Pointer to the command line args.
+ *  @param[in] obs_id The observation id (GPS time).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int loadgen_write_metafits(multilog_t *log, loadgenArgs_s *args, long obs_id)
+{
+  char filename[PATH_MAX];
+  snprintf(filename, PATH_MAX, "!%s/%ld_metafits.fits", args->metafits_path, obs_id); // ! == overwrite
+
+  fitsfile *fptr = NULL;
+  int status = 0;
+  double mjd = LOADGEN_GPS_EPOCH_MJD + (obs_id - LOADGEN_GPS_LEAP_SECONDS) / 86400.0;
+  double ra = 83.633;   // Crab
+  double dec = 22.0145; // Crab
+  double altitude = 40.0;
+  double azimuth = 0.0;
+  char source[FLEN_VALUE] = "loadgen_synthetic";
+
+  fits_create_file(&fptr, filename, &status);
+  fits_create_img(fptr, 8, 0, NULL, &status);
+  fits_update_key(fptr, TLONG, "GPSTIME", &obs_id, "[s] GPS time of observation start", &status);
+  fits_update_key(fptr, TDOUBLE, "MJD", &mjd, "[days] MJD of observation", &status);
+  fits_update_key(fptr, TDOUBLE, "RA", &ra, "[deg] RA of pointing centre", &status);
+  fits_update_key(fptr, TDOUBLE, "DEC", &dec, "[deg] Dec of pointing centre", &status);
+  fits_update_key(fptr, TDOUBLE, "ALTITUDE", &altitude, "[deg] Altitude of pointing centre", &status);
+  fits_update_key(fptr, TDOUBLE, "AZIMUTH", &azimuth, "[deg] Azimuth of pointing centre", &status);
+  fits_update_key(fptr, TSTRING, "FILENAME", source, "Name of observation", &status);
+  fits_close_file(fptr, &status);
+
+  if (status)
+  {
+    char error_text[30] = "";
+    fits_get_errstatus(status, error_text);
+    multilog(log, LOG_ERR, "loadgen_write_metafits(): Error writing %s. Error: %d -- %s\n", filename + 1, status, error_text);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Fills a PSRDADA header for one sub-observation.
+ *  @param[in] args Pointer to the command line args.
+ *  @param[out] header Header buffer (LOADGEN_HDR_SIZE bytes).
+ *  @param[in] mode Value of MODE.
+ *  @param[in] obs_id Observation id.
+ *  @param[in] obs_offset Seconds since the start of the observation.
+ *  @param[in] duration Value of EXPOSURE_SECS.
+ *  @param[in] transfer_size Bytes of data in this sub-observation.
+ */
+void loadgen_fill_header(loadgenArgs_s *args, char *header, const char *mode, long obs_id, int obs_offset, int duration, uint64_t transfer_size)
+{
+  memset(header, 0, LOADGEN_HDR_SIZE);
+
+  // UTC_START is the start of the observation, not of this sub-observation
+  time_t unix_start = obs_id + LOADGEN_GPS_EPOCH_UNIX - LOADGEN_GPS_LEAP_SECONDS;
+  struct tm utc;
+  char utc_start[32];
+  gmtime_r(&unix_start, &utc);
+  strftime(utc_start, sizeof(utc_start), "%Y-%m-%d-%H:%M:%S", &utc);
+
+  ascii_header_set(header, "HDR_SIZE", "%d", LOADGEN_HDR_SIZE);
+  ascii_header_set(header, "HDR_VERSION", "%s", "1.0");
+  ascii_header_set(header, HEADER_MODE, "%s", mode);
+  ascii_header_set(header, HEADER_OBS_ID, "%ld", obs_id);
+  ascii_header_set(header, HEADER_SUBOBS_ID, "%ld", obs_id + obs_offset);
+  ascii_header_set(header, HEADER_OBS_OFFSET, "%d", obs_offset);
+  ascii_header_set(header, HEADER_UTC_START, "%s", utc_start);
+  ascii_header_set(header, HEADER_EXPOSURE_SECS, "%d", duration);
+  ascii_header_set(header, HEADER_SECS_PER_SUBOBS, "%d", args->secs_per_subobs);
+  ascii_header_set(header, HEADER_NBIT, "%d", 32);
+  ascii_header_set(header, HEADER_NPOL, "%d", 1);
+  ascii_header_set(header, HEADER_TRANSFER_SIZE, "%lu", transfer_size);
+  ascii_header_set(header, HEADER_COARSE_CHANNEL, "%d", args->coarse_channel);
+  ascii_header_set(header, HEADER_BANDWIDTH_HZ, "%d", args->bandwidth_hz);
+  ascii_header_set(header, HEADER_NUM_INCOHERENT_BEAMS, "%d", args->nbeams);
+  ascii_header_set(header, HEADER_NUM_COHERENT_BEAMS, "%d", 0);
+  ascii_header_set(header, HEADER_MC_IP, "%s", "0.0.0.0");
+  ascii_header_set(header, HEADER_MC_PORT, "%d", 0);
+
+  for (int beam = 0; beam < args->nbeams; beam++)
+  {
+    ascii_header_set(header, incoherent_beam_time_integ_string[beam], "%ld", args->time_integration);
+    ascii_header_set(header, incoherent_beam_fine_chan_string[beam], "%ld", args->nchan);
+  }
+}
+
+/**
+ *
+ *  @brief Generates LOADGEN_DATA_SECONDS seconds of synthetic beam power for one beam: a bandpass
+ *         with coarse channel edge roll-off, noise, and a bright sample every 100ms.
+ *  @param[in] args Pointer to the command line args.
+ *  @param[in] beam Beam index (used to seed).
+ *  @param[out] data Buffer of LOADGEN_DATA_SECONDS * ntimesteps * nchan floats.
+ */
+void loadgen_generate_beam(loadgenArgs_s *args, int beam, float *data)
+{
+  long ntimesteps = args->bandwidth_hz / args->time_integration / args->nchan;
+  uint32_t seed = 12345 + beam;
+
+  for (long t = 0; t < LOADGEN_DATA_SECONDS * ntimesteps; t++)
+  {
+    int pulse = (t % (ntimesteps / 10 > 0 ? ntimesteps / 10 : 1)) == 0;
+
+    for (long ch = 0; ch < args->nchan; ch++)
+    {
+      // Coarse channel (PFB) roll-off towards each edge
+      double x = ((double)ch + 0.5) / args->nchan - 0.5;
+      double bandpass = 100.0 * (1.0 - 0.6 * pow(2.0 * fabs(x), 4.0)) * args->time_integration;
+
+      // Cheap LCG noise, +/- 10%
+      seed = seed * 1664525u + 1013904223u;
+      double noise = ((seed >> 8) / 16777216.0 - 0.5) * 0.2;
+
+      data[t * args->nchan + ch] = (float)(bandpass * (1.0 + noise + (pulse ? 0.5 : 0.0)));
+    }
+  }
+}
+
+/**
+ *
+ *  @brief Monitor thread- samples the fill level of the ring 10 times a second.
+ *  @param[in] args Pointer to the loadgen_monitor_s.
+ *  @returns void.
+ */
+void *loadgen_monitor_fn(void *args)
+{
+  loadgen_monitor_s *mon = (loadgen_monitor_s *)args;
+
+  if (mon->fill_log != NULL)
+    fprintf(mon->fill_log, "elapsed_sec,obs_id,obs_offset,full_bufs,nbufs,fill_pct\n");
+
+  while (!mon->done)
+  {
+    uint64_t full = ipcbuf_get_nfull(mon->data_block);
+    double elapsed = loadgen_elapsed(&mon->start);
+
+    pthread_mutex_lock(&mon->mutex);
+    mon->samples++;
+    mon->sum_full += full;
+
+    if (full > mon->max_full)
+      mon->max_full = full;
+
+    if (full * 10 >= mon->nbufs * 9)
+      mon->samples_over_90pct++;
+    pthread_mutex_unlock(&mon->mutex);
+
+    if (mon->fill_log != NULL)
+      fprintf(mon->fill_log, "%.2f,%ld,%d,%lu,%lu,%.1f\n", elapsed, mon->obs_id, mon->obs_offset, full, mon->nbufs, 100.0 * full / mon->nbufs);
+
+    usleep(100000);
+  }
+
+  return NULL;
+}
+
+/**
+ *
+ *  @brief Writes one transfer (header + data) into the ring, pacing each beam second to the requested rate.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int loadgen_write_ring_transfer(multilog_t *log, dada_hdu_t *hdu, const char *header, float **beam_data, uint64_t beam_bytes,
+                                int nbeams, int seconds, long second_index, loadgenArgs_s *args, loadgen_monitor_s *mon)
+{
+  if (dada_hdu_lock_write(hdu) < 0)
+  {
+    multilog(log, LOG_ERR, "loadgen: could not lock write on the ring.\n");
+    return EXIT_FAILURE;
+  }
+
+  char *header_buf = ipcbuf_get_next_write(hdu->header_block);
+  memcpy(header_buf, header, LOADGEN_HDR_SIZE);
+
+  if (ipcbuf_mark_filled(hdu->header_block, LOADGEN_HDR_SIZE) < 0)
+  {
+    multilog(log, LOG_ERR, "loadgen: could not mark header block filled.\n");
+    return EXIT_FAILURE;
+  }
+
+  for (int s = 0; s < seconds; s++)
+  {
+    // Wait until this second is due
+    if (args->realtime_factor > 0)
+    {
+      double due = (second_index + s) / args->realtime_factor;
+      double now = loadgen_elapsed(&mon->start);
+
+      if (due > now)
+        usleep((useconds_t)((due - now) * 1e6));
+    }
+
+    for (int beam = 0; beam < nbeams; beam++)
+    {
+      char *data = (char *)beam_data[beam] + ((second_index + s) % LOADGEN_DATA_SECONDS) * beam_bytes;
+
+      if (ipcio_write(hdu->data_block, data, beam_bytes) < 0)
+      {
+        multilog(log, LOG_ERR, "loadgen: ipcio_write failed.\n");
+        return EXIT_FAILURE;
+      }
+    }
+
+    // How late are we? If the reader cannot keep up the ring fills and ipcio_write blocks
+    if (args->realtime_factor > 0)
+    {
+      double lateness = loadgen_elapsed(&mon->start) - (second_index + s + 1) / args->realtime_factor;
+
+      pthread_mutex_lock(&mon->mutex);
+      if (lateness > mon->max_lateness)
+        mon->max_lateness = lateness;
+      pthread_mutex_unlock(&mon->mutex);
+    }
+  }
+
+  if (dada_hdu_unlock_write(hdu) < 0)
+  {
+    multilog(log, LOG_ERR, "loadgen: could not unlock write on the ring.\n");
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Writes one transfer (header + data) to the dada file.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int loadgen_write_file_transfer(multilog_t *log, FILE *out, const char *header, float **beam_data, uint64_t beam_bytes,
+                                int nbeams, int seconds, long second_index)
+{
+  if (fwrite(header, 1, LOADGEN_HDR_SIZE, out) != LOADGEN_HDR_SIZE)
+  {
+    multilog(log, LOG_ERR, "loadgen: error writing header to output file.\n");
+    return EXIT_FAILURE;
+  }
+
+  for (int s = 0; s < seconds; s++)
+  {
+    for (int beam = 0; beam < nbeams; beam++)
+    {
+      char *data = (char *)beam_data[beam] + ((second_index + s) % LOADGEN_DATA_SECONDS) * beam_bytes;
+
+      if (fwrite(data, 1, beam_bytes, out) != beam_bytes)
+      {
+        multilog(log, LOG_ERR, "loadgen: error writing data to output file.\n");
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief This is main for the load generator.
+ *  @param[in] argc Count of arguments passed in from command line.
+ *  @param[in] argv Array of arguments passed in from command line.
+ *  @returns EXIT_SUCCESS if the reader kept up, or EXIT_FAILURE on error or if it fell behind.
+ */
+int main(int argc, char *argv[])
+{
+  multilog_t *log = multilog_open("mwax-beamdb2fil-loadgen", 0);
+  multilog_add(log, stderr);
+
+  loadgenArgs_s args;
+
+  if (loadgen_process_args(argc, argv, &args) != EXIT_SUCCESS)
+    exit(EXIT_FAILURE);
+
+  signal(SIGINT, loadgen_sig_handler);
+
+  long ntimesteps = args.bandwidth_hz / args.time_integration / args.nchan;
+  uint64_t beam_bytes = ntimesteps * args.nchan * sizeof(float);
+  uint64_t transfer_size = beam_bytes * args.nbeams * args.secs_per_subobs;
+
+  multilog(log, LOG_INFO, "loadgen: %d beam(s) x %ld channels x %ld timesteps/sec = %lu bytes per beam second, %lu bytes per sub-observation.\n",
+           args.nbeams, args.nchan, ntimesteps, beam_bytes, transfer_size);
+  multilog(log, LOG_INFO, "loadgen: %d observation(s) starting at obs id %ld at %.2fx real time (%.1f MB/s).\n",
+           args.obs_count, args.first_obs_id, args.realtime_factor, args.realtime_factor * beam_bytes * args.nbeams / 1e6);
+
+  // Pre-generate data so generating it does not limit the rate
+  float **beam_data = calloc(args.nbeams, sizeof(float *));
+
+  for (int beam = 0; beam < args.nbeams; beam++)
+  {
+    beam_data[beam] = malloc(LOADGEN_DATA_SECONDS * beam_bytes);
+    loadgen_generate_beam(&args, beam, beam_data[beam]);
+  }
+
+  // Set up the output
+  FILE *out = NULL;
+  dada_hdu_t *hdu = NULL;
+  ipcbuf_t header_block = IPCBUF_INIT;
+  ipcbuf_t data_block = IPCBUF_INIT;
+
+  loadgen_monitor_s mon;
+  memset(&mon, 0, sizeof(mon));
+  pthread_mutex_init(&mon.mutex, NULL);
+  mon.log = log;
+  mon.nbufs = args.nbufs;
+  pthread_t monitor_thread;
+
+  if (args.output_file != NULL)
+  {
+    if ((out = fopen(args.output_file, "wb")) == NULL)
+    {
+      multilog(log, LOG_ERR, "loadgen: could not create %s: %s\n", args.output_file, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+  {
+    // Create the ring the same way dada_db does (header block key = data block key + 1)
+    multilog(log, LOG_INFO, "loadgen: creating ring %x with %d x %lu byte blocks.\n", args.ring_key, args.nbufs, beam_bytes);
+
+    if (ipcbuf_create(&data_block, args.ring_key, args.nbufs, beam_bytes, 1) < 0 ||
+        ipcbuf_create(&header_block, args.ring_key + 1, 8, LOADGEN_HDR_SIZE, 1) < 0)
+    {
+      multilog(log, LOG_ERR, "loadgen: could not create ring %x.\n", args.ring_key);
+      exit(EXIT_FAILURE);
+    }
+
+    hdu = dada_hdu_create(log);
+    dada_hdu_set_key(hdu, args.ring_key);
+
+    if (dada_hdu_connect(hdu) < 0)
+    {
+      multilog(log, LOG_ERR, "loadgen: could not connect to ring %x.\n", args.ring_key);
+      exit(EXIT_FAILURE);
+    }
+
+    if (args.fill_log != NULL && (mon.fill_log = fopen(args.fill_log, "w")) == NULL)
+      multilog(log, LOG_WARNING, "loadgen: could not create fill log %s: %s\n", args.fill_log, strerror(errno));
+
+    multilog(log, LOG_INFO, "loadgen: waiting %d sec for mwax_beamdb2fil to attach...\n", args.start_delay);
+    sleep(args.start_delay);
+
+    mon.data_block = (ipcbuf_t *)hdu->data_block;
+    clock_gettime(CLOCK_MONOTONIC, &mon.start);
+    pthread_create(&monitor_thread, NULL, loadgen_monitor_fn, &mon);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &mon.start);
+
+  char header[LOADGEN_HDR_SIZE];
+  long obs_id = args.first_obs_id;
+  long second_index = 0;
+  int result = EXIT_SUCCESS;
+
+  for (int obs = 0; obs < args.obs_count && result == EXIT_SUCCESS && !g_loadgen_quit; obs++)
+  {
+    if (loadgen_write_metafits(log, &args, obs_id) != EXIT_SUCCESS)
+    {
+      result = EXIT_FAILURE;
+      break;
+    }
+
+    multilog(log, LOG_INFO, "loadgen: obs %ld: %d sec%s.\n", obs_id, args.final_duration[obs],
+             args.initial_duration[obs] != args.final_duration[obs] ? " (duration changed mid-observation)" : "");
+
+    for (int offset = 0; offset < args.final_duration[obs] && !g_loadgen_quit; offset += args.secs_per_subobs)
+    {
+      int duration = (offset == 0) ? args.initial_duration[obs] : args.final_duration[obs];
+
+      mon.obs_id = obs_id;
+      mon.obs_offset = offset;
+      loadgen_fill_header(&args, header, args.mode, obs_id, offset, duration, transfer_size);
+
+      if (out != NULL)
+        result = loadgen_write_file_transfer(log, out, header, beam_data, beam_bytes, args.nbeams, args.secs_per_subobs, second_index);
+      else
+        result = loadgen_write_ring_transfer(log, hdu, header, beam_data, beam_bytes, args.nbeams, args.secs_per_subobs, second_index, &args, &mon);
+
+      if (result != EXIT_SUCCESS)
+        break;
+
+      second_index += args.secs_per_subobs;
+    }
+
+    obs_id += args.final_duration[obs];
+  }
+
+  // Optionally tell the reader to quit
+  if (args.send_quit && result == EXIT_SUCCESS)
+  {
+    loadgen_fill_header(&args, header, "QUIT", obs_id, 0, args.secs_per_subobs, 0);
+
+    if (out != NULL)
+      result = loadgen_write_file_transfer(log, out, header, beam_data, beam_bytes, args.nbeams, 0, 0);
+    else
+      result = loadgen_write_ring_transfer(log, hdu, header, beam_data, beam_bytes, args.nbeams, 0, 0, &args, &mon);
+  }
+
+  double elapsed = loadgen_elapsed(&mon.start);
+  multilog(log, LOG_INFO, "loadgen: wrote %ld beam seconds (%.1f MB) in %.1f sec.\n", second_index * args.nbeams,
+           second_index * args.nbeams * beam_bytes / 1e6, elapsed);
+
+  if (out != NULL)
+  {
+    fclose(out);
+  }
+  else
+  {
+    // Let the reader drain what is left before we report and destroy the ring
+    while (ipcbuf_get_nfull(mon.data_block) > 0 && !g_loadgen_quit)
+      usleep(100000);
+
+    mon.done = 1;
+    pthread_join(monitor_thread, NULL);
+
+    if (mon.fill_log != NULL)
+      fclose(mon.fill_log);
+
+    double mean_full = mon.samples > 0 ? mon.sum_full / mon.samples : 0;
+    int kept_up = (mon.max_full < mon.nbufs) && (mon.max_lateness < 1.0);
+
+    multilog(log, LOG_INFO, "loadgen: ring fill: mean %.1f%%, max %.1f%% (%lu of %lu blocks), >90%% full for %.1f sec.\n",
+             100.0 * mean_full / mon.nbufs, 100.0 * mon.max_full / mon.nbufs, mon.max_full, mon.nbufs, mon.samples_over_90pct / 10.0);
+    multilog(log, LOG_INFO, "loadgen: max lateness behind %.2fx real time: %.2f sec.\n", args.realtime_factor, mon.max_lateness);
+    multilog(log, LOG_INFO, "loadgen: RESULT: mwax_beamdb2fil %s with %d beam(s).\n", kept_up ? "KEPT UP" : "FELL BEHIND", args.nbeams);
+
+    if (!kept_up && result == EXIT_SUCCESS)
+      result = EXIT_FAILURE;
+
+    dada_hdu_disconnect(hdu);
+    dada_hdu_destroy(hdu);
+
+    if (!args.keep_ring)
+    {
+      ipcbuf_destroy(&data_block);
+      ipcbuf_destroy(&header_block);
+    }
+  }
+
+  for (int beam = 0; beam < args.nbeams; beam++)
+    free(beam_data[beam]);
+  free(beam_data);
+
+  multilog_close(log);
+
+  return result;
+}
@@ -17,11 +17,24 @@
 
 #include "global.h"
 #include "args.h"
+#include "asynclog.h"
+#include "crc32c.h"
 #include "dada_dbfil.h"
 #include "dada_hdu.h"
 #include "health.h"
+#include "kernels.h"
+#include "pipeline.h"
+#include "metafitscache.h"
 #include "multilog.h"
+#include "notify.h"
+#include "placement.h"
+#include "quicklook.h"
+#include "replay.h"
+#include "ring.h"
+#include "segment.h"
+#include "trace.h"
 #include "version.h"
+#include "wideband.h"
 
 #define STATUS_OFFLINE 0
 #define STATUS_RUNNING 1
@@ -49,110 +62,123 @@ void sig_handler(int signum)
 
 /**
  * 
- *  @brief This is main, duh!
- *  @param[in] argc Count of arguments passed in from command line.
- *  @param[in] argv Array of arguments passed in from command line.
+ *  @brief This captures SIGUSR1 and asks the reader to dump the latency histograms of the current observation.
+ *  @param[in] signum Signal number to handle.
+  */
+void sig_usr1_handler(int signum)
+{
+  (void)signum;
+  latency_request_dump();
+}
+
+/**
+ * 
+ *  @brief This captures SIGUSR2 and asks for the trace ring to be dumped.
+ *  @param[in] signum Signal number to handle.
+  */
+void sig_usr2_handler(int signum)
+{
+  (void)signum;
+  trace_request_dump();
+}
+
+/**
+ * 
+ *  @brief Starts tracing and the threads and modules the readers need, then reads the ringbuffers (or replays the dada files)
+ *         until we are asked to quit. main() shuts everything down afterwards, however far this got.
+ *  @param[in] logger A pointer to the logger to use.
+ *  @param[in] globalArgs The command line options.
  *  @returns EXIT_SUCCESS on success, or any other value if there was an error. 
  */
-int main(int argc, char *argv[])
+int run(multilog_t *logger, globalArgs_s *globalArgs)
 {
-  // Logger
-  multilog_t *logger = 0;
-  logger = multilog_open("mwax-beamdb2fil-log", 0);
-  multilog_add(logger, stderr);
-  multilog(logger, LOG_INFO, "Starting mwax_beamdb2fil  v%d.%d.%d...\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  // Tracing (the ring is only allocated if asked for). SIGUSR2 dumps it
+  if (globalArgs->trace_path)
+  {
+    if (trace_init(logger, globalArgs->trace_path, TRACE_DEFAULT_EVENTS) != EXIT_SUCCESS)
+      return EXIT_FAILURE;
 
-  globalArgs_s globalArgs;
+    trace_set_thread_name("main");
 
-  if (process_args(argc, argv, &globalArgs))
-  {
-    exit(EXIT_FAILURE);
+    multilog(g_ctx.log, LOG_INFO, "main(): Configured to dump the trace on SIGUSR2.\n");
+    signal(SIGUSR2, sig_usr2_handler);
   }
 
-  // DADA Primary Read Client
-  dada_client_t *client = 0;
+  // Log the topology and check the cpu lists. Each thread binds itself to the cpus of its role when it starts
+  const char *cpu_lists[PLACEMENT_ROLE_COUNT] = {globalArgs->reader_cpus, globalArgs->worker_cpus, globalArgs->writer_cpus};
 
-  // DADA Header plus Data Units
-  dada_hdu_t *in_hdu = 0;
+  if (placement_init(logger, cpu_lists) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
 
-  // DADA keys for input ring buffers
-  key_t in_key = globalArgs.input_db_key;
+  // Choose the instruction set of the per sample kernels (the newest this cpu supports, unless --kernels says otherwise)
+  if (kernels_init(logger, globalArgs->kernels) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
 
-  g_ctx.log = logger;
+  // Per block messages are formatted and written by a background thread (falls back to multilog if it can't start)
+  asynclog_init(logger, ASYNCLOG_DEFAULT_RECORDS, globalArgs->log_rate_limit);
+  multilog(g_ctx.log, LOG_INFO, "main(): Hot path log overhead is %.1f ns per message.\n", asynclog_measure_overhead_ns());
 
-  // Get the current hostname
-  if (gethostname(g_ctx.hostname, HOST_NAME_LEN + 1) != 0)
-  {
-    multilog(g_ctx.log, LOG_ERR, "main: ERROR: gethostname() failed\n");
+  // Tell downstream tools about each finished file
+  if (notify_init(logger, globalArgs->notify_socket, globalArgs->manifest_path) != EXIT_SUCCESS)
     return EXIT_FAILURE;
-  }
 
-  multilog(g_ctx.log, LOG_INFO, "Hostname: %s\n", g_ctx.hostname);
+  // What we read from each metafits is cached (also on disk with --metafits-cache, so a restart is quick)
+  metafits_cache_init(logger, globalArgs->metafits_cache_dir);
 
-  // print all of the options (this is debug)
-  multilog(g_ctx.log, LOG_INFO, "Command line options used:\n");
-  multilog(g_ctx.log, LOG_INFO, "* Shared Memory key:    %x\n", globalArgs.input_db_key);
-  multilog(g_ctx.log, LOG_INFO, "* Destination path:     %s\n", globalArgs.destination_path);
+  // Finished segments are closed in the background
+  if (g_ctx.segment_seconds > 0 || g_ctx.segment_bytes > 0)
+    segment_closer_init(logger);
 
-  if (!globalArgs.stats_path)
-    multilog(g_ctx.log, LOG_INFO, "* Stats path:           [Not generating stats]\n");
-  else
-    multilog(g_ctx.log, LOG_INFO, "* Stats path:           %s\n", globalArgs.stats_path);
-  multilog(g_ctx.log, LOG_INFO, "* Metafits path:        %s\n", globalArgs.metafits_path);
-  multilog(g_ctx.log, LOG_INFO, "* Health UDP IP:        %s\n", globalArgs.health_ip);
-  multilog(g_ctx.log, LOG_INFO, "* Health UDP Port:      %d\n", globalArgs.health_port);
+  // With --wideband the beams of every ring (or replayed file) go to the assembler instead of their own fil files
+  if (globalArgs->wideband && wideband_init(logger, globalArgs->replay ? globalArgs->replay_file_count : globalArgs->input_db_key_count, globalArgs->wideband_timeout_ms) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
 
-  // This tells us if we need to quit
-  int quit = 0;
-  initialise_quit(); // Setup quit mutex
-  set_quit(quit);
+  // With --quicklook each beam's pyramid is built in the background (when replaying the readers wait for it, rather
+  // than drop beam seconds when it falls behind)
+  if (globalArgs->quicklook_rows > 0 && quicklook_init(logger, globalArgs->replay) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
 
-  // Catch SIGINT
-  multilog(g_ctx.log, LOG_INFO, "main(): Configured to catching SIGINT.\n");
-  signal(SIGINT, sig_handler);
+  multilog(g_ctx.log, LOG_INFO, "main(): Latency instrumentation overhead is %.1f ns per stage (%d stages per beam second).\n", latency_measure_overhead_ns(), LATENCY_STAGE_COUNT);
 
-  // create the input HDU
-  multilog(g_ctx.log, LOG_INFO, "main(): Creating HDU handle...\n");
-  in_hdu = dada_hdu_create(logger);
+  // In replay mode we read dada files from disk- there is no ringbuffer or health thread
+  if (globalArgs->replay)
+  {
+    g_ctx.destination_dir = globalArgs->destination_path;
+    g_ctx.stats_dir = globalArgs->stats_path;
+    g_ctx.metafits_path = globalArgs->metafits_path;
 
-  multilog(g_ctx.log, LOG_INFO, "main(): Assigning key %x to HDU handle.\n", globalArgs.input_db_key);
-  dada_hdu_set_key(in_hdu, in_key);
+    return replay_dada_files(logger, &g_ctx, globalArgs->replay_file_count, globalArgs->replay_files);
+  }
+
+  // Pass stuff to the context (each reader gets a copy of it)
+  g_ctx.destination_dir = globalArgs->destination_path;
+  g_ctx.stats_dir = globalArgs->stats_path;
+  g_ctx.metafits_path = globalArgs->metafits_path;
 
-  multilog(g_ctx.log, LOG_INFO, "main(): Connecting to HDU with key %x...\n", globalArgs.input_db_key);
-  if (dada_hdu_connect(in_hdu) < 0)
+  // One reader (HDU, dada client and context) per ringbuffer
+  ring_reader_s readers[ARGS_MAX_KEYS];
+  int nreaders = 0;
+  int result = EXIT_SUCCESS;
+
+  for (int ring = 0; ring < globalArgs->input_db_key_count; ring++)
   {
-    multilog(g_ctx.log, LOG_ERR, "main: ERROR: could not connect to input HDU\n");
-    return EXIT_FAILURE;
+    if (ring_reader_open(logger, &readers[ring], ring, globalArgs->input_db_keys[ring], &g_ctx) != EXIT_SUCCESS)
+    {
+      ring_reader_close(&readers[ring]);
+      result = EXIT_FAILURE;
+      break;
+    }
+
+    nreaders++;
   }
 
-  multilog(g_ctx.log, LOG_INFO, "main(): Locking HDU %x handle for read...\n", globalArgs.input_db_key);
-  if (dada_hdu_lock_read(in_hdu) < 0)
+  if (result != EXIT_SUCCESS)
   {
-    multilog(g_ctx.log, LOG_ERR, "main: ERROR: could not lock read on input HDU\n");
-    return EXIT_FAILURE;
-  }
+    for (int ring = 0; ring < nreaders; ring++)
+      ring_reader_close(&readers[ring]);
 
-  // Pass stuff to the context
-  g_ctx.destination_dir = globalArgs.destination_path;
-  g_ctx.stats_dir = globalArgs.stats_path;
-  g_ctx.metafits_path = globalArgs.metafits_path;
-
-  // set up DADA read client
-  multilog(g_ctx.log, LOG_INFO, "main(): Creating DADA client...\n", globalArgs.input_db_key);
-  client = dada_client_create();
-  client->log = g_ctx.log;
-  client->data_block = in_hdu->data_block;
-  client->header_block = in_hdu->header_block;
-  client->open_function = dada_dbfil_open;
-  client->io_function = dada_dbfil_io;
-  client->io_block_function = dada_dbfil_io_block;
-  client->close_function = dada_dbfil_close;
-  client->direction = dada_client_reader;
-  client->context = &g_ctx;
-
-  // Set some useful params based on our ringbuffer config
-  g_ctx.block_size = ipcbuf_get_bufsz((ipcbuf_t *)(client->data_block));
-  multilog(g_ctx.log, LOG_INFO, "main(): Block size (one integration) is %lu bytes.\n", g_ctx.block_size);
+    return result;
+  }
 
   // Launch Health thread
   pthread_t health_thread;
@@ -164,71 +190,187 @@ int main(int argc, char *argv[])
 
   health_args.log = logger;
   health_args.status = STATUS_RUNNING;
-  health_args.header_block = client->header_block;
-  health_args.data_block = (ipcbuf_t *)client->data_block;
-  health_args.health_udp_ip = globalArgs.health_ip;
-  health_args.health_udp_port = globalArgs.health_port;
+  health_args.nrings = nreaders;
+  for (int ring = 0; ring < nreaders; ring++)
+  {
+    health_args.keys[ring] = readers[ring].key;
+    health_args.header_blocks[ring] = readers[ring].client->header_block;
+    health_args.data_blocks[ring] = (ipcbuf_t *)readers[ring].client->data_block;
+  }
+  health_args.health_udp_ip = globalArgs->health_ip;
+  health_args.health_udp_port = globalArgs->health_port;
+  health_args.prometheus_path = globalArgs->prometheus_path;
 
   multilog(g_ctx.log, LOG_INFO, "main():Launching health thread...\n");
   pthread_create(&health_thread, NULL, health_thread_fn, (void *)&health_args);
 
-  // main loop
-  while (!quit)
-  {
-    multilog(g_ctx.log, LOG_INFO, "main: dada_client_read()\n");
+  // Each reader binds itself (after the other threads are started, so they don't inherit it) and keeps the staging
+  // buffers it allocates on the NUMA node of its ring
+  int started = 0;
 
-    if (dada_client_read(client) < 0)
+  for (int ring = 0; ring < nreaders; ring++)
+  {
+    if (ring_reader_start(&readers[ring]) != EXIT_SUCCESS)
     {
-      multilog(g_ctx.log, LOG_ERR, "main: error during transfer\n");
       set_quit(1);
+      result = EXIT_FAILURE;
+      break;
     }
 
-    // Check quit status
-    quit = get_quit();
+    started++;
+  }
 
-    if (quit)
-    {
-      health_args.status = STATUS_SHUTTING_DOWN;
-      client->quit = 1;
-    }
-    else
-    {
-      multilog(g_ctx.log, LOG_INFO, "main: dada_hdu_unlock_read()\n");
-      if (dada_hdu_unlock_read(in_hdu) < 0)
-      {
-        multilog(g_ctx.log, LOG_ERR, "main: could not unlock read on hdu\n");
-        return EXIT_FAILURE;
-      }
-
-      multilog(g_ctx.log, LOG_INFO, "main: dada_hdu_lock_read()\n");
-
-      if (dada_hdu_lock_read(in_hdu) < 0)
-      {
-        multilog(g_ctx.log, LOG_ERR, "could not lock read on hdu\n");
-        return EXIT_FAILURE;
-      }
-    }
+  // Wait for the readers. They stop when we are asked to quit (a QUIT on any ring, a signal or an error on any reader)
+  for (int ring = 0; ring < started; ring++)
+  {
+    if (ring_reader_join(&readers[ring]) != EXIT_SUCCESS)
+      result = EXIT_FAILURE;
   }
 
   // Wait for health thread to terminate
+  health_args.status = STATUS_SHUTTING_DOWN;
   pthread_join(health_thread, NULL);
 
-  multilog(g_ctx.log, LOG_INFO, "main: dada_hdu_disconnect()\n");
-  if (dada_hdu_disconnect(in_hdu) < 0)
+  // disconnect and destroy HDUs, read clients and contexts
+  for (int ring = 0; ring < nreaders; ring++)
+    ring_reader_close(&readers[ring]);
+
+  return result;
+}
+
+/**
+ * 
+ *  @brief This is main, duh!
+ *  @param[in] argc Count of arguments passed in from command line.
+ *  @param[in] argv Array of arguments passed in from command line.
+ *  @returns EXIT_SUCCESS on success, or any other value if there was an error. 
+ */
+int main(int argc, char *argv[])
+{
+  // Logger
+  multilog_t *logger = 0;
+  logger = multilog_open("mwax-beamdb2fil-log", 0);
+  multilog_add(logger, stderr);
+  multilog(logger, LOG_INFO, "Starting mwax_beamdb2fil  v%d.%d.%d...\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+
+  globalArgs_s globalArgs;
+
+  if (process_args(argc, argv, &globalArgs))
+  {
+    exit(EXIT_FAILURE);
+  }
+
+  g_ctx.log = logger;
+
+  // Get the current hostname
+  if (gethostname(g_ctx.hostname, HOST_NAME_LEN + 1) != 0)
   {
-    multilog(g_ctx.log, LOG_ERR, "main: failed to disconnect HDU\n");
+    multilog(g_ctx.log, LOG_ERR, "main: ERROR: gethostname() failed\n");
     return EXIT_FAILURE;
   }
 
-  // destroy HDUs and read client
-  dada_hdu_destroy(in_hdu);
-  dada_client_destroy(client);
+  multilog(g_ctx.log, LOG_INFO, "Hostname: %s\n", g_ctx.hostname);
+
+  // print all of the options (this is debug)
+  multilog(g_ctx.log, LOG_INFO, "Command line options used:\n");
+  if (globalArgs.replay)
+    multilog(g_ctx.log, LOG_INFO, "* Replay files:         %d\n", globalArgs.replay_file_count);
+  else
+  {
+    for (int ring = 0; ring < globalArgs.input_db_key_count; ring++)
+      multilog(g_ctx.log, LOG_INFO, "* Shared Memory key:    %x\n", globalArgs.input_db_keys[ring]);
+  }
+  multilog(g_ctx.log, LOG_INFO, "* Destination path:     %s\n", globalArgs.destination_path);
+
+  if (!globalArgs.stats_path)
+    multilog(g_ctx.log, LOG_INFO, "* Stats path:           [Not generating stats]\n");
+  else
+    multilog(g_ctx.log, LOG_INFO, "* Stats path:           %s\n", globalArgs.stats_path);
+  multilog(g_ctx.log, LOG_INFO, "* Metafits path:        %s\n", globalArgs.metafits_path);
+  multilog(g_ctx.log, LOG_INFO, "* Health UDP IP:        %s\n", globalArgs.health_ip);
+  multilog(g_ctx.log, LOG_INFO, "* Health UDP Port:      %d\n", globalArgs.health_port);
+  if (globalArgs.prometheus_path)
+    multilog(g_ctx.log, LOG_INFO, "* Prometheus file:      %s\n", globalArgs.prometheus_path);
+  if (globalArgs.perf_counters)
+    multilog(g_ctx.log, LOG_INFO, "* Perf counters:        enabled\n");
+  if (globalArgs.trace_path)
+    multilog(g_ctx.log, LOG_INFO, "* Trace path:           %s\n", globalArgs.trace_path);
+
+  if (globalArgs.hugepages)
+    multilog(g_ctx.log, LOG_INFO, "* Staging buffers:      hugepages\n");
+  if (globalArgs.no_checksums)
+    multilog(g_ctx.log, LOG_INFO, "* Checksums:            [Not writing checksums]\n");
+  else
+    multilog(g_ctx.log, LOG_INFO, "* Checksums:            CRC32C, %s\n", crc32c_implementation());
+  if (globalArgs.segment_seconds > 0 || globalArgs.segment_mb > 0)
+    multilog(g_ctx.log, LOG_INFO, "* Segments:             every %d sec, at most %d MiB (0 = no limit)\n", globalArgs.segment_seconds, globalArgs.segment_mb);
+  if (globalArgs.notify_socket)
+    multilog(g_ctx.log, LOG_INFO, "* Notify socket:        %s\n", globalArgs.notify_socket);
+  if (globalArgs.manifest_path)
+    multilog(g_ctx.log, LOG_INFO, "* Manifest:             %s\n", globalArgs.manifest_path);
+  if (globalArgs.normalise_seconds > 0)
+    multilog(g_ctx.log, LOG_INFO, "* Normalise:            running bandpass over %.1f sec\n", globalArgs.normalise_seconds);
+  if (globalArgs.subbands > 1)
+    multilog(g_ctx.log, LOG_INFO, "* Sub-bands:            %d per beam\n", globalArgs.subbands);
+  if (globalArgs.container)
+    multilog(g_ctx.log, LOG_INFO, "* Container:            all beams in one %s file\n", CONTAINER_EXTENSION);
+  if (globalArgs.wideband)
+    multilog(g_ctx.log, LOG_INFO, "* Wideband:             coarse channels stitched per beam, late channels wait %d ms\n", globalArgs.wideband_timeout_ms);
+  if (globalArgs.quicklook_rows > 0)
+    multilog(g_ctx.log, LOG_INFO, "* Quick-look:           %d levels per beam, %d rows/sec at full resolution\n", QUICKLOOK_LEVELS, globalArgs.quicklook_rows);
+  if (globalArgs.metafits_cache_dir)
+    multilog(g_ctx.log, LOG_INFO, "* Metafits cache:       %s\n", globalArgs.metafits_cache_dir);
+  if (globalArgs.pipeline)
+    multilog(g_ctx.log, LOG_INFO, "* Pipeline:             %s\n", globalArgs.pipeline);
+  if (globalArgs.degrade)
+    multilog(g_ctx.log, LOG_INFO, "* Degrade:              ring fill high %.2f low %.2f, %d beam priorities\n", globalArgs.degrade_high_fill, globalArgs.degrade_low_fill, globalArgs.beam_priority_count);
+
+  g_ctx.perf.requested = globalArgs.perf_counters;
+  g_ctx.pool.use_hugepages = globalArgs.hugepages;
+  g_ctx.checksums = !globalArgs.no_checksums;
+  g_ctx.segment_seconds = globalArgs.segment_seconds;
+  g_ctx.segment_bytes = (uint64_t)globalArgs.segment_mb * 1024 * 1024;
+  g_ctx.normalise_seconds = globalArgs.normalise_seconds;
+  g_ctx.subbands = globalArgs.subbands;
+  g_ctx.container_mode = globalArgs.container;
+  g_ctx.wideband_mode = globalArgs.wideband;
+  g_ctx.quicklook_rows = globalArgs.quicklook_rows;
+
+  // The stages each beam second goes through (see pipeline.c)
+  if (pipeline_configure(logger, globalArgs.pipeline, globalArgs.stats_path != NULL, &g_ctx) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (globalArgs.degrade)
+    degrade_init(&g_ctx.degrade, globalArgs.degrade_high_fill, globalArgs.degrade_low_fill, globalArgs.beam_priorities, globalArgs.beam_priority_count);
+
+  // This tells us if we need to quit
+  int quit = 0;
+  initialise_quit(); // Setup quit mutex
+  set_quit(quit);
+
+  // Catch SIGINT
+  multilog(g_ctx.log, LOG_INFO, "main(): Configured to catching SIGINT.\n");
+  signal(SIGINT, sig_handler);
+
+  // Catch SIGUSR1 to dump latency histograms
+  multilog(g_ctx.log, LOG_INFO, "main(): Configured to dump latency histograms on SIGUSR1.\n");
+  signal(SIGUSR1, sig_usr1_handler);
+
+  // Whatever run() started (however far it got) is shut down here
+  int result = run(logger, &globalArgs);
 
   // close log
+  wideband_shutdown();
+  quicklook_shutdown();
+  segment_closer_shutdown();
+  notify_shutdown();
+  metafits_cache_destroy();
+  asynclog_shutdown();
+  placement_shutdown();
   multilog_close(logger);
 
   // Destroy mutexes
   destroy_quit();
 
-  return EXIT_SUCCESS;
+  return result;
 }
@@ -0,0 +1,307 @@
+/**
+ * @file metafitscache.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that caches what we read from metafits files
+ *
+ * Opening and reading a metafits file (often over NFS) can take longer than a sub observation, which matters most when
+ * we are restarted part way through an observation and need to be writing again before the ring fills. So what we read
+ * from each metafits is kept in memory (the last METAFITS_CACHE_ENTRIES observations, shared by every reader thread),
+ * and with --metafits-cache=DIR also written to DIR/<obs_id>.metacache, which survives a restart. A cached entry is
+ * used as long as the metafits file has the same modification time and size as when it was read, or if the metafits
+ * file can not be found at all.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metafitscache.h"
+
+typedef struct metafits_cache_entry_s
+{
+    long obs_id;          // 0 if the entry is free
+    time_t mtime;         // of the metafits file when it was read (0 if it could not be found)
+    off_t size;
+    metafits_s metafits;  // its filename is owned by the entry
+} metafits_cache_entry_s;
+
+typedef struct metafits_cache_s
+{
+    pthread_mutex_t mutex;
+    metafits_cache_entry_s entries[METAFITS_CACHE_ENTRIES];
+    int next;        // entry to replace next
+    char *cache_dir; // NULL to only cache in memory
+} metafits_cache_s;
+
+static metafits_cache_s g_metafits_cache = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ *
+ *  @brief Starts the cache.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] cache_dir Directory to also keep the cache in (so it survives a restart), or NULL for memory only.
+ */
+void metafits_cache_init(multilog_t *log, const char *cache_dir)
+{
+    pthread_mutex_lock(&g_metafits_cache.mutex);
+
+    free(g_metafits_cache.cache_dir);
+    g_metafits_cache.cache_dir = (cache_dir != NULL) ? strdup(cache_dir) : NULL;
+
+    pthread_mutex_unlock(&g_metafits_cache.mutex);
+
+    if (cache_dir != NULL)
+        multilog(log, LOG_INFO, "metafits_cache_init(): Caching metafits in %s\n", cache_dir);
+}
+
+/**
+ *
+ *  @brief Gets the modification time and size of a metafits file.
+ *  @param[in] metafits_filename The metafits file.
+ *  @param[out] mtime Its modification time (0 if it could not be found).
+ *  @param[out] size Its size (0 if it could not be found).
+ */
+static void metafits_cache_stat(const char *metafits_filename, time_t *mtime, off_t *size)
+{
+    struct stat file_stat;
+
+    if (stat(metafits_filename, &file_stat) == 0)
+    {
+        *mtime = file_stat.st_mtime;
+        *size = file_stat.st_size;
+    }
+    else
+    {
+        *mtime = 0;
+        *size = 0;
+    }
+}
+
+/**
+ *
+ *  @brief Reads a cache file written by metafits_cache_write().
+ *  @param[in] filename The cache file.
+ *  @param[out] entry The entry (its metafits filename is allocated).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there is no (complete) cache file.
+ */
+static int metafits_cache_read(const char *filename, metafits_cache_entry_s *entry)
+{
+    FILE *file = fopen(filename, "r");
+
+    if (file == NULL)
+        return EXIT_FAILURE;
+
+    char line[PATH_MAX + 64];
+    int fields = 0;
+
+    memset(entry, 0, sizeof(metafits_cache_entry_s));
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        long long value;
+
+        if (sscanf(line, "obsid %ld", &entry->obs_id) == 1)
+            fields++;
+        else if (sscanf(line, "mtime %lld", &value) == 1)
+        {
+            entry->mtime = (time_t)value;
+            fields++;
+        }
+        else if (sscanf(line, "size %lld", &value) == 1)
+        {
+            entry->size = (off_t)value;
+            fields++;
+        }
+        else if (sscanf(line, "mjd %lf", &entry->metafits.mjd) == 1)
+            fields++;
+        else if (sscanf(line, "ra %lf", &entry->metafits.ra) == 1)
+            fields++;
+        else if (sscanf(line, "dec %lf", &entry->metafits.dec) == 1)
+            fields++;
+        else if (sscanf(line, "altitude %lf", &entry->metafits.altitude) == 1)
+            fields++;
+        else if (sscanf(line, "azimuth %lf", &entry->metafits.azimuth) == 1)
+            fields++;
+        else if (strncmp(line, "filename ", 9) == 0 && entry->metafits.filename == NULL)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            entry->metafits.filename = strdup(&line[9]);
+            fields++;
+        }
+    }
+
+    fclose(file);
+
+    entry->metafits.obsid = entry->obs_id;
+
+    if (fields != 9)
+    {
+        free(entry->metafits.filename);
+        entry->metafits.filename = NULL;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Writes an entry to its cache file (as NAME.partial, renamed once it is complete).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] filename The cache file.
+ *  @param[in] entry The entry.
+ */
+static void metafits_cache_write(multilog_t *log, const char *filename, const metafits_cache_entry_s *entry)
+{
+    char partial_filename[PATH_MAX + sizeof(METAFITS_CACHE_EXTENSION) + sizeof(FIL_PARTIAL_EXTENSION)];
+    snprintf(partial_filename, sizeof(partial_filename), "%s%s", filename, FIL_PARTIAL_EXTENSION);
+
+    FILE *file = fopen(partial_filename, "w");
+
+    if (file == NULL)
+    {
+        multilog(log, LOG_WARNING, "metafits_cache_put(): Could not create %s. Error: %s\n", partial_filename, strerror(errno));
+        return;
+    }
+
+    int written = fprintf(file, "# mwax_beamdb2fil metafits cache\nobsid %ld\nmtime %lld\nsize %lld\nmjd %.17g\nra %.17g\ndec %.17g\naltitude %.17g\nazimuth %.17g\nfilename %s\n",
+                          entry->obs_id, (long long)entry->mtime, (long long)entry->size, entry->metafits.mjd, entry->metafits.ra,
+                          entry->metafits.dec, entry->metafits.altitude, entry->metafits.azimuth, entry->metafits.filename);
+
+    if (fclose(file) != 0 || written < 0 || rename(partial_filename, filename) != 0)
+    {
+        multilog(log, LOG_WARNING, "metafits_cache_put(): Could not write %s. Error: %s\n", filename, strerror(errno));
+        unlink(partial_filename);
+    }
+}
+
+/**
+ *
+ *  @brief Looks up what was read from the metafits of an observation: in memory, then in the cache directory.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] obs_id The observation.
+ *  @param[in] metafits_filename Its metafits file (to check the cached values are still current).
+ *  @param[out] metafits Filled in on success (its filename is allocated, free it).
+ *  @returns EXIT_SUCCESS if it was cached, or EXIT_FAILURE if the metafits file needs to be read.
+ */
+int metafits_cache_get(multilog_t *log, long obs_id, const char *metafits_filename, metafits_s *metafits)
+{
+    time_t mtime;
+    off_t size;
+    metafits_cache_stat(metafits_filename, &mtime, &size);
+
+    int result = EXIT_FAILURE;
+
+    pthread_mutex_lock(&g_metafits_cache.mutex);
+
+    for (int e = 0; e < METAFITS_CACHE_ENTRIES && result != EXIT_SUCCESS; e++)
+    {
+        metafits_cache_entry_s *entry = &g_metafits_cache.entries[e];
+
+        if (entry->obs_id == obs_id && (mtime == 0 || (entry->mtime == mtime && entry->size == size)))
+        {
+            *metafits = entry->metafits;
+            metafits->filename = strdup(entry->metafits.filename);
+            result = EXIT_SUCCESS;
+
+            multilog(log, LOG_INFO, "metafits_cache_get(): Using the cached metafits of %ld\n", obs_id);
+        }
+    }
+
+    if (result != EXIT_SUCCESS && g_metafits_cache.cache_dir != NULL)
+    {
+        char cache_filename[PATH_MAX + sizeof(METAFITS_CACHE_EXTENSION)];
+        snprintf(cache_filename, sizeof(cache_filename), "%s/%ld%s", g_metafits_cache.cache_dir, obs_id, METAFITS_CACHE_EXTENSION);
+
+        metafits_cache_entry_s entry;
+
+        if (metafits_cache_read(cache_filename, &entry) == EXIT_SUCCESS)
+        {
+            if (entry.obs_id == obs_id && (mtime == 0 || (entry.mtime == mtime && entry.size == size)))
+            {
+                *metafits = entry.metafits;
+                result = EXIT_SUCCESS;
+
+                multilog(log, LOG_INFO, "metafits_cache_get(): Using the cached metafits of %ld from %s\n", obs_id, cache_filename);
+            }
+            else
+            {
+                free(entry.metafits.filename);
+                multilog(log, LOG_INFO, "metafits_cache_get(): %s is out of date\n", cache_filename);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&g_metafits_cache.mutex);
+
+    return result;
+}
+
+/**
+ *
+ *  @brief Caches what was read from the metafits of an observation (in memory, and in the cache directory if we have one).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] obs_id The observation.
+ *  @param[in] metafits_filename Its metafits file.
+ *  @param[in] metafits What was read from it.
+ */
+void metafits_cache_put(multilog_t *log, long obs_id, const char *metafits_filename, const metafits_s *metafits)
+{
+    pthread_mutex_lock(&g_metafits_cache.mutex);
+
+    // Replace the entry of this observation if it has one, otherwise the oldest
+    int e = g_metafits_cache.next;
+
+    for (int i = 0; i < METAFITS_CACHE_ENTRIES; i++)
+    {
+        if (g_metafits_cache.entries[i].obs_id == obs_id)
+            e = i;
+    }
+
+    if (e == g_metafits_cache.next)
+        g_metafits_cache.next = (g_metafits_cache.next + 1) % METAFITS_CACHE_ENTRIES;
+
+    metafits_cache_entry_s *entry = &g_metafits_cache.entries[e];
+
+    free(entry->metafits.filename);
+
+    entry->obs_id = obs_id;
+    metafits_cache_stat(metafits_filename, &entry->mtime, &entry->size);
+    entry->metafits = *metafits;
+    entry->metafits.filename = strdup(metafits->filename);
+    entry->metafits.channels_string = NULL;
+
+    if (g_metafits_cache.cache_dir != NULL)
+    {
+        char cache_filename[PATH_MAX + sizeof(METAFITS_CACHE_EXTENSION)];
+        snprintf(cache_filename, sizeof(cache_filename), "%s/%ld%s", g_metafits_cache.cache_dir, obs_id, METAFITS_CACHE_EXTENSION);
+
+        metafits_cache_write(log, cache_filename, entry);
+    }
+
+    pthread_mutex_unlock(&g_metafits_cache.mutex);
+}
+
+/**
+ *
+ *  @brief Frees the cache (the cache directory is left as it is).
+ */
+void metafits_cache_destroy()
+{
+    pthread_mutex_lock(&g_metafits_cache.mutex);
+
+    for (int e = 0; e < METAFITS_CACHE_ENTRIES; e++)
+    {
+        free(g_metafits_cache.entries[e].metafits.filename);
+        memset(&g_metafits_cache.entries[e], 0, sizeof(metafits_cache_entry_s));
+    }
+
+    free(g_metafits_cache.cache_dir);
+    g_metafits_cache.cache_dir = NULL;
+    g_metafits_cache.next = 0;
+
+    pthread_mutex_unlock(&g_metafits_cache.mutex);
+}
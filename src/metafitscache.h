@@ -0,0 +1,19 @@
+/**
+ * @file metafitscache.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that caches what we read from metafits files
+ *
+ */
+#pragma once
+
+#include "global.h"
+#include "multilog.h"
+
+#define METAFITS_CACHE_ENTRIES 16             // Observations kept in memory (the oldest is replaced)
+#define METAFITS_CACHE_EXTENSION ".metacache" // DIR/<obs_id>.metacache
+
+void metafits_cache_init(multilog_t *log, const char *cache_dir);
+int metafits_cache_get(multilog_t *log, long obs_id, const char *metafits_filename, metafits_s *metafits);
+void metafits_cache_put(multilog_t *log, long obs_id, const char *metafits_filename, const metafits_s *metafits);
+void metafits_cache_destroy();
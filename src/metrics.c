@@ -0,0 +1,344 @@
+/**
+ * @file metrics.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code for the per process pipeline counters which are reported to M&C
+ *
+ */
+#include <stdlib.h>
+
+#include "metrics.h"
+#include "../mwax_common/mwax_global_defs.h" // From mwax-common
+
+_Static_assert(METRICS_MAX_BEAMS >= INCOHERENT_BEAMS_MAX + COHERENT_BEAMS_MAX, "METRICS_MAX_BEAMS is too small");
+
+pipeline_metrics_s g_metrics;
+ring_metrics_s g_ring_metrics[METRICS_MAX_RINGS];
+
+// The ring whose reader this thread is (NULL for every other thread, and in replay mode)
+static __thread ring_metrics_s *t_ring_metrics = NULL;
+
+/**
+ *
+ *  @brief Makes the counters updated by this thread also count towards a ring (called by each ring's reader thread).
+ *  @param[in] ring Index of the ring.
+ *  @param[in] key Its shared memory key.
+ */
+void metrics_set_thread_ring(int ring, int32_t key)
+{
+    if (ring < 0 || ring >= METRICS_MAX_RINGS)
+        return;
+
+    t_ring_metrics = &g_ring_metrics[ring];
+    __atomic_store_n(&t_ring_metrics->key, key, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Returns 1 if this thread sets the process wide observation fields: every thread but the readers of the second
+ *         and later rings, so with several rings those fields are always the first ring's.
+ *  @returns 1 if it does, otherwise 0.
+ */
+static int metrics_thread_sets_observation()
+{
+    return t_ring_metrics == NULL || t_ring_metrics == &g_ring_metrics[0];
+}
+
+/**
+ *
+ *  @brief Sets the observation in progress (0 when we are not processing one), of this thread's ring and, if it is
+ *         the first, of the process.
+ *  @param[in] obs_id Obs id of the observation.
+ *  @param[in] subobs_id Sub obs id of the sub observation.
+ *  @param[in] nbeams Number of beams in the observation.
+ */
+void metrics_set_observation(int64_t obs_id, int64_t subobs_id, int32_t nbeams)
+{
+    if (metrics_thread_sets_observation())
+    {
+        __atomic_store_n(&g_metrics.obs_id, obs_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_metrics.subobs_id, subobs_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_metrics.nbeams, nbeams, __ATOMIC_RELAXED);
+    }
+
+    if (t_ring_metrics != NULL)
+    {
+        __atomic_store_n(&t_ring_metrics->obs_id, obs_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&t_ring_metrics->subobs_id, subobs_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&t_ring_metrics->nbeams, nbeams, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ *
+ *  @brief Sets the marker (seconds into the observation) of the last beam second written (see metrics_set_observation()).
+ *  @param[in] obs_marker The marker.
+ */
+void metrics_set_marker(int32_t obs_marker)
+{
+    if (metrics_thread_sets_observation())
+        __atomic_store_n(&g_metrics.obs_marker, obs_marker, __ATOMIC_RELAXED);
+
+    if (t_ring_metrics != NULL)
+        __atomic_store_n(&t_ring_metrics->obs_marker, obs_marker, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts one beam second written to a beam's fil file.
+ *  @param[in] beam Beam index.
+ *  @param[in] bytes Bytes written.
+ */
+void metrics_add_beam_bytes(int beam, uint64_t bytes)
+{
+    if (beam >= 0 && beam < METRICS_MAX_BEAMS)
+    {
+        __atomic_fetch_add(&g_metrics.beam_bytes_written[beam], bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_metrics.beam_blocks_written[beam], 1, __ATOMIC_RELAXED);
+
+        if (t_ring_metrics != NULL)
+            __atomic_fetch_add(&t_ring_metrics->beam_bytes_written[beam], bytes, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add(&g_metrics.blocks_processed, 1, __ATOMIC_RELAXED);
+
+    if (t_ring_metrics != NULL)
+        __atomic_fetch_add(&t_ring_metrics->blocks_processed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts one block read from the ringbuffer which was not written out.
+ *  @param[in] bytes Bytes in the block.
+ */
+void metrics_add_dropped(uint64_t bytes)
+{
+    __atomic_fetch_add(&g_metrics.blocks_dropped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.bytes_dropped, bytes, __ATOMIC_RELAXED);
+
+    if (t_ring_metrics != NULL)
+    {
+        __atomic_fetch_add(&t_ring_metrics->blocks_dropped, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&t_ring_metrics->bytes_dropped, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ *
+ *  @brief Records the time one beam second spent in a stage: into the health interval, the cumulative histogram
+ *         and the beam's total.
+ *  @param[in] beam Beam index.
+ *  @param[in] stage The stage.
+ *  @param[in] value_ns Time spent in the stage in nanoseconds.
+ */
+void metrics_record_stage(int beam, latency_stage_enum stage, uint64_t value_ns)
+{
+    metrics_interval_record(&g_metrics.interval[stage], value_ns);
+    latency_record(&g_metrics.stage_latency[stage], value_ns);
+
+    if (beam >= 0 && beam < METRICS_MAX_BEAMS)
+        __atomic_fetch_add(&g_metrics.beam_stage_ns[beam][stage], value_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts an attempt to create a fil file.
+ *  @param[in] success 1 if the file was created, 0 if there was an error.
+ */
+void metrics_add_file_opened(int success)
+{
+    if (success)
+        __atomic_fetch_add(&g_metrics.files_opened, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&g_metrics.file_open_errors, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a fil file being closed.
+ */
+void metrics_add_file_closed()
+{
+    __atomic_fetch_add(&g_metrics.files_closed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts the record of a finished file being published (once per file, however many places it goes to).
+ *  @param[in] success 1 if it was sent and/or appended everywhere, 0 if there was an error.
+ */
+void metrics_add_notification(int success)
+{
+    if (success)
+        __atomic_fetch_add(&g_metrics.notifications_sent, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&g_metrics.notification_errors, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Sets the current degradation level.
+ *  @param[in] level The level (see degrade_level_enum).
+ */
+void metrics_set_degrade_level(int32_t level)
+{
+    __atomic_store_n(&g_metrics.degrade_level, level, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a change of degradation level.
+ */
+void metrics_add_degrade_change()
+{
+    __atomic_fetch_add(&g_metrics.degrade_changes, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a beam second which was shed (not written) to keep up.
+ *  @param[in] bytes Bytes in the beam second.
+ */
+void metrics_add_shed(uint64_t bytes)
+{
+    __atomic_fetch_add(&g_metrics.blocks_shed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.bytes_shed, bytes, __ATOMIC_RELAXED);
+
+    if (t_ring_metrics != NULL)
+        __atomic_fetch_add(&t_ring_metrics->blocks_shed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a beam second whose stats were skipped to keep up.
+ */
+void metrics_add_stats_skipped()
+{
+    __atomic_fetch_add(&g_metrics.stats_skipped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a beam second whose extra products (e.g. its quick-look rows) were skipped to keep up.
+ */
+void metrics_add_extras_skipped()
+{
+    __atomic_fetch_add(&g_metrics.extras_skipped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a gap in an observation (beam seconds which never arrived) being filled.
+ *  @param[in] fill_bytes Bytes of zeros the gap was filled with.
+ */
+void metrics_add_gap(uint64_t fill_bytes)
+{
+    __atomic_fetch_add(&g_metrics.gaps, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.gap_fill_bytes, fill_bytes, __ATOMIC_RELAXED);
+
+    if (t_ring_metrics != NULL)
+    {
+        __atomic_fetch_add(&t_ring_metrics->gaps, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&t_ring_metrics->gap_fill_bytes, fill_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ *
+ *  @brief Counts a wideband beam second being written.
+ *  @param[in] late_channels Coarse channels which had not arrived in time (written as zeros).
+ */
+void metrics_add_wideband_second(uint32_t late_channels)
+{
+    __atomic_fetch_add(&g_metrics.wideband_seconds, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.wideband_channels_late, late_channels, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a wideband beam second being skipped, as none of its coarse channels arrived (it is left as zeros).
+ *  @param[in] late_channels Coarse channels it should have had.
+ */
+void metrics_add_wideband_skipped(uint32_t late_channels)
+{
+    __atomic_fetch_add(&g_metrics.wideband_seconds_skipped, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.wideband_channels_late, late_channels, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a coarse channel beam second which could not go in its wideband beam second (too late, or not in the band).
+ */
+void metrics_add_wideband_dropped()
+{
+    __atomic_fetch_add(&g_metrics.wideband_channels_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a beam second being added to its beam's quick-look pyramid.
+ */
+void metrics_add_quicklook_second()
+{
+    __atomic_fetch_add(&g_metrics.quicklook_seconds, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a beam second left out of its beam's quick-look pyramid, as the quick-look thread was too far behind.
+ */
+void metrics_add_quicklook_dropped()
+{
+    __atomic_fetch_add(&g_metrics.quicklook_seconds_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a staging buffer region being mapped (at the start of an observation).
+ *  @param[in] bytes Bytes in the region.
+ */
+void metrics_add_staging_pool_map(uint64_t bytes)
+{
+    __atomic_fetch_add(&g_metrics.staging_pool_maps, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_metrics.staging_pool_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Counts a staging buffer which had to come from the heap (the pool was empty or too small).
+ */
+void metrics_add_staging_heap_alloc()
+{
+    __atomic_fetch_add(&g_metrics.staging_heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Records one value into an interval. Lock free.
+ *  @param[in] interval Pointer to the interval.
+ *  @param[in] value_ns Value in nanoseconds.
+ */
+void metrics_interval_record(metrics_interval_s *interval, uint64_t value_ns)
+{
+    __atomic_fetch_add(&interval->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&interval->sum_ns, value_ns, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&interval->max_ns, __ATOMIC_RELAXED);
+    while (value_ns > max && !__atomic_compare_exchange_n(&interval->max_ns, &max, value_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/**
+ *
+ *  @brief Returns the values of an interval and starts a new one. A value recorded while this runs may be
+ *         counted in either interval, which is fine for monitoring.
+ *  @param[in] interval Pointer to the interval.
+ *  @param[out] taken The values of the interval which just finished.
+ */
+void metrics_interval_take(metrics_interval_s *interval, metrics_interval_s *taken)
+{
+    taken->count = __atomic_exchange_n(&interval->count, 0, __ATOMIC_RELAXED);
+    taken->sum_ns = __atomic_exchange_n(&interval->sum_ns, 0, __ATOMIC_RELAXED);
+    taken->max_ns = __atomic_exchange_n(&interval->max_ns, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file metrics.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the per process pipeline counters which are reported to M&C
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "latency.h"
+
+#define METRICS_MAX_BEAMS 32 // Must be >= INCOHERENT_BEAMS_MAX + COHERENT_BEAMS_MAX (checked in metrics.c)
+#define METRICS_MAX_RINGS 24 // Must be >= ARGS_MAX_KEYS (checked in ring.c)
+
+// Count, total and max of a stage since the last time the interval was taken
+typedef struct metrics_interval_s
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} metrics_interval_s;
+
+// Process wide counters. The reader updates these with relaxed atomics and the health thread reads them,
+// so the hot path never takes a lock.
+typedef struct pipeline_metrics_s
+{
+    // Observation in progress (0 if none). With several rings, that of the first (--key order): each ring's is in
+    // ring_metrics_s
+    int64_t obs_id;
+    int64_t subobs_id;
+    int32_t obs_marker;
+    int32_t nbeams;
+
+    // Cumulative counters
+    uint64_t beam_bytes_written[METRICS_MAX_BEAMS];
+    uint64_t beam_blocks_written[METRICS_MAX_BEAMS];
+    uint64_t beam_stage_ns[METRICS_MAX_BEAMS][LATENCY_STAGE_COUNT];
+    uint64_t blocks_processed;
+    uint64_t blocks_dropped;
+    uint64_t bytes_dropped;
+    uint64_t files_opened;
+    uint64_t files_closed;
+    uint64_t file_open_errors;
+    uint64_t notifications_sent;  // finished files whose record was sent and/or appended (see notify.h)
+    uint64_t notification_errors; // finished files whose record the socket or manifest missed
+
+    // Degradation (see degrade.h)
+    int32_t degrade_level;
+    uint64_t degrade_changes;
+    uint64_t blocks_shed;
+    uint64_t bytes_shed;
+    uint64_t stats_skipped;
+    uint64_t extras_skipped;
+
+    // Gaps: sub observations which never arrived, filled with zeros (see fill_gap() in dada_dbfil.c)
+    uint64_t gaps;
+    uint64_t gap_fill_bytes;
+
+    // Wideband output (see wideband.c): beam seconds written, those skipped as nothing arrived for them, and channels of
+    // them which were late (zeros) or dropped
+    uint64_t wideband_seconds;
+    uint64_t wideband_seconds_skipped;
+    uint64_t wideband_channels_late;
+    uint64_t wideband_channels_dropped;
+
+    // Quick-look pyramids (see quicklook.c): beam seconds added, and those dropped as the quick-look thread fell behind
+    uint64_t quicklook_seconds;
+    uint64_t quicklook_seconds_dropped;
+
+    // Staging buffers (see bufferpool.h). staging_heap_allocs should stay 0 once observations are running
+    uint64_t staging_pool_maps;
+    uint64_t staging_pool_bytes;
+    uint64_t staging_heap_allocs;
+
+    // Stage latency since the process started (never reset, as Prometheus expects)
+    latency_histogram_s stage_latency[LATENCY_STAGE_COUNT];
+
+    // Stage latency since the last interval was taken
+    metrics_interval_s interval[LATENCY_STAGE_COUNT];
+} pipeline_metrics_s;
+
+// Per ringbuffer (--key) counters, sent in the health record of each ring. Each ring's reader thread updates its own
+// (see metrics_set_thread_ring()) as well as the process wide ones above
+typedef struct ring_metrics_s
+{
+    int32_t key; // 0 if the ring is not in use
+    int32_t nbeams;
+    int64_t obs_id;
+    int64_t subobs_id;
+    int32_t obs_marker;
+    int32_t reserved;
+
+    uint64_t beam_bytes_written[METRICS_MAX_BEAMS];
+    uint64_t blocks_processed;
+    uint64_t blocks_dropped;
+    uint64_t bytes_dropped;
+    uint64_t blocks_shed;
+    uint64_t gaps;
+    uint64_t gap_fill_bytes;
+} ring_metrics_s;
+
+extern pipeline_metrics_s g_metrics;
+extern ring_metrics_s g_ring_metrics[METRICS_MAX_RINGS];
+
+void metrics_set_thread_ring(int ring, int32_t key);
+
+void metrics_set_observation(int64_t obs_id, int64_t subobs_id, int32_t nbeams);
+void metrics_set_marker(int32_t obs_marker);
+void metrics_add_beam_bytes(int beam, uint64_t bytes);
+void metrics_add_dropped(uint64_t bytes);
+void metrics_record_stage(int beam, latency_stage_enum stage, uint64_t value_ns);
+void metrics_add_file_opened(int success);
+void metrics_add_file_closed();
+void metrics_add_notification(int success);
+void metrics_set_degrade_level(int32_t level);
+void metrics_add_degrade_change();
+void metrics_add_shed(uint64_t bytes);
+void metrics_add_stats_skipped();
+void metrics_add_extras_skipped();
+void metrics_add_gap(uint64_t fill_bytes);
+void metrics_add_wideband_second(uint32_t late_channels);
+void metrics_add_wideband_skipped(uint32_t late_channels);
+void metrics_add_wideband_dropped();
+void metrics_add_quicklook_second();
+void metrics_add_quicklook_dropped();
+void metrics_add_staging_pool_map(uint64_t bytes);
+void metrics_add_staging_heap_alloc();
+void metrics_interval_record(metrics_interval_s *interval, uint64_t value_ns);
+void metrics_interval_take(metrics_interval_s *interval, metrics_interval_s *taken);
@@ -0,0 +1,194 @@
+/**
+ * @file notify.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that tells downstream tools when a fil file is finished
+ *
+ * Fil files (and their checksum sidecars) are written as NAME.partial and renamed to NAME once they are closed, so a
+ * file with its final name is always complete. Straight after the rename a record is published, so archivers do not
+ * have to poll the destination directory. The record is one line of JSON:
+ *
+ *   {"path":"...","obs_id":N,"beam":N,"segment":N,"subband":N,"bytes":N,"nsamples":N,"data_crc32c":"xxxxxxxx"}
+ *
+ * It is sent as one datagram to a UNIX datagram socket (--notify-socket) and/or appended to a manifest file
+ * (--manifest). Sends never block: if nothing is listening the record is not sent, and this is logged and counted
+ * (the manifest can be used to catch up). Records come from the reader and segment closer threads; each is a single
+ * sendto() / write() with O_APPEND, so records from different threads never interleave.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "notify.h"
+#include "metrics.h"
+
+static int g_notify_socket = -1;
+static struct sockaddr_un g_notify_address;
+static int g_manifest_fd = -1;
+
+/**
+ *
+ *  @brief Copies a string into a JSON string (without the quotes), escaping quotes, backslashes and control characters.
+ *  @param[out] out Where to write.
+ *  @param[in] out_len Size of out.
+ *  @param[in] in The string.
+ */
+static void notify_json_escape(char *out, size_t out_len, const char *in)
+{
+    size_t o = 0;
+
+    for (const char *c = in; *c && o + 7 < out_len; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            out[o++] = '\\';
+            out[o++] = *c;
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            o += snprintf(&out[o], out_len - o, "\\u%04x", (unsigned char)*c);
+        }
+        else
+        {
+            out[o++] = *c;
+        }
+    }
+
+    out[o] = '\0';
+}
+
+/**
+ *
+ *  @brief Opens the notification socket and/or manifest. Call once from main() before any files are written.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] socket_path Path of the UNIX datagram socket to send records to, or NULL.
+ *  @param[in] manifest_path Path of the manifest to append records to, or NULL.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the socket path is too long or the manifest could not be opened.
+ */
+int notify_init(multilog_t *log, const char *socket_path, const char *manifest_path)
+{
+    if (socket_path != NULL)
+    {
+        if (strlen(socket_path) >= sizeof(g_notify_address.sun_path))
+        {
+            multilog(log, LOG_ERR, "notify_init(): Socket path %s is too long (max %lu characters).\n", socket_path, sizeof(g_notify_address.sun_path) - 1);
+            return EXIT_FAILURE;
+        }
+
+        g_notify_socket = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+        if (g_notify_socket == -1)
+        {
+            multilog(log, LOG_ERR, "notify_init(): Could not create a UNIX datagram socket. Error: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        memset(&g_notify_address, 0, sizeof(g_notify_address));
+        g_notify_address.sun_family = AF_UNIX;
+        strncpy(g_notify_address.sun_path, socket_path, sizeof(g_notify_address.sun_path) - 1);
+
+        multilog(log, LOG_INFO, "notify_init(): Finished files will be sent to %s.\n", socket_path);
+    }
+
+    if (manifest_path != NULL)
+    {
+        g_manifest_fd = open(manifest_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+        if (g_manifest_fd == -1)
+        {
+            multilog(log, LOG_ERR, "notify_init(): Could not open manifest %s. Error: %s\n", manifest_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        multilog(log, LOG_INFO, "notify_init(): Finished files will be appended to %s.\n", manifest_path);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Returns 1 if records are being published (to a socket or manifest).
+ *  @returns 1 if enabled, otherwise 0.
+ */
+int notify_enabled()
+{
+    return g_notify_socket != -1 || g_manifest_fd != -1;
+}
+
+/**
+ *
+ *  @brief Publishes the record of a finished fil file. Never blocks on the receiver.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] record The finished file.
+ */
+void notify_file_closed(multilog_t *log, const notify_record_s *record)
+{
+    if (!notify_enabled())
+        return;
+
+    char path[NOTIFY_RECORD_LEN / 2];
+    notify_json_escape(path, sizeof(path), record->path);
+
+    char line[NOTIFY_RECORD_LEN];
+    int len;
+
+    if (record->has_checksum)
+        len = snprintf(line, sizeof(line), "{\"path\":\"%s\",\"obs_id\":%ld,\"beam\":%d,\"segment\":%d,\"subband\":%d,\"bytes\":%lu,\"nsamples\":%ld,\"data_crc32c\":\"%08x\"}\n",
+                       path, record->obs_id, record->beam, record->segment, record->subband, record->bytes, record->nsamples, record->data_crc32c);
+    else
+        len = snprintf(line, sizeof(line), "{\"path\":\"%s\",\"obs_id\":%ld,\"beam\":%d,\"segment\":%d,\"subband\":%d,\"bytes\":%lu,\"nsamples\":%ld}\n",
+                       path, record->obs_id, record->beam, record->segment, record->subband, record->bytes, record->nsamples);
+
+    if (len < 0 || len >= (int)sizeof(line))
+    {
+        multilog(log, LOG_ERR, "notify_file_closed(): Record for %s is too long.\n", record->path);
+        metrics_add_notification(0);
+        return;
+    }
+
+    // Counted once per file, as an error if either the socket or the manifest missed it
+    int published = 1;
+
+    if (g_notify_socket != -1)
+    {
+        // The datagram is the line without its newline
+        if (sendto(g_notify_socket, line, len - 1, MSG_DONTWAIT, (struct sockaddr *)&g_notify_address, sizeof(g_notify_address)) != len - 1)
+        {
+            multilog(log, LOG_WARNING, "notify_file_closed(): Could not send the record for %s to %s. Error: %s\n", record->path, g_notify_address.sun_path, strerror(errno));
+            published = 0;
+        }
+    }
+
+    if (g_manifest_fd != -1)
+    {
+        if (write(g_manifest_fd, line, len) != len)
+        {
+            multilog(log, LOG_ERR, "notify_file_closed(): Could not append the record for %s to the manifest. Error: %s\n", record->path, strerror(errno));
+            published = 0;
+        }
+    }
+
+    metrics_add_notification(published);
+}
+
+/**
+ *
+ *  @brief Closes the socket and manifest.
+ */
+void notify_shutdown()
+{
+    if (g_notify_socket != -1)
+        close(g_notify_socket);
+
+    if (g_manifest_fd != -1)
+        close(g_manifest_fd);
+
+    g_notify_socket = -1;
+    g_manifest_fd = -1;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file notify.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that tells downstream tools when a fil file is finished
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "multilog.h"
+
+#define NOTIFY_RECORD_LEN 8192 // Max length of one record (a line of JSON)
+
+// A finished (closed and renamed) fil file
+typedef struct notify_record_s
+{
+    const char *path;
+    long obs_id;
+    int beam;             // 1 based (0 for a multi-beam container)
+    int segment;          // segment index, or -1 if the observation is not segmented
+    int subband;          // sub-band index, or -1 if the beam is not split into sub-bands
+    uint64_t bytes;       // size of the file
+    long nsamples;        // as in the header
+    int has_checksum;     // 0 if --no-checksums (data_crc32c is then not sent)
+    uint32_t data_crc32c; // CRC32C of the data (everything after the header), as in the sidecar
+} notify_record_s;
+
+int notify_init(multilog_t *log, const char *socket_path, const char *manifest_path);
+int notify_enabled();
+void notify_file_closed(multilog_t *log, const notify_record_s *record);
+void notify_shutdown();
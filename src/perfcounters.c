@@ -0,0 +1,266 @@
+/**
+ * @file perfcounters.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that profiles the hot path stages with hardware performance counters
+ *
+ * When --perf-counters is passed, the reader thread opens a perf_event_open group (cycles, instructions,
+ * LLC misses, backend stalled cycles) and reads it at every stage boundary in dada_dbfil_io(). The deltas
+ * are summed per stage and reported at the end of the observation as IPC, bytes/cycle and misses/KB, which
+ * tells us if a stage is compute or memory bound. Each read is one read() syscall (~1us), so this is opt-in.
+ */
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfcounters.h"
+
+const char *perf_counter_names[PERF_COUNTER_COUNT] = {"cycles", "instructions", "llc_misses", "stalled_cycles"};
+
+static const uint64_t perf_counter_configs[PERF_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_STALLED_CYCLES_BACKEND};
+
+// Layout of a read() of the group with PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+typedef struct
+{
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_COUNTER_COUNT];
+} perf_group_read_s;
+
+/**
+ *
+ *  @brief Opens one counter (glibc has no wrapper for perf_event_open).
+ *  @param[in] config The PERF_COUNT_HW_* counter.
+ *  @param[in] group_fd Group leader fd, or -1 to open the leader.
+ *  @param[in] user_only 1 to exclude kernel time.
+ *  @returns The fd, or -1 (errno is set) if the counter could not be opened.
+ */
+static int open_counter(uint64_t config, int group_fd, int user_only)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = (group_fd == -1); // the leader starts disabled and enables the whole group
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // This thread, any cpu
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/**
+ *
+ *  @brief Opens the counter group on the calling thread. If the counters are not permitted or not supported we log
+ *         a warning and carry on without them.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] perf Pointer to the counters.
+ *  @returns EXIT_SUCCESS if the group is counting, or EXIT_FAILURE if profiling is disabled.
+ */
+int perf_counters_open(multilog_t *log, perf_counters_s *perf)
+{
+    perf->attempted = 1;
+    perf->enabled = 0;
+    perf->nopen = 0;
+    perf->group_fd = -1;
+
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        perf->fd[c] = -1;
+        perf->read_index[c] = -1;
+    }
+
+    // Try to count kernel time too (most of the fil write is in the kernel), then fall back to user only
+    perf->user_only = 0;
+    perf->group_fd = open_counter(perf_counter_configs[perf_cycles], -1, 0);
+
+    if (perf->group_fd == -1 && (errno == EACCES || errno == EPERM))
+    {
+        perf->user_only = 1;
+        perf->group_fd = open_counter(perf_counter_configs[perf_cycles], -1, 1);
+    }
+
+    if (perf->group_fd == -1)
+    {
+        multilog(log, LOG_WARNING, "perf_counters_open(): Hardware counters are not available (%s). Check /proc/sys/kernel/perf_event_paranoid. Continuing without them.\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    perf->fd[perf_cycles] = perf->group_fd;
+    perf->read_index[perf_cycles] = perf->nopen++;
+
+    // The rest are optional (e.g. stalled cycles is not supported on every cpu or in every VM)
+    for (int c = perf_cycles + 1; c < PERF_COUNTER_COUNT; c++)
+    {
+        perf->fd[c] = open_counter(perf_counter_configs[c], perf->group_fd, perf->user_only);
+
+        if (perf->fd[c] == -1)
+            multilog(log, LOG_WARNING, "perf_counters_open(): Counter %s is not available (%s).\n", perf_counter_names[c], strerror(errno));
+        else
+            perf->read_index[c] = perf->nopen++;
+    }
+
+    ioctl(perf->group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    perf->enabled = 1;
+
+    multilog(log, LOG_INFO, "perf_counters_open(): Profiling stages with %d hardware counters%s.\n", perf->nopen, perf->user_only ? " (user space only)" : "");
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Closes the counter group.
+ *  @param[in] perf Pointer to the counters.
+ */
+void perf_counters_close(perf_counters_s *perf)
+{
+    if (!perf->enabled)
+        return;
+
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        if (perf->fd[c] != -1)
+            close(perf->fd[c]);
+
+        perf->fd[c] = -1;
+    }
+
+    perf->group_fd = -1;
+    perf->enabled = 0;
+}
+
+/**
+ *
+ *  @brief Zeros the per stage totals (called at the start of each observation).
+ *  @param[in] perf Pointer to the counters.
+ */
+void perf_counters_reset(perf_counters_s *perf)
+{
+    memset(perf->stage_totals, 0, sizeof(perf->stage_totals));
+    memset(perf->stage_bytes, 0, sizeof(perf->stage_bytes));
+    perf->multiplexed = 0;
+}
+
+/**
+ *
+ *  @brief Reads the current value of each counter.
+ *  @param[in] perf Pointer to the counters.
+ *  @param[out] values The value of each counter (0 for counters which are not available).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the group could not be read.
+ */
+static int read_counters(perf_counters_s *perf, uint64_t *values)
+{
+    perf_group_read_s group;
+
+    memset(values, 0, PERF_COUNTER_COUNT * sizeof(uint64_t));
+
+    if (read(perf->group_fd, &group, sizeof(group)) <= 0)
+        return EXIT_FAILURE;
+
+    if (group.time_running < group.time_enabled)
+        perf->multiplexed = 1;
+
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        if (perf->read_index[c] >= 0 && (uint64_t)perf->read_index[c] < group.nr)
+            values[c] = group.values[perf->read_index[c]];
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Marks the start of an io call (one beam second).
+ *  @param[in] perf Pointer to the counters.
+ *  @param[in] bytes The bytes this io call processes (used for bytes/cycle and misses/KB).
+ */
+void perf_counters_io_begin(perf_counters_s *perf, uint64_t bytes)
+{
+    if (!perf->enabled)
+        return;
+
+    read_counters(perf, perf->io_start);
+    memcpy(perf->last, perf->io_start, sizeof(perf->last));
+    perf->io_bytes = bytes;
+}
+
+/**
+ *
+ *  @brief Marks the end of a stage. stage_io is the whole io call, every other stage runs from the end of the last one.
+ *  @param[in] perf Pointer to the counters.
+ *  @param[in] stage The stage which just finished.
+ */
+void perf_counters_stage_end(perf_counters_s *perf, latency_stage_enum stage)
+{
+    if (!perf->enabled)
+        return;
+
+    uint64_t now[PERF_COUNTER_COUNT];
+
+    if (read_counters(perf, now) != EXIT_SUCCESS)
+        return;
+
+    uint64_t *start = (stage == stage_io) ? perf->io_start : perf->last;
+
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        perf->stage_totals[stage][c] += now[c] - start[c];
+
+    perf->stage_bytes[stage] += perf->io_bytes;
+
+    if (stage != stage_io)
+        memcpy(perf->last, now, sizeof(perf->last));
+}
+
+/**
+ *
+ *  @brief Logs the counters of each stage for the observation: IPC, bytes/cycle, LLC misses/KB and % stalled.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] perf Pointer to the counters.
+ */
+void perf_counters_log_summary(multilog_t *log, perf_counters_s *perf)
+{
+    if (!perf->enabled)
+        return;
+
+    multilog(log, LOG_INFO, "Perf counters%s%s:\n", perf->user_only ? " (user space only)" : "",
+             perf->multiplexed ? " (counters were multiplexed, values are under-reported)" : "");
+
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        uint64_t *totals = perf->stage_totals[stage];
+        double cycles = (double)totals[perf_cycles];
+        double kb = perf->stage_bytes[stage] / 1024.0;
+
+        if (cycles == 0)
+            continue;
+
+        char ipc[16] = "n/a", misses_per_kb[16] = "n/a", stalled[16] = "n/a";
+
+        if (perf->read_index[perf_instructions] >= 0)
+            snprintf(ipc, sizeof(ipc), "%.2f", totals[perf_instructions] / cycles);
+
+        if (perf->read_index[perf_llc_misses] >= 0 && kb > 0)
+            snprintf(misses_per_kb, sizeof(misses_per_kb), "%.3f", totals[perf_llc_misses] / kb);
+
+        if (perf->read_index[perf_stalled_cycles] >= 0)
+            snprintf(stalled, sizeof(stalled), "%.1f%%", 100.0 * totals[perf_stalled_cycles] / cycles);
+
+        multilog(log, LOG_INFO, "Perf %-12s cycles=%-14lu instructions=%-14lu llc_misses=%-10lu IPC=%-6s bytes/cycle=%-8.3f misses/KB=%-8s stalled=%s\n",
+                 latency_stage_names[stage], totals[perf_cycles], totals[perf_instructions], totals[perf_llc_misses], ipc,
+                 perf->stage_bytes[stage] / cycles, misses_per_kb, stalled);
+    }
+}
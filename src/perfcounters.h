@@ -0,0 +1,54 @@
+/**
+ * @file perfcounters.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that profiles the hot path stages with hardware performance counters
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "latency.h"
+#include "multilog.h"
+
+typedef enum perf_counter_enum
+{
+    perf_cycles = 0,
+    perf_instructions,
+    perf_llc_misses,
+    perf_stalled_cycles, // backend stalls (waiting on memory or execution units)
+    PERF_COUNTER_COUNT
+} perf_counter_enum;
+
+extern const char *perf_counter_names[PERF_COUNTER_COUNT];
+
+// One counter group per reader thread (the counters only count the thread which opened them)
+typedef struct perf_counters_s
+{
+    int requested; // --perf-counters was passed
+    int attempted; // we tried to open the group on this thread
+    int enabled;   // the group is open and counting
+
+    int group_fd;                     // fd of the group leader (cycles)
+    int fd[PERF_COUNTER_COUNT];       // -1 if this counter is not available
+    int read_index[PERF_COUNTER_COUNT]; // position of each counter in a group read, -1 if not available
+    int nopen;
+    int user_only;   // kernel time could not be counted (perf_event_paranoid)
+    int multiplexed; // the kernel had to time share the counters, so counts are under-reported
+
+    // Counter values at the start of this io call, and at the end of the last stage
+    uint64_t io_start[PERF_COUNTER_COUNT];
+    uint64_t last[PERF_COUNTER_COUNT];
+    uint64_t io_bytes;
+
+    // Totals for this observation
+    uint64_t stage_totals[LATENCY_STAGE_COUNT][PERF_COUNTER_COUNT];
+    uint64_t stage_bytes[LATENCY_STAGE_COUNT];
+} perf_counters_s;
+
+int perf_counters_open(multilog_t *log, perf_counters_s *perf);
+void perf_counters_close(perf_counters_s *perf);
+void perf_counters_reset(perf_counters_s *perf);
+void perf_counters_io_begin(perf_counters_s *perf, uint64_t bytes);
+void perf_counters_stage_end(perf_counters_s *perf, latency_stage_enum stage);
+void perf_counters_log_summary(multilog_t *log, perf_counters_s *perf);
@@ -0,0 +1,765 @@
+/**
+ * @file pipeline.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that runs each beam second through the stages of its beam's pipeline (stats, normalise,
+ *        quick-look, sub-bands, checksum, write and stats files). The stages which work on samples are run a tile of timesteps at
+ *        a time, all of them over one tile before the next, so each sample comes from memory once per beam second
+ *        rather than once per stage. A new product is a new stage in the table below: dada_dbfil_io() only runs the
+ *        pipeline
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline.h"
+#include "asynclog.h"
+#include "dada_dbfil.h"
+#include "filwriter.h"
+#include "global.h"
+#include "kernels.h"
+#include "metrics.h"
+#include "quicklook.h"
+#include "trace.h"
+#include "wideband.h"
+
+#define PIPELINE_BIT(stage) (1 << (stage))
+
+/**
+ *
+ *  @brief Puts the output of a stage which transforms the data in a staging buffer (the block still belongs to the
+ *         ringbuffer), and has the stages after it read that.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @param[in] what What the stage does with it (for the error message).
+ *  @returns 1, or -1 if there is no buffer for it.
+ */
+static int stage_into_staging_buffer(pipeline_block_s *block, pipeline_step_s *step, const char *what)
+{
+    step->out = buffer_pool_get_uninitialised(&block->ctx->pool, block->bytes);
+
+    if (step->out == NULL)
+    {
+        multilog(block->log, LOG_ERR, "pipeline_run(): Could not allocate %lu bytes to %s beam %d.\n", block->bytes, what, block->beam + 1);
+        return -1;
+    }
+
+    block->data = step->out;
+
+    return 1;
+}
+
+/**
+ *
+ *  @brief Returns the staging buffer of a stage which transforms the data to the pool.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ */
+static void stage_release_staging_buffer(pipeline_block_s *block, pipeline_step_s *step)
+{
+    buffer_pool_put(&block->ctx->pool, step->out);
+    step->out = NULL;
+}
+
+/**
+ *
+ *  @brief Stats: starts the sums of each channel and each timestep, unless they are shed to keep up (see degrade.c).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, 0 if shed, or -1 if there is no buffer for the sums.
+ */
+static int stats_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    dada_db_s *ctx = block->ctx;
+    beam_s *beam = &ctx->beams[block->beam];
+
+    if (block->shed || degrade_should_shed_stats(&ctx->degrade))
+    {
+        ctx->degrade.stats_skipped++;
+        metrics_add_stats_skipped();
+        return 0;
+    }
+
+    beam->power_freq = buffer_pool_get(&ctx->pool, beam->nchan * sizeof(double));
+    beam->power_time = buffer_pool_get(&ctx->pool, beam->ntimesteps * sizeof(double));
+
+    if (beam->power_freq == NULL || beam->power_time == NULL)
+    {
+        multilog(block->log, LOG_ERR, "pipeline_run(): Could not allocate the stats of beam %d.\n", block->beam + 1);
+        return -1;
+    }
+
+    block->stats_gathered = 1;
+
+    return 1;
+}
+
+/**
+ *
+ *  @brief Stats: adds a tile to the sum of every channel and every timestep (see kernels.c).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @param[in] t0 First timestep of the tile.
+ *  @param[in] t1 Timestep after the tile.
+ */
+static void stats_tile(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1)
+{
+    beam_s *beam = &block->ctx->beams[block->beam];
+
+    kernel_stats(&step->in[t0 * block->nvalues], t1 - t0, beam->nchan, block->ctx->npol, beam->power_freq, &beam->power_time[t0]);
+}
+
+/**
+ *
+ *  @brief Stats: returns the sums to the pool (once the stats files have been written).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ */
+static void stats_release(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    beam_s *beam = &block->ctx->beams[block->beam];
+
+    buffer_pool_put(&block->ctx->pool, beam->power_freq);
+    buffer_pool_put(&block->ctx->pool, beam->power_time);
+    beam->power_freq = NULL;
+    beam->power_time = NULL;
+}
+
+/**
+ *
+ *  @brief Normalise: into a staging buffer, unless the beam second is shed.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, 0 if shed, or -1 if there is no staging buffer.
+ */
+static int normalise_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    if (block->shed)
+        return 0;
+
+    return stage_into_staging_buffer(block, step, "normalise");
+}
+
+/**
+ *
+ *  @brief Normalise: updates the running bandpass with the whole beam second, before any of it is normalised by it
+ *         (see bandpass.c).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns EXIT_SUCCESS.
+ */
+static int normalise_prepare(pipeline_block_s *block, pipeline_step_s *step)
+{
+    bandpass_update(&block->ctx->beams[block->beam].bandpass, step->in, block->ntimesteps, (float)(1.0 / block->ctx->normalise_seconds));
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Normalise: a tile, by the running bandpass.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @param[in] t0 First timestep of the tile.
+ *  @param[in] t1 Timestep after the tile.
+ */
+static void normalise_tile(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1)
+{
+    bandpass_apply(&block->ctx->beams[block->beam].bandpass, &step->in[t0 * block->nvalues], &step->out[t0 * block->nvalues], t1 - t0);
+}
+
+/**
+ *
+ *  @brief Quick-look: takes the buffer for the level 0 rows of the beam second, unless it is shed, extra products are
+ *         shed to keep up (see degrade.c) or the quick-look thread is too far behind (see quicklook.c), which leaves
+ *         zeros in the pyramid.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, or 0 if not.
+ */
+static int quicklook_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    dada_db_s *ctx = block->ctx;
+    beam_s *beam = &ctx->beams[block->beam];
+
+    if (block->shed || beam->quicklook == NULL)
+        return 0;
+
+    if (degrade_should_shed_extras(&ctx->degrade))
+    {
+        ctx->degrade.extras_skipped++;
+        metrics_add_extras_skipped();
+        return 0;
+    }
+
+    beam->quicklook_rows = quicklook_reserve(beam->quicklook);
+
+    return beam->quicklook_rows != NULL;
+}
+
+/**
+ *
+ *  @brief Quick-look: adds each timestep of a tile to its level 0 row.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @param[in] t0 First timestep of the tile.
+ *  @param[in] t1 Timestep after the tile.
+ */
+static void quicklook_tile(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1)
+{
+    beam_s *beam = &block->ctx->beams[block->beam];
+
+    quicklook_add(beam->quicklook, beam->quicklook_rows, step->in, t0, t1);
+}
+
+/**
+ *
+ *  @brief Quick-look: hands the rows to the quick-look thread, which builds the rest of the pyramid from them.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns EXIT_SUCCESS.
+ */
+static int quicklook_end(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    beam_s *beam = &block->ctx->beams[block->beam];
+
+    quicklook_commit(beam->quicklook, block->second);
+    beam->quicklook_rows = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Sub-bands: into a staging buffer, unless the beam second is shed.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, 0 if shed, or -1 if there is no staging buffer.
+ */
+static int subbands_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    if (block->shed || block->ctx->beams[block->beam].noutputs < 2)
+        return 0;
+
+    return stage_into_staging_buffer(block, step, "split into sub-bands");
+}
+
+/**
+ *
+ *  @brief Sub-bands: the channels of each sub-band in each timestep of a tile are copied to that timestep of the
+ *         sub-band's region of the staging buffer, so each sub-band is contiguous ([sub-band][time][chan][pol]) and one
+ *         write.
+ *  @param[in] block The beam second ([time][channel][pol]).
+ *  @param[in] step The stage.
+ *  @param[in] t0 First timestep of the tile.
+ *  @param[in] t1 Timestep after the tile.
+ */
+static void subbands_tile(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1)
+{
+    int nsubbands = block->ctx->beams[block->beam].noutputs;
+    long subband_values = block->nvalues / nsubbands;
+    long subband_elements = block->ntimesteps * subband_values;
+
+    for (long t = t0; t < t1; t++)
+    {
+        for (int subband = 0; subband < nsubbands; subband++)
+            memcpy(&step->out[subband * subband_elements + t * subband_values], &step->in[(t * nsubbands + subband) * subband_values], subband_values * sizeof(float));
+    }
+}
+
+/**
+ *
+ *  @brief Checksum: starts the CRC32C of each fil file's part of the beam second (only with checksums, and fil files of
+ *         our own, and not if the beam second is shed: the write checksums the zeros).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, or 0 if not.
+ */
+static int checksum_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    beam_s *beam = &block->ctx->beams[block->beam];
+
+    if (block->shed || !block->ctx->checksums || beam->noutputs == 0)
+        return 0;
+
+    for (int output = 0; output < beam->noutputs; output++)
+        beam->outputs[output].block_crc = 0;
+
+    block->checksummed = 1;
+
+    return 1;
+}
+
+/**
+ *
+ *  @brief Checksum: adds a tile of each fil file's part to its CRC32C (each part is contiguous, as the sub-bands stage
+ *         is before this one).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @param[in] t0 First timestep of the tile.
+ *  @param[in] t1 Timestep after the tile.
+ */
+static void checksum_tile(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1)
+{
+    beam_s *beam = &block->ctx->beams[block->beam];
+    long output_values = block->nvalues / beam->noutputs;
+    long output_elements = block->ntimesteps * output_values;
+
+    for (int output = 0; output < beam->noutputs; output++)
+        beam->outputs[output].block_crc = crc32c(beam->outputs[output].block_crc, &step->in[output * output_elements + t0 * output_values],
+                                                 (t1 - t0) * output_values * sizeof(float));
+}
+
+/**
+ *
+ *  @brief Write: the beam second into the fil files (starting the next segment first if it would not fit in this one),
+ *         the container or the wideband assembler. A shed beam second is not written, so it reads back as zeros.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+static int write_end(pipeline_block_s *block, pipeline_step_s *step)
+{
+    dada_db_s *ctx = block->ctx;
+    multilog_t *log = block->log;
+    int beam = block->beam;
+    int result = EXIT_SUCCESS;
+
+    if (ctx->beams[beam].segment_secs > 0 && ctx->beams[beam].segment_written_secs >= ctx->beams[beam].segment_secs)
+        result = next_fil_segment(block->client, beam);
+
+    // Each fil file's part of the beam second (a sub-band, or all of it)
+    uint64_t output_bytes = ctx->beams[beam].noutputs > 1 ? block->bytes / ctx->beams[beam].noutputs : block->bytes;
+    long output_elements = output_bytes / sizeof(float);
+
+    if (result == EXIT_SUCCESS && ctx->wideband_mode)
+    {
+        // To the assembler, which puts it in its place in the band (see wideband.c)
+        result = wideband_deposit(log, ctx, beam, block->second, block->shed ? NULL : step->in);
+    }
+    else if (result == EXIT_SUCCESS && ctx->container_mode)
+    {
+        // Into the container (see container.c). A shed beam second is only indexed
+        if (block->shed)
+            result = container_skip_block(log, &ctx->container, beam, block->second, block->bytes, CONTAINER_BLOCK_SHED);
+        else
+            result = container_write_block(log, &ctx->container, beam, block->second, step->in, block->bytes);
+    }
+    else if (result == EXIT_SUCCESS && block->shed)
+    {
+        for (int subband = 0; subband < ctx->beams[beam].noutputs && result == EXIT_SUCCESS; subband++)
+        {
+            fil_output_s *output = &ctx->beams[beam].outputs[subband];
+
+            result = skip_fil_block(block->client, &output->out_filfile_ptr, output_bytes);
+            output->data_crc = crc32c_zeros(output->data_crc, output_bytes);
+        }
+    }
+    else if (result == EXIT_SUCCESS)
+    {
+        for (int subband = 0; subband < ctx->beams[beam].noutputs && result == EXIT_SUCCESS; subband++)
+        {
+            fil_output_s *output = &ctx->beams[beam].outputs[subband];
+
+            result = create_fil_block(block->client, &output->out_filfile_ptr, ctx->nbit / 8, block->ntimesteps,
+                                      ctx->beams[beam].nsubband_chan, ctx->npol, (float *)&step->in[subband * output_elements], output_bytes,
+                                      output->checksum_file, &output->data_crc, block->checksummed ? &output->block_crc : NULL);
+
+            // And what it was normalised by (the second is from the start of the observation)
+            if (result == EXIT_SUCCESS && output->scales_file != NULL &&
+                bandpass_write_scales(output->scales_file, &ctx->beams[beam].bandpass, block->second,
+                                      subband * ctx->beams[beam].nsubband_chan * ctx->npol, ctx->beams[beam].nsubband_chan * ctx->npol) != EXIT_SUCCESS)
+            {
+                multilog(log, LOG_ERR, "pipeline_run(): Error writing scales of beam %d to %s. Error: %s\n", beam + 1, output->scales_filename, strerror(errno));
+                result = EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (result == EXIT_SUCCESS)
+    {
+        ctx->beams[beam].segment_written_secs++;
+
+        if (block->shed)
+        {
+            ctx->beams[beam].blocks_shed++;
+            metrics_add_shed(block->bytes);
+        }
+    }
+
+    return result;
+}
+
+/**
+ *
+ *  @brief Stats files: only if there are stats of this beam second.
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns 1 to run, or 0 if not.
+ */
+static int stats_files_begin(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    return block->stats_gathered;
+}
+
+/**
+ *
+ *  @brief Stats files: the mean power of each channel, and of each timestep. They are numbered by the marker after
+ *         this beam second has been written (so the last beam's are one second on, as they always have been).
+ *  @param[in] block The beam second.
+ *  @param[in] step The stage.
+ *  @returns EXIT_SUCCESS.
+ */
+static int stats_files_end(pipeline_block_s *block, pipeline_step_s *step)
+{
+    (void)step;
+
+    dada_db_s *ctx = block->ctx;
+    beam_s *beam = &ctx->beams[block->beam];
+    int marker = block->beam == ctx->nbeams_total - 1 ? block->second + 1 : block->second;
+
+    /* Make a new filename for the freq stats */
+    char output_spectrum_filename[PATH_MAX];
+    snprintf(output_spectrum_filename, PATH_MAX, "%s/%ld_ch%02d_%02d_%03d_spec.txt",
+             ctx->stats_dir, ctx->obs_id, ctx->coarse_channel, block->beam + 1, marker);
+
+    FILE *out_fs = fopen(output_spectrum_filename, "w");
+    for (int ch = 0; ch < beam->nchan; ch++)
+    {
+        beam->power_freq[ch] = beam->power_freq[ch] / (double)beam->ntimesteps;
+
+        fprintf(out_fs, "%d %f\n", ch, beam->power_freq[ch]);
+    }
+    fclose(out_fs);
+
+    /* Make a new filename for the time stats */
+    char output_time_filename[PATH_MAX];
+    snprintf(output_time_filename, PATH_MAX, "%s/%ld_ch%02d_%02d_%03d_time.txt",
+             ctx->stats_dir, ctx->obs_id, ctx->coarse_channel, block->beam + 1, marker);
+
+    FILE *out_ft = fopen(output_time_filename, "w");
+    for (long t = 0; t < beam->ntimesteps; t++)
+    {
+        beam->power_time[t] = beam->power_time[t] / (double)beam->nchan;
+
+        fprintf(out_ft, "%ld %f\n", t, beam->power_time[t]);
+    }
+    fclose(out_ft);
+
+    asynclog_write(block->log, msg_io_stats_written, block->beam + 1, marker, 0, 0);
+
+    return EXIT_SUCCESS;
+}
+
+// Every stage, in the order they are in when not given by --pipeline
+static const pipeline_stage_s pipeline_stages[PIPELINE_STAGE_COUNT] = {
+    [pipeline_stats] = {"stats", "--stats-path", stats_begin, NULL, stats_tile, NULL, stats_release, 0, stage_stats},
+    [pipeline_normalise] = {"normalise", "--normalise", normalise_begin, normalise_prepare, normalise_tile, NULL, stage_release_staging_buffer, 0, -1},
+    [pipeline_quicklook] = {"quicklook", "--quicklook", quicklook_begin, NULL, quicklook_tile, quicklook_end, NULL, PIPELINE_BIT(pipeline_normalise), -1},
+    [pipeline_subbands] = {"subbands", "--subbands", subbands_begin, NULL, subbands_tile, NULL, stage_release_staging_buffer,
+                           PIPELINE_BIT(pipeline_stats) | PIPELINE_BIT(pipeline_normalise) | PIPELINE_BIT(pipeline_quicklook), -1},
+    [pipeline_checksum] = {"checksum", "fil files with checksums (not --no-checksums, --container or --wideband)", checksum_begin, NULL, checksum_tile, NULL, NULL,
+                           PIPELINE_BIT(pipeline_normalise) | PIPELINE_BIT(pipeline_subbands), -1},
+    [pipeline_write] = {"write", NULL, NULL, NULL, NULL, write_end, NULL,
+                        PIPELINE_BIT(pipeline_normalise) | PIPELINE_BIT(pipeline_subbands) | PIPELINE_BIT(pipeline_checksum), stage_fil_write},
+    [pipeline_stats_files] = {"stats_files", "--stats-path", stats_files_begin, NULL, NULL, stats_files_end, NULL,
+                              PIPELINE_BIT(pipeline_stats) | PIPELINE_BIT(pipeline_write), stage_stats_write},
+};
+
+/**
+ *
+ *  @brief Chooses the stages each beam second goes through, in order: those the options ask for, in the order of the
+ *         table above, or the list given by --pipeline (which must have every stage the options ask for, except
+ *         checksum: without it the write checksums each block itself, after the other stages rather than with them).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] list Comma separated stage names (e.g. "normalise,stats,checksum,write,stats_files"), or NULL.
+ *  @param[in] stats There is a stats path (--stats-path).
+ *  @param[in,out] ctx Pointer to the context with the options populated. The stages are put in it.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the list is not valid.
+ */
+int pipeline_configure(multilog_t *log, const char *list, int stats, dada_db_s *ctx)
+{
+    int wanted = PIPELINE_BIT(pipeline_write);
+
+    if (stats)
+        wanted |= PIPELINE_BIT(pipeline_stats) | PIPELINE_BIT(pipeline_stats_files);
+
+    if (ctx->normalise_seconds > 0)
+        wanted |= PIPELINE_BIT(pipeline_normalise);
+
+    if (ctx->quicklook_rows > 0)
+        wanted |= PIPELINE_BIT(pipeline_quicklook);
+
+    if (ctx->subbands > 1)
+        wanted |= PIPELINE_BIT(pipeline_subbands);
+
+    if (ctx->checksums && !ctx->container_mode && !ctx->wideband_mode)
+        wanted |= PIPELINE_BIT(pipeline_checksum);
+
+    int listed = 0;
+    ctx->pipeline_nstages = 0;
+
+    if (list == NULL)
+    {
+        for (int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+        {
+            if (wanted & PIPELINE_BIT(stage))
+                ctx->pipeline_stages[ctx->pipeline_nstages++] = stage;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    const char *item = list;
+
+    while (*item != '\0')
+    {
+        size_t length = strcspn(item, ",");
+        int stage = 0;
+
+        while (stage < PIPELINE_STAGE_COUNT && !(strlen(pipeline_stages[stage].name) == length && strncmp(item, pipeline_stages[stage].name, length) == 0))
+            stage++;
+
+        if (stage == PIPELINE_STAGE_COUNT)
+        {
+            multilog(log, LOG_ERR, "pipeline_configure(): Unknown stage '%.*s' (the stages are stats, normalise, quicklook, subbands, checksum, write and stats_files).\n", (int)length, item);
+            return EXIT_FAILURE;
+        }
+
+        if (listed & PIPELINE_BIT(stage))
+        {
+            multilog(log, LOG_ERR, "pipeline_configure(): Stage %s is in the pipeline more than once.\n", pipeline_stages[stage].name);
+            return EXIT_FAILURE;
+        }
+
+        if (!(wanted & PIPELINE_BIT(stage)))
+        {
+            multilog(log, LOG_ERR, "pipeline_configure(): Stage %s needs %s.\n", pipeline_stages[stage].name, pipeline_stages[stage].needs);
+            return EXIT_FAILURE;
+        }
+
+        listed |= PIPELINE_BIT(stage);
+        ctx->pipeline_stages[ctx->pipeline_nstages++] = stage;
+
+        item += length;
+
+        if (*item == ',')
+            item++;
+    }
+
+    int missing = wanted & ~listed & ~PIPELINE_BIT(pipeline_checksum);
+
+    for (int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++)
+    {
+        if (missing & PIPELINE_BIT(stage))
+        {
+            multilog(log, LOG_ERR, "pipeline_configure(): The pipeline has no %s stage%s%s.\n", pipeline_stages[stage].name,
+                     pipeline_stages[stage].needs ? ", which is needed with " : "", pipeline_stages[stage].needs ? pipeline_stages[stage].needs : "");
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < ctx->pipeline_nstages; i++)
+    {
+        for (int j = i + 1; j < ctx->pipeline_nstages; j++)
+        {
+            if (pipeline_stages[ctx->pipeline_stages[i]].after & PIPELINE_BIT(ctx->pipeline_stages[j]))
+            {
+                multilog(log, LOG_ERR, "pipeline_configure(): Stage %s must come after %s.\n", pipeline_stages[ctx->pipeline_stages[i]].name,
+                         pipeline_stages[ctx->pipeline_stages[j]].name);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Builds the pipeline of a beam from the stages chosen by pipeline_configure(), with tiles of as many
+ *         timesteps of the beam as fit in PIPELINE_TILE_BYTES.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to our context.
+ *  @param[in] beam The beam index.
+ */
+void pipeline_build(multilog_t *log, dada_db_s *ctx, int beam)
+{
+    pipeline_s *pipeline = &ctx->beams[beam].pipeline;
+    char names[PIPELINE_STAGE_COUNT * 16] = "";
+
+    memset(pipeline, 0, sizeof(pipeline_s));
+
+    for (int i = 0; i < ctx->pipeline_nstages; i++)
+    {
+        pipeline->steps[pipeline->nsteps++].stage = &pipeline_stages[ctx->pipeline_stages[i]];
+
+        snprintf(names + strlen(names), sizeof(names) - strlen(names), "%s%s", i > 0 ? " > " : "", pipeline_stages[ctx->pipeline_stages[i]].name);
+    }
+
+    long timestep_bytes = ctx->beams[beam].nchan * ctx->npol * sizeof(float);
+
+    pipeline->tile_timesteps = timestep_bytes < PIPELINE_TILE_BYTES ? PIPELINE_TILE_BYTES / timestep_bytes : 1;
+
+    multilog(log, LOG_INFO, "pipeline_build(): Beam %d pipeline is %s (tiles of %ld timesteps).\n", beam + 1, names, pipeline->tile_timesteps);
+}
+
+/**
+ *
+ *  @brief Runs the tile callbacks of some stages over the beam second, a tile at a time.
+ *  @param[in] pipeline The pipeline.
+ *  @param[in] block The beam second.
+ *  @param[in] first First stage.
+ *  @param[in] last Stage after the last one.
+ */
+static void pipeline_tiles(pipeline_s *pipeline, pipeline_block_s *block, int first, int last)
+{
+    int tiled = 0;
+
+    for (int s = first; s < last; s++)
+        tiled |= (pipeline->steps[s].active && pipeline->steps[s].stage->tile != NULL);
+
+    if (!tiled)
+        return;
+
+    uint64_t tiles_start_ns = latency_now_ns();
+
+    for (long t0 = 0; t0 < block->ntimesteps; t0 += pipeline->tile_timesteps)
+    {
+        long t1 = t0 + pipeline->tile_timesteps < block->ntimesteps ? t0 + pipeline->tile_timesteps : block->ntimesteps;
+
+        for (int s = first; s < last; s++)
+        {
+            pipeline_step_s *step = &pipeline->steps[s];
+
+            if (!step->active || step->stage->tile == NULL)
+                continue;
+
+            if (step->stage->latency_stage >= 0)
+            {
+                uint64_t tile_start_ns = latency_now_ns();
+
+                step->stage->tile(block, step, t0, t1);
+                step->tile_ns += latency_now_ns() - tile_start_ns;
+            }
+            else
+            {
+                step->stage->tile(block, step, t0, t1);
+            }
+        }
+    }
+
+    trace_span("pipeline_tiles", "io", tiles_start_ns, "beam", block->beam + 1);
+}
+
+/**
+ *
+ *  @brief Runs a beam second through a beam's pipeline: begin for every stage, then the tiles (in as few passes as
+ *         the stages which need all of their input first allow), then end for every stage, then release. The passes
+ *         are timed as the tiles stage, and the ends (or the tiles of a stage without an end) as their own stages.
+ *  @param[in] pipeline The beam's pipeline.
+ *  @param[in,out] block The beam second.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error (it is logged).
+ */
+int pipeline_run(pipeline_s *pipeline, pipeline_block_s *block)
+{
+    int result = EXIT_SUCCESS;
+    int begun = 0;
+
+    // Each stage reads what the one before it left
+    while (begun < pipeline->nsteps && result == EXIT_SUCCESS)
+    {
+        pipeline_step_s *step = &pipeline->steps[begun++];
+
+        step->in = block->data;
+        step->out = NULL;
+        step->tile_ns = 0;
+
+        int run = step->stage->begin != NULL ? step->stage->begin(block, step) : 1;
+
+        step->active = (run > 0);
+
+        if (run < 0)
+            result = EXIT_FAILURE;
+    }
+
+    // A stage which needs all of its input first ends the pass in progress, if a stage in it writes that input
+    int first = 0;
+    int transformed = 0;
+
+    for (int s = 0; s < pipeline->nsteps && result == EXIT_SUCCESS; s++)
+    {
+        pipeline_step_s *step = &pipeline->steps[s];
+
+        if (!step->active)
+            continue;
+
+        if (step->stage->prepare != NULL)
+        {
+            if (transformed)
+            {
+                pipeline_tiles(pipeline, block, first, s);
+                first = s;
+                transformed = 0;
+            }
+
+            uint64_t prepare_start_ns = latency_now_ns();
+
+            result = step->stage->prepare(block, step);
+
+            trace_span(step->stage->name, "io", prepare_start_ns, "beam", block->beam + 1);
+        }
+
+        if (step->out != NULL)
+            transformed = 1;
+    }
+
+    if (result == EXIT_SUCCESS)
+    {
+        pipeline_tiles(pipeline, block, first, pipeline->nsteps);
+
+        block->stage_start_ns = record_stage_latency(block->ctx, block->beam, stage_tiles, block->stage_start_ns);
+
+        for (int s = 0; s < pipeline->nsteps; s++)
+        {
+            pipeline_step_s *step = &pipeline->steps[s];
+
+            if (step->active && step->stage->end == NULL && step->stage->tile != NULL && step->stage->latency_stage >= 0)
+                record_stage_duration(block->ctx, block->beam, step->stage->latency_stage, step->tile_ns);
+        }
+    }
+
+    for (int s = 0; s < pipeline->nsteps && result == EXIT_SUCCESS; s++)
+    {
+        pipeline_step_s *step = &pipeline->steps[s];
+
+        if (step->active && step->stage->end != NULL)
+        {
+            result = step->stage->end(block, step);
+
+            if (result == EXIT_SUCCESS && step->stage->latency_stage >= 0)
+                block->stage_start_ns = record_stage_latency(block->ctx, block->beam, step->stage->latency_stage, block->stage_start_ns);
+        }
+    }
+
+    for (int s = 0; s < begun; s++)
+    {
+        if (pipeline->steps[s].stage->release != NULL)
+            pipeline->steps[s].stage->release(block, &pipeline->steps[s]);
+    }
+
+    return result;
+}
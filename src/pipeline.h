@@ -0,0 +1,92 @@
+/**
+ * @file pipeline.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the per beam pipeline: the stages each beam second goes through on its way to disk
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "dada_client.h"
+#include "multilog.h"
+
+#define PIPELINE_TILE_BYTES (64 * 1024) // Bytes of a tile of timesteps: each stage's part of it should stay in L2 until the next
+
+struct dada_db_s;
+
+typedef enum pipeline_stage_enum
+{
+    pipeline_stats = 0,    // Per channel and per timestep mean power (only if --stats-path)
+    pipeline_normalise,    // Normalise by the running bandpass (only if --normalise)
+    pipeline_quicklook,    // Into the level 0 rows of the quick-look pyramid (only if --quicklook)
+    pipeline_subbands,     // Split into sub-bands, each contiguous (only if --subbands)
+    pipeline_checksum,     // CRC32C of each fil file's part of the beam second, while it is still in cache
+    pipeline_write,        // Into the fil files, the container or the wideband assembler
+    pipeline_stats_files,  // The per second stats files (only if --stats-path)
+    PIPELINE_STAGE_COUNT
+} pipeline_stage_enum;
+
+// One beam second on its way through the pipeline
+typedef struct pipeline_block_s
+{
+    dada_client_t *client;
+    struct dada_db_s *ctx;
+    multilog_t *log;
+    int beam;
+    int second;           // from the start of the observation
+    long ntimesteps;
+    long nvalues;         // values in a timestep (channels * pols)
+    uint64_t bytes;
+    const float *data;    // the beam second as the next stage sees it (the block in the ring, or a staging buffer)
+    int shed;             // shed to keep up (see degrade.c): written as zeros, and nothing else is done with it
+    int stats_gathered;   // the stats stage ran, so there are stats to write
+    int checksummed;      // the checksum stage set the block_crc of each fil output
+    uint64_t stage_start_ns; // start of the latency stage in progress (see record_stage_latency())
+} pipeline_block_s;
+
+struct pipeline_stage_s;
+
+// A stage of one beam's pipeline, and what it works on in the beam second in progress
+typedef struct pipeline_step_s
+{
+    const struct pipeline_stage_s *stage;
+    int active;      // running for this beam second
+    const float *in; // what it reads (the data as the stage before left it)
+    float *out;      // what it writes, if it transforms the data (a staging buffer it owns until release)
+    uint64_t tile_ns; // time in its tile callbacks this beam second (only kept for a stage with a latency stage)
+} pipeline_step_s;
+
+// What a stage does with each beam second. Every callback is optional. The pipeline calls begin for every stage, then
+// passes over the beam second a tile of timesteps at a time, calling tile for each stage in order (so a stage reads
+// what the one before it just wrote while it is still in cache), then end for every stage, then release
+typedef struct pipeline_stage_s
+{
+    const char *name;  // in --pipeline
+    const char *needs; // the options it needs (for the error message if it is listed without them)
+    // Returns 1 to run, 0 to sit this beam second out or -1 on error. A stage which transforms the data sets step->out
+    // (and block->data to it, for the stages after it)
+    int (*begin)(pipeline_block_s *block, pipeline_step_s *step);
+    // Needs all of its input before its first tile (e.g. to measure it). Returns EXIT_SUCCESS or EXIT_FAILURE
+    int (*prepare)(pipeline_block_s *block, pipeline_step_s *step);
+    // Timesteps [t0, t1) of its input
+    void (*tile)(pipeline_block_s *block, pipeline_step_s *step, long t0, long t1);
+    // After every tile. Returns EXIT_SUCCESS or EXIT_FAILURE
+    int (*end)(pipeline_block_s *block, pipeline_step_s *step);
+    // Always called (even on error) if begin was
+    void (*release)(pipeline_block_s *block, pipeline_step_s *step);
+    int after;         // stages (1 << pipeline_stage_enum) which must come before this one, if they are in the pipeline
+    int latency_stage; // recorded when its end returns, or the time in its tiles if it has no end (a latency_stage_enum), or -1
+} pipeline_stage_s;
+
+// The stages of one beam, in order
+typedef struct pipeline_s
+{
+    pipeline_step_s steps[PIPELINE_STAGE_COUNT];
+    int nsteps;
+    long tile_timesteps;
+} pipeline_s;
+
+int pipeline_configure(multilog_t *log, const char *list, int stats, struct dada_db_s *ctx);
+void pipeline_build(multilog_t *log, struct dada_db_s *ctx, int beam);
+int pipeline_run(pipeline_s *pipeline, pipeline_block_s *block);
@@ -0,0 +1,199 @@
+/**
+ * @file placement.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that places our threads and buffers on cpus and NUMA nodes (via hwloc)
+ *
+ * psrdada already uses hwloc for its shared memory, but our own threads were left wherever the scheduler put them,
+ * so the reader could run on the other socket from the ring and pull every beam second across the interconnect.
+ * The cpu lists given with --reader-cpus, --worker-cpus and --writer-cpus (hwloc list syntax, e.g. "0-3,8") are
+ * applied by each thread when it starts. Once the ring is attached, the reader's memory policy is bound to the NUMA
+ * node holding the ring, so the staging buffers it allocates (the stats accumulators) are local to the data.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <hwloc.h>
+
+#include "placement.h"
+
+const char *placement_role_names[PLACEMENT_ROLE_COUNT] = {"reader", "worker", "writer"};
+
+static hwloc_topology_t g_topology;
+static int g_topology_loaded = 0;
+static hwloc_bitmap_t g_role_cpusets[PLACEMENT_ROLE_COUNT]; // NULL if no cpu list was given for the role
+
+/**
+ *
+ *  @brief Logs the packages, NUMA nodes (with their cpus and memory), cores and PUs of this machine.
+ *  @param[in] log Pointer to the logger.
+ */
+static void log_topology(multilog_t *log)
+{
+    int nnodes = hwloc_get_nbobjs_by_type(g_topology, HWLOC_OBJ_NUMANODE);
+
+    multilog(log, LOG_INFO, "placement_init(): Topology: %d package(s), %d NUMA node(s), %d core(s), %d PU(s).\n",
+             hwloc_get_nbobjs_by_type(g_topology, HWLOC_OBJ_PACKAGE), nnodes,
+             hwloc_get_nbobjs_by_type(g_topology, HWLOC_OBJ_CORE), hwloc_get_nbobjs_by_type(g_topology, HWLOC_OBJ_PU));
+
+    for (int n = 0; n < nnodes; n++)
+    {
+        hwloc_obj_t node = hwloc_get_obj_by_type(g_topology, HWLOC_OBJ_NUMANODE, n);
+        char *cpus = NULL;
+
+        hwloc_bitmap_list_asprintf(&cpus, node->cpuset);
+
+#if HWLOC_API_VERSION >= 0x00020000
+        uint64_t memory = node->attr->numanode.local_memory;
+#else
+        uint64_t memory = node->memory.local_memory;
+#endif
+        multilog(log, LOG_INFO, "placement_init(): NUMA node %u: cpus %s, %lu MB\n", node->os_index, cpus ? cpus : "?", memory / (1024 * 1024));
+
+        free(cpus);
+    }
+}
+
+/**
+ *
+ *  @brief Loads the topology, logs it and parses the cpu list of each role. Call once from main() before any threads
+ *         are started.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] cpu_lists The cpu list of each role (hwloc list syntax e.g. "0-3,8"), or NULL to leave it unbound.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if a cpu list is not valid on this machine.
+ */
+int placement_init(multilog_t *log, const char *cpu_lists[PLACEMENT_ROLE_COUNT])
+{
+    int any_lists = 0;
+
+    for (int role = 0; role < PLACEMENT_ROLE_COUNT; role++)
+    {
+        g_role_cpusets[role] = NULL;
+        any_lists |= (cpu_lists[role] != NULL);
+    }
+
+    if (hwloc_topology_init(&g_topology) != 0 || hwloc_topology_load(g_topology) != 0)
+    {
+        multilog(log, any_lists ? LOG_ERR : LOG_WARNING, "placement_init(): Could not load the hwloc topology.\n");
+        return any_lists ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    g_topology_loaded = 1;
+
+    log_topology(log);
+
+    hwloc_const_cpuset_t allowed = hwloc_topology_get_allowed_cpuset(g_topology);
+
+    for (int role = 0; role < PLACEMENT_ROLE_COUNT; role++)
+    {
+        if (cpu_lists[role] == NULL)
+            continue;
+
+        g_role_cpusets[role] = hwloc_bitmap_alloc();
+
+        if (hwloc_bitmap_list_sscanf(g_role_cpusets[role], cpu_lists[role]) != 0 || hwloc_bitmap_iszero(g_role_cpusets[role]))
+        {
+            multilog(log, LOG_ERR, "placement_init(): %s cpu list '%s' is not valid (expected e.g. 0-3,8).\n", placement_role_names[role], cpu_lists[role]);
+            return EXIT_FAILURE;
+        }
+
+        if (!hwloc_bitmap_isincluded(g_role_cpusets[role], allowed))
+        {
+            char *allowed_list = NULL;
+            hwloc_bitmap_list_asprintf(&allowed_list, allowed);
+            multilog(log, LOG_ERR, "placement_init(): %s cpu list '%s' is not within the cpus we may use (%s).\n", placement_role_names[role], cpu_lists[role], allowed_list ? allowed_list : "?");
+            free(allowed_list);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Binds the calling thread to the cpu list of its role. Does nothing if no list was given for the role.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] role The role of the calling thread.
+ *  @param[in] thread_name Name of the thread (for the log).
+ */
+void placement_bind_thread(multilog_t *log, placement_role_enum role, const char *thread_name)
+{
+    if (!g_topology_loaded || g_role_cpusets[role] == NULL)
+        return;
+
+    char *cpus = NULL;
+    hwloc_bitmap_list_asprintf(&cpus, g_role_cpusets[role]);
+
+    if (hwloc_set_cpubind(g_topology, g_role_cpusets[role], HWLOC_CPUBIND_THREAD) != 0)
+        multilog(log, LOG_WARNING, "placement_bind_thread(): Could not bind the %s thread to cpus %s.\n", thread_name, cpus ? cpus : "?");
+    else
+        multilog(log, LOG_INFO, "placement_bind_thread(): %s thread (%s) bound to cpus %s.\n", thread_name, placement_role_names[role], cpus ? cpus : "?");
+
+    free(cpus);
+}
+
+/**
+ *
+ *  @brief Binds the memory the calling thread allocates from now on to the NUMA node(s) holding addr (e.g. the ring),
+ *         and warns if the reader cpus are not on that node. Does nothing on a machine with one NUMA node.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] addr Start of the memory to be near.
+ *  @param[in] len Length of the memory to be near.
+ *  @param[in] description What the memory is (for the log).
+ */
+void placement_bind_memory_near(multilog_t *log, const void *addr, size_t len, const char *description)
+{
+    if (!g_topology_loaded || addr == NULL || hwloc_get_nbobjs_by_type(g_topology, HWLOC_OBJ_NUMANODE) < 2)
+        return;
+
+    hwloc_nodeset_t nodeset = hwloc_bitmap_alloc();
+    hwloc_cpuset_t node_cpus = hwloc_bitmap_alloc();
+    char *nodes = NULL;
+    char *cpus = NULL;
+
+    if (hwloc_get_area_memlocation(g_topology, addr, len, nodeset, HWLOC_MEMBIND_BYNODESET) != 0 || hwloc_bitmap_iszero(nodeset))
+    {
+        multilog(log, LOG_WARNING, "placement_bind_memory_near(): Could not find the NUMA node of the %s; staging buffers are not bound.\n", description);
+    }
+    else
+    {
+        hwloc_bitmap_list_asprintf(&nodes, nodeset);
+        hwloc_cpuset_from_nodeset(g_topology, node_cpus, nodeset);
+        hwloc_bitmap_list_asprintf(&cpus, node_cpus);
+
+        if (hwloc_set_membind(g_topology, nodeset, HWLOC_MEMBIND_BIND, HWLOC_MEMBIND_THREAD | HWLOC_MEMBIND_BYNODESET) != 0)
+            multilog(log, LOG_WARNING, "placement_bind_memory_near(): Could not bind staging buffers to NUMA node %s of the %s.\n", nodes, description);
+        else
+            multilog(log, LOG_INFO, "placement_bind_memory_near(): The %s is on NUMA node %s (cpus %s); staging buffers bound to it.\n", description, nodes, cpus);
+
+        if (g_role_cpusets[placement_reader] == NULL)
+            multilog(log, LOG_INFO, "placement_bind_memory_near(): Consider --reader-cpus within %s to keep the reader next to the %s.\n", cpus, description);
+        else if (!hwloc_bitmap_isincluded(g_role_cpusets[placement_reader], node_cpus))
+            multilog(log, LOG_WARNING, "placement_bind_memory_near(): Some reader cpus are not on NUMA node %s of the %s (cpus %s); reads will cross sockets.\n", nodes, description, cpus);
+    }
+
+    free(nodes);
+    free(cpus);
+    hwloc_bitmap_free(node_cpus);
+    hwloc_bitmap_free(nodeset);
+}
+
+/**
+ *
+ *  @brief Frees the topology and cpu lists.
+ */
+void placement_shutdown()
+{
+    for (int role = 0; role < PLACEMENT_ROLE_COUNT; role++)
+    {
+        if (g_role_cpusets[role] != NULL)
+            hwloc_bitmap_free(g_role_cpusets[role]);
+
+        g_role_cpusets[role] = NULL;
+    }
+
+    if (g_topology_loaded)
+        hwloc_topology_destroy(g_topology);
+
+    g_topology_loaded = 0;
+}
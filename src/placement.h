@@ -0,0 +1,27 @@
+/**
+ * @file placement.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that places our threads and buffers on cpus and NUMA nodes (via hwloc)
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include "multilog.h"
+
+// Each thread has a role; the threads of a role are bound to that role's cpu list (if one was given)
+typedef enum placement_role_enum
+{
+    placement_reader = 0, // dada client (or replay) threads: read the ring, compute stats and write the fil files
+    placement_worker,     // background threads: health and log formatter
+    placement_writer,     // threads which only write or close files
+    PLACEMENT_ROLE_COUNT
+} placement_role_enum;
+
+extern const char *placement_role_names[PLACEMENT_ROLE_COUNT];
+
+int placement_init(multilog_t *log, const char *cpu_lists[PLACEMENT_ROLE_COUNT]);
+void placement_bind_thread(multilog_t *log, placement_role_enum role, const char *thread_name);
+void placement_bind_memory_near(multilog_t *log, const void *addr, size_t len, const char *description);
+void placement_shutdown();
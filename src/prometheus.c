@@ -0,0 +1,316 @@
+/**
+ * @file prometheus.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that publishes metrics in the Prometheus text format
+ *
+ * The health thread writes the metrics to a file for the node_exporter textfile collector. The file is
+ * written under a temporary name and renamed into place, so the collector never sees a partial file.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "metrics.h"
+#include "prometheus.h"
+
+// Upper bounds (seconds) of the stage latency histogram buckets. Each one is made from the latency histogram
+// buckets whose upper bound is <= it, so a value within 6.25% below a bound may be counted in the next bucket up.
+static const double prometheus_latency_buckets_sec[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0};
+#define PROMETHEUS_LATENCY_BUCKET_COUNT (int)(sizeof(prometheus_latency_buckets_sec) / sizeof(double))
+
+/**
+ *
+ *  @brief Writes the HELP and TYPE lines of a metric.
+ *  @param[in] out Stream to write to.
+ *  @param[in] name Metric name (without the prefix).
+ *  @param[in] type gauge, counter or histogram.
+ *  @param[in] help Description of the metric.
+ */
+static void write_metric_header(FILE *out, const char *name, const char *type, const char *help)
+{
+    fprintf(out, "# HELP " PROMETHEUS_METRIC_PREFIX "%s %s\n", name, help);
+    fprintf(out, "# TYPE " PROMETHEUS_METRIC_PREFIX "%s %s\n", name, type);
+}
+
+/**
+ *
+ *  @brief Writes a metric which has a single unlabelled value.
+ *  @param[in] out Stream to write to.
+ *  @param[in] name Metric name (without the prefix).
+ *  @param[in] type gauge or counter.
+ *  @param[in] help Description of the metric.
+ *  @param[in] value The value.
+ */
+static void write_metric(FILE *out, const char *name, const char *type, const char *help, double value)
+{
+    write_metric_header(out, name, type, help);
+    fprintf(out, PROMETHEUS_METRIC_PREFIX "%s %.17g\n", name, value);
+}
+
+/**
+ *
+ *  @brief Writes one value per ring and block (header / data) of a ringbuffer metric.
+ *  @param[in] out Stream to write to.
+ *  @param[in] name Metric name (without the prefix).
+ *  @param[in] keys Shared memory key of each ring.
+ *  @param[in] nrings Number of rings.
+ *  @param[in] format printf format of the values, e.g. "%lu".
+ *  @param[in] header_values The header block value of each ring.
+ *  @param[in] data_values The data block value of each ring.
+ */
+static void write_ring_metric(FILE *out, const char *name, const key_t *keys, int nrings, const char *format, const double *header_values, const double *data_values)
+{
+    char line_format[128];
+
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        snprintf(line_format, sizeof(line_format), PROMETHEUS_METRIC_PREFIX "%%s{key=\"%%x\",block=\"header\"} %s\n", format);
+        fprintf(out, line_format, name, keys[ring], header_values[ring]);
+        snprintf(line_format, sizeof(line_format), PROMETHEUS_METRIC_PREFIX "%%s{key=\"%%x\",block=\"data\"} %s\n", format);
+        fprintf(out, line_format, name, keys[ring], data_values[ring]);
+    }
+}
+
+/**
+ *
+ *  @brief Writes all of the metrics in the Prometheus text exposition format.
+ *  @param[in] out Stream to write to.
+ *  @param[in] health_data Pointer to the already populated ringbuffer stats of each ring.
+ *  @param[in] keys Shared memory key of each ring (the ring metrics are labelled with it).
+ *  @param[in] nrings Number of rings.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error writing.
+ */
+int write_prometheus_metrics(FILE *out, health_data_s *health_data, const key_t *keys, int nrings)
+{
+    // Process
+    write_metric(out, "status", "gauge", "Process status (0=offline, 1=running, 2=shutting down).", health_data[0].status);
+
+    // Ringbuffer occupancy
+    double header_values[METRICS_MAX_RINGS] = {0};
+    double data_values[METRICS_MAX_RINGS] = {0};
+
+    write_metric_header(out, "ring_buffers", "gauge", "Number of buffers in the ringbuffer.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_nbufs;
+        data_values[ring] = health_data[ring].data_nbufs;
+    }
+    write_ring_metric(out, "ring_buffers", keys, nrings, "%.0f", header_values, data_values);
+
+    write_metric_header(out, "ring_buffer_size_bytes", "gauge", "Size of each buffer in the ringbuffer.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_bufsz;
+        data_values[ring] = health_data[ring].data_bufsz;
+    }
+    write_ring_metric(out, "ring_buffer_size_bytes", keys, nrings, "%.0f", header_values, data_values);
+
+    write_metric_header(out, "ring_full_buffers", "gauge", "Buffers written but not yet read by us.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_full_bufs;
+        data_values[ring] = health_data[ring].data_full_bufs;
+    }
+    write_ring_metric(out, "ring_full_buffers", keys, nrings, "%.0f", header_values, data_values);
+
+    write_metric_header(out, "ring_occupancy_ratio", "gauge", "Fraction of the ringbuffer which is full.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_nbufs > 0 ? (double)health_data[ring].hdr_full_bufs / health_data[ring].hdr_nbufs : 0;
+        data_values[ring] = health_data[ring].data_nbufs > 0 ? (double)health_data[ring].data_full_bufs / health_data[ring].data_nbufs : 0;
+    }
+    write_ring_metric(out, "ring_occupancy_ratio", keys, nrings, "%.6f", header_values, data_values);
+
+    write_metric_header(out, "ring_buffers_written_total", "counter", "Buffers written to the ringbuffer.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_bufs_written;
+        data_values[ring] = health_data[ring].data_bufs_written;
+    }
+    write_ring_metric(out, "ring_buffers_written_total", keys, nrings, "%.0f", header_values, data_values);
+
+    write_metric_header(out, "ring_buffers_read_total", "counter", "Buffers read from the ringbuffer by us.");
+    for (int ring = 0; ring < nrings; ring++)
+    {
+        header_values[ring] = health_data[ring].hdr_bufs_read;
+        data_values[ring] = health_data[ring].data_bufs_read;
+    }
+    write_ring_metric(out, "ring_buffers_read_total", keys, nrings, "%.0f", header_values, data_values);
+
+    // What each ring's reader is doing
+    write_metric_header(out, "ring_obs_id", "gauge", "Obs id being written from each ringbuffer (0 if none).");
+    for (int ring = 0; ring < nrings; ring++)
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "ring_obs_id{key=\"%x\"} %ld\n", keys[ring], __atomic_load_n(&g_ring_metrics[ring].obs_id, __ATOMIC_RELAXED));
+
+    write_metric_header(out, "ring_obs_marker_seconds", "gauge", "Seconds of the observation written from each ringbuffer so far.");
+    for (int ring = 0; ring < nrings; ring++)
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "ring_obs_marker_seconds{key=\"%x\"} %d\n", keys[ring], __atomic_load_n(&g_ring_metrics[ring].obs_marker, __ATOMIC_RELAXED));
+
+    write_metric_header(out, "ring_blocks_processed_total", "counter", "Beam seconds written from each ringbuffer.");
+    for (int ring = 0; ring < nrings; ring++)
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "ring_blocks_processed_total{key=\"%x\"} %lu\n", keys[ring], __atomic_load_n(&g_ring_metrics[ring].blocks_processed, __ATOMIC_RELAXED));
+
+    write_metric_header(out, "ring_blocks_dropped_total", "counter", "Blocks read from each ringbuffer but not written out.");
+    for (int ring = 0; ring < nrings; ring++)
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "ring_blocks_dropped_total{key=\"%x\"} %lu\n", keys[ring], __atomic_load_n(&g_ring_metrics[ring].blocks_dropped, __ATOMIC_RELAXED));
+
+    // Observation state
+    int64_t obs_id = __atomic_load_n(&g_metrics.obs_id, __ATOMIC_RELAXED);
+    int32_t nbeams = __atomic_load_n(&g_metrics.nbeams, __ATOMIC_RELAXED);
+
+    write_metric(out, "observing", "gauge", "1 if an observation is being written (with several rings, from the first), otherwise 0.", obs_id != 0);
+    write_metric(out, "obs_id", "gauge", "Obs id being written (0 if none; with several rings, from the first).", obs_id);
+    write_metric(out, "subobs_id", "gauge", "Sub obs id being written (0 if none; with several rings, from the first).", __atomic_load_n(&g_metrics.subobs_id, __ATOMIC_RELAXED));
+    write_metric(out, "obs_marker_seconds", "gauge", "Seconds of the observation written so far (with several rings, from the first).", __atomic_load_n(&g_metrics.obs_marker, __ATOMIC_RELAXED));
+    write_metric(out, "beams", "gauge", "Number of beams in the observation.", nbeams);
+
+    // Throughput
+    write_metric(out, "blocks_processed_total", "counter", "Beam seconds written.", __atomic_load_n(&g_metrics.blocks_processed, __ATOMIC_RELAXED));
+    write_metric(out, "blocks_dropped_total", "counter", "Blocks read but not written out.", __atomic_load_n(&g_metrics.blocks_dropped, __ATOMIC_RELAXED));
+    write_metric(out, "bytes_dropped_total", "counter", "Bytes read but not written out.", __atomic_load_n(&g_metrics.bytes_dropped, __ATOMIC_RELAXED));
+
+    // Degradation
+    write_metric(out, "degrade_level", "gauge", "Work being shed to keep up (0=none, 1=stats, 2=extra products, 3+=low priority beams).", __atomic_load_n(&g_metrics.degrade_level, __ATOMIC_RELAXED));
+    write_metric(out, "degrade_changes_total", "counter", "Changes of degrade level.", __atomic_load_n(&g_metrics.degrade_changes, __ATOMIC_RELAXED));
+    write_metric(out, "blocks_shed_total", "counter", "Beam seconds not written to keep up (zeros in the fil file).", __atomic_load_n(&g_metrics.blocks_shed, __ATOMIC_RELAXED));
+    write_metric(out, "bytes_shed_total", "counter", "Bytes not written to keep up.", __atomic_load_n(&g_metrics.bytes_shed, __ATOMIC_RELAXED));
+    write_metric(out, "stats_skipped_total", "counter", "Beam seconds whose stats were skipped to keep up.", __atomic_load_n(&g_metrics.stats_skipped, __ATOMIC_RELAXED));
+    write_metric(out, "extras_skipped_total", "counter", "Beam seconds whose extra products (quick-look) were skipped to keep up.", __atomic_load_n(&g_metrics.extras_skipped, __ATOMIC_RELAXED));
+
+    // Gaps
+    write_metric(out, "gaps_total", "counter", "Gaps in observations (sub observations which never arrived) filled with zeros.", __atomic_load_n(&g_metrics.gaps, __ATOMIC_RELAXED));
+    write_metric(out, "gap_fill_bytes_total", "counter", "Bytes of zeros written to fill gaps.", __atomic_load_n(&g_metrics.gap_fill_bytes, __ATOMIC_RELAXED));
+
+    // Wideband output
+    write_metric(out, "wideband_seconds_total", "counter", "Wideband beam seconds written.", __atomic_load_n(&g_metrics.wideband_seconds, __ATOMIC_RELAXED));
+    write_metric(out, "wideband_seconds_skipped_total", "counter", "Wideband beam seconds skipped (left as zeros) as none of their coarse channels arrived.", __atomic_load_n(&g_metrics.wideband_seconds_skipped, __ATOMIC_RELAXED));
+    write_metric(out, "wideband_channels_late_total", "counter", "Coarse channels of wideband beam seconds which were late (zeros).", __atomic_load_n(&g_metrics.wideband_channels_late, __ATOMIC_RELAXED));
+    write_metric(out, "wideband_channels_dropped_total", "counter", "Coarse channel beam seconds which could not go in their wideband beam second (too late, or not in the band).", __atomic_load_n(&g_metrics.wideband_channels_dropped, __ATOMIC_RELAXED));
+    write_metric(out, "quicklook_seconds_total", "counter", "Beam seconds added to their quick-look pyramid.", __atomic_load_n(&g_metrics.quicklook_seconds, __ATOMIC_RELAXED));
+    write_metric(out, "quicklook_seconds_dropped_total", "counter", "Beam seconds left out of their quick-look pyramid as it fell behind.", __atomic_load_n(&g_metrics.quicklook_seconds_dropped, __ATOMIC_RELAXED));
+
+    // Staging buffers
+    write_metric(out, "staging_pool_maps_total", "counter", "Staging buffer regions mapped.", __atomic_load_n(&g_metrics.staging_pool_maps, __ATOMIC_RELAXED));
+    write_metric(out, "staging_pool_bytes_total", "counter", "Bytes of staging buffer regions mapped.", __atomic_load_n(&g_metrics.staging_pool_bytes, __ATOMIC_RELAXED));
+    write_metric(out, "staging_heap_allocs_total", "counter", "Staging buffers which had to come from the heap (should stay 0).", __atomic_load_n(&g_metrics.staging_heap_allocs, __ATOMIC_RELAXED));
+
+    // Files
+    uint64_t files_opened = __atomic_load_n(&g_metrics.files_opened, __ATOMIC_RELAXED);
+    uint64_t files_closed = __atomic_load_n(&g_metrics.files_closed, __ATOMIC_RELAXED);
+
+    write_metric(out, "files_opened_total", "counter", "Fil files created.", files_opened);
+    write_metric(out, "files_closed_total", "counter", "Fil files closed.", files_closed);
+    write_metric(out, "files_open", "gauge", "Fil files currently open.", files_opened >= files_closed ? files_opened - files_closed : 0);
+    write_metric(out, "file_open_errors_total", "counter", "Fil files which could not be created.", __atomic_load_n(&g_metrics.file_open_errors, __ATOMIC_RELAXED));
+    write_metric(out, "notifications_sent_total", "counter", "Finished files whose record was sent and/or appended to the manifest.", __atomic_load_n(&g_metrics.notifications_sent, __ATOMIC_RELAXED));
+    write_metric(out, "notification_errors_total", "counter", "Finished files whose record could not be sent or appended.", __atomic_load_n(&g_metrics.notification_errors, __ATOMIC_RELAXED));
+
+    // Per beam (only beams which have written something)
+    write_metric_header(out, "beam_bytes_written_total", "counter", "Bytes written to the fil file of each beam.");
+    for (int beam = 0; beam < METRICS_MAX_BEAMS; beam++)
+    {
+        uint64_t bytes = __atomic_load_n(&g_metrics.beam_bytes_written[beam], __ATOMIC_RELAXED);
+        if (bytes > 0)
+            fprintf(out, PROMETHEUS_METRIC_PREFIX "beam_bytes_written_total{beam=\"%02d\"} %lu\n", beam + 1, bytes);
+    }
+
+    write_metric_header(out, "beam_blocks_written_total", "counter", "Beam seconds written for each beam.");
+    for (int beam = 0; beam < METRICS_MAX_BEAMS; beam++)
+    {
+        uint64_t blocks = __atomic_load_n(&g_metrics.beam_blocks_written[beam], __ATOMIC_RELAXED);
+        if (blocks > 0)
+            fprintf(out, PROMETHEUS_METRIC_PREFIX "beam_blocks_written_total{beam=\"%02d\"} %lu\n", beam + 1, blocks);
+    }
+
+    write_metric_header(out, "beam_stage_seconds_total", "counter", "Time spent in each stage for each beam (divide by beam_blocks_written_total for the mean).");
+    for (int beam = 0; beam < METRICS_MAX_BEAMS; beam++)
+    {
+        if (__atomic_load_n(&g_metrics.beam_blocks_written[beam], __ATOMIC_RELAXED) == 0)
+            continue;
+
+        for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+        {
+            fprintf(out, PROMETHEUS_METRIC_PREFIX "beam_stage_seconds_total{beam=\"%02d\",stage=\"%s\"} %.9f\n", beam + 1, latency_stage_names[stage],
+                    __atomic_load_n(&g_metrics.beam_stage_ns[beam][stage], __ATOMIC_RELAXED) / 1e9);
+        }
+    }
+
+    // Stage latency histograms (fil_write is the write latency)
+    write_metric_header(out, "stage_latency_seconds", "histogram", "Time one beam second spends in each stage.");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        latency_histogram_s *histogram = &g_metrics.stage_latency[stage];
+        uint64_t cumulative = 0;
+        int bucket = 0;
+
+        for (int le = 0; le < PROMETHEUS_LATENCY_BUCKET_COUNT; le++)
+        {
+            uint64_t le_ns = (uint64_t)(prometheus_latency_buckets_sec[le] * 1e9);
+
+            while (bucket < LATENCY_HISTOGRAM_BUCKETS && latency_bucket_upper_ns(bucket) <= le_ns)
+            {
+                cumulative += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+                bucket++;
+            }
+
+            fprintf(out, PROMETHEUS_METRIC_PREFIX "stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %lu\n", latency_stage_names[stage], prometheus_latency_buckets_sec[le], cumulative);
+        }
+
+        // Read count after the buckets so +Inf is never less than the last bucket
+        uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n", latency_stage_names[stage], count > cumulative ? count : cumulative);
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "stage_latency_seconds_sum{stage=\"%s\"} %.9f\n", latency_stage_names[stage], __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED) / 1e9);
+        fprintf(out, PROMETHEUS_METRIC_PREFIX "stage_latency_seconds_count{stage=\"%s\"} %lu\n", latency_stage_names[stage], count > cumulative ? count : cumulative);
+    }
+
+    return ferror(out) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Writes the metrics to a textfile collector file. The file is written as path.tmp then renamed over path.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] path Full path of the .prom file.
+ *  @param[in] health_data Pointer to the already populated ringbuffer stats of each ring.
+ *  @param[in] keys Shared memory key of each ring.
+ *  @param[in] nrings Number of rings.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int write_prometheus_textfile(multilog_t *log, const char *path, health_data_s *health_data, const key_t *keys, int nrings)
+{
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, PATH_MAX, "%s.tmp", path);
+
+    FILE *out = fopen(tmp_path, "w");
+
+    if (out == NULL)
+    {
+        multilog(log, LOG_ERR, "write_prometheus_textfile(): Error opening %s. Error: %s\n", tmp_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int result = write_prometheus_metrics(out, health_data, keys, nrings);
+
+    if (fclose(out) != 0)
+        result = EXIT_FAILURE;
+
+    if (result != EXIT_SUCCESS)
+    {
+        multilog(log, LOG_ERR, "write_prometheus_textfile(): Error writing %s.\n", tmp_path);
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    if (rename(tmp_path, path) != 0)
+    {
+        multilog(log, LOG_ERR, "write_prometheus_textfile(): Error renaming %s to %s. Error: %s\n", tmp_path, path, strerror(errno));
+        unlink(tmp_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,17 @@
+/**
+ * @file prometheus.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that publishes metrics in the Prometheus text format
+ *
+ */
+#pragma once
+
+#include <stdio.h>
+#include "health.h"
+#include "multilog.h"
+
+#define PROMETHEUS_METRIC_PREFIX "mwax_beamdb2fil_"
+
+int write_prometheus_metrics(FILE *out, health_data_s *health_data, const key_t *keys, int nrings);
+int write_prometheus_textfile(multilog_t *log, const char *path, health_data_s *health_data, const key_t *keys, int nrings);
@@ -0,0 +1,335 @@
+/**
+ * @file qlview.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief Prints part of a quick-look pyramid (.qlk) written by mwax_beamdb2fil --quicklook, at any zoom
+ *
+ * The region (a time range and a channel range) is printed from one level of the pyramid: the one given, or the
+ * finest at which it fits in --max-rows x --max-chans. Only the header, the index and the tiles of that level which
+ * overlap the region are read, so however long the observation is, a screen of it is a few MB. A file which was not
+ * closed (the observation is still going) has no index: its tiles are found by reading each tile header in turn.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "quicklook.h"
+#include "version.h"
+
+#define QLVIEW_DEFAULT_MAX 1024 // Default --max-rows and --max-chans (about a screen)
+
+/**
+ *
+ *  @brief Provides the user with the summary of usage/help.
+ */
+void qlview_print_usage()
+{
+  printf("mwax_qlview v%d.%d.%d\n", MWAX_BEAMDB2FIL_VERSION_MAJOR, MWAX_BEAMDB2FIL_VERSION_MINOR, MWAX_BEAMDB2FIL_VERSION_PATCH);
+  printf("\nUsage: mwax_qlview [OPTION]... FILE\n\n");
+  printf("Prints part of the quick-look pyramid FILE (%s): a row per line, its time (seconds from the start of the\n", QUICKLOOK_EXTENSION);
+  printf("observation) then the mean power of each channel.\n\n");
+  printf("  -s --start=SEC       From SEC seconds after the start of the observation (default: the start of the file)\n");
+  printf("  -n --seconds=N       For N seconds (default: to the end)\n");
+  printf("  -c --channels=C,N    Channels C to C+N-1 (of the full resolution; default: all)\n");
+  printf("  -l --level=L         From level L (default: the finest which fits in --max-rows x --max-chans)\n");
+  printf("  -R --max-rows=N      (default %d)\n", QLVIEW_DEFAULT_MAX);
+  printf("  -C --max-chans=N     (default %d)\n", QLVIEW_DEFAULT_MAX);
+  printf("  -i --info            Only print the header and the rows in each level\n");
+  printf("  -? --help            This help text\n");
+}
+
+/**
+ *
+ *  @brief Reads the index of a quick-look file, or if it was not closed, finds its tiles one after another.
+ *  @param[in] fd The file.
+ *  @param[in,out] header Its header (index_entries and level_rows are filled in if it was not closed).
+ *  @param[out] bytes_read Incremented by the bytes read.
+ *  @returns The index (free it), or NULL if it could not be read.
+ */
+quicklook_tile_s *read_index(int fd, quicklook_header_s *header, uint64_t *bytes_read)
+{
+  if (header->index_offset != 0)
+  {
+    quicklook_tile_s *index = malloc((header->index_entries + 1) * sizeof(quicklook_tile_s));
+    ssize_t index_bytes = header->index_entries * sizeof(quicklook_tile_s);
+
+    if (index == NULL || pread(fd, index, index_bytes, header->index_offset) != index_bytes)
+    {
+      free(index);
+      return NULL;
+    }
+
+    *bytes_read += index_bytes;
+    return index;
+  }
+
+  uint64_t capacity = 1024;
+  quicklook_tile_s *index = malloc(capacity * sizeof(quicklook_tile_s));
+  uint64_t offset = sizeof(quicklook_header_s);
+  uint64_t file_bytes = lseek(fd, 0, SEEK_END);
+
+  header->index_entries = 0;
+
+  while (index != NULL && pread(fd, &index[header->index_entries], sizeof(quicklook_tile_s), offset) == sizeof(quicklook_tile_s))
+  {
+    quicklook_tile_s *tile = &index[header->index_entries];
+
+    // A tile being written when the file was read is not (all) there yet
+    if (tile->offset != offset + sizeof(quicklook_tile_s) || tile->level >= QUICKLOOK_LEVELS || tile->nrows > header->tile_rows || tile->nchans > header->tile_chans ||
+        tile->offset + (uint64_t)tile->nrows * tile->nchans * sizeof(float) > file_bytes)
+      break;
+
+    *bytes_read += sizeof(quicklook_tile_s);
+    offset = tile->offset + (uint64_t)tile->nrows * tile->nchans * sizeof(float);
+
+    if (tile->row0 + tile->nrows > header->level_rows[tile->level])
+      header->level_rows[tile->level] = tile->row0 + tile->nrows;
+
+    if (++header->index_entries == capacity)
+    {
+      capacity *= 2;
+      quicklook_tile_s *grown = realloc(index, capacity * sizeof(quicklook_tile_s));
+
+      if (grown == NULL)
+        free(index);
+
+      index = grown;
+    }
+  }
+
+  return index;
+}
+
+int main(int argc, char *argv[])
+{
+  double start = -1;
+  double seconds = -1;
+  long first_chan = 0;
+  long chan_count = -1;
+  int level = -1;
+  long max_rows = QLVIEW_DEFAULT_MAX;
+  long max_chans = QLVIEW_DEFAULT_MAX;
+  int info_only = 0;
+
+  static const struct option longOpts[] =
+      {
+          {"start", required_argument, NULL, 's'},
+          {"seconds", required_argument, NULL, 'n'},
+          {"channels", required_argument, NULL, 'c'},
+          {"level", required_argument, NULL, 'l'},
+          {"max-rows", required_argument, NULL, 'R'},
+          {"max-chans", required_argument, NULL, 'C'},
+          {"info", no_argument, NULL, 'i'},
+          {"help", no_argument, NULL, '?'},
+          {NULL, no_argument, NULL, 0}};
+
+  int opt = 0;
+
+  while ((opt = getopt_long(argc, argv, "s:n:c:l:R:C:i?", longOpts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      start = atof(optarg);
+      break;
+
+    case 'n':
+      seconds = atof(optarg);
+      break;
+
+    case 'c':
+      if (sscanf(optarg, "%ld,%ld", &first_chan, &chan_count) != 2 || first_chan < 0 || chan_count < 1)
+      {
+        fprintf(stderr, "Error: (-c | --channels) expects the first channel and how many e.g. --channels=0,64\n");
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'l':
+      level = atoi(optarg);
+      break;
+
+    case 'R':
+      max_rows = atol(optarg);
+      break;
+
+    case 'C':
+      max_chans = atol(optarg);
+      break;
+
+    case 'i':
+      info_only = 1;
+      break;
+
+    default:
+      qlview_print_usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1 || max_rows < 1 || max_chans < 1)
+  {
+    qlview_print_usage();
+    return EXIT_FAILURE;
+  }
+
+  const char *filename = argv[optind];
+  int fd = open(filename, O_RDONLY);
+
+  if (fd == -1)
+  {
+    fprintf(stderr, "Error: could not open %s (%s)\n", filename, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  quicklook_header_s header;
+  uint64_t bytes_read = sizeof(header);
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, QUICKLOOK_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != QUICKLOOK_VERSION || header.nlevels > QUICKLOOK_LEVELS || header.nchan == 0 || header.rows_per_second == 0)
+  {
+    fprintf(stderr, "Error: %s is not a version %d quick-look file\n", filename, QUICKLOOK_VERSION);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  quicklook_tile_s *index = read_index(fd, &header, &bytes_read);
+
+  if (index == NULL)
+  {
+    fprintf(stderr, "Error: could not read the index of %s\n", filename);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  if (level >= (int)header.nlevels)
+  {
+    fprintf(stderr, "Error: %s has levels 0 to %u\n", filename, header.nlevels - 1);
+    close(fd);
+    free(index);
+    return EXIT_FAILURE;
+  }
+
+  printf("# %s: obs %" PRId64 " beam %02u ch%02u, from second %u, %u channels of %f MHz from %f MHz, %u rows/sec%s\n", filename, header.obs_id,
+         header.beam + 1, header.coarse_channel, header.first_second, header.nchan, header.foff, header.fch1, header.rows_per_second,
+         header.index_offset != 0 ? "" : " (not closed)");
+
+  if (info_only)
+  {
+    for (uint32_t l = 0; l < header.nlevels; l++)
+      printf("# level %2u: %" PRIu64 " rows of %u channels\n", l, header.level_rows[l], (header.nchan >> l) > 0 ? header.nchan >> l : 1);
+
+    close(fd);
+    free(index);
+    return EXIT_SUCCESS;
+  }
+
+  // The region, in level 0 rows and channels
+  double start_row0 = start < 0 ? 0 : (start - header.first_second) * header.rows_per_second;
+  double end_row0 = seconds < 0 ? (double)header.level_rows[0] : start_row0 + seconds * header.rows_per_second;
+
+  if (start_row0 < 0)
+    start_row0 = 0;
+
+  if (chan_count < 0 || first_chan + chan_count > (long)header.nchan)
+    chan_count = first_chan < (long)header.nchan ? (long)header.nchan - first_chan : 0;
+
+  // The finest level at which it fits (as each level up is half of each)
+  if (level < 0)
+  {
+    level = 0;
+
+    while (level < (int)header.nlevels - 1 && ((end_row0 - start_row0) / (1L << level) > max_rows || chan_count / (1L << level) > max_chans))
+      level++;
+  }
+
+  long level_nchan = (header.nchan >> level) > 0 ? header.nchan >> level : 1;
+  long row_first = (long)(start_row0 / (1L << level));
+  long row_end = (long)((end_row0 + (1L << level) - 1) / (1L << level));
+  long chan_first = first_chan >> level;
+  long chan_end = (first_chan + chan_count + (1L << level) - 1) >> level;
+
+  if (row_end > (long)header.level_rows[level])
+    row_end = header.level_rows[level];
+
+  if (chan_end > level_nchan)
+    chan_end = level_nchan;
+
+  long nrows = row_end > row_first ? row_end - row_first : 0;
+  long nchans = chan_end > chan_first ? chan_end - chan_first : 0;
+  float *region = calloc(nrows * nchans + 1, sizeof(float));
+  float *tile_data = malloc((uint64_t)header.tile_rows * header.tile_chans * sizeof(float));
+
+  if (region == NULL || tile_data == NULL)
+  {
+    fprintf(stderr, "Error: could not allocate %ld rows of %ld channels\n", nrows, nchans);
+    close(fd);
+    free(index);
+    free(region);
+    free(tile_data);
+    return EXIT_FAILURE;
+  }
+
+  // Only the tiles of the level which overlap the region (and of them, only the rows in it)
+  int failed = 0;
+
+  for (uint64_t i = 0; i < header.index_entries && !failed; i++)
+  {
+    quicklook_tile_s *tile = &index[i];
+
+    if ((int)tile->level != level || (long)(tile->row0 + tile->nrows) <= row_first || (long)tile->row0 >= row_end ||
+        (long)(tile->chan0 + tile->nchans) <= chan_first || (long)tile->chan0 >= chan_end)
+      continue;
+
+    long r0 = (long)tile->row0 > row_first ? (long)tile->row0 : row_first;
+    long r1 = (long)(tile->row0 + tile->nrows) < row_end ? (long)(tile->row0 + tile->nrows) : row_end;
+    ssize_t tile_bytes = (r1 - r0) * tile->nchans * sizeof(float);
+
+    if (pread(fd, tile_data, tile_bytes, tile->offset + (r0 - tile->row0) * tile->nchans * sizeof(float)) != tile_bytes)
+    {
+      fprintf(stderr, "Error: could not read a tile of %s at %" PRIu64 "\n", filename, tile->offset);
+      failed = 1;
+      break;
+    }
+
+    bytes_read += tile_bytes;
+
+    for (long r = r0; r < r1; r++)
+    {
+      for (long c = tile->chan0; c < (long)(tile->chan0 + tile->nchans); c++)
+      {
+        if (c >= chan_first && c < chan_end)
+          region[(r - row_first) * nchans + (c - chan_first)] = tile_data[(r - r0) * tile->nchans + (c - tile->chan0)];
+      }
+    }
+  }
+
+  if (!failed)
+  {
+    printf("# level %d: rows %ld to %ld of %" PRIu64 ", channels %ld to %ld of %ld (each %ld x %ld of level 0), %" PRIu64 " bytes read\n", level, row_first,
+           row_end - 1, header.level_rows[level], chan_first, chan_end - 1, level_nchan, 1L << level, 1L << level, bytes_read);
+
+    for (long r = 0; r < nrows; r++)
+    {
+      printf("%.6f", header.first_second + (double)((row_first + r) << level) / header.rows_per_second);
+
+      for (long c = 0; c < nchans; c++)
+        printf(" %.7g", region[r * nchans + c]);
+
+      printf("\n");
+    }
+  }
+
+  close(fd);
+  free(index);
+  free(region);
+  free(tile_data);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,729 @@
+/**
+ * @file quicklook.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that builds the quick-look pyramid of each beam as it is written
+ *
+ * With --quicklook each beam of an observation also gets a quick-look file (see quicklook.h for its layout): a dynamic
+ * spectrum of the beam at a few rows a second (level 0), and above it levels each half the rows and channels of the one
+ * below, stored in tiles of QUICKLOOK_TILE_ROWS x QUICKLOOK_TILE_CHANS with an index. A viewer can show a whole
+ * observation, or any part of it at any zoom, by reading the index and only the tiles of the level which fits the
+ * screen, which is a few MB however long the observation is.
+ *
+ * The only work on the reader thread is the quicklook stage of the pipeline (see pipeline.c), which adds each sample to
+ * its level 0 row while the tile of the beam second it is in is still in cache: one add per sample, into a buffer of
+ * QUICKLOOK_QUEUE_SECONDS of the beam. Everything else is done by the quick-look thread (bound to the writer cpus): it
+ * pushes each level 0 row up the pyramid as soon as the row after it arrives (so each level is built as the data
+ * streams through, and the work per sample is amortised O(1): each level has a quarter of the values of the one below),
+ * and writes each row of tiles of a level as soon as it is full. At the end of the observation it writes what is left,
+ * the index and the final header, and renames the file from .partial. If the thread falls behind, beam seconds which do
+ * not fit in the buffer are dropped (counted, and zeros in the pyramid) rather than holding up the reader, except when
+ * replaying, where the reader waits.
+ */
+#include <errno.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "quicklook.h"
+#include "dada_dbfil.h"
+#include "global.h"
+#include "latency.h"
+#include "metrics.h"
+#include "placement.h"
+#include "trace.h"
+
+// One level of a beam's pyramid
+typedef struct quicklook_level_s
+{
+    long nchan;
+    uint64_t nrows;   // rows so far
+    float *tile_rows; // the row of tiles being filled: QUICKLOOK_TILE_ROWS rows of nchan ([row][channel])
+    int tile_nrows;   // rows in it
+    float *pending;   // an even row waiting for the row after it, to go up a level together
+    int has_pending;
+    float *up;        // the row going up from the level below
+} quicklook_level_s;
+
+typedef struct quicklook_beam_s
+{
+    // Set when the observation starts
+    int beam;
+    long nchan;
+    int npol;
+    int rows_per_second;
+    long timesteps_per_row;
+    char filename[PATH_MAX];
+    char partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)]; // what it is called until it is closed
+
+    // Beam seconds from the reader, waiting for the quick-look thread (under the lock)
+    float *rows[QUICKLOOK_QUEUE_SECONDS]; // rows_per_second rows of nchan: the sum of each row's samples
+    int seconds[QUICKLOOK_QUEUE_SECONDS];
+    int head;    // next beam second to take
+    int count;   // beam seconds queued
+    int closing; // the observation has finished: close it once the queue is empty
+    struct quicklook_beam_s *next;
+
+    // The quick-look thread's own
+    FILE *file;
+    char *write_buffer;
+    int error;        // a write failed (logged once): nothing more is written
+    uint64_t offset;  // where the next tile goes
+    quicklook_header_s header;
+    quicklook_tile_s *index;
+    uint64_t index_capacity;
+    float *tile;      // a tile being written
+    int next_second;  // beam second the next level 0 row starts
+    quicklook_level_s levels[QUICKLOOK_LEVELS];
+} quicklook_beam_s;
+
+typedef struct quicklook_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;  // to the quick-look thread: a beam second was queued, a beam finished, or we are stopping
+    pthread_cond_t changed; // to the readers: a beam second was taken off a queue
+    quicklook_beam_s *beams; // every open beam of every reader
+    int wait;    // readers wait for room rather than drop beam seconds (replaying)
+    int stop;
+    int running;
+
+    multilog_t *log;
+    pthread_t thread;
+} quicklook_s;
+
+static quicklook_s g_quicklook = {.mutex = PTHREAD_MUTEX_INITIALIZER, .queued = PTHREAD_COND_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+
+/**
+ *
+ *  @brief Frees a beam's pyramid (closing its file if it is still open).
+ *  @param[in] qb The beam.
+ */
+static void quicklook_free_beam(quicklook_beam_s *qb)
+{
+    if (qb->file != NULL)
+        fclose(qb->file);
+
+    for (int slot = 0; slot < QUICKLOOK_QUEUE_SECONDS; slot++)
+        free(qb->rows[slot]);
+
+    for (int level = 0; level < QUICKLOOK_LEVELS; level++)
+    {
+        free(qb->levels[level].tile_rows);
+        free(qb->levels[level].pending);
+        free(qb->levels[level].up);
+    }
+
+    free(qb->write_buffer);
+    free(qb->index);
+    free(qb->tile);
+    free(qb);
+}
+
+/**
+ *
+ *  @brief Writes to a beam's file, unless an earlier write failed. Only the first error is logged.
+ *  @param[in] qb The beam.
+ *  @param[in] data What to write.
+ *  @param[in] bytes How much of it.
+ */
+static void quicklook_write(quicklook_beam_s *qb, const void *data, size_t bytes)
+{
+    if (qb->error)
+        return;
+
+    if (fwrite(data, 1, bytes, qb->file) != bytes)
+    {
+        multilog(g_quicklook.log, LOG_ERR, "quicklook_write(): Error writing %s. Error: %s\n", qb->partial_filename, strerror(errno));
+        qb->error = 1;
+        return;
+    }
+
+    qb->offset += bytes;
+}
+
+/**
+ *
+ *  @brief Writes the row of tiles being filled of a level (all of it, or the rows it has at the end), one tile of
+ *         QUICKLOOK_TILE_CHANS channels after another, and adds them to the index.
+ *  @param[in] qb The beam.
+ *  @param[in] level The level.
+ */
+static void quicklook_write_tiles(quicklook_beam_s *qb, int level)
+{
+    quicklook_level_s *ql = &qb->levels[level];
+
+    for (long chan0 = 0; chan0 < ql->nchan; chan0 += QUICKLOOK_TILE_CHANS)
+    {
+        long nchans = ql->nchan - chan0 < QUICKLOOK_TILE_CHANS ? ql->nchan - chan0 : QUICKLOOK_TILE_CHANS;
+
+        if (qb->header.index_entries == qb->index_capacity)
+        {
+            uint64_t capacity = qb->index_capacity * 2;
+            quicklook_tile_s *index = realloc(qb->index, capacity * sizeof(quicklook_tile_s));
+
+            if (index == NULL)
+            {
+                multilog(g_quicklook.log, LOG_ERR, "quicklook_write_tiles(): Could not grow the index of %s to %lu tiles.\n", qb->partial_filename, capacity);
+                qb->error = 1;
+                return;
+            }
+
+            qb->index = index;
+            qb->index_capacity = capacity;
+        }
+
+        quicklook_tile_s *tile = &qb->index[qb->header.index_entries];
+
+        tile->level = level;
+        tile->nrows = ql->tile_nrows;
+        tile->chan0 = chan0;
+        tile->nchans = nchans;
+        tile->row0 = ql->nrows - ql->tile_nrows;
+        tile->offset = qb->offset + sizeof(quicklook_tile_s);
+
+        for (int row = 0; row < ql->tile_nrows; row++)
+            memcpy(&qb->tile[row * nchans], &ql->tile_rows[row * ql->nchan + chan0], nchans * sizeof(float));
+
+        quicklook_write(qb, tile, sizeof(quicklook_tile_s));
+        quicklook_write(qb, qb->tile, ql->tile_nrows * nchans * sizeof(float));
+
+        qb->header.index_entries++;
+    }
+
+    ql->tile_nrows = 0;
+}
+
+/**
+ *
+ *  @brief Adds a row to a level, and every other row the mean of it and the row before it (and of each pair of
+ *         channels) to the level above, and so on up the pyramid.
+ *  @param[in] qb The beam.
+ *  @param[in] level The level.
+ *  @param[in] row The row (nchan of the level).
+ */
+static void quicklook_push_row(quicklook_beam_s *qb, int level, const float *row)
+{
+    for (; level < QUICKLOOK_LEVELS; level++)
+    {
+        quicklook_level_s *ql = &qb->levels[level];
+
+        memcpy(&ql->tile_rows[ql->tile_nrows * ql->nchan], row, ql->nchan * sizeof(float));
+        ql->tile_nrows++;
+        ql->nrows++;
+
+        if (ql->tile_nrows == QUICKLOOK_TILE_ROWS)
+            quicklook_write_tiles(qb, level);
+
+        if (level == QUICKLOOK_LEVELS - 1)
+            return;
+
+        if (!ql->has_pending)
+        {
+            memcpy(ql->pending, row, ql->nchan * sizeof(float));
+            ql->has_pending = 1;
+            return;
+        }
+
+        quicklook_level_s *above = &qb->levels[level + 1];
+
+        if (ql->nchan > 1)
+        {
+            for (long c = 0; c < above->nchan; c++)
+                above->up[c] = 0.25f * (ql->pending[2 * c] + ql->pending[2 * c + 1] + row[2 * c] + row[2 * c + 1]);
+        }
+        else
+            above->up[0] = 0.5f * (ql->pending[0] + row[0]);
+
+        ql->has_pending = 0;
+        row = above->up;
+    }
+}
+
+/**
+ *
+ *  @brief Adds a beam second (or the zeros of one which was not written) to the pyramid.
+ *  @param[in] qb The beam.
+ *  @param[in] rows The sums of each level 0 row of the beam second, or NULL for zeros.
+ */
+static void quicklook_add_second(quicklook_beam_s *qb, const float *rows)
+{
+    quicklook_level_s *ql = &qb->levels[0];
+    float scale = 1.0f / (float)(qb->timesteps_per_row * qb->npol);
+
+    for (int r = 0; r < qb->rows_per_second; r++)
+    {
+        if (rows != NULL)
+        {
+            for (long c = 0; c < qb->nchan; c++)
+                ql->up[c] = rows[r * qb->nchan + c] * scale;
+        }
+        else
+            memset(ql->up, 0, qb->nchan * sizeof(float));
+
+        quicklook_push_row(qb, 0, ql->up);
+    }
+
+    qb->next_second++;
+}
+
+/**
+ *
+ *  @brief Adds a queued beam second to the pyramid, after zeros for any beam seconds before it which never came.
+ *  @param[in] qb The beam.
+ *  @param[in] second The beam second (from the start of the observation).
+ *  @param[in] rows The sums of each level 0 row of it.
+ */
+static void quicklook_process(quicklook_beam_s *qb, int second, const float *rows)
+{
+    uint64_t start_ns = latency_now_ns();
+
+    while (qb->next_second < second)
+        quicklook_add_second(qb, NULL);
+
+    if (second == qb->next_second)
+        quicklook_add_second(qb, rows);
+
+    // So the tiles so far can be read while the observation goes on
+    if (!qb->error && fflush(qb->file) != 0)
+    {
+        multilog(g_quicklook.log, LOG_ERR, "quicklook_process(): Error writing %s. Error: %s\n", qb->partial_filename, strerror(errno));
+        qb->error = 1;
+    }
+
+    metrics_add_quicklook_second();
+
+    trace_span("quicklook_second", "file", start_ns, "beam", qb->beam + 1);
+}
+
+/**
+ *
+ *  @brief Finishes a beam's pyramid: sends the odd last row of each level up on its own, writes the tiles each level
+ *         has left, the index and the final header, and renames the file to its final name (or removes it if it has
+ *         no rows).
+ *  @param[in] qb The beam.
+ */
+static void quicklook_finish(quicklook_beam_s *qb)
+{
+    multilog_t *log = g_quicklook.log;
+    uint64_t close_start_ns = latency_now_ns();
+
+    for (int level = 0; level < QUICKLOOK_LEVELS - 1; level++)
+    {
+        quicklook_level_s *ql = &qb->levels[level];
+        quicklook_level_s *above = &qb->levels[level + 1];
+
+        if (!ql->has_pending)
+            continue;
+
+        if (ql->nchan > 1)
+        {
+            for (long c = 0; c < above->nchan; c++)
+                above->up[c] = 0.5f * (ql->pending[2 * c] + ql->pending[2 * c + 1]);
+        }
+        else
+            above->up[0] = ql->pending[0];
+
+        ql->has_pending = 0;
+        quicklook_push_row(qb, level + 1, above->up);
+    }
+
+    for (int level = 0; level < QUICKLOOK_LEVELS; level++)
+    {
+        if (qb->levels[level].tile_nrows > 0)
+            quicklook_write_tiles(qb, level);
+
+        qb->header.level_rows[level] = qb->levels[level].nrows;
+    }
+
+    qb->header.index_offset = qb->offset;
+    quicklook_write(qb, qb->index, qb->header.index_entries * sizeof(quicklook_tile_s));
+
+    if (!qb->error && (fseek(qb->file, 0, SEEK_SET) != 0 || fwrite(&qb->header, sizeof(quicklook_header_s), 1, qb->file) != 1))
+    {
+        multilog(log, LOG_ERR, "quicklook_finish(): Error writing the header of %s. Error: %s\n", qb->partial_filename, strerror(errno));
+        qb->error = 1;
+    }
+
+    int closed = fclose(qb->file);
+    qb->file = NULL;
+
+    if (qb->error || closed != 0)
+        multilog(log, LOG_ERR, "quicklook_finish(): Error closing %s. It is left as it is.\n", qb->partial_filename);
+    else if (qb->header.level_rows[0] == 0)
+    {
+        // Every beam second was shed or dropped, so there is nothing to look at
+        multilog(log, LOG_INFO, "quicklook_finish(): %s has no rows, so it is not kept.\n", qb->filename);
+        unlink(qb->partial_filename);
+    }
+    else if (rename(qb->partial_filename, qb->filename) != 0)
+        multilog(log, LOG_ERR, "quicklook_finish(): Error renaming %s to %s. Error: %s\n", qb->partial_filename, qb->filename, strerror(errno));
+    else
+        multilog(log, LOG_INFO, "quicklook_finish(): Closed %s: %lu rows at level 0, %lu tiles.\n", qb->filename, qb->header.level_rows[0], qb->header.index_entries);
+
+    trace_span("close_quicklook", "file", close_start_ns, "beam", qb->beam + 1);
+}
+
+/**
+ *
+ *  @brief The quick-look thread. Adds queued beam seconds to the pyramid of their beam, and finishes each beam once
+ *         its observation has finished, until asked to stop (when every beam is finished).
+ *  @param[in] args Not used.
+ *  @returns NULL.
+ */
+static void *quicklook_thread_fn(void *args)
+{
+    (void)args;
+
+    trace_set_thread_name("quicklook");
+    placement_bind_thread(g_quicklook.log, placement_writer, "quicklook");
+
+    pthread_mutex_lock(&g_quicklook.mutex);
+
+    for (;;)
+    {
+        int worked = 0;
+        quicklook_beam_s **link = &g_quicklook.beams;
+
+        while (*link != NULL)
+        {
+            quicklook_beam_s *qb = *link;
+
+            if (qb->count > 0)
+            {
+                int slot = qb->head;
+
+                pthread_mutex_unlock(&g_quicklook.mutex);
+
+                quicklook_process(qb, qb->seconds[slot], qb->rows[slot]);
+
+                pthread_mutex_lock(&g_quicklook.mutex);
+
+                qb->head = (qb->head + 1) % QUICKLOOK_QUEUE_SECONDS;
+                qb->count--;
+                pthread_cond_broadcast(&g_quicklook.changed);
+                worked = 1;
+            }
+            else if (qb->closing || g_quicklook.stop)
+            {
+                *link = qb->next;
+
+                pthread_mutex_unlock(&g_quicklook.mutex);
+
+                quicklook_finish(qb);
+                quicklook_free_beam(qb);
+
+                pthread_mutex_lock(&g_quicklook.mutex);
+
+                worked = 1;
+                continue;
+            }
+
+            link = &qb->next;
+        }
+
+        if (worked)
+            continue;
+
+        if (g_quicklook.stop)
+            break;
+
+        pthread_cond_wait(&g_quicklook.queued, &g_quicklook.mutex);
+    }
+
+    pthread_mutex_unlock(&g_quicklook.mutex);
+
+    return NULL;
+}
+
+/**
+ *
+ *  @brief Starts the quick-look thread. Call once from main() (only if --quicklook).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] wait Readers wait for the thread to catch up rather than drop beam seconds (when replaying).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be started.
+ */
+int quicklook_init(multilog_t *log, int wait)
+{
+    g_quicklook.log = log;
+    g_quicklook.wait = wait;
+    g_quicklook.stop = 0;
+    g_quicklook.beams = NULL;
+
+    if (pthread_create(&g_quicklook.thread, NULL, quicklook_thread_fn, NULL) != 0)
+    {
+        multilog(log, LOG_ERR, "quicklook_init(): Could not create the quick-look thread. Error: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    g_quicklook.running = 1;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Works out how many level 0 rows a second a beam gets: the most, up to the rows asked for, which divides its
+ *         timesteps (so every row has the same number of them).
+ *  @param[in] ntimesteps Timesteps in a second of the beam.
+ *  @param[in] rows Rows asked for (--quicklook).
+ *  @returns The rows a second.
+ */
+static int quicklook_rows_for_beam(long ntimesteps, int rows)
+{
+    if (rows > ntimesteps)
+        rows = ntimesteps;
+
+    while (rows > 1 && ntimesteps % rows != 0)
+        rows--;
+
+    return rows;
+}
+
+/**
+ *
+ *  @brief Creates the quick-look file of each beam of a new observation and hands them to the quick-look thread. Call
+ *         from the reader when the observation starts (after the beams are set up).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int quicklook_open(multilog_t *log, dada_db_s *ctx)
+{
+    for (int beam = 0; beam < ctx->nbeams_total; beam++)
+    {
+        beam_s *b = &ctx->beams[beam];
+        quicklook_beam_s *qb = calloc(1, sizeof(quicklook_beam_s));
+
+        if (qb == NULL)
+        {
+            multilog(log, LOG_ERR, "quicklook_open(): Could not allocate the quick-look pyramid of beam %d.\n", beam + 1);
+            return EXIT_FAILURE;
+        }
+
+        qb->beam = beam;
+        qb->nchan = b->nchan;
+        qb->npol = ctx->npol;
+        qb->rows_per_second = quicklook_rows_for_beam(b->ntimesteps, ctx->quicklook_rows);
+        qb->timesteps_per_row = b->ntimesteps / qb->rows_per_second;
+        qb->next_second = ctx->join_offset_sec;
+        qb->index_capacity = 1024;
+
+        int allocated = 1;
+
+        for (int slot = 0; slot < QUICKLOOK_QUEUE_SECONDS; slot++)
+            allocated &= ((qb->rows[slot] = malloc(qb->rows_per_second * qb->nchan * sizeof(float))) != NULL);
+
+        for (int level = 0; level < QUICKLOOK_LEVELS; level++)
+        {
+            quicklook_level_s *ql = &qb->levels[level];
+
+            ql->nchan = (qb->nchan >> level) > 0 ? qb->nchan >> level : 1;
+            ql->tile_rows = malloc(QUICKLOOK_TILE_ROWS * ql->nchan * sizeof(float));
+            ql->pending = malloc(ql->nchan * sizeof(float));
+            ql->up = malloc(ql->nchan * sizeof(float));
+
+            allocated &= (ql->tile_rows != NULL && ql->pending != NULL && ql->up != NULL);
+        }
+
+        qb->write_buffer = malloc(QUICKLOOK_WRITE_BUFFER_BYTES);
+        qb->index = malloc(qb->index_capacity * sizeof(quicklook_tile_s));
+        qb->tile = malloc(QUICKLOOK_TILE_ROWS * QUICKLOOK_TILE_CHANS * sizeof(float));
+
+        if (!allocated || qb->write_buffer == NULL || qb->index == NULL || qb->tile == NULL)
+        {
+            multilog(log, LOG_ERR, "quicklook_open(): Could not allocate the quick-look pyramid of beam %d.\n", beam + 1);
+            quicklook_free_beam(qb);
+            return EXIT_FAILURE;
+        }
+
+        make_quicklook_filename(ctx, beam, qb->filename);
+        snprintf(qb->partial_filename, sizeof(qb->partial_filename), "%s%s", qb->filename, FIL_PARTIAL_EXTENSION);
+
+        qb->file = fopen(qb->partial_filename, "wb");
+
+        if (qb->file == NULL)
+        {
+            multilog(log, LOG_ERR, "quicklook_open(): Error creating %s. Error: %s\n", qb->partial_filename, strerror(errno));
+            quicklook_free_beam(qb);
+            return EXIT_FAILURE;
+        }
+
+        setvbuf(qb->file, qb->write_buffer, _IOFBF, QUICKLOOK_WRITE_BUFFER_BYTES);
+
+        // The header as it is until the file is closed (no index, and no rows in any level)
+        memcpy(qb->header.magic, QUICKLOOK_MAGIC, sizeof(qb->header.magic));
+        qb->header.version = QUICKLOOK_VERSION;
+        qb->header.beam = beam;
+        qb->header.obs_id = ctx->obs_id;
+        qb->header.coarse_channel = ctx->coarse_channel;
+        qb->header.first_second = ctx->join_offset_sec;
+        qb->header.nchan = qb->nchan;
+        qb->header.nlevels = QUICKLOOK_LEVELS;
+        qb->header.rows_per_second = qb->rows_per_second;
+        qb->header.tile_rows = QUICKLOOK_TILE_ROWS;
+        qb->header.tile_chans = QUICKLOOK_TILE_CHANS;
+        qb->header.fch1 = b->channels[0];
+        qb->header.foff = (double)ctx->bandwidth_hz / 1000000.0 / (double)b->nchan;
+        qb->header.tstart = ctx->metafits_info->mjd + ctx->join_offset_sec / 86400.0;
+        qb->header.tsamp = 1.0 / qb->rows_per_second;
+
+        quicklook_write(qb, &qb->header, sizeof(quicklook_header_s));
+
+        if (qb->error)
+        {
+            quicklook_free_beam(qb);
+            return EXIT_FAILURE;
+        }
+
+        multilog(log, LOG_INFO, "quicklook_open(): Beam %d quick-look is %s (%d rows/sec of %ld channels, %d levels).\n",
+                 beam + 1, qb->filename, qb->rows_per_second, qb->nchan, QUICKLOOK_LEVELS);
+
+        pthread_mutex_lock(&g_quicklook.mutex);
+
+        qb->next = g_quicklook.beams;
+        g_quicklook.beams = qb;
+
+        pthread_mutex_unlock(&g_quicklook.mutex);
+
+        b->quicklook = qb;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Takes the buffer for the level 0 rows of a beam's next beam second, zeroed. If the quick-look thread is
+ *         QUICKLOOK_QUEUE_SECONDS behind, the beam second is dropped (counted), or when replaying, waited for.
+ *  @param[in] qb The beam.
+ *  @returns The buffer (rows_per_second rows of nchan), or NULL if the beam second is dropped.
+ */
+float *quicklook_reserve(quicklook_beam_s *qb)
+{
+    pthread_mutex_lock(&g_quicklook.mutex);
+
+    while (g_quicklook.wait && qb->count == QUICKLOOK_QUEUE_SECONDS)
+        pthread_cond_wait(&g_quicklook.changed, &g_quicklook.mutex);
+
+    // The thread only touches the queued ones, so the slot after them is ours until it is committed
+    float *rows = qb->count < QUICKLOOK_QUEUE_SECONDS ? qb->rows[(qb->head + qb->count) % QUICKLOOK_QUEUE_SECONDS] : NULL;
+
+    pthread_mutex_unlock(&g_quicklook.mutex);
+
+    if (rows == NULL)
+    {
+        metrics_add_quicklook_dropped();
+        return NULL;
+    }
+
+    memset(rows, 0, qb->rows_per_second * qb->nchan * sizeof(float));
+
+    return rows;
+}
+
+/**
+ *
+ *  @brief Adds timesteps [t0, t1) of a beam second to their level 0 rows (summed over pols; the quick-look thread
+ *         turns the sums into means).
+ *  @param[in] qb The beam.
+ *  @param[in,out] rows The buffer from quicklook_reserve().
+ *  @param[in] data The beam second ([time][channel][pol]).
+ *  @param[in] t0 First timestep.
+ *  @param[in] t1 Timestep after the last.
+ */
+void quicklook_add(const quicklook_beam_s *qb, float *rows, const float *data, long t0, long t1)
+{
+    long nchan = qb->nchan;
+    int npol = qb->npol;
+
+    for (long t = t0; t < t1; t++)
+    {
+        float *row = &rows[(t / qb->timesteps_per_row) * nchan];
+        const float *in = &data[t * nchan * npol];
+
+        if (npol == 1)
+        {
+            for (long c = 0; c < nchan; c++)
+                row[c] += in[c];
+        }
+        else
+        {
+            for (long c = 0; c < nchan; c++)
+            {
+                for (int p = 0; p < npol; p++)
+                    row[c] += in[c * npol + p];
+            }
+        }
+    }
+}
+
+/**
+ *
+ *  @brief Queues the beam second in the buffer from quicklook_reserve() for the quick-look thread.
+ *  @param[in] qb The beam.
+ *  @param[in] second The beam second (from the start of the observation).
+ */
+void quicklook_commit(quicklook_beam_s *qb, int second)
+{
+    pthread_mutex_lock(&g_quicklook.mutex);
+
+    qb->seconds[(qb->head + qb->count) % QUICKLOOK_QUEUE_SECONDS] = second;
+    qb->count++;
+    pthread_cond_signal(&g_quicklook.queued);
+
+    pthread_mutex_unlock(&g_quicklook.mutex);
+}
+
+/**
+ *
+ *  @brief Hands the pyramid of each beam of a finished observation to the quick-look thread to finish (once it has
+ *         the beam seconds still queued). Call from the reader when the observation ends.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ */
+void quicklook_close(multilog_t *log, dada_db_s *ctx)
+{
+    (void)log;
+
+    pthread_mutex_lock(&g_quicklook.mutex);
+
+    for (int beam = 0; beam < ctx->nbeams_total; beam++)
+    {
+        if (ctx->beams[beam].quicklook != NULL)
+        {
+            ctx->beams[beam].quicklook->closing = 1;
+            ctx->beams[beam].quicklook = NULL;
+        }
+    }
+
+    pthread_cond_signal(&g_quicklook.queued);
+
+    pthread_mutex_unlock(&g_quicklook.mutex);
+}
+
+/**
+ *
+ *  @brief Finishes every beam's pyramid and stops the quick-look thread. Call before multilog_close().
+ */
+void quicklook_shutdown()
+{
+    pthread_mutex_lock(&g_quicklook.mutex);
+
+    if (!g_quicklook.running)
+    {
+        pthread_mutex_unlock(&g_quicklook.mutex);
+        return;
+    }
+
+    g_quicklook.stop = 1;
+    pthread_cond_signal(&g_quicklook.queued);
+
+    pthread_mutex_unlock(&g_quicklook.mutex);
+
+    pthread_join(g_quicklook.thread, NULL);
+
+    g_quicklook.running = 0;
+}
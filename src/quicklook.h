@@ -0,0 +1,79 @@
+/**
+ * @file quicklook.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that builds the quick-look pyramid of each beam as it is written
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "multilog.h"
+
+#define QUICKLOOK_EXTENSION ".qlk"          // oooooooooo_YYYYMMDDhhmmss_chCCC_BB.qlk
+#define QUICKLOOK_MAGIC "MWAXQLK1"          // First 8 bytes of a quick-look file
+#define QUICKLOOK_VERSION 1
+#define QUICKLOOK_DEFAULT_ROWS 10           // Level 0 rows per second (the most up to this which divides the timesteps)
+#define QUICKLOOK_LEVELS 12                 // Levels of the pyramid, each half the rows and channels of the one below
+#define QUICKLOOK_TILE_ROWS 64              // Rows of a tile
+#define QUICKLOOK_TILE_CHANS 64             // Channels of a tile
+#define QUICKLOOK_QUEUE_SECONDS 4           // Beam seconds of each beam waiting for the quick-look thread. When full they are dropped (or waited for, when replaying)
+#define QUICKLOOK_WRITE_BUFFER_BYTES (1024 * 1024)
+
+// The layout of a quick-look file (all little endian):
+//   quicklook_header_s
+//   tiles, one after another as they are finished (any level order): a quicklook_tile_s, then nrows * nchans floats
+//   ([row][channel]) at its offset
+//   quicklook_tile_s * index_entries (at index_offset): a copy of every tile's own quicklook_tile_s
+// Level 0 is the beam's power (summed over pols) averaged into rows_per_second rows a second. Each level above it is
+// the 2x2 (time x channel) mean of the one below: row r, channel c of level l + 1 is the mean of rows 2r, 2r + 1 and
+// channels 2c, 2c + 1 of level l, so it has nchan >> (l + 1) channels (an odd last channel is left out, and a level of
+// one channel is only halved in time). An odd last row at the end of the observation is averaged on its own.
+// Row r of level l starts (r << l) / rows_per_second seconds after first_second. Seconds which were not written (shed,
+// gaps, or dropped as the quick-look thread fell behind) are zeros. A file which was not closed has no index, but its
+// tiles can still be read one after another from the end of the header
+
+typedef struct quicklook_header_s
+{
+    char magic[8];            // QUICKLOOK_MAGIC
+    uint32_t version;         // QUICKLOOK_VERSION
+    uint32_t beam;            // beam index (0 based)
+    uint64_t index_offset;    // where the index starts (0 if the file was not closed)
+    uint64_t index_entries;   // tiles in the index
+    int64_t obs_id;
+    uint32_t coarse_channel;
+    uint32_t first_second;    // beam second row 0 starts at (not 0 if the observation was joined in progress)
+    uint32_t nchan;           // channels of level 0
+    uint32_t nlevels;         // QUICKLOOK_LEVELS
+    uint32_t rows_per_second; // rows of level 0 in a second
+    uint32_t tile_rows;       // QUICKLOOK_TILE_ROWS
+    uint32_t tile_chans;      // QUICKLOOK_TILE_CHANS
+    uint32_t reserved0;
+    double fch1;              // centre (MHz) of the first channel of level 0
+    double foff;              // channel width (MHz) of level 0
+    double tstart;            // MJD of row 0
+    double tsamp;             // seconds per row of level 0
+    uint64_t level_rows[QUICKLOOK_LEVELS]; // rows in each level (0 if the file was not closed)
+    uint32_t reserved[4];
+} quicklook_header_s; // 216 bytes
+
+typedef struct quicklook_tile_s
+{
+    uint32_t level;  // level of the pyramid
+    uint32_t nrows;  // rows in the tile (QUICKLOOK_TILE_ROWS, or fewer in the last tile of a level)
+    uint32_t chan0;  // first channel (a multiple of QUICKLOOK_TILE_CHANS)
+    uint32_t nchans; // channels in the tile (QUICKLOOK_TILE_CHANS, or fewer in the last tile of a row of tiles)
+    uint64_t row0;   // first row (a multiple of QUICKLOOK_TILE_ROWS)
+    uint64_t offset; // where its data is
+} quicklook_tile_s; // 32 bytes
+
+struct dada_db_s;
+struct quicklook_beam_s;
+
+int quicklook_init(multilog_t *log, int wait);
+int quicklook_open(multilog_t *log, struct dada_db_s *ctx);
+float *quicklook_reserve(struct quicklook_beam_s *beam);
+void quicklook_add(const struct quicklook_beam_s *beam, float *rows, const float *data, long t0, long t1);
+void quicklook_commit(struct quicklook_beam_s *beam, int second);
+void quicklook_close(multilog_t *log, struct dada_db_s *ctx);
+void quicklook_shutdown();
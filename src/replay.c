@@ -0,0 +1,472 @@
+/**
+ * @file replay.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that replays dada files from disk through the psrdada callbacks
+ *
+ * Each dada file is mmap'd and split into (header, TRANSFER_SIZE bytes of data) transfers.
+ * Each transfer is fed through the same open/io/close callbacks psrdada uses, one beam
+ * second per io call, so the output is identical to reading the same data from a ringbuffer.
+ * A fifo (e.g. written by mwax_beamdb2fil_loadgen --output-file) is read as the data arrives, and
+ * like the reader of an idle ring, a thread waiting for it stops when we are asked to quit.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "ascii_header.h"
+#include "dada_client.h"
+#include "dada_dbfil.h"
+#include "placement.h"
+#include "replay.h"
+#include "trace.h"
+#include "../mwax_common/mwax_global_defs.h" // From mwax-common
+
+#define REPLAY_POLL_MS 100                      // How often a thread waiting for a fifo checks if it should quit
+#define REPLAY_FIFO_SKIP_BYTES (64 * 1024 * 1024) // Most of a skipped observation read from a fifo at once
+
+// Where a dada file is replayed from: the whole file mmap'd, or what has arrived so far of a fifo
+typedef struct
+{
+  int fd;            // the fifo, or -1 if the file is mmap'd
+  char *data;        // the mmap'd file, or the bytes read from the fifo
+  uint64_t size;     // bytes in data
+  uint64_t offset;   // next byte of data to replay
+  uint64_t capacity; // bytes allocated for data (fifo only)
+} replay_source_s;
+
+/**
+ *
+ *  @brief Returns the number of bytes the next io call will consume (one beam second of the current beam).
+ *  @param[in] ctx Pointer to the context of the observation being replayed.
+ *  @returns Number of bytes in the next beam second block, or 0 if we are not processing an observation.
+ */
+uint64_t replay_next_block_size(dada_db_s *ctx)
+{
+  if (ctx->obs_id == 0 || ctx->nbeams_total == 0)
+    return 0;
+
+  beam_s *beam = &ctx->beams[ctx->block_number % ctx->nbeams_total];
+
+  return (uint64_t)beam->ntimesteps * beam->nchan * ctx->npol * (ctx->nbit / 8);
+}
+
+/**
+ *
+ *  @brief Opens a dada file to replay: mmap's it, or if it is a fifo, gets ready to read it as it arrives.
+ *  @param[in] log Pointer to the logger.
+ *  @param[out] source Pointer to the source to set up.
+ *  @param[in] filename Full path of the dada file.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+static int replay_source_open(multilog_t *log, replay_source_s *source, const char *filename)
+{
+  memset(source, 0, sizeof(replay_source_s));
+  source->fd = -1;
+
+  // Non blocking, so opening a fifo does not wait for its writer (nor ignore a quit while it does)
+  int fd = open(filename, O_RDONLY | O_NONBLOCK);
+
+  if (fd < 0)
+  {
+    multilog(log, LOG_ERR, "replay_dada_file(): Error opening %s. Error: %s\n", filename, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  struct stat file_stat;
+  int stat_result = fstat(fd, &file_stat);
+
+  if (stat_result == 0 && S_ISFIFO(file_stat.st_mode))
+  {
+    multilog(log, LOG_INFO, "replay_dada_file(): %s is a fifo, reading it as it arrives.\n", filename);
+    source->fd = fd;
+    return EXIT_SUCCESS;
+  }
+
+  if (stat_result != 0 || file_stat.st_size == 0)
+  {
+    multilog(log, LOG_ERR, "replay_dada_file(): %s is empty or could not be stat'd.\n", filename);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  source->size = (uint64_t)file_stat.st_size;
+  source->data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+
+  if (source->data == MAP_FAILED)
+  {
+    multilog(log, LOG_ERR, "replay_dada_file(): Error mmap'ing %s. Error: %s\n", filename, strerror(errno));
+    source->data = NULL;
+    return EXIT_FAILURE;
+  }
+
+  madvise(source->data, source->size, MADV_SEQUENTIAL);
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Waits until a fifo has more to read (or its writer has gone), checking every REPLAY_POLL_MS whether we have
+ *         been asked to quit, e.g. by a QUIT in another file (see ring_reader_wait_for_header()).
+ *  @param[in] source Pointer to the source of a fifo.
+ *  @returns 1 if there is something to read, or 0 if we are quitting.
+ */
+static int replay_source_wait(replay_source_s *source)
+{
+  struct pollfd poll_fd = {.fd = source->fd, .events = POLLIN};
+
+  while (!get_quit())
+  {
+    int ready = poll(&poll_fd, 1, REPLAY_POLL_MS);
+
+    // Data, the writer has gone or an error: read() tells us which
+    if (ready > 0 || (ready < 0 && errno != EINTR))
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ *  @brief Makes the next bytes of a source available at data + offset, reading them from a fifo if need be.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in,out] source Pointer to the source.
+ *  @param[in] filename Its name (for errors).
+ *  @param[in] bytes How many bytes are wanted.
+ *  @returns The number available (up to bytes): fewer only at the end of the file, if there was an error reading a
+ *           fifo, or if we are quitting.
+ */
+static uint64_t replay_source_ensure(multilog_t *log, replay_source_s *source, const char *filename, uint64_t bytes)
+{
+  while (source->fd != -1 && source->size - source->offset < bytes)
+  {
+    // Keep only what is left to replay, at the start of a buffer big enough for what is wanted
+    if (source->offset > 0)
+    {
+      memmove(source->data, source->data + source->offset, source->size - source->offset);
+      source->size -= source->offset;
+      source->offset = 0;
+    }
+
+    if (source->capacity < bytes)
+    {
+      char *data = realloc(source->data, bytes);
+
+      if (data == NULL)
+      {
+        multilog(log, LOG_ERR, "replay_dada_file(): Could not allocate %lu bytes to read %s into.\n", bytes, filename);
+        break;
+      }
+
+      source->data = data;
+      source->capacity = bytes;
+    }
+
+    if (!replay_source_wait(source))
+      break;
+
+    ssize_t got = read(source->fd, source->data + source->size, source->capacity - source->size);
+
+    // The writer has closed the fifo
+    if (got == 0)
+      break;
+
+    if (got < 0)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+
+      multilog(log, LOG_ERR, "replay_dada_file(): Error reading %s. Error: %s\n", filename, strerror(errno));
+      break;
+    }
+
+    source->size += (uint64_t)got;
+  }
+
+  uint64_t available = source->size - source->offset;
+
+  return (available < bytes) ? available : bytes;
+}
+
+/**
+ *
+ *  @brief Unmaps the file, or closes the fifo and frees what was read from it.
+ *  @param[in] source Pointer to the source.
+ */
+static void replay_source_close(replay_source_s *source)
+{
+  if (source->fd != -1)
+  {
+    close(source->fd);
+    free(source->data);
+  }
+  else if (source->data != NULL)
+    munmap(source->data, source->size);
+
+  memset(source, 0, sizeof(replay_source_s));
+  source->fd = -1;
+}
+
+/**
+ *
+ *  @brief Replays one dada file through the open/io/close callbacks. The file may contain more than one transfer.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the context to use for this file (one per thread).
+ *  @param[in] filename Full path of the dada file to replay.
+ *  @param[out] bytes_replayed The number of data bytes fed to the io callback.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int replay_dada_file(multilog_t *log, dada_db_s *ctx, const char *filename, uint64_t *bytes_replayed)
+{
+  *bytes_replayed = 0;
+
+  replay_source_s source;
+
+  if (replay_source_open(log, &source, filename) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  // Set up a client which looks like the one main() creates for the ringbuffer
+  dada_client_t *client = dada_client_create();
+  client->log = log;
+  client->context = ctx;
+  client->open_function = dada_dbfil_open;
+  client->io_function = dada_dbfil_io;
+  client->io_block_function = dada_dbfil_io_block;
+  client->close_function = dada_dbfil_close;
+  client->direction = dada_client_reader;
+
+  int result = EXIT_SUCCESS;
+  int transfer = 0;
+
+  while (!get_quit())
+  {
+    // Determine the size of the header. The header is ascii and null padded, so copy the default size first
+    uint64_t hdr_size = DADA_DEFAULT_HDR_SIZE;
+    char probe[DADA_DEFAULT_HDR_SIZE + 1];
+    uint64_t probe_size = replay_source_ensure(log, &source, filename, DADA_DEFAULT_HDR_SIZE);
+
+    // The end of the file (or of the wait for more of a fifo, because we are quitting)
+    if (probe_size == 0)
+      break;
+
+    memcpy(probe, source.data + source.offset, probe_size);
+    probe[probe_size] = '\0';
+
+    if (ascii_header_get(probe, "HDR_SIZE", "%lu", &hdr_size) == -1)
+      hdr_size = DADA_DEFAULT_HDR_SIZE;
+
+    if (hdr_size == 0 || replay_source_ensure(log, &source, filename, hdr_size) < hdr_size)
+    {
+      if (get_quit())
+        break;
+
+      multilog(log, LOG_ERR, "replay_dada_file(): %s transfer %d: header of %lu bytes extends past end of file.\n", filename, transfer, hdr_size);
+      result = EXIT_FAILURE;
+      break;
+    }
+
+    client->header = calloc(hdr_size + 1, 1);
+    client->header_size = hdr_size;
+    memcpy(client->header, source.data + source.offset, hdr_size);
+    source.offset += hdr_size;
+
+    // Work out how much data belongs to this transfer (of a fifo without TRANSFER_SIZE, everything until it is closed)
+    uint64_t transfer_size = 0;
+    uint64_t remaining = (source.fd == -1) ? source.size - source.offset : UINT64_MAX;
+
+    if (ascii_header_get(client->header, HEADER_TRANSFER_SIZE, "%lu", &transfer_size) == -1 || transfer_size > remaining)
+      transfer_size = remaining;
+
+    multilog(log, LOG_INFO, "replay_dada_file(): %s transfer %d: %lu header bytes, %lu data bytes.\n", filename, transfer, hdr_size, transfer_size);
+
+    if (client->open_function(client) != EXIT_SUCCESS)
+    {
+      multilog(log, LOG_ERR, "replay_dada_file(): %s transfer %d: open failed.\n", filename, transfer);
+      result = EXIT_FAILURE;
+    }
+    else
+    {
+      uint64_t transfer_offset = 0;
+      uint64_t block_id = 0;
+
+      while (transfer_offset < transfer_size && !is_mwax_mode_quit(ctx->mode))
+      {
+        uint64_t block_bytes = replay_next_block_size(ctx);
+        int skipping = (block_bytes == 0);
+
+        // Skipped observations just consume what is left (a fifo's a piece at a time)
+        if (skipping)
+        {
+          block_bytes = transfer_size - transfer_offset;
+
+          if (source.fd != -1 && block_bytes > REPLAY_FIFO_SKIP_BYTES)
+            block_bytes = REPLAY_FIFO_SKIP_BYTES;
+        }
+
+        // The io callback always reads a whole beam second, so a truncated file must stop here rather than be read past
+        if (block_bytes > transfer_size - transfer_offset)
+        {
+          multilog(log, LOG_ERR, "replay_dada_file(): %s transfer %d: block %lu is truncated (%lu bytes left, a beam second is %lu bytes).\n", filename,
+                   transfer, block_id, transfer_size - transfer_offset, block_bytes);
+          result = EXIT_FAILURE;
+          break;
+        }
+
+        uint64_t available = replay_source_ensure(log, &source, filename, block_bytes);
+
+        if (skipping && available > 0)
+          block_bytes = available;
+
+        if (available < block_bytes)
+        {
+          // A fifo without TRANSFER_SIZE ends the transfer when it is closed, and quitting stops it where it is
+          if (get_quit() || (available == 0 && transfer_size == UINT64_MAX))
+            break;
+
+          multilog(log, LOG_ERR, "replay_dada_file(): %s transfer %d: block %lu is truncated (%lu bytes left, a beam second is %lu bytes).\n", filename,
+                   transfer, block_id, available, block_bytes);
+          result = EXIT_FAILURE;
+          break;
+        }
+
+        if (client->io_block_function(client, source.data + source.offset, block_bytes, block_id) < 0)
+        {
+          multilog(log, LOG_ERR, "replay_dada_file(): %s transfer %d: io failed on block %lu.\n", filename, transfer, block_id);
+          result = EXIT_FAILURE;
+          break;
+        }
+
+        source.offset += block_bytes;
+        transfer_offset += block_bytes;
+        block_id++;
+      }
+
+      *bytes_replayed += transfer_offset;
+
+      if (client->close_function(client, transfer_offset) != EXIT_SUCCESS)
+        result = EXIT_FAILURE;
+    }
+
+    free(client->header);
+    client->header = NULL;
+
+    if (result != EXIT_SUCCESS || is_mwax_mode_quit(ctx->mode))
+      break;
+
+    transfer++;
+  }
+
+  dada_client_destroy(client);
+  replay_source_close(&source);
+
+  return result;
+}
+
+/**
+ *
+ *  @brief This is the thread function which replays a single dada file.
+ *  @param[in] args Pointer to the replay_thread_args_s for this file.
+ *  @returns void.
+ */
+void *replay_thread_fn(void *args)
+{
+  replay_thread_args_s *replay_args = (replay_thread_args_s *)args;
+
+  trace_set_thread_name("replay");
+  placement_bind_thread(replay_args->log, placement_reader, "replay");
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  replay_args->result = replay_dada_file(replay_args->log, replay_args->ctx, replay_args->filename, &replay_args->bytes_replayed);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  replay_args->elapsed_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  return NULL;
+}
+
+/**
+ *
+ *  @brief Replays each dada file on its own thread, waits for them all, then reports the throughput.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] template_ctx Pointer to a context with the paths/hostname populated. Each thread gets a copy.
+ *  @param[in] file_count Number of files to replay.
+ *  @param[in] filenames Array of file names to replay.
+ *  @returns EXIT_SUCCESS if every file was replayed successfully, or EXIT_FAILURE otherwise.
+ */
+int replay_dada_files(multilog_t *log, dada_db_s *template_ctx, int file_count, char *filenames[])
+{
+  pthread_t *threads = calloc(file_count, sizeof(pthread_t));
+  replay_thread_args_s *replay_args = calloc(file_count, sizeof(replay_thread_args_s));
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int f = 0; f < file_count; f++)
+  {
+    // Each file needs its own context since the callbacks keep observation state in it
+    dada_db_s *ctx = create_reader_context(template_ctx);
+    ctx->ring_index = f; // each file is a ring of its own (e.g. for --wideband)
+
+    replay_args[f].log = log;
+    replay_args[f].filename = filenames[f];
+    replay_args[f].ctx = ctx;
+    replay_args[f].result = EXIT_FAILURE;
+
+    multilog(log, LOG_INFO, "replay_dada_files(): Launching replay thread for %s...\n", filenames[f]);
+
+    if (pthread_create(&threads[f], NULL, replay_thread_fn, (void *)&replay_args[f]) != 0)
+    {
+      multilog(log, LOG_ERR, "replay_dada_files(): Could not create replay thread for %s.\n", filenames[f]);
+      threads[f] = 0;
+    }
+  }
+
+  int result = EXIT_SUCCESS;
+  uint64_t total_bytes = 0;
+
+  for (int f = 0; f < file_count; f++)
+  {
+    if (threads[f] != 0)
+      pthread_join(threads[f], NULL);
+
+    double mb = replay_args[f].bytes_replayed / 1000000.0;
+
+    multilog(log, LOG_INFO, "replay_dada_files(): %s: %s, %.1f MB in %.3f sec (%.1f MB/s)\n", replay_args[f].filename,
+             replay_args[f].result == EXIT_SUCCESS ? "OK" : "FAILED", mb, replay_args[f].elapsed_sec,
+             replay_args[f].elapsed_sec > 0 ? mb / replay_args[f].elapsed_sec : 0);
+
+    if (replay_args[f].result != EXIT_SUCCESS)
+      result = EXIT_FAILURE;
+
+    total_bytes += replay_args[f].bytes_replayed;
+
+    // Cleanup the per thread context
+    destroy_reader_context(replay_args[f].ctx);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed_sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  multilog(log, LOG_INFO, "replay_dada_files(): Replayed %d file(s), %.1f MB in %.3f sec (%.1f MB/s)\n", file_count,
+           total_bytes / 1000000.0, elapsed_sec, elapsed_sec > 0 ? total_bytes / 1000000.0 / elapsed_sec : 0);
+
+  free(replay_args);
+  free(threads);
+
+  return result;
+}
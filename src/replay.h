@@ -0,0 +1,29 @@
+/**
+ * @file replay.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that replays dada files from disk through the psrdada callbacks
+ *
+ */
+#pragma once
+
+#include "multilog.h"
+#include "global.h"
+
+#define DADA_DEFAULT_HDR_SIZE 4096 // Size of a dada header if HDR_SIZE is not present in the header itself
+
+typedef struct
+{
+    multilog_t *log;
+    const char *filename;
+    dada_db_s *ctx;
+
+    // Results
+    int result;
+    uint64_t bytes_replayed;
+    double elapsed_sec;
+} replay_thread_args_s;
+
+int replay_dada_files(multilog_t *log, dada_db_s *template_ctx, int file_count, char *filenames[]);
+int replay_dada_file(multilog_t *log, dada_db_s *ctx, const char *filename, uint64_t *bytes_replayed);
+void *replay_thread_fn(void *args);
@@ -0,0 +1,257 @@
+/**
+ * @file ring.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that reads each ringbuffer (--key) on its own reader thread
+ *
+ * One process can read the ringbuffers of several coarse channels (--key=KEY,KEY...). Each ring gets a reader thread,
+ * with its own dada client and context, so its observations are written exactly as a process of its own would write
+ * them. Everything else is shared by all of the readers: the worker threads (log formatter and health), the segment
+ * closer (writer), notify, the metafits cache and the process wide counters. The counters of each ring are also kept
+ * apart (see ring_metrics_s), and the health thread sends a record per ring. A QUIT on one ring stops every reader: an
+ * idle one is not left blocked waiting for a header which may never come.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "args.h"
+#include "dada_dbfil.h"
+#include "metrics.h"
+#include "placement.h"
+#include "ring.h"
+#include "trace.h"
+
+_Static_assert(METRICS_MAX_RINGS >= ARGS_MAX_KEYS, "METRICS_MAX_RINGS is too small");
+
+#define RING_READER_POLL_MS 100 // How often a reader waiting for a header checks if it should quit
+
+/**
+ *
+ *  @brief Connects to a ringbuffer, locks it for reading and sets up the dada client and context of its reader.
+ *  @param[in] log Pointer to the logger.
+ *  @param[out] reader Pointer to the reader to set up.
+ *  @param[in] index Index of the ring (in --key order).
+ *  @param[in] key Shared memory key of the ring.
+ *  @param[in] template_ctx Pointer to a context with the options, paths and hostname populated.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+int ring_reader_open(multilog_t *log, ring_reader_s *reader, int index, key_t key, const dada_db_s *template_ctx)
+{
+    memset(reader, 0, sizeof(ring_reader_s));
+    reader->index = index;
+    reader->key = key;
+    reader->log = log;
+    reader->result = EXIT_SUCCESS;
+    snprintf(reader->name, sizeof(reader->name), "reader_%x", key);
+
+    // create the input HDU
+    multilog(log, LOG_INFO, "ring_reader_open(): Creating HDU handle for key %x...\n", key);
+    reader->hdu = dada_hdu_create(log);
+    dada_hdu_set_key(reader->hdu, key);
+
+    multilog(log, LOG_INFO, "ring_reader_open(): Connecting to HDU with key %x...\n", key);
+    if (dada_hdu_connect(reader->hdu) < 0)
+    {
+        multilog(log, LOG_ERR, "ring_reader_open(): ERROR: could not connect to input HDU %x\n", key);
+        dada_hdu_destroy(reader->hdu);
+        reader->hdu = NULL;
+        return EXIT_FAILURE;
+    }
+
+    multilog(log, LOG_INFO, "ring_reader_open(): Locking HDU %x handle for read...\n", key);
+    if (dada_hdu_lock_read(reader->hdu) < 0)
+    {
+        multilog(log, LOG_ERR, "ring_reader_open(): ERROR: could not lock read on input HDU %x\n", key);
+        return EXIT_FAILURE;
+    }
+
+    reader->ctx = create_reader_context(template_ctx);
+
+    if (reader->ctx == NULL)
+    {
+        multilog(log, LOG_ERR, "ring_reader_open(): ERROR: could not allocate the context of the reader of %x\n", key);
+        return EXIT_FAILURE;
+    }
+
+    reader->ctx->ring_index = index;
+
+    // set up DADA read client
+    multilog(log, LOG_INFO, "ring_reader_open(): Creating DADA client for %x...\n", key);
+    reader->client = dada_client_create();
+    reader->client->log = log;
+    reader->client->data_block = reader->hdu->data_block;
+    reader->client->header_block = reader->hdu->header_block;
+    reader->client->open_function = dada_dbfil_open;
+    reader->client->io_function = dada_dbfil_io;
+    reader->client->io_block_function = dada_dbfil_io_block;
+    reader->client->close_function = dada_dbfil_close;
+    reader->client->direction = dada_client_reader;
+    reader->client->context = reader->ctx;
+
+    // Set some useful params based on our ringbuffer config
+    reader->ctx->block_size = ipcbuf_get_bufsz((ipcbuf_t *)(reader->client->data_block));
+    multilog(log, LOG_INFO, "ring_reader_open(): Block size (one integration) of %x is %lu bytes.\n", key, reader->ctx->block_size);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Waits for the next header on a ring. dada_client_read() would block until one came, so a QUIT on another
+ *         ring (or a signal, or an error on another reader) would never stop this one; instead we check every
+ *         RING_READER_POLL_MS whether we have been asked to quit.
+ *  @param[in] reader Pointer to the reader.
+ *  @returns 1 if there is a header to read, or 0 if we are quitting.
+ */
+static int ring_reader_wait_for_header(ring_reader_s *reader)
+{
+    const struct timespec poll_interval = {.tv_sec = 0, .tv_nsec = RING_READER_POLL_MS * 1000000L};
+
+    while (!get_quit())
+    {
+        if (ipcbuf_get_nfull(reader->hdu->header_block) > 0)
+            return 1;
+
+        nanosleep(&poll_interval, NULL);
+    }
+
+    return 0;
+}
+
+/**
+ *
+ *  @brief This is the reader thread of a ring: reads transfers until we are asked to quit.
+ *  @param[in] args Pointer to the ring_reader_s of the ring.
+ *  @returns void.
+ */
+static void *ring_reader_thread_fn(void *args)
+{
+    ring_reader_s *reader = (ring_reader_s *)args;
+    multilog_t *log = reader->log;
+
+    trace_set_thread_name(reader->name);
+    metrics_set_thread_ring(reader->index, (int32_t)reader->key);
+
+    // Keep the staging buffers this thread allocates on the NUMA node of its ring
+    placement_bind_thread(log, placement_reader, reader->name);
+    placement_bind_memory_near(log, ((ipcbuf_t *)reader->client->data_block)->buffer[0], reader->ctx->block_size, "ringbuffer");
+
+    int quit = 0;
+
+    while (!quit)
+    {
+        if (!ring_reader_wait_for_header(reader))
+            break;
+
+        multilog(log, LOG_INFO, "ring_reader(%x): dada_client_read()\n", reader->key);
+
+        if (dada_client_read(reader->client) < 0)
+        {
+            multilog(log, LOG_ERR, "ring_reader(%x): error during transfer\n", reader->key);
+            set_quit(1);
+        }
+
+        // Check quit status
+        quit = get_quit();
+
+        if (quit)
+        {
+            reader->client->quit = 1;
+        }
+        else
+        {
+            multilog(log, LOG_INFO, "ring_reader(%x): dada_hdu_unlock_read()\n", reader->key);
+            if (dada_hdu_unlock_read(reader->hdu) < 0)
+            {
+                multilog(log, LOG_ERR, "ring_reader(%x): could not unlock read on hdu\n", reader->key);
+                reader->result = EXIT_FAILURE;
+                break;
+            }
+
+            multilog(log, LOG_INFO, "ring_reader(%x): dada_hdu_lock_read()\n", reader->key);
+            if (dada_hdu_lock_read(reader->hdu) < 0)
+            {
+                multilog(log, LOG_ERR, "ring_reader(%x): could not lock read on hdu\n", reader->key);
+                reader->result = EXIT_FAILURE;
+                break;
+            }
+        }
+    }
+
+    // A reader which can not carry on stops the whole process, as it would have when it was the only one
+    if (reader->result != EXIT_SUCCESS)
+        set_quit(1);
+
+    return NULL;
+}
+
+/**
+ *
+ *  @brief Starts the reader thread of a ring.
+ *  @param[in] reader Pointer to the reader (set up by ring_reader_open()).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the thread could not be started.
+ */
+int ring_reader_start(ring_reader_s *reader)
+{
+    multilog(reader->log, LOG_INFO, "ring_reader_start(): Launching reader thread for %x...\n", reader->key);
+
+    if (pthread_create(&reader->thread, NULL, ring_reader_thread_fn, (void *)reader) != 0)
+    {
+        multilog(reader->log, LOG_ERR, "ring_reader_start(): Could not create the reader thread for %x. Error: %s\n", reader->key, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    reader->started = 1;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Waits for the reader thread of a ring to finish.
+ *  @param[in] reader Pointer to the reader.
+ *  @returns EXIT_SUCCESS if the reader finished normally, or EXIT_FAILURE if it stopped because of an error.
+ */
+int ring_reader_join(ring_reader_s *reader)
+{
+    if (reader->started)
+    {
+        pthread_join(reader->thread, NULL);
+        reader->started = 0;
+    }
+
+    return reader->result;
+}
+
+/**
+ *
+ *  @brief Disconnects from a ringbuffer and frees its reader's client and context (the thread must have finished).
+ *  @param[in] reader Pointer to the reader.
+ */
+void ring_reader_close(ring_reader_s *reader)
+{
+    if (reader->hdu != NULL)
+    {
+        multilog(reader->log, LOG_INFO, "ring_reader_close(): dada_hdu_disconnect() %x\n", reader->key);
+        if (dada_hdu_disconnect(reader->hdu) < 0)
+            multilog(reader->log, LOG_ERR, "ring_reader_close(): failed to disconnect HDU %x\n", reader->key);
+
+        dada_hdu_destroy(reader->hdu);
+        reader->hdu = NULL;
+    }
+
+    if (reader->client != NULL)
+    {
+        dada_client_destroy(reader->client);
+        reader->client = NULL;
+    }
+
+    if (reader->ctx != NULL)
+    {
+        destroy_reader_context(reader->ctx);
+        reader->ctx = NULL;
+    }
+}
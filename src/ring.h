@@ -0,0 +1,35 @@
+/**
+ * @file ring.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that reads each ringbuffer (--key) on its own reader thread
+ *
+ */
+#pragma once
+
+#include <pthread.h>
+#include <sys/ipc.h>
+#include "dada_client.h"
+#include "dada_hdu.h"
+#include "global.h"
+#include "multilog.h"
+
+// One ringbuffer and its reader. Each has its own context (observation state) and dada client
+typedef struct ring_reader_s
+{
+    int index; // 0 based, in --key order
+    key_t key;
+    multilog_t *log;
+    dada_hdu_t *hdu;
+    dada_client_t *client;
+    dada_db_s *ctx;
+    char name[32]; // thread name e.g. reader_dada
+    pthread_t thread;
+    int started;
+    int result; // EXIT_SUCCESS unless the reader stopped because of an error
+} ring_reader_s;
+
+int ring_reader_open(multilog_t *log, ring_reader_s *reader, int index, key_t key, const dada_db_s *template_ctx);
+int ring_reader_start(ring_reader_s *reader);
+int ring_reader_join(ring_reader_s *reader);
+void ring_reader_close(ring_reader_s *reader);
@@ -0,0 +1,252 @@
+/**
+ * @file segment.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that splits long observations into fil file segments
+ *
+ * With --segment-seconds (or --segment-mb) each beam's fil file is replaced by a new one every N beam seconds, so
+ * downstream processing can start on a segment while the observation continues. The rollover happens on the reader
+ * thread in dada_dbfil_io(), between two beam seconds: the new file is created there (it must exist before the next
+ * block is written), but the old one is handed to a closer thread, as flushing and closing it (and its checksum and
+ * scales sidecars) can block on the filesystem for much longer than a beam second allows. The closer thread is bound to
+ * the writer cpus (--writer-cpus). If it could not be started, segments are closed on the reader thread instead.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "segment.h"
+#include "filwriter.h"
+#include "latency.h"
+#include "placement.h"
+#include "trace.h"
+
+typedef struct segment_closer_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;  // signalled when a segment is queued (or we are stopping)
+    pthread_cond_t changed; // signalled when a segment is taken off the queue or finished
+
+    segment_close_s queue[SEGMENT_CLOSE_QUEUE_LENGTH];
+    int head;    // next segment to close
+    int count;   // segments in the queue
+    int stop;
+    int running; // 0 until segment_closer_init() (segments are then closed synchronously)
+
+    multilog_t *log;
+    pthread_t thread;
+} segment_closer_s;
+
+static segment_closer_s g_segment_closer = {.mutex = PTHREAD_MUTEX_INITIALIZER, .queued = PTHREAD_COND_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+
+/**
+ *
+ *  @brief Closes a finished segment (its fil file and sidecars), renames it to its final name and publishes it.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] segment The segment.
+ */
+static void segment_close(multilog_t *log, segment_close_s *segment)
+{
+    uint64_t close_start_ns = latency_now_ns();
+
+    cFilFile filfile;
+    filfile.m_szFileName = segment->fil_partial_filename;
+    filfile.m_File = segment->fil_file;
+
+    notify_record_s record;
+    record.obs_id = segment->obs_id;
+    record.beam = segment->beam + 1;
+    record.segment = segment->segment;
+    record.subband = segment->subband;
+    record.nsamples = segment->nsamples;
+    record.has_checksum = (segment->checksum_file != NULL);
+    record.data_crc32c = segment->data_crc;
+
+    int has_scales = (segment->scales_file != NULL);
+
+    if (finish_fil_file(log, &filfile, segment->checksum_file, segment->checksum_filename, segment->scales_file, segment->scales_filename) == EXIT_SUCCESS &&
+        publish_fil_file(log, segment->fil_partial_filename, segment->fil_filename, record.has_checksum ? segment->checksum_filename : NULL,
+                         has_scales ? segment->scales_filename : NULL, &record) == EXIT_SUCCESS)
+        multilog(log, LOG_INFO, "segment_close(): Closed segment %d of beam %d: %s\n", segment->segment, segment->beam + 1, segment->fil_filename);
+    else
+        multilog(log, LOG_ERR, "segment_close(): Error closing segment %d of beam %d: %s\n", segment->segment, segment->beam + 1, segment->fil_filename);
+
+    trace_span("close_segment", "file", close_start_ns, "beam", segment->beam + 1);
+}
+
+/**
+ *
+ *  @brief The closer thread. Closes queued segments, in order, until asked to stop (and the queue is empty).
+ *  @param[in] args Not used.
+ *  @returns NULL.
+ */
+static void *segment_closer_thread_fn(void *args)
+{
+    (void)args;
+
+    trace_set_thread_name("closer");
+    placement_bind_thread(g_segment_closer.log, placement_writer, "closer");
+
+    segment_close_s segment;
+
+    pthread_mutex_lock(&g_segment_closer.mutex);
+
+    for (;;)
+    {
+        while (g_segment_closer.count == 0 && !g_segment_closer.stop)
+            pthread_cond_wait(&g_segment_closer.queued, &g_segment_closer.mutex);
+
+        if (g_segment_closer.count == 0)
+            break;
+
+        segment = g_segment_closer.queue[g_segment_closer.head];
+        g_segment_closer.head = (g_segment_closer.head + 1) % SEGMENT_CLOSE_QUEUE_LENGTH;
+        g_segment_closer.count--;
+        pthread_cond_broadcast(&g_segment_closer.changed);
+
+        pthread_mutex_unlock(&g_segment_closer.mutex);
+
+        segment_close(g_segment_closer.log, &segment);
+
+        pthread_mutex_lock(&g_segment_closer.mutex);
+
+        (*segment.closing)--;
+        pthread_cond_broadcast(&g_segment_closer.changed);
+    }
+
+    pthread_mutex_unlock(&g_segment_closer.mutex);
+
+    return NULL;
+}
+
+/**
+ *
+ *  @brief Starts the closer thread. Call once from main() (only needed if we are writing segments).
+ *  @param[in] log Pointer to the logger.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be started (segments are then closed synchronously).
+ */
+int segment_closer_init(multilog_t *log)
+{
+    g_segment_closer.log = log;
+    g_segment_closer.head = 0;
+    g_segment_closer.count = 0;
+    g_segment_closer.stop = 0;
+
+    if (pthread_create(&g_segment_closer.thread, NULL, segment_closer_thread_fn, NULL) != 0)
+    {
+        multilog(log, LOG_ERR, "segment_closer_init(): Could not create the segment closer thread. Closing segments on the reader thread.\n");
+        return EXIT_FAILURE;
+    }
+
+    g_segment_closer.running = 1;
+
+    multilog(log, LOG_INFO, "segment_closer_init(): Finished segments are closed by a background thread (queue of %d).\n", SEGMENT_CLOSE_QUEUE_LENGTH);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Hands a finished segment to the closer thread. Only waits if the queue is full (the filesystem is not
+ *         keeping up). Without the closer thread the segment is closed now.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] segment The segment (copied), with closing pointing at the segments_closing of its reader.
+ */
+void segment_close_async(multilog_t *log, segment_close_s *segment)
+{
+    pthread_mutex_lock(&g_segment_closer.mutex);
+
+    if (!g_segment_closer.running)
+    {
+        pthread_mutex_unlock(&g_segment_closer.mutex);
+        segment_close(log, segment);
+        return;
+    }
+
+    if (g_segment_closer.count == SEGMENT_CLOSE_QUEUE_LENGTH)
+    {
+        multilog(log, LOG_WARNING, "segment_close_async(): %d segments are waiting to be closed; waiting for the closer thread.\n", SEGMENT_CLOSE_QUEUE_LENGTH);
+
+        while (g_segment_closer.count == SEGMENT_CLOSE_QUEUE_LENGTH)
+            pthread_cond_wait(&g_segment_closer.changed, &g_segment_closer.mutex);
+    }
+
+    g_segment_closer.queue[(g_segment_closer.head + g_segment_closer.count) % SEGMENT_CLOSE_QUEUE_LENGTH] = *segment;
+    g_segment_closer.count++;
+    (*segment->closing)++;
+    pthread_cond_signal(&g_segment_closer.queued);
+
+    pthread_mutex_unlock(&g_segment_closer.mutex);
+}
+
+/**
+ *
+ *  @brief Waits until every segment a reader has handed to the closer thread so far is closed (e.g. at the end of its
+ *         observation). The segments of the other readers (rings) are not waited for.
+ *  @param[in] closing The segments_closing of the reader.
+ */
+void segment_closer_drain(int *closing)
+{
+    pthread_mutex_lock(&g_segment_closer.mutex);
+
+    while (*closing > 0)
+        pthread_cond_wait(&g_segment_closer.changed, &g_segment_closer.mutex);
+
+    pthread_mutex_unlock(&g_segment_closer.mutex);
+}
+
+/**
+ *
+ *  @brief Closes any queued segments and stops the closer thread. Call before multilog_close().
+ */
+void segment_closer_shutdown()
+{
+    pthread_mutex_lock(&g_segment_closer.mutex);
+
+    if (!g_segment_closer.running)
+    {
+        pthread_mutex_unlock(&g_segment_closer.mutex);
+        return;
+    }
+
+    g_segment_closer.stop = 1;
+    pthread_cond_signal(&g_segment_closer.queued);
+
+    pthread_mutex_unlock(&g_segment_closer.mutex);
+
+    pthread_join(g_segment_closer.thread, NULL);
+
+    // Anything closed from here on is closed synchronously
+    g_segment_closer.running = 0;
+}
+
+/**
+ *
+ *  @brief Works out how many beam seconds go in each segment of a beam: segment_seconds, or fewer if that many would
+ *         take the data past segment_bytes (at least 1 second, as we only roll over between beam seconds).
+ *  @param[in] segment_seconds Seconds per segment (--segment-seconds), 0 for no limit.
+ *  @param[in] segment_bytes Max bytes of data per segment (--segment-mb), 0 for no limit.
+ *  @param[in] bytes_per_second Bytes in one second of this beam.
+ *  @returns The seconds per segment, or 0 if the observation is not segmented.
+ */
+int segment_seconds_for_beam(int segment_seconds, uint64_t segment_bytes, uint64_t bytes_per_second)
+{
+    int seconds = segment_seconds;
+
+    if (segment_bytes > 0 && bytes_per_second > 0)
+    {
+        uint64_t seconds_by_size = segment_bytes / bytes_per_second;
+
+        if (seconds_by_size < 1)
+            seconds_by_size = 1;
+        else if (seconds_by_size > INT_MAX)
+            seconds_by_size = INT_MAX;
+
+        if (seconds == 0 || seconds_by_size < (uint64_t)seconds)
+            seconds = (int)seconds_by_size;
+    }
+
+    return seconds;
+}
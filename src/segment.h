@@ -0,0 +1,44 @@
+/**
+ * @file segment.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that splits long observations into fil file segments
+ *
+ */
+#pragma once
+
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "bandpass.h"
+#include "crc32c.h"
+#include "filfile.h"
+#include "global.h"
+#include "multilog.h"
+
+#define SEGMENT_CLOSE_QUEUE_LENGTH 16 // Segments waiting for the closer thread. When full the reader waits
+
+// A finished segment handed to the closer thread. Everything it needs is copied, as the beam moves on to the next file
+typedef struct segment_close_s
+{
+    char fil_filename[PATH_MAX];
+    char fil_partial_filename[PATH_MAX + sizeof(FIL_PARTIAL_EXTENSION)]; // what it is called until it is closed
+    FILE *fil_file;
+    char checksum_filename[PATH_MAX + sizeof(CRC32C_SIDECAR_EXTENSION)];
+    FILE *checksum_file; // NULL if --no-checksums
+    uint32_t data_crc;   // CRC32C of the data in the segment
+    char scales_filename[PATH_MAX + sizeof(BANDPASS_SCALES_EXTENSION)];
+    FILE *scales_file;   // NULL unless --normalise
+    long obs_id;
+    long nsamples;       // as in the header
+    int beam;            // beam index
+    int segment;         // segment index within the observation
+    int subband;         // sub-band index, or -1 if the beam is not split into sub-bands
+    int *closing;        // the segments_closing of the reader it is from
+} segment_close_s;
+
+int segment_closer_init(multilog_t *log);
+void segment_close_async(multilog_t *log, segment_close_s *segment);
+void segment_closer_drain(int *closing);
+void segment_closer_shutdown();
+int segment_seconds_for_beam(int segment_seconds, uint64_t segment_bytes, uint64_t bytes_per_second);
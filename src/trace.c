@@ -0,0 +1,235 @@
+/**
+ * @file trace.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that records a timeline of spans and exports it as Chrome trace-event JSON
+ *
+ * Spans from every thread go into one fixed size ring. A writer claims a slot with an atomic increment and
+ * publishes it by storing its sequence number last, so recording never takes a lock and a dump can run at any
+ * time: it skips slots which are being written. The JSON can be loaded into chrome://tracing or ui.perfetto.dev.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "latency.h"
+#include "trace.h"
+
+static trace_event_s *g_trace_ring = NULL; // NULL if tracing is off
+static uint64_t g_trace_ring_size = 0;
+static uint64_t g_trace_head = 0;
+static const char *g_trace_dir = NULL;
+static int g_trace_dump_requested = 0;
+
+static __thread int32_t t_trace_tid = 0;
+
+static int32_t g_trace_thread_ids[TRACE_MAX_THREADS];
+static const char *g_trace_thread_names[TRACE_MAX_THREADS];
+static int g_trace_thread_count = 0;
+
+/**
+ *
+ *  @brief Turns tracing on. Call once from main() before any threads are started.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] trace_dir Directory the JSON files are written to.
+ *  @param[in] nevents Number of spans the ring holds.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the ring could not be allocated.
+ */
+int trace_init(multilog_t *log, const char *trace_dir, int nevents)
+{
+    g_trace_ring = calloc(nevents, sizeof(trace_event_s));
+
+    if (g_trace_ring == NULL)
+    {
+        multilog(log, LOG_ERR, "trace_init(): Could not allocate a ring of %d trace events.\n", nevents);
+        return EXIT_FAILURE;
+    }
+
+    g_trace_ring_size = nevents;
+    g_trace_dir = trace_dir;
+
+    multilog(log, LOG_INFO, "trace_init(): Tracing the last %d spans to %s (%lu KB).\n", nevents, trace_dir, nevents * sizeof(trace_event_s) / 1024);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Returns whether tracing is on.
+ *  @returns 1 if tracing is on, 0 otherwise.
+ */
+int trace_enabled()
+{
+    return g_trace_ring != NULL;
+}
+
+/**
+ *
+ *  @brief Returns the kernel thread id of the calling thread (cached).
+ *  @returns The thread id.
+ */
+static int32_t trace_tid()
+{
+    if (t_trace_tid == 0)
+        t_trace_tid = (int32_t)syscall(SYS_gettid);
+
+    return t_trace_tid;
+}
+
+/**
+ *
+ *  @brief Names the calling thread in the trace (e.g. "reader", "health").
+ *  @param[in] name Name of the thread. Must be a string literal or otherwise outlive the process.
+ */
+void trace_set_thread_name(const char *name)
+{
+    if (!trace_enabled())
+        return;
+
+    int index = __atomic_fetch_add(&g_trace_thread_count, 1, __ATOMIC_RELAXED);
+
+    if (index >= TRACE_MAX_THREADS)
+        return;
+
+    g_trace_thread_ids[index] = trace_tid();
+    __atomic_store_n(&g_trace_thread_names[index], name, __ATOMIC_RELEASE);
+}
+
+/**
+ *
+ *  @brief Records a span which started at start_ns and ends now. Lock free; does nothing if tracing is off.
+ *  @param[in] name Name of the span. Must be a string literal.
+ *  @param[in] category Category of the span (e.g. "io"). Must be a string literal.
+ *  @param[in] start_ns Start of the span (latency_now_ns()).
+ *  @param[in] arg_name Name of the argument (e.g. "beam"), or NULL if there is none. Must be a string literal.
+ *  @param[in] arg Value of the argument.
+ */
+void trace_span(const char *name, const char *category, uint64_t start_ns, const char *arg_name, int64_t arg)
+{
+    if (!trace_enabled())
+        return;
+
+    uint64_t end_ns = latency_now_ns();
+    uint64_t position = __atomic_fetch_add(&g_trace_head, 1, __ATOMIC_RELAXED);
+    trace_event_s *event = &g_trace_ring[position % g_trace_ring_size];
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    event->name = name;
+    event->category = category;
+    event->arg_name = arg_name;
+    event->arg = arg;
+    event->start_ns = start_ns;
+    event->dur_ns = end_ns - start_ns;
+    event->tid = trace_tid();
+
+    __atomic_store_n(&event->seq, position + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *
+ *  @brief Writes the spans in the ring which started at or after since_ns to <trace_dir>/<label>_trace.json.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] label Start of the file name (e.g. the obs_id).
+ *  @param[in] since_ns Only spans which started at or after this time (latency_now_ns() clock) are written.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the file could not be written.
+ */
+int trace_dump(multilog_t *log, const char *label, uint64_t since_ns)
+{
+    if (!trace_enabled())
+        return EXIT_SUCCESS;
+
+    char filename[PATH_MAX];
+    snprintf(filename, PATH_MAX, "%s/%s_trace.json", g_trace_dir, label);
+
+    FILE *out = fopen(filename, "w");
+
+    if (out == NULL)
+    {
+        multilog(log, LOG_ERR, "trace_dump(): Error opening %s. Error: %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int pid = getpid();
+    int written = 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    // Thread names
+    int thread_count = __atomic_load_n(&g_trace_thread_count, __ATOMIC_RELAXED);
+
+    for (int t = 0; t < thread_count && t < TRACE_MAX_THREADS; t++)
+    {
+        const char *thread_name = __atomic_load_n(&g_trace_thread_names[t], __ATOMIC_ACQUIRE);
+
+        if (thread_name == NULL)
+            continue;
+
+        fprintf(out, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                written++ ? ",\n" : "", pid, g_trace_thread_ids[t], thread_name);
+    }
+
+    // Spans, oldest first
+    uint64_t head = __atomic_load_n(&g_trace_head, __ATOMIC_ACQUIRE);
+    uint64_t first = (head > g_trace_ring_size) ? head - g_trace_ring_size : 0;
+
+    for (uint64_t position = first; position < head; position++)
+    {
+        trace_event_s *slot = &g_trace_ring[position % g_trace_ring_size];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != position + 1)
+            continue;
+
+        trace_event_s event = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        // Skip it if a writer reused the slot while we were copying it
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != position + 1 || event.start_ns < since_ns)
+            continue;
+
+        fprintf(out, "%s{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                written++ ? ",\n" : "", event.name, event.category, pid, event.tid, event.start_ns / 1000.0, event.dur_ns / 1000.0);
+
+        if (event.arg_name != NULL)
+            fprintf(out, ",\"args\":{\"%s\":%ld}", event.arg_name, event.arg);
+
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "\n]}\n");
+
+    if (fclose(out) != 0)
+    {
+        multilog(log, LOG_ERR, "trace_dump(): Error writing %s. Error: %s\n", filename, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    multilog(log, LOG_INFO, "trace_dump(): Wrote %d trace events to %s.\n", written, filename);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Flags that the trace should be dumped. Safe to call from a signal handler.
+ */
+void trace_request_dump()
+{
+    __atomic_store_n(&g_trace_dump_requested, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ *
+ *  @brief Returns (and clears) whether a dump of the trace was requested.
+ *  @returns 1 if a dump was requested, 0 otherwise.
+ */
+int trace_dump_requested()
+{
+    return __atomic_exchange_n(&g_trace_dump_requested, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,37 @@
+/**
+ * @file trace.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that records a timeline of spans and exports it as Chrome trace-event JSON
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+#include "multilog.h"
+
+#define TRACE_DEFAULT_EVENTS 65536 // Size of the ring (~3MB). Once full the oldest spans are overwritten
+#define TRACE_MAX_THREADS 64       // Threads which can be given a name
+
+// One complete span. name, category and arg_name must be string literals (only the pointer is stored)
+typedef struct trace_event_s
+{
+    uint64_t seq; // ring position + 1 once the event is complete, 0 while it is being written
+    const char *name;
+    const char *category;
+    const char *arg_name; // NULL if the span has no argument
+    int64_t arg;
+    uint64_t start_ns; // latency_now_ns() clock
+    uint64_t dur_ns;
+    int32_t tid;
+} trace_event_s;
+
+int trace_init(multilog_t *log, const char *trace_dir, int nevents);
+int trace_enabled();
+void trace_set_thread_name(const char *name);
+void trace_span(const char *name, const char *category, uint64_t start_ns, const char *arg_name, int64_t arg);
+int trace_dump(multilog_t *log, const char *label, uint64_t since_ns);
+
+// SIGUSR2 asks for a dump of everything in the ring
+void trace_request_dump();
+int trace_dump_requested();
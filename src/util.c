@@ -5,6 +5,8 @@
  * @brief Various utility functions
  *
  */
+#include <errno.h>
+#include <fcntl.h>  // for fallocate
 #include <math.h>   // for fabs
 #include <stdlib.h> // for abs
 #include <string.h>
@@ -89,4 +91,22 @@ int binary_strstr(char *buffer, size_t buffer_len, char *search_bytes, size_t se
     }
   }
   return -1; // search bytes not in buffer
-}
\ No newline at end of file
+}
+
+/**
+ *
+ *  @brief Reserves the space of a file we are about to write, so its blocks are allocated in one go (and mostly in one
+ *         piece) instead of a few at a time as it is written. The file is extended to bytes, so cut it back to what was
+ *         written when it is closed. Uses fallocate() rather than posix_fallocate(), as on filesystems which can not
+ *         preallocate it fails straight away instead of writing zeros.
+ *  @param[in] fd The file.
+ *  @param[in] bytes How long the file will be.
+ *  @returns 0 on success, otherwise the errno.
+ */
+int preallocate_file(int fd, off_t bytes)
+{
+  if (bytes <= 0)
+    return 0;
+
+  return (fallocate(fd, 0, 0, bytes) == 0) ? 0 : errno;
+}
@@ -0,0 +1,982 @@
+/**
+ * @file wideband.c
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the code that stitches the coarse channels of several rings into wideband fil files
+ *
+ * With --wideband each reader (one per ring, --key, or per dada file being replayed) hands its beam seconds to a shared
+ * assembler instead of writing its own fil files. Beam seconds are matched up by obs id and marker (seconds from the
+ * start of the observation, from OBS_OFFSET), and each coarse channel is copied straight into its place in a band wide
+ * beam second: every timestep of the band holds the fine channels of each coarse channel in turn, lowest first. The
+ * assembler thread (bound to the writer cpus) writes a beam second to the wideband fil file of its beam once every
+ * coarse channel has arrived, or once it has waited --wideband=MS for the late ones, which are then zeros.
+ *
+ * Each beam has WIDEBAND_WINDOW_SECONDS beam seconds in flight. A ring which gets further ahead of the slowest one than
+ * that waits for the assembler (which is never longer than the timeout), so its ringbuffer takes up the slack. Channels
+ * which turn up after their beam second was written are dropped and counted.
+ *
+ * Observations are assembled in obs id order. A ring which starts a newer observation waits for the others to finish
+ * the band (or for it to go the timeout without a beam second arriving); a ring still on an older one than the band is
+ * not part of it, and its beam seconds are dropped and counted.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wideband.h"
+#include "crc32c.h"
+#include "dada_dbfil.h"
+#include "filwriter.h"
+#include "latency.h"
+#include "metrics.h"
+#include "placement.h"
+#include "trace.h"
+
+// One beam second of the band being assembled
+typedef struct wideband_slot_s
+{
+    int second;       // beam second (from the start of the observation), -1 if the slot is free
+    int writing;      // the assembler is writing it (channels arriving now are too late)
+    int copying;      // channels being copied in (outside the lock)
+    uint32_t arrived; // bit per position in the band: the channels which have arrived
+    uint32_t copied;  // of those, the ones with data (a shed beam second, or a gap, arrives without any)
+    uint64_t first_ns;
+    float *data; // ntimesteps * (nchannels * nchan * npol)
+} wideband_slot_s;
+
+typedef struct wideband_beam_s
+{
+    long ntimesteps;
+    long nchan;            // fine channels of each coarse channel
+    long channel_values;   // nchan * npol: one timestep of one coarse channel
+    uint64_t second_bytes; // a beam second of the band
+    int next_second;       // next beam second to write
+    int last_second;       // latest beam second which has arrived
+    wideband_slot_s slots[WIDEBAND_WINDOW_SECONDS];
+    fil_output_s output;
+} wideband_beam_s;
+
+typedef struct wideband_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t arrived; // to the assembler: a channel arrived, a ring finished the observation, or we are stopping
+    pthread_cond_t changed; // to the readers: a beam second was written, the band was laid out, or the observation finished
+
+    multilog_t *log;
+    pthread_t thread;
+    int running;
+    int stop;
+    int nrings;
+    uint64_t timeout_ns;
+
+    // The observation being assembled (obs_id is 0 if none)
+    long obs_id;
+    long finished_obs_id; // the newest observation finished: rings still on it (or older ones) are not assembled
+    uint64_t open_ns;     // when the first ring opened it
+    uint64_t active_ns;   // when it last made progress (opened, laid out, or a channel arrived)
+    int laid_out;     // the band, and its files, are set up
+    int finishing;    // every ring is done with it (or one has moved on): write what is left and close the files
+    int ring_joined[METRICS_MAX_RINGS];
+    int ring_closed[METRICS_MAX_RINGS];
+    int ring_coarse_channel[METRICS_MAX_RINGS];
+    int ring_join_sec[METRICS_MAX_RINGS]; // first beam second the ring has (where it joined the observation)
+    int ring_position[METRICS_MAX_RINGS]; // its position in the band, -1 if it is not in it
+    long ring_dropping[METRICS_MAX_RINGS]; // observation the ring's dropped beam seconds were last logged for
+    int first_coarse_channel;
+    int nchannels; // coarse channels the band spans (positions without a ring are zeros)
+    int start_sec; // first beam second of the files
+    int nbeams;
+    int npol;
+    int nbit;
+    wideband_beam_s *beams;
+
+    // Counters of this observation
+    uint64_t seconds_written;
+    uint64_t seconds_skipped;  // beam seconds nothing arrived for (left as zeros)
+    uint64_t channels_late;    // channel seconds which had not arrived in time (zeros)
+    uint64_t channels_dropped; // channel seconds which could not go in the band (too late, or not in it)
+} wideband_s;
+
+static wideband_s g_wideband = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ *
+ *  @brief Works out the absolute (CLOCK_MONOTONIC, like latency_now_ns()) time to wait until.
+ *  @param[in] deadline_ns The latency_now_ns() timestamp to wait until.
+ *  @param[out] deadline The same as a timespec.
+ */
+static void wideband_deadline(uint64_t deadline_ns, struct timespec *deadline)
+{
+    deadline->tv_sec = deadline_ns / 1000000000ULL;
+    deadline->tv_nsec = deadline_ns % 1000000000ULL;
+}
+
+/**
+ *
+ *  @brief Works out which positions of the band we expect a beam second from: the rings in the band which have it (they
+ *         joined the observation at or before it) and which have not finished the observation. Call with the lock held.
+ *  @param[in] second The beam second.
+ *  @returns A bit per position.
+ */
+static uint32_t wideband_expected(int second)
+{
+    uint32_t expected = 0;
+
+    for (int ring = 0; ring < g_wideband.nrings; ring++)
+    {
+        if (g_wideband.ring_position[ring] >= 0 && !g_wideband.ring_closed[ring] && g_wideband.ring_join_sec[ring] <= second)
+            expected |= 1u << g_wideband.ring_position[ring];
+    }
+
+    return expected;
+}
+
+/**
+ *
+ *  @brief Copies a beam second of one coarse channel into its place in the band. Each timestep of the coarse channel is
+ *         one contiguous run (its fine channels and pols), which goes to the same timestep of the band. Those are a
+ *         band timestep apart (e.g. 24 coarse channels of 128 fine channels is 12 KiB), so the hardware prefetcher
+ *         does not follow them across pages: the rows of the next group of timesteps are prefetched while a group is
+ *         copied.
+ *  @param[out] band Where the coarse channel goes in the first timestep of the band.
+ *  @param[in] channel The beam second of the coarse channel.
+ *  @param[in] ntimesteps Timesteps in the beam second.
+ *  @param[in] channel_values Values in a timestep of the coarse channel.
+ *  @param[in] band_values Values in a timestep of the band.
+ */
+static void wideband_copy_channel(float *band, const float *channel, long ntimesteps, long channel_values, long band_values)
+{
+    size_t row_bytes = channel_values * sizeof(float);
+
+    for (long group = 0; group < ntimesteps; group += WIDEBAND_COPY_GROUP_TIMESTEPS)
+    {
+        long group_end = (group + WIDEBAND_COPY_GROUP_TIMESTEPS < ntimesteps) ? group + WIDEBAND_COPY_GROUP_TIMESTEPS : ntimesteps;
+        long next_end = (group_end + WIDEBAND_COPY_GROUP_TIMESTEPS < ntimesteps) ? group_end + WIDEBAND_COPY_GROUP_TIMESTEPS : ntimesteps;
+
+        for (long t = group_end; t < next_end; t++)
+        {
+            for (size_t offset = 0; offset < row_bytes; offset += 64)
+                __builtin_prefetch((char *)&band[t * band_values] + offset, 1, 3);
+        }
+
+        for (long t = group; t < group_end; t++)
+            memcpy(&band[t * band_values], &channel[t * channel_values], row_bytes);
+    }
+}
+
+/**
+ *
+ *  @brief Zeros the positions of the band a beam second has no data for (late or missing coarse channels).
+ *  @param[in] beam The beam.
+ *  @param[in,out] slot The beam second.
+ */
+static void wideband_zero_missing(wideband_beam_s *beam, wideband_slot_s *slot)
+{
+    long band_values = beam->channel_values * g_wideband.nchannels;
+
+    for (int position = 0; position < g_wideband.nchannels; position++)
+    {
+        if (slot->copied & (1u << position))
+            continue;
+
+        for (long t = 0; t < beam->ntimesteps; t++)
+            memset(&slot->data[t * band_values + position * beam->channel_values], 0, beam->channel_values * sizeof(float));
+    }
+}
+
+/**
+ *
+ *  @brief Writes the next beam seconds of a beam which are ready: every channel we expect has arrived, or the oldest has
+ *         waited long enough (the rest are zeros), or the observation is finishing. A beam second no channel has arrived
+ *         for is skipped over (reads back as zeros) once a later one is ready to go. Call with the lock held (it is
+ *         released while writing).
+ *  @param[in] beam_index The beam index.
+ *  @param[in] now_ns latency_now_ns().
+ *  @returns 1 if anything was written, 0 if nothing was ready.
+ */
+static int wideband_write_ready(int beam_index, uint64_t now_ns)
+{
+    multilog_t *log = g_wideband.log;
+    wideband_beam_s *beam = &g_wideband.beams[beam_index];
+    int progressed = 0;
+
+    while (beam->next_second <= beam->last_second)
+    {
+        int second = beam->next_second;
+        wideband_slot_s *slot = &beam->slots[second % WIDEBAND_WINDOW_SECONDS];
+        uint32_t expected = wideband_expected(second);
+
+        if (slot->second == second)
+        {
+            if (slot->copying > 0)
+                break;
+
+            // (now_ns is from before the lock was last released, so the slot may have been claimed since: no subtraction)
+            if (!g_wideband.finishing && (slot->arrived & expected) != expected && now_ns < slot->first_ns + g_wideband.timeout_ns)
+                break;
+
+            slot->writing = 1;
+
+            uint32_t late = expected & ~slot->arrived;
+            g_wideband.seconds_written++;
+            g_wideband.channels_late += __builtin_popcount(late);
+            metrics_add_wideband_second(__builtin_popcount(late));
+
+            pthread_mutex_unlock(&g_wideband.mutex);
+
+            uint64_t write_start_ns = latency_now_ns();
+
+            wideband_zero_missing(beam, slot);
+
+            int bytes_per_sample = g_wideband.nbit / 8;
+
+            if (beam->output.out_filfile_ptr.m_File != NULL &&
+                write_fil_block(log, &beam->output.out_filfile_ptr, bytes_per_sample, beam->ntimesteps, beam->nchan * g_wideband.nchannels, g_wideband.npol,
+                                slot->data, beam->second_bytes, beam->output.checksum_file, &beam->output.data_crc, NULL) != EXIT_SUCCESS)
+                multilog(log, LOG_ERR, "wideband_write_ready(): Error writing second %d of beam %d to %s.\n", second, beam_index + 1, beam->output.fil_filename);
+
+            trace_span("wideband_write", "file", write_start_ns, "beam", beam_index + 1);
+
+            pthread_mutex_lock(&g_wideband.mutex);
+
+            slot->second = -1;
+            slot->writing = 0;
+            slot->arrived = 0;
+            slot->copied = 0;
+        }
+        else
+        {
+            // Nothing has arrived for this beam second. Skip it once a later one has waited long enough (or nobody will
+            // ever send it)
+            uint64_t oldest_ns = now_ns;
+
+            for (int s = 0; s < WIDEBAND_WINDOW_SECONDS; s++)
+            {
+                if (beam->slots[s].second >= 0 && beam->slots[s].first_ns < oldest_ns)
+                    oldest_ns = beam->slots[s].first_ns;
+            }
+
+            if (!g_wideband.finishing && expected != 0 && now_ns < oldest_ns + g_wideband.timeout_ns)
+                break;
+
+            g_wideband.seconds_skipped++;
+            g_wideband.channels_late += __builtin_popcount(expected);
+            metrics_add_wideband_skipped(__builtin_popcount(expected));
+
+            if (beam->output.out_filfile_ptr.m_File != NULL)
+            {
+                if (fseeko(beam->output.out_filfile_ptr.m_File, (off_t)beam->second_bytes, SEEK_CUR) != 0)
+                    multilog(log, LOG_ERR, "wideband_write_ready(): Error skipping second %d of beam %d in %s. Error: %s\n", second, beam_index + 1, beam->output.fil_filename, strerror(errno));
+
+                beam->output.data_crc = crc32c_zeros(beam->output.data_crc, beam->second_bytes);
+            }
+        }
+
+        beam->next_second++;
+        progressed = 1;
+
+        pthread_cond_broadcast(&g_wideband.changed);
+    }
+
+    return progressed;
+}
+
+/**
+ *
+ *  @brief Closes and publishes the wideband fil file of each beam (fixing nsamples if it was not what we expected,
+ *         and discarding a file that has no samples), frees the band and lets the next observation start. Call with the lock held (it is released while closing).
+ */
+static void wideband_finish_observation()
+{
+    multilog_t *log = g_wideband.log;
+    long obs_id = g_wideband.obs_id;
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+
+    for (int b = 0; g_wideband.laid_out && b < g_wideband.nbeams; b++)
+    {
+        wideband_beam_s *beam = &g_wideband.beams[b];
+        fil_output_s *output = &beam->output;
+        cFilFile *out_filfile_ptr = &output->out_filfile_ptr;
+
+        if (out_filfile_ptr->m_File == NULL)
+            continue;
+
+        uint64_t close_start_ns = latency_now_ns();
+
+        int has_checksum = (output->checksum_file != NULL);
+
+        if (finish_fil_file(log, out_filfile_ptr, output->checksum_file, output->checksum_filename, NULL, NULL) != EXIT_SUCCESS)
+            continue;
+
+        output->checksum_file = NULL;
+
+        long nsamples = beam->ntimesteps * (beam->next_second - g_wideband.start_sec);
+
+        if (nsamples == 0)
+        {
+            // Nothing of this beam was written (every ring stopped before its first second): a header-only fil file is of no use to anyone
+            multilog(log, LOG_WARNING, "wideband_finish_observation(): Beam %d: no samples were written, so %s is not kept.\n", b + 1, output->fil_filename);
+
+            unlink(output->fil_partial_filename);
+
+            if (has_checksum)
+            {
+                char checksum_partial_filename[sizeof(output->checksum_filename) + sizeof(FIL_PARTIAL_EXTENSION)];
+                snprintf(checksum_partial_filename, sizeof(checksum_partial_filename), "%s%s", output->checksum_filename, FIL_PARTIAL_EXTENSION);
+                unlink(checksum_partial_filename);
+            }
+
+            continue;
+        }
+
+        if (nsamples != output->header_nsamples)
+        {
+            multilog(log, LOG_INFO, "wideband_finish_observation(): Beam %d: %ld samples were written, not %ld. Updating nsamples in the header.\n", b + 1, nsamples, output->header_nsamples);
+
+            out_filfile_ptr->m_File = fopen(out_filfile_ptr->m_szFileName, "r+");
+
+            if (out_filfile_ptr->m_File != NULL)
+            {
+                update_fil_header_int(log, out_filfile_ptr, "nsamples", nsamples);
+                CFilFile_Close(out_filfile_ptr);
+                out_filfile_ptr->m_File = NULL;
+            }
+        }
+
+        notify_record_s record;
+        record.obs_id = obs_id;
+        record.beam = b + 1;
+        record.segment = -1;
+        record.subband = -1;
+        record.nsamples = nsamples;
+        record.has_checksum = has_checksum;
+        record.data_crc32c = output->data_crc;
+
+        publish_fil_file(log, output->fil_partial_filename, output->fil_filename, has_checksum ? output->checksum_filename : NULL, NULL, &record);
+
+        trace_span("close_wideband", "file", close_start_ns, "beam", b + 1);
+    }
+
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    if (g_wideband.laid_out)
+        multilog(log, LOG_INFO, "wideband_finish_observation(): %ld: wrote %lu beam seconds of ch%02d-ch%02d and skipped %lu (nothing arrived). %lu channel seconds were late (zeros) and %lu were dropped.\n",
+                 obs_id, g_wideband.seconds_written, g_wideband.first_coarse_channel, g_wideband.first_coarse_channel + g_wideband.nchannels - 1,
+                 g_wideband.seconds_skipped, g_wideband.channels_late, g_wideband.channels_dropped);
+
+    for (int b = 0; g_wideband.beams != NULL && b < g_wideband.nbeams; b++)
+    {
+        for (int s = 0; s < WIDEBAND_WINDOW_SECONDS; s++)
+            free(g_wideband.beams[b].slots[s].data);
+    }
+
+    free(g_wideband.beams);
+    g_wideband.beams = NULL;
+
+    if (obs_id > g_wideband.finished_obs_id)
+        g_wideband.finished_obs_id = obs_id;
+
+    g_wideband.obs_id = 0;
+    g_wideband.laid_out = 0;
+    g_wideband.finishing = 0;
+
+    pthread_cond_broadcast(&g_wideband.changed);
+}
+
+/**
+ *
+ *  @brief The assembler thread. Writes beam seconds as they become ready, and finishes each observation once every ring
+ *         is done with it, until asked to stop.
+ *  @param[in] args Not used.
+ *  @returns NULL.
+ */
+static void *wideband_thread_fn(void *args)
+{
+    (void)args;
+
+    trace_set_thread_name("assembler");
+    placement_bind_thread(g_wideband.log, placement_writer, "assembler");
+
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    for (;;)
+    {
+        int progressed = 0;
+
+        // Once the readers are gone, whatever is left is written out
+        if (g_wideband.stop && g_wideband.obs_id != 0)
+            g_wideband.finishing = 1;
+
+        if (g_wideband.obs_id != 0 && g_wideband.laid_out)
+        {
+            uint64_t now_ns = latency_now_ns();
+
+            for (int beam = 0; beam < g_wideband.nbeams; beam++)
+                progressed |= wideband_write_ready(beam, now_ns);
+
+            if (g_wideband.finishing)
+            {
+                int drained = 1;
+
+                for (int beam = 0; beam < g_wideband.nbeams; beam++)
+                {
+                    if (g_wideband.beams[beam].next_second <= g_wideband.beams[beam].last_second)
+                        drained = 0;
+                }
+
+                if (drained)
+                {
+                    wideband_finish_observation();
+                    progressed = 1;
+                }
+            }
+        }
+        else if (g_wideband.obs_id != 0 && g_wideband.finishing)
+        {
+            wideband_finish_observation();
+            progressed = 1;
+        }
+
+        if (g_wideband.stop && g_wideband.obs_id == 0)
+            break;
+
+        if (!progressed)
+        {
+            struct timespec deadline;
+            wideband_deadline(latency_now_ns() + WIDEBAND_POLL_MS * 1000000ULL, &deadline);
+            pthread_cond_timedwait(&g_wideband.arrived, &g_wideband.mutex, &deadline);
+        }
+    }
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+
+    return NULL;
+}
+
+/**
+ *
+ *  @brief Starts the assembler thread. Call once from main() (only if --wideband).
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] nrings Number of rings (or dada files being replayed) feeding it.
+ *  @param[in] timeout_ms How long a beam second waits for late coarse channels.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if it could not be started.
+ */
+int wideband_init(multilog_t *log, int nrings, int timeout_ms)
+{
+    if (nrings < 1 || nrings > METRICS_MAX_RINGS)
+    {
+        multilog(log, LOG_ERR, "wideband_init(): Wideband output needs 1 to %d rings, not %d.\n", METRICS_MAX_RINGS, nrings);
+        return EXIT_FAILURE;
+    }
+
+    g_wideband.log = log;
+    g_wideband.nrings = nrings;
+    g_wideband.timeout_ns = (uint64_t)timeout_ms * 1000000ULL;
+    g_wideband.stop = 0;
+    g_wideband.obs_id = 0;
+    g_wideband.finished_obs_id = 0;
+
+    // Deadlines are in latency_now_ns() time
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_wideband.arrived, &attr);
+    pthread_cond_init(&g_wideband.changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&g_wideband.thread, NULL, wideband_thread_fn, NULL) != 0)
+    {
+        multilog(log, LOG_ERR, "wideband_init(): Could not create the assembler thread. Error: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    g_wideband.running = 1;
+
+    multilog(log, LOG_INFO, "wideband_init(): The beams of %d rings are stitched into wideband fil files (%d beam seconds in flight, late channels wait %d ms).\n",
+             nrings, WIDEBAND_WINDOW_SECONDS, timeout_ms);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Leaves every ring out of the band (it could not be set up), so their beam seconds of this observation are
+ *         dropped. Call with the lock held.
+ */
+static void wideband_leave_out_all()
+{
+    for (int ring = 0; ring < g_wideband.nrings; ring++)
+        g_wideband.ring_position[ring] = -1;
+
+    g_wideband.nchannels = 0;
+}
+
+/**
+ *
+ *  @brief Lays out the band from the rings which have joined the observation (lowest coarse channel first), and creates
+ *         the wideband fil file of each beam. Call with the lock held.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the context of the ring laying it out (its header is used for the files).
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if there was an error.
+ */
+static int wideband_lay_out(multilog_t *log, dada_db_s *ctx)
+{
+    int first = -1;
+    int last = -1;
+    int start_sec = -1;
+    int nrings = 0;
+
+    for (int ring = 0; ring < g_wideband.nrings; ring++)
+    {
+        if (!g_wideband.ring_joined[ring] || g_wideband.ring_position[ring] == -2)
+            continue;
+
+        if (first < 0 || g_wideband.ring_coarse_channel[ring] < first)
+            first = g_wideband.ring_coarse_channel[ring];
+
+        if (g_wideband.ring_coarse_channel[ring] > last)
+            last = g_wideband.ring_coarse_channel[ring];
+
+        if (start_sec < 0 || g_wideband.ring_join_sec[ring] < start_sec)
+            start_sec = g_wideband.ring_join_sec[ring];
+    }
+
+    g_wideband.laid_out = 1;
+    g_wideband.nchannels = 0;
+    g_wideband.active_ns = latency_now_ns();
+    pthread_cond_broadcast(&g_wideband.changed);
+
+    if (first < 0 || last - first + 1 > WIDEBAND_MAX_CHANNELS)
+    {
+        multilog(log, LOG_ERR, "wideband_lay_out(): %ld: coarse channels %d to %d span more than %d channels. Not writing wideband files for it.\n",
+                 g_wideband.obs_id, first, last, WIDEBAND_MAX_CHANNELS);
+
+        wideband_leave_out_all();
+        return EXIT_FAILURE;
+    }
+
+    // Each coarse channel is one position (a second ring with the same coarse channel is left out)
+    uint32_t taken = 0;
+
+    for (int ring = 0; ring < g_wideband.nrings; ring++)
+    {
+        if (!g_wideband.ring_joined[ring] || g_wideband.ring_position[ring] == -2)
+        {
+            g_wideband.ring_position[ring] = -1;
+            continue;
+        }
+
+        int position = g_wideband.ring_coarse_channel[ring] - first;
+
+        if (taken & (1u << position))
+        {
+            multilog(log, LOG_ERR, "wideband_lay_out(): Ring %d has coarse channel %d, which another ring already has. Leaving it out.\n", ring, g_wideband.ring_coarse_channel[ring]);
+            g_wideband.ring_position[ring] = -1;
+            continue;
+        }
+
+        taken |= 1u << position;
+        g_wideband.ring_position[ring] = position;
+        nrings++;
+    }
+
+    g_wideband.first_coarse_channel = first;
+    g_wideband.nchannels = last - first + 1;
+    g_wideband.start_sec = start_sec;
+
+    multilog(log, LOG_INFO, "wideband_lay_out(): %ld: the band is ch%02d-ch%02d (%d of %d rings, %d coarse channels), starting at %d sec.\n",
+             g_wideband.obs_id, first, last, nrings, g_wideband.nrings, g_wideband.nchannels, start_sec);
+
+    for (int b = 0; b < g_wideband.nbeams; b++)
+    {
+        wideband_beam_s *beam = &g_wideband.beams[b];
+
+        beam->second_bytes = (uint64_t)beam->ntimesteps * beam->channel_values * g_wideband.nchannels * sizeof(float);
+        beam->next_second = start_sec;
+        beam->last_second = start_sec - 1;
+
+        for (int s = 0; s < WIDEBAND_WINDOW_SECONDS; s++)
+        {
+            beam->slots[s].second = -1;
+            beam->slots[s].data = malloc(beam->second_bytes);
+
+            if (beam->slots[s].data == NULL)
+            {
+                multilog(log, LOG_ERR, "wideband_lay_out(): Could not allocate %lu bytes for beam %d.\n", beam->second_bytes, b + 1);
+                wideband_leave_out_all();
+                return EXIT_FAILURE;
+            }
+        }
+
+        make_wideband_filename(ctx, b, first, last, start_sec, beam->output.fil_filename);
+
+        if (create_wideband_fil(log, ctx, b, ctx->metafits_info, first, g_wideband.nchannels, start_sec, &beam->output) != EXIT_SUCCESS)
+        {
+            multilog(log, LOG_ERR, "wideband_lay_out(): Error creating the wideband fil file of beam %d.\n", b + 1);
+            wideband_leave_out_all();
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Called by a reader when it starts an observation (after its header and metafits are read). The first ring
+ *         to get here starts the observation; the band is laid out once every ring has joined it, or the timeout
+ *         passes. A ring which joins after that is added if its coarse channel has a place in the band. A ring which
+ *         starts an observation older than the band (or one already finished) is left out of it.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ *  @returns EXIT_SUCCESS on success, or EXIT_FAILURE if the wideband files could not be created.
+ */
+int wideband_open(multilog_t *log, dada_db_s *ctx)
+{
+    int ring = ctx->ring_index;
+    int result = EXIT_SUCCESS;
+
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    // A ring still on an older observation than the band must not end it: its beam seconds are dropped (see
+    // wideband_deposit())
+    if ((g_wideband.obs_id != 0 && ctx->obs_id < g_wideband.obs_id) || ctx->obs_id <= g_wideband.finished_obs_id)
+    {
+        multilog(log, LOG_WARNING, "wideband_open(): Ring %d started %ld, which is older than %ld. Its beam seconds of %ld are dropped.\n", ring, ctx->obs_id,
+                 g_wideband.obs_id != 0 ? g_wideband.obs_id : g_wideband.finished_obs_id, ctx->obs_id);
+
+        pthread_mutex_unlock(&g_wideband.mutex);
+        return EXIT_SUCCESS;
+    }
+
+    // A ring which has moved on to a newer observation waits for the others to finish the band. If it goes the timeout
+    // without a channel arriving (e.g. a ring has stopped), it is finished without them
+    if (g_wideband.obs_id != 0 && g_wideband.obs_id != ctx->obs_id)
+    {
+        while (g_wideband.obs_id != 0 && g_wideband.obs_id != ctx->obs_id)
+        {
+            uint64_t idle_deadline_ns = g_wideband.active_ns + g_wideband.timeout_ns;
+
+            if (!g_wideband.laid_out)
+            {
+                // The ring which opened it lays it out within the timeout
+                pthread_cond_wait(&g_wideband.changed, &g_wideband.mutex);
+            }
+            else if (latency_now_ns() >= idle_deadline_ns)
+            {
+                break;
+            }
+            else
+            {
+                struct timespec deadline;
+                wideband_deadline(idle_deadline_ns, &deadline);
+                pthread_cond_timedwait(&g_wideband.changed, &g_wideband.mutex, &deadline);
+            }
+        }
+
+        if (g_wideband.obs_id != 0 && g_wideband.obs_id != ctx->obs_id)
+        {
+            multilog(log, LOG_WARNING, "wideband_open(): Ring %d started %ld, and nothing of %ld has arrived for %lu ms. Finishing %ld without the other rings.\n", ring,
+                     ctx->obs_id, g_wideband.obs_id, g_wideband.timeout_ns / 1000000, g_wideband.obs_id);
+
+            g_wideband.finishing = 1;
+            pthread_cond_signal(&g_wideband.arrived);
+
+            while (g_wideband.obs_id != 0 && g_wideband.obs_id != ctx->obs_id)
+                pthread_cond_wait(&g_wideband.changed, &g_wideband.mutex);
+        }
+    }
+
+    // The first ring to get here starts the observation (the beams of every ring must match its beams)
+    if (g_wideband.obs_id == 0)
+    {
+        g_wideband.obs_id = ctx->obs_id;
+        g_wideband.open_ns = latency_now_ns();
+        g_wideband.active_ns = g_wideband.open_ns;
+        g_wideband.laid_out = 0;
+        g_wideband.finishing = 0;
+        g_wideband.nbeams = ctx->nbeams_total;
+        g_wideband.npol = ctx->npol;
+        g_wideband.nbit = ctx->nbit;
+        g_wideband.nchannels = 0;
+        g_wideband.seconds_written = 0;
+        g_wideband.seconds_skipped = 0;
+        g_wideband.channels_late = 0;
+        g_wideband.channels_dropped = 0;
+        g_wideband.beams = calloc(ctx->nbeams_total, sizeof(wideband_beam_s));
+
+        for (int r = 0; r < g_wideband.nrings; r++)
+        {
+            g_wideband.ring_joined[r] = 0;
+            g_wideband.ring_closed[r] = 0;
+            g_wideband.ring_position[r] = -1;
+        }
+
+        for (int b = 0; b < ctx->nbeams_total; b++)
+        {
+            g_wideband.beams[b].ntimesteps = ctx->beams[b].ntimesteps;
+            g_wideband.beams[b].nchan = ctx->beams[b].nchan;
+            g_wideband.beams[b].channel_values = ctx->beams[b].nchan * ctx->npol;
+        }
+    }
+
+    int matches = (ctx->nbeams_total == g_wideband.nbeams && ctx->npol == g_wideband.npol && ctx->nbit == g_wideband.nbit);
+
+    for (int b = 0; matches && b < ctx->nbeams_total; b++)
+        matches = (ctx->beams[b].ntimesteps == g_wideband.beams[b].ntimesteps && ctx->beams[b].nchan == g_wideband.beams[b].nchan);
+
+    g_wideband.ring_joined[ring] = 1;
+    g_wideband.ring_coarse_channel[ring] = ctx->coarse_channel;
+    g_wideband.ring_join_sec[ring] = ctx->join_offset_sec;
+
+    if (!matches)
+    {
+        // -2: joined, but not part of the band
+        multilog(log, LOG_ERR, "wideband_open(): The beams of ring %d (coarse channel %d) do not match the other rings of %ld. Leaving it out of the band.\n", ring, ctx->coarse_channel, ctx->obs_id);
+        g_wideband.ring_position[ring] = g_wideband.laid_out ? -1 : -2;
+    }
+    else if (g_wideband.laid_out)
+    {
+        // Joined after the band was laid out: it can only go where there is a place for its coarse channel
+        int position = ctx->coarse_channel - g_wideband.first_coarse_channel;
+        int taken = 0;
+
+        for (int r = 0; r < g_wideband.nrings; r++)
+        {
+            if (g_wideband.ring_position[r] == position)
+                taken = 1;
+        }
+
+        if (g_wideband.nchannels > 0 && position >= 0 && position < g_wideband.nchannels && !taken)
+        {
+            g_wideband.ring_position[ring] = position;
+            multilog(log, LOG_WARNING, "wideband_open(): Ring %d (coarse channel %d) joined %ld late. Its seconds up to now are zeros.\n", ring, ctx->coarse_channel, ctx->obs_id);
+        }
+        else
+        {
+            multilog(log, LOG_ERR, "wideband_open(): Ring %d (coarse channel %d) joined %ld after the band (ch%02d-ch%02d) was laid out. Leaving it out.\n",
+                     ring, ctx->coarse_channel, ctx->obs_id, g_wideband.first_coarse_channel, g_wideband.first_coarse_channel + g_wideband.nchannels - 1);
+        }
+    }
+    else
+    {
+        // Wait for the other rings (at most the timeout from when the first one got here), then lay out the band
+        int joined = 0;
+
+        for (int r = 0; r < g_wideband.nrings; r++)
+            joined += g_wideband.ring_joined[r];
+
+        if (joined < g_wideband.nrings)
+        {
+            struct timespec deadline;
+            wideband_deadline(g_wideband.open_ns + g_wideband.timeout_ns, &deadline);
+
+            while (!g_wideband.laid_out && g_wideband.obs_id == ctx->obs_id)
+            {
+                if (pthread_cond_timedwait(&g_wideband.changed, &g_wideband.mutex, &deadline) == ETIMEDOUT)
+                    break;
+            }
+        }
+
+        if (!g_wideband.laid_out && g_wideband.obs_id == ctx->obs_id)
+        {
+            if (joined < g_wideband.nrings)
+                multilog(log, LOG_WARNING, "wideband_open(): Only %d of %d rings joined %ld in time. Laying out the band without the others.\n", joined, g_wideband.nrings, ctx->obs_id);
+
+            result = wideband_lay_out(log, ctx);
+        }
+    }
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+
+    return result;
+}
+
+/**
+ *
+ *  @brief Counts a beam second of a ring which can not go in the band, and logs the first of each observation of the
+ *         ring. Call with the lock held.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ *  @param[in] beam The beam index.
+ *  @param[in] second The beam second (from the start of the observation).
+ *  @param[in] reason Why it can not go in the band (for the log).
+ */
+static void wideband_drop(multilog_t *log, dada_db_s *ctx, int beam, int second, const char *reason)
+{
+    int ring = ctx->ring_index;
+
+    g_wideband.channels_dropped++;
+    metrics_add_wideband_dropped();
+
+    if (g_wideband.ring_dropping[ring] != ctx->obs_id)
+    {
+        g_wideband.ring_dropping[ring] = ctx->obs_id;
+        multilog(log, LOG_WARNING, "wideband_deposit(): Ring %d (coarse channel %d): dropping beam seconds of %ld from second %d of beam %d (%s).\n", ring,
+                 ctx->coarse_channel, ctx->obs_id, second, beam + 1, reason);
+    }
+}
+
+/**
+ *
+ *  @brief Called by a reader for each beam second instead of writing it: copies its coarse channel into its place in
+ *         the band. Waits if the ring is more than WIDEBAND_WINDOW_SECONDS ahead of what has been written.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ *  @param[in] beam The beam index.
+ *  @param[in] second The beam second (from the start of the observation).
+ *  @param[in] data The beam second, or NULL if it has no data (shed, or a gap): it arrives as zeros.
+ *  @returns EXIT_SUCCESS (a beam second which can not be used is counted and dropped).
+ */
+int wideband_deposit(multilog_t *log, dada_db_s *ctx, int beam, int second, const float *data)
+{
+    int ring = ctx->ring_index;
+
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    wideband_slot_s *slot = NULL;
+
+    while (slot == NULL)
+    {
+        // Not if the ring is not in the band (e.g. it is on an older observation), or the band is being finished without it
+        if (g_wideband.obs_id != ctx->obs_id || !g_wideband.laid_out || g_wideband.finishing || g_wideband.ring_position[ring] < 0)
+        {
+            wideband_drop(log, ctx, beam, second, g_wideband.obs_id != ctx->obs_id ? "not the observation being assembled" : "not in the band");
+            break;
+        }
+
+        wideband_beam_s *wideband_beam = &g_wideband.beams[beam];
+        wideband_slot_s *candidate = &wideband_beam->slots[second % WIDEBAND_WINDOW_SECONDS];
+
+        if (second < wideband_beam->next_second || (candidate->second == second && candidate->writing))
+        {
+            // Too late: the beam second was already written without it
+            wideband_drop(log, ctx, beam, second, "too late");
+            break;
+        }
+
+        if (candidate->second == second)
+        {
+            slot = candidate;
+        }
+        else if (candidate->second == -1 && second < wideband_beam->next_second + WIDEBAND_WINDOW_SECONDS)
+        {
+            candidate->second = second;
+            candidate->arrived = 0;
+            candidate->copied = 0;
+            candidate->first_ns = latency_now_ns();
+            slot = candidate;
+        }
+        else
+        {
+            // Too far ahead of the slowest coarse channel. Wait for the assembler to write (or time out) the oldest one
+            pthread_cond_wait(&g_wideband.changed, &g_wideband.mutex);
+        }
+    }
+
+    if (slot == NULL)
+    {
+        pthread_mutex_unlock(&g_wideband.mutex);
+        return EXIT_SUCCESS;
+    }
+
+    wideband_beam_s *wideband_beam = &g_wideband.beams[beam];
+    uint32_t bit = 1u << g_wideband.ring_position[ring];
+
+    if (second > wideband_beam->last_second)
+        wideband_beam->last_second = second;
+
+    g_wideband.active_ns = latency_now_ns();
+
+    if (!(slot->arrived & bit))
+    {
+        if (data != NULL)
+        {
+            // The copy is done without the lock: no one else writes this position, and the assembler waits for it
+            slot->copying++;
+            pthread_mutex_unlock(&g_wideband.mutex);
+
+            long band_values = wideband_beam->channel_values * g_wideband.nchannels;
+            wideband_copy_channel(&slot->data[g_wideband.ring_position[ring] * wideband_beam->channel_values], data, wideband_beam->ntimesteps,
+                                  wideband_beam->channel_values, band_values);
+
+            pthread_mutex_lock(&g_wideband.mutex);
+            slot->copying--;
+            slot->copied |= bit;
+        }
+
+        slot->arrived |= bit;
+        pthread_cond_signal(&g_wideband.arrived);
+    }
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ *
+ *  @brief Called by a reader when it finishes an observation. Once every ring which joined it has, the rest of it is
+ *         written and the wideband files are closed; the last ring waits for that.
+ *  @param[in] log Pointer to the logger.
+ *  @param[in] ctx Pointer to the reader's context.
+ */
+void wideband_close(multilog_t *log, dada_db_s *ctx)
+{
+    int ring = ctx->ring_index;
+
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    if (g_wideband.obs_id == ctx->obs_id && g_wideband.ring_joined[ring] && !g_wideband.ring_closed[ring])
+    {
+        g_wideband.ring_closed[ring] = 1;
+
+        int open_rings = 0;
+
+        for (int r = 0; r < g_wideband.nrings; r++)
+            open_rings += (g_wideband.ring_joined[r] && !g_wideband.ring_closed[r]);
+
+        pthread_cond_signal(&g_wideband.arrived);
+
+        if (open_rings == 0)
+        {
+            multilog(log, LOG_INFO, "wideband_close(): Every ring has finished %ld. Closing its wideband files...\n", ctx->obs_id);
+
+            g_wideband.finishing = 1;
+
+            while (g_wideband.obs_id == ctx->obs_id && g_wideband.running)
+                pthread_cond_wait(&g_wideband.changed, &g_wideband.mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+}
+
+/**
+ *
+ *  @brief Writes out anything left, closes the wideband files and stops the assembler thread. Call after the readers
+ *         have stopped and before multilog_close().
+ */
+void wideband_shutdown()
+{
+    pthread_mutex_lock(&g_wideband.mutex);
+
+    if (!g_wideband.running)
+    {
+        pthread_mutex_unlock(&g_wideband.mutex);
+        return;
+    }
+
+    g_wideband.stop = 1;
+    pthread_cond_signal(&g_wideband.arrived);
+
+    pthread_mutex_unlock(&g_wideband.mutex);
+
+    pthread_join(g_wideband.thread, NULL);
+
+    g_wideband.running = 0;
+}
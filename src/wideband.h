@@ -0,0 +1,23 @@
+/**
+ * @file wideband.h
+ * @author agent
+ * @date 18 Oct 2026
+ * @brief This is the header for the code that stitches the coarse channels of several rings into wideband fil files
+ *
+ */
+#pragma once
+
+#include "global.h"
+#include "multilog.h"
+
+#define WIDEBAND_MAX_CHANNELS 32         // Coarse channels a band can span (one bit each in a mask)
+#define WIDEBAND_WINDOW_SECONDS 3        // Beam seconds of each beam assembled at once. A ring further ahead waits
+#define WIDEBAND_DEFAULT_TIMEOUT_MS 2000 // How long a beam second waits for late coarse channels before they are zeros
+#define WIDEBAND_COPY_GROUP_TIMESTEPS 16 // Timesteps copied into the band per group (see wideband_copy_channel())
+#define WIDEBAND_POLL_MS 10              // How often the assembler looks for beam seconds which have waited long enough
+
+int wideband_init(multilog_t *log, int nrings, int timeout_ms);
+int wideband_open(multilog_t *log, dada_db_s *ctx);
+int wideband_deposit(multilog_t *log, dada_db_s *ctx, int beam, int second, const float *data);
+void wideband_close(multilog_t *log, dada_db_s *ctx);
+void wideband_shutdown();